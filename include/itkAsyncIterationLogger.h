@@ -0,0 +1,191 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkAsyncIterationLogger_h
+#define itkAsyncIterationLogger_h
+
+#include "itkCommand.h"
+#include "itkObjectFactory.h"
+#include "itkIntTypes.h"
+#include "itkNumericTraits.h"
+#include "itkAtomicInt.h"
+#include "itkMultiThreader.h"
+#include "itkRealTimeClock.h"
+#include "ExternalTemplateExport.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace itk
+{
+/** \class AsyncIterationLogger
+ * \brief Logs optimizer iterations from a background thread.
+ *
+ * Attach it to an optimizer like any iteration observer:
+ *
+ * \code
+ * AsyncIterationLogger::Pointer logger = AsyncIterationLogger::New();
+ * logger->SetFileName("iterations.csv");
+ * logger->Start();
+ * optimizer->AddObserver(IterationEvent(), logger);
+ * registration->Update();
+ * logger->Stop();
+ * \endcode
+ *
+ * On the optimizer thread Execute() only copies the iteration number, the
+ * event name, a time stamp and the cached value (and optionally the norm of
+ * the cached derivative) of a SingleValuedNonLinearVnlOptimizer into a
+ * fixed size ring buffer. It takes no lock and never allocates. A
+ * background thread started by Start() formats the records and writes them
+ * as CSV to the file, or to std::cout when no file name is set. When the
+ * buffer is full the record is dropped and counted rather than waiting.
+ *
+ * SamplingInterval keeps every n-th event and MinimumInterval skips
+ * events closer than that many seconds to the last kept one. Skipped
+ * events are counted but cost no formatting.
+ *
+ * The ring has one producer: use one logger per optimizer.
+ *
+ */
+class ExternalTemplate_EXPORT AsyncIterationLogger:public Command
+{
+public:
+  /** Standard class typedefs. */
+  typedef AsyncIterationLogger       Self;
+  typedef Command                    Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(AsyncIterationLogger, Command);
+
+  /** One logged event. */
+  struct RecordType
+    {
+    SizeValueType Event;     // number of the event among all received
+    const char *  EventName; // from EventObject::GetEventName()
+    double        Time;      // seconds since Start()
+    double        Value;
+    double        DerivativeNorm; // -1 when not recorded
+    };
+
+  /** Set/Get the file the records are written to. std::cout when empty. */
+  itkSetStringMacro(FileName);
+  itkGetStringMacro(FileName);
+
+  /** Set/Get the number of records the ring buffer holds, rounded up to a
+   *  power of two at Start(). Defaults to 4096. */
+  itkSetClampMacro(Capacity, SizeValueType, 2, 1u << 30);
+  itkGetConstMacro(Capacity, SizeValueType);
+
+  /** Set/Get n to keep every n-th event. Defaults to 1. */
+  itkSetClampMacro(SamplingInterval, SizeValueType, 1, NumericTraits< SizeValueType >::max());
+  itkGetConstMacro(SamplingInterval, SizeValueType);
+
+  /** Set/Get the minimum time in seconds between kept events. Defaults to 0. */
+  itkSetMacro(MinimumInterval, double);
+  itkGetConstMacro(MinimumInterval, double);
+
+  /** Set/Get whether the norm of the optimizer's cached derivative is
+   *  recorded. This is a pass over the parameters on the optimizer thread,
+   *  so it is off by default. */
+  itkSetMacro(RecordDerivativeNorm, bool);
+  itkGetConstMacro(RecordDerivativeNorm, bool);
+  itkBooleanMacro(RecordDerivativeNorm);
+
+  /** Set/Get the time in milliseconds the writer thread sleeps when the
+   *  buffer is empty. Defaults to 5. */
+  itkSetClampMacro(PollInterval, unsigned int, 1, 1000);
+  itkGetConstMacro(PollInterval, unsigned int);
+
+  /** Open the output and start the writer thread. */
+  void Start();
+
+  /** Write the remaining records, stop the writer thread and close the
+   *  output. Called by the destructor. */
+  void Stop();
+
+  bool IsRunning() const { return m_Running; }
+
+  /** Events received, records written, records dropped on a full buffer
+   *  and events skipped by the sampling and throttling options, since the
+   *  last Start(). */
+  SizeValueType GetNumberOfEvents() const { return m_NumberOfEvents; }
+  SizeValueType GetNumberOfWrittenRecords() const { return m_NumberOfWrittenRecords; }
+  SizeValueType GetNumberOfDroppedRecords() const { return m_NumberOfDroppedRecords; }
+  SizeValueType GetNumberOfSkippedEvents() const { return m_NumberOfSkippedEvents; }
+
+  /** Record an iteration event of the caller. Other events are ignored. */
+  virtual void Execute(Object *caller, const EventObject & event) ITK_OVERRIDE;
+  virtual void Execute(const Object *caller, const EventObject & event) ITK_OVERRIDE;
+
+protected:
+  AsyncIterationLogger();
+  virtual ~AsyncIterationLogger();
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+  /** Format one record, on the writer thread. */
+  virtual void WriteRecord(std::ostream & os, const RecordType & record);
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(AsyncIterationLogger);
+
+  std::string   m_FileName;
+  SizeValueType m_Capacity;
+  SizeValueType m_SamplingInterval;
+  double        m_MinimumInterval;
+  bool          m_RecordDerivativeNorm;
+  unsigned int  m_PollInterval;
+
+  // Ring buffer: the optimizer thread writes m_Records[m_Head & m_Mask] and
+  // then advances m_Head, the writer thread reads m_Records[m_Tail & m_Mask]
+  // and then advances m_Tail. The counters wrap around.
+  std::vector< RecordType > m_Records;
+  uint32_t                  m_Mask;
+  AtomicInt< uint32_t >     m_Head;
+  AtomicInt< uint32_t >     m_Tail;
+
+  // optimizer thread only
+  SizeValueType m_NumberOfEvents;
+  SizeValueType m_NumberOfDroppedRecords;
+  SizeValueType m_NumberOfSkippedEvents;
+  double        m_LastKeptTime;
+
+  // writer thread only while running
+  SizeValueType m_NumberOfWrittenRecords;
+  std::ofstream m_File;
+  std::ostream *m_Stream;
+
+  RealTimeClock::Pointer m_Clock;
+  double                 m_StartTime;
+  MultiThreader::Pointer m_Threader;
+  ThreadIdType           m_WriterThread;
+  AtomicInt< int >       m_StopRequested;
+  bool                   m_Running;
+
+  // write the records between m_Tail and m_Head
+  void Drain();
+
+  static ITK_THREAD_RETURN_TYPE WriterThreadCallback(void *arg);
+};
+} // end namespace itk
+
+#endif
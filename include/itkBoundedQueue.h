@@ -0,0 +1,127 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkBoundedQueue_h
+#define itkBoundedQueue_h
+
+#include "itkConditionVariable.h"
+#include "itkIntTypes.h"
+#include "itkMutexLockHolder.h"
+#include "itkSimpleMutexLock.h"
+#include <deque>
+
+namespace itk
+{
+/** \class BoundedQueue
+ * \brief Blocking first-in first-out queue with a fixed capacity.
+ *
+ * Connects the stages of a producer/consumer pipeline. Push() blocks while
+ * the queue is full, Pop() while it is empty, so a fast stage cannot run
+ * more than Capacity items ahead of a slow one. Close() wakes every waiting
+ * thread: further pushes fail, and pops fail once the queue has drained.
+ *
+ * All member functions are safe to call from any thread.
+ *
+ */
+template< typename TItem >
+class BoundedQueue
+{
+public:
+  typedef TItem ItemType;
+
+  explicit BoundedQueue(SizeValueType capacity = 1) :
+    m_Capacity( capacity > 0 ? capacity : 1 ),
+    m_Closed( false )
+  {
+    m_NotEmpty = ConditionVariable::New();
+    m_NotFull = ConditionVariable::New();
+  }
+
+  /** Append an item, waiting for room. Returns false if the queue was
+   *  closed, in which case the item was not added. */
+  bool Push(const ItemType & item)
+  {
+    MutexLockHolder< SimpleMutexLock > holder(m_Mutex);
+    while ( !m_Closed && m_Items.size() >= m_Capacity )
+      {
+      m_NotFull->Wait(&m_Mutex);
+      }
+    if ( m_Closed )
+      {
+      return false;
+      }
+    m_Items.push_back(item);
+    m_NotEmpty->Signal();
+    return true;
+  }
+
+  /** Remove the oldest item, waiting for one. Returns false once the queue
+   *  is closed and empty. */
+  bool Pop(ItemType & item)
+  {
+    MutexLockHolder< SimpleMutexLock > holder(m_Mutex);
+    while ( !m_Closed && m_Items.empty() )
+      {
+      m_NotEmpty->Wait(&m_Mutex);
+      }
+    if ( m_Items.empty() )
+      {
+      return false;
+      }
+    item = m_Items.front();
+    m_Items.pop_front();
+    m_NotFull->Signal();
+    return true;
+  }
+
+  /** Refuse further items and release all waiting threads. */
+  void Close()
+  {
+    MutexLockHolder< SimpleMutexLock > holder(m_Mutex);
+    m_Closed = true;
+    m_NotEmpty->Broadcast();
+    m_NotFull->Broadcast();
+  }
+
+  bool IsClosed() const
+  {
+    MutexLockHolder< SimpleMutexLock > holder(m_Mutex);
+    return m_Closed;
+  }
+
+  SizeValueType GetSize() const
+  {
+    MutexLockHolder< SimpleMutexLock > holder(m_Mutex);
+    return static_cast< SizeValueType >( m_Items.size() );
+  }
+
+  SizeValueType GetCapacity() const { return m_Capacity; }
+
+private:
+  BoundedQueue(const BoundedQueue &);   // purposely not implemented
+  void operator=(const BoundedQueue &); // purposely not implemented
+
+  const SizeValueType        m_Capacity;
+  bool                       m_Closed;
+  std::deque< ItemType >     m_Items;
+  mutable SimpleMutexLock    m_Mutex;
+  ConditionVariable::Pointer m_NotEmpty;
+  ConditionVariable::Pointer m_NotFull;
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,182 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkFastVTKPolyDataWriter_h
+#define itkFastVTKPolyDataWriter_h
+
+#include "itkObject.h"
+#include "itkIntTypes.h"
+#include "itkMultiThreader.h"
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace itk
+{
+/** \class FastVTKPolyDataWriter
+ * \brief Writes an itk::Mesh to a legacy VTK polydata file, in binary or ASCII.
+ *
+ * Drop-in replacement for itk::VTKPolyDataWriter. In BINARY mode (the
+ * default) the points and polygons are streamed from the mesh containers in
+ * fixed size blocks, byte swapped to big-endian as the legacy VTK format
+ * requires, and written without building a copy of the mesh. In ASCII mode
+ * the text is formatted block-wise on several threads and written in order.
+ *
+ * Triangle, quadrilateral and polygon cells are written as POLYGONS, line
+ * cells as LINES. All other cells are ignored.
+ *
+ * Points are written in the order of the points container, and cells refer
+ * to them by that position, as in VTKPolyDataWriter. When the point
+ * identifiers are not 0 ... n-1 in that order, e.g. in a MapContainer or
+ * after points were removed, they are mapped to positions; a cell that
+ * refers to an identifier without a point is an error.
+ *
+ */
+template< typename TInputMesh >
+class ITK_TEMPLATE_EXPORT FastVTKPolyDataWriter:public Object
+{
+public:
+  /** Standard "Self" typedef. */
+  typedef FastVTKPolyDataWriter      Self;
+  typedef Object                     Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(FastVTKPolyDataWriter, Object);
+
+  /** Hold on to the type information specified by the template parameters. */
+  typedef TInputMesh                                   InputMeshType;
+  typedef typename InputMeshType::ConstPointer         InputMeshConstPointer;
+  typedef typename InputMeshType::CoordRepType         CoordRepType;
+  typedef typename InputMeshType::PointsContainer      PointsContainer;
+  typedef typename PointsContainer::ConstIterator      PointIterator;
+  typedef typename InputMeshType::CellsContainer       CellsContainer;
+  typedef typename CellsContainer::ConstIterator       CellIterator;
+  typedef typename InputMeshType::CellType             CellType;
+  typedef typename InputMeshType::PointIdentifier      PointIdentifier;
+
+  itkStaticConstMacro(PointDimension, unsigned int, TInputMesh::PointDimension);
+
+  /** Encoding of the file body. */
+  typedef enum { ASCII, BINARY } FileType;
+
+  /** Set/Get the input mesh to be written. */
+  void SetInput(const InputMeshType *input);
+  const InputMeshType * GetInput() const;
+
+  /** Set/Get the filename. */
+  itkSetStringMacro(FileName);
+  itkGetStringMacro(FileName);
+
+  /** Set/Get the free text written on the second line of the file. */
+  itkSetStringMacro(FileHeader);
+  itkGetStringMacro(FileHeader);
+
+  /** Set/Get the encoding of the file body. Defaults to BINARY. */
+  itkSetMacro(FileType, FileType);
+  itkGetConstMacro(FileType, FileType);
+  void SetFileTypeAsASCII() { this->SetFileType(ASCII); }
+  void SetFileTypeAsBINARY() { this->SetFileType(BINARY); }
+
+  /** Set/Get the number of threads used to format ASCII output. */
+  itkSetClampMacro(NumberOfThreads, ThreadIdType, 1, ITK_MAX_THREADS);
+  itkGetConstMacro(NumberOfThreads, ThreadIdType);
+
+  /** Invoke the writer. */
+  void Update();
+  void Write();
+
+protected:
+  FastVTKPolyDataWriter();
+  virtual ~FastVTKPolyDataWriter() {}
+
+  void GenerateData();
+
+  void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+  InputMeshConstPointer m_Input;
+
+  std::string  m_FileName;
+  std::string  m_FileHeader;
+  FileType     m_FileType;
+  ThreadIdType m_NumberOfThreads;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(FastVTKPolyDataWriter);
+
+  /** Number of elements staged per block before a write. Keeps the staging
+   *  buffer inside the L2 cache. */
+  itkStaticConstMacro(BlockSize, unsigned int, 8192);
+
+  typedef std::vector< const CellType * > CellListType;
+
+  // position in the POINTS section of each point identifier, only filled
+  // when the identifiers are not the positions themselves
+  typedef std::map< PointIdentifier, SizeValueType > PointIndexMapType;
+
+  PointIndexMapType m_PointIndices;
+  bool              m_PointIdsAreIndices;
+  SizeValueType     m_NumberOfPoints;
+
+  void BuildPointIndices();
+  bool HasPoint(PointIdentifier id) const;
+  SizeValueType GetPointIndex(PointIdentifier id) const
+  {
+    return m_PointIdsAreIndices ? static_cast< SizeValueType >( id ) : m_PointIndices.find(id)->second;
+  }
+
+  void WritePoints(std::ostream & os) const;
+  void WriteCells(std::ostream & os, const char *keyword, const CellListType & cells) const;
+
+  void WritePointsASCII(std::ostream & os) const;
+  void WriteCellsASCII(std::ostream & os, const CellListType & cells) const;
+
+  /** Convert a block of words in place from system to big-endian order.
+   *  Written as plain shifts so that the compiler turns the loop into
+   *  vector byte shuffles. */
+  static void SwapToBigEndian(uint32_t *words, SizeValueType count);
+  static void SwapToBigEndian(uint64_t *words, SizeValueType count);
+
+  /** Per-thread state for the ASCII formatter. */
+  struct ASCIIPointsThreadStruct
+    {
+    std::vector< PointIterator > BlockBegin;
+    std::vector< std::string >   Text;
+    SizeValueType                NumberOfPoints;
+    };
+  struct ASCIICellsThreadStruct
+    {
+    const Self *               Writer;
+    const CellListType *       Cells;
+    std::vector< std::string > Text;
+    };
+
+  static ITK_THREAD_RETURN_TYPE FormatPointsThreaderCallback(void *arg);
+  static ITK_THREAD_RETURN_TYPE FormatCellsThreaderCallback(void *arg);
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkFastVTKPolyDataWriter.hxx"
+#endif
+
+#endif
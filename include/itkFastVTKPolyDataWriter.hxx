@@ -0,0 +1,522 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkFastVTKPolyDataWriter_hxx
+#define itkFastVTKPolyDataWriter_hxx
+
+#include "itkFastVTKPolyDataWriter.h"
+#include "itkByteSwapper.h"
+#include <cstdio>
+#include <cstring>
+
+namespace itk
+{
+namespace FastVTKPolyDataWriterHelpers
+{
+/** Unsigned word with the size of a coordinate, used as the byte swapping
+ *  staging type. */
+template< unsigned int NBytes > struct WordType;
+template< > struct WordType< 4 > { typedef uint32_t Type; };
+template< > struct WordType< 8 > { typedef uint64_t Type; };
+
+/** Legacy VTK name of a coordinate type. */
+template< typename T > struct VTKTypeName;
+template< > struct VTKTypeName< float >  { static const char * Get() { return "float"; } };
+template< > struct VTKTypeName< double > { static const char * Get() { return "double"; } };
+
+/** Significant digits needed for a text round trip of a coordinate. */
+template< typename T > struct RoundTripDigits { static int Get() { return sizeof( T ) == 4 ? 9 : 17; } };
+} // end namespace FastVTKPolyDataWriterHelpers
+
+template< typename TInputMesh >
+FastVTKPolyDataWriter< TInputMesh >
+::FastVTKPolyDataWriter()
+{
+  m_Input = ITK_NULLPTR;
+  m_FileName = "";
+  m_FileHeader = "";
+  m_FileType = BINARY;
+  m_NumberOfThreads = MultiThreader::GetGlobalDefaultNumberOfThreads();
+  m_PointIdsAreIndices = true;
+  m_NumberOfPoints = 0;
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::SetInput(const InputMeshType *input)
+{
+  m_Input = input;
+}
+
+template< typename TInputMesh >
+const typename FastVTKPolyDataWriter< TInputMesh >::InputMeshType *
+FastVTKPolyDataWriter< TInputMesh >
+::GetInput() const
+{
+  return m_Input.GetPointer();
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::Write()
+{
+  this->GenerateData();
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::Update()
+{
+  this->GenerateData();
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::GenerateData()
+{
+  if ( m_FileName == "" )
+    {
+    itkExceptionMacro("No FileName");
+    }
+
+  if ( !m_Input )
+    {
+    itkExceptionMacro("No input mesh");
+    }
+
+  // Checked before the file is opened, so that a bad mesh leaves no
+  // partial file behind
+  this->BuildPointIndices();
+  CellListType polygons;
+  CellListType lines;
+  const CellsContainer *cells = m_Input->GetCells();
+  if ( cells )
+    {
+    for ( CellIterator it = cells->Begin(); it != cells->End(); ++it )
+      {
+      const CellType *cell = it.Value();
+      CellListType *  list = ITK_NULLPTR;
+      switch ( cell->GetType() )
+        {
+        case CellType::TRIANGLE_CELL:
+        case CellType::QUADRILATERAL_CELL:
+        case CellType::POLYGON_CELL:
+          list = &polygons;
+          break;
+        case CellType::LINE_CELL:
+          list = &lines;
+          break;
+        default:
+          break;
+        }
+      if ( !list )
+        {
+        continue;
+        }
+      for ( typename CellType::PointIdConstIterator pit = cell->PointIdsBegin(); pit != cell->PointIdsEnd(); ++pit )
+        {
+        if ( !this->HasPoint(*pit) )
+          {
+          itkExceptionMacro("Cell " << it.Index() << " refers to point " << *pit
+                                    << ", which is not in the points container");
+          }
+        }
+      list->push_back(cell);
+      }
+    }
+
+  // Binary mode even for ASCII output, so that no newline translation
+  // happens and the file is byte identical on every platform.
+  std::ofstream outputFile( m_FileName.c_str(), std::ios::out | std::ios::binary );
+
+  if ( !outputFile.is_open() )
+    {
+    itkExceptionMacro("Unable to open file\n"
+                      "outputFilename= " << m_FileName);
+    }
+
+  outputFile << "# vtk DataFile Version 2.0\n";
+  outputFile << m_FileHeader << "\n";
+  outputFile << ( m_FileType == BINARY ? "BINARY\n" : "ASCII\n" );
+  outputFile << "DATASET POLYDATA\n";
+
+  this->WritePoints(outputFile);
+
+  this->WriteCells(outputFile, "LINES", lines);
+  this->WriteCells(outputFile, "POLYGONS", polygons);
+
+  if ( !outputFile )
+    {
+    itkExceptionMacro("Error while writing file\n"
+                      "outputFilename= " << m_FileName);
+    }
+  outputFile.close();
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::BuildPointIndices()
+{
+  const PointsContainer *points = m_Input->GetPoints();
+
+  m_PointIndices.clear();
+  m_PointIdsAreIndices = true;
+  m_NumberOfPoints = points ? points->Size() : 0;
+  if ( !points )
+    {
+    return;
+    }
+
+  // The common case, identifiers 0 ... n-1 in container order, needs no map
+  SizeValueType position = 0;
+  for ( PointIterator it = points->Begin(); it != points->End(); ++it, ++position )
+    {
+    if ( static_cast< SizeValueType >( it.Index() ) != position )
+      {
+      m_PointIdsAreIndices = false;
+      break;
+      }
+    }
+  if ( m_PointIdsAreIndices )
+    {
+    return;
+    }
+
+  position = 0;
+  for ( PointIterator it = points->Begin(); it != points->End(); ++it, ++position )
+    {
+    m_PointIndices[it.Index()] = position;
+    }
+}
+
+template< typename TInputMesh >
+bool
+FastVTKPolyDataWriter< TInputMesh >
+::HasPoint(PointIdentifier id) const
+{
+  if ( m_PointIdsAreIndices )
+    {
+    return static_cast< SizeValueType >( id ) < m_NumberOfPoints;
+    }
+  return m_PointIndices.find(id) != m_PointIndices.end();
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::WritePoints(std::ostream & os) const
+{
+  typedef typename FastVTKPolyDataWriterHelpers::WordType< sizeof( CoordRepType ) >::Type WordType;
+
+  const PointsContainer *points = m_Input->GetPoints();
+  const SizeValueType    numberOfPoints = points ? points->Size() : 0;
+
+  os << "POINTS " << numberOfPoints << " "
+     << FastVTKPolyDataWriterHelpers::VTKTypeName< CoordRepType >::Get() << "\n";
+
+  if ( numberOfPoints == 0 )
+    {
+    return;
+    }
+
+  if ( m_FileType == ASCII )
+    {
+    this->WritePointsASCII(os);
+    return;
+    }
+
+  // legacy VTK always stores 3 components per point
+  const unsigned int componentsToCopy = PointDimension < 3 ? PointDimension : 3;
+  const WordType     zero = 0;
+
+  std::vector< WordType > block( 3 * BlockSize );
+  SizeValueType           staged = 0;
+  for ( PointIterator it = points->Begin(); it != points->End(); ++it )
+    {
+    WordType *dst = &block[3 * staged];
+    std::memcpy( dst, it.Value().GetDataPointer(), componentsToCopy * sizeof( WordType ) );
+    for ( unsigned int d = componentsToCopy; d < 3; ++d )
+      {
+      dst[d] = zero;
+      }
+    if ( ++staged == BlockSize )
+      {
+      SwapToBigEndian(&block[0], 3 * staged);
+      os.write( reinterpret_cast< const char * >( &block[0] ), 3 * staged * sizeof( WordType ) );
+      staged = 0;
+      }
+    }
+  if ( staged > 0 )
+    {
+    SwapToBigEndian(&block[0], 3 * staged);
+    os.write( reinterpret_cast< const char * >( &block[0] ), 3 * staged * sizeof( WordType ) );
+    }
+  os << "\n";
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::WriteCells(std::ostream & os, const char *keyword, const CellListType & cells) const
+{
+  if ( cells.empty() )
+    {
+    return;
+    }
+
+  SizeValueType size = 0;
+  for ( typename CellListType::const_iterator it = cells.begin(); it != cells.end(); ++it )
+    {
+    size += 1 + ( *it )->GetNumberOfPoints();
+    }
+
+  os << keyword << " " << cells.size() << " " << size << "\n";
+
+  if ( m_FileType == ASCII )
+    {
+    this->WriteCellsASCII(os, cells);
+    return;
+    }
+
+  // Cells are flushed whenever the block cannot hold another one, so a
+  // polygon of any size only needs its own length in the buffer.
+  std::vector< uint32_t > block( BlockSize );
+  SizeValueType           staged = 0;
+  for ( typename CellListType::const_iterator it = cells.begin(); it != cells.end(); ++it )
+    {
+    const CellType *    cell = *it;
+    const SizeValueType cellSize = 1 + cell->GetNumberOfPoints();
+    if ( staged + cellSize > block.size() )
+      {
+      SwapToBigEndian(&block[0], staged);
+      os.write( reinterpret_cast< const char * >( &block[0] ), staged * sizeof( uint32_t ) );
+      staged = 0;
+      if ( cellSize > block.size() )
+        {
+        block.resize(cellSize);
+        }
+      }
+    block[staged++] = static_cast< uint32_t >( cellSize - 1 );
+    for ( typename CellType::PointIdConstIterator pit = cell->PointIdsBegin();
+          pit != cell->PointIdsEnd(); ++pit )
+      {
+      block[staged++] = static_cast< uint32_t >( this->GetPointIndex(*pit) );
+      }
+    }
+  SwapToBigEndian(&block[0], staged);
+  os.write( reinterpret_cast< const char * >( &block[0] ), staged * sizeof( uint32_t ) );
+  os << "\n";
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::WritePointsASCII(std::ostream & os) const
+{
+  const PointsContainer *points = m_Input->GetPoints();
+
+  ASCIIPointsThreadStruct str;
+  str.NumberOfPoints = points->Size();
+
+  const ThreadIdType numberOfThreads =
+    str.NumberOfPoints < m_NumberOfThreads ? static_cast< ThreadIdType >( str.NumberOfPoints ) : m_NumberOfThreads;
+
+  // One walk over the container to find where each thread starts; this also
+  // works for map based containers that have no random access.
+  PointIterator it = points->Begin();
+  SizeValueType position = 0;
+  for ( ThreadIdType t = 0; t < numberOfThreads; ++t )
+    {
+    const SizeValueType begin = str.NumberOfPoints * t / numberOfThreads;
+    for ( ; position < begin; ++position )
+      {
+      ++it;
+      }
+    str.BlockBegin.push_back(it);
+    }
+  str.Text.resize(numberOfThreads);
+
+  MultiThreader::Pointer threader = MultiThreader::New();
+  threader->SetNumberOfThreads(numberOfThreads);
+  threader->SetSingleMethod(Self::FormatPointsThreaderCallback, &str);
+  threader->SingleMethodExecute();
+
+  for ( ThreadIdType t = 0; t < numberOfThreads; ++t )
+    {
+    os.write( str.Text[t].data(), str.Text[t].size() );
+    }
+}
+
+template< typename TInputMesh >
+ITK_THREAD_RETURN_TYPE
+FastVTKPolyDataWriter< TInputMesh >
+::FormatPointsThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast< MultiThreader::ThreadInfoStruct * >( arg );
+  ASCIIPointsThreadStruct *        str = static_cast< ASCIIPointsThreadStruct * >( info->UserData );
+
+  const ThreadIdType  threadId = info->ThreadID;
+  const ThreadIdType  numberOfThreads = static_cast< ThreadIdType >( str->BlockBegin.size() );
+  if ( threadId >= numberOfThreads )
+    {
+    return ITK_THREAD_RETURN_VALUE;
+    }
+  const SizeValueType begin = str->NumberOfPoints * threadId / numberOfThreads;
+  const SizeValueType end = str->NumberOfPoints * ( threadId + 1 ) / numberOfThreads;
+  const int           digits = FastVTKPolyDataWriterHelpers::RoundTripDigits< CoordRepType >::Get();
+
+  std::string & text = str->Text[threadId];
+  text.reserve( ( end - begin ) * 3 * ( digits + 8 ) );
+
+  char          buffer[128];
+  PointIterator it = str->BlockBegin[threadId];
+  for ( SizeValueType i = begin; i < end; ++i, ++it )
+    {
+    double coordinates[3] = { 0.0, 0.0, 0.0 };
+    for ( unsigned int d = 0; d < PointDimension && d < 3; ++d )
+      {
+      coordinates[d] = static_cast< double >( it.Value()[d] );
+      }
+    const int length = snprintf(buffer, sizeof( buffer ), "%.*g %.*g %.*g\n",
+                                     digits, coordinates[0], digits, coordinates[1], digits, coordinates[2]);
+    text.append(buffer, length);
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::WriteCellsASCII(std::ostream & os, const CellListType & cells) const
+{
+  ASCIICellsThreadStruct str;
+  str.Writer = this;
+  str.Cells = &cells;
+
+  const ThreadIdType numberOfThreads =
+    cells.size() < m_NumberOfThreads ? static_cast< ThreadIdType >( cells.size() ) : m_NumberOfThreads;
+  str.Text.resize(numberOfThreads);
+
+  MultiThreader::Pointer threader = MultiThreader::New();
+  threader->SetNumberOfThreads(numberOfThreads);
+  threader->SetSingleMethod(Self::FormatCellsThreaderCallback, &str);
+  threader->SingleMethodExecute();
+
+  for ( ThreadIdType t = 0; t < numberOfThreads; ++t )
+    {
+    os.write( str.Text[t].data(), str.Text[t].size() );
+    }
+}
+
+template< typename TInputMesh >
+ITK_THREAD_RETURN_TYPE
+FastVTKPolyDataWriter< TInputMesh >
+::FormatCellsThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast< MultiThreader::ThreadInfoStruct * >( arg );
+  ASCIICellsThreadStruct *         str = static_cast< ASCIICellsThreadStruct * >( info->UserData );
+
+  const ThreadIdType  threadId = info->ThreadID;
+  const ThreadIdType  numberOfThreads = static_cast< ThreadIdType >( str->Text.size() );
+  if ( threadId >= numberOfThreads )
+    {
+    return ITK_THREAD_RETURN_VALUE;
+    }
+  const CellListType & cells = *str->Cells;
+  const SizeValueType  begin = cells.size() * threadId / numberOfThreads;
+  const SizeValueType  end = cells.size() * ( threadId + 1 ) / numberOfThreads;
+
+  std::string & text = str->Text[threadId];
+  text.reserve( ( end - begin ) * 32 );
+
+  char buffer[32];
+  for ( SizeValueType i = begin; i < end; ++i )
+    {
+    const CellType *cell = cells[i];
+    int             length = snprintf( buffer, sizeof( buffer ), "%u",
+                                            static_cast< unsigned int >( cell->GetNumberOfPoints() ) );
+    text.append(buffer, length);
+    for ( typename CellType::PointIdConstIterator pit = cell->PointIdsBegin();
+          pit != cell->PointIdsEnd(); ++pit )
+      {
+      length = snprintf( buffer, sizeof( buffer ), " %lu",
+                         static_cast< unsigned long >( str->Writer->GetPointIndex(*pit) ) );
+      text.append(buffer, length);
+      }
+    text.push_back('\n');
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::SwapToBigEndian(uint32_t *words, SizeValueType count)
+{
+  if ( ByteSwapper< uint32_t >::SystemIsBigEndian() )
+    {
+    return;
+    }
+  for ( SizeValueType i = 0; i < count; ++i )
+    {
+    const uint32_t w = words[i];
+    words[i] = ( w >> 24 ) | ( ( w >> 8 ) & 0x0000ff00u )
+               | ( ( w << 8 ) & 0x00ff0000u ) | ( w << 24 );
+    }
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::SwapToBigEndian(uint64_t *words, SizeValueType count)
+{
+  if ( ByteSwapper< uint64_t >::SystemIsBigEndian() )
+    {
+    return;
+    }
+  for ( SizeValueType i = 0; i < count; ++i )
+    {
+    uint64_t w = words[i];
+    w = ( ( w & 0x00000000ffffffffULL ) << 32 ) | ( w >> 32 );
+    w = ( ( w & 0x0000ffff0000ffffULL ) << 16 ) | ( ( w >> 16 ) & 0x0000ffff0000ffffULL );
+    w = ( ( w & 0x00ff00ff00ff00ffULL ) << 8 )  | ( ( w >> 8 ) & 0x00ff00ff00ff00ffULL );
+    words[i] = w;
+    }
+}
+
+template< typename TInputMesh >
+void
+FastVTKPolyDataWriter< TInputMesh >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+
+  os << indent << "FileName: " << m_FileName << std::endl;
+  os << indent << "FileHeader: " << m_FileHeader << std::endl;
+  os << indent << "FileType: " << ( m_FileType == BINARY ? "BINARY" : "ASCII" ) << std::endl;
+  os << indent << "NumberOfThreads: " << m_NumberOfThreads << std::endl;
+}
+} // end namespace itk
+
+#endif
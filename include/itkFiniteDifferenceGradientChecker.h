@@ -0,0 +1,161 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkFiniteDifferenceGradientChecker_h
+#define itkFiniteDifferenceGradientChecker_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkIntTypes.h"
+#include "itkMultiThreader.h"
+#include "itkSingleValuedCostFunction.h"
+#include "ExternalTemplateExport.h"
+#include <string>
+#include <vector>
+
+namespace itk
+{
+/** \class FiniteDifferenceGradientChecker
+ * \brief Compares GetDerivative() of a cost function to central differences of GetValue().
+ *
+ * Check() evaluates (f(p + h e_k) - f(p - h e_k)) / 2h for every parameter
+ * k, or for a random sample of them, and compares it to component k of
+ * GetDerivative(p). The samples are spread over several threads, each
+ * perturbing its own copy of the parameters, so the cost function's
+ * GetValue() must be safe to call concurrently.
+ *
+ * The relative error of a component is |analytic - numeric| divided by the
+ * larger of their magnitudes and of ErrorFloor, which keeps components that
+ * are zero up to rounding from dominating the report.
+ *
+ * Each GetValue() of a mesh metric visits the whole mesh, so checking all
+ * parameters costs twice the number of parameters full evaluations;
+ * sampling a few thousand parameters is enough to catch a wrong term. A
+ * metric that threads its own evaluation is best set to one thread while
+ * it is checked.
+ *
+ */
+class ExternalTemplate_EXPORT FiniteDifferenceGradientChecker:public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef FiniteDifferenceGradientChecker Self;
+  typedef Object                          Superclass;
+  typedef SmartPointer< Self >            Pointer;
+  typedef SmartPointer< const Self >      ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(FiniteDifferenceGradientChecker, Object);
+
+  typedef SingleValuedCostFunction          CostFunctionType;
+  typedef CostFunctionType::ParametersType  ParametersType;
+  typedef CostFunctionType::DerivativeType  DerivativeType;
+
+  /** Set/Get the cost function to check. */
+  itkSetObjectMacro(CostFunction, CostFunctionType);
+  itkGetModifiableObjectMacro(CostFunction, CostFunctionType);
+
+  /** Set/Get the finite difference step h. Defaults to 1e-4. */
+  itkSetMacro(StepSize, double);
+  itkGetConstMacro(StepSize, double);
+
+  /** Set/Get the number of parameters to check, drawn at random without
+   *  replacement. 0 (the default) checks all of them. */
+  itkSetMacro(NumberOfSamples, SizeValueType);
+  itkGetConstMacro(NumberOfSamples, SizeValueType);
+
+  /** Set/Get the seed of the sampling. */
+  itkSetMacro(Seed, uint32_t);
+  itkGetConstMacro(Seed, uint32_t);
+
+  /** Set/Get the smallest magnitude relative errors are taken against.
+   *  Defaults to 1e-8. */
+  itkSetMacro(ErrorFloor, double);
+  itkGetConstMacro(ErrorFloor, double);
+
+  /** Set/Get the number of threads evaluating the differences. Defaults to
+   *  the global default number of threads. */
+  itkSetClampMacro(NumberOfThreads, ThreadIdType, 1, ITK_MAX_THREADS);
+  itkGetConstMacro(NumberOfThreads, ThreadIdType);
+
+  /** Check the derivative at the given position. Throws if the cost
+   *  function throws. */
+  void Check(const ParametersType & position);
+
+  /** Results of the last Check(). */
+  itkGetConstMacro(MaximumRelativeError, double);
+  itkGetConstMacro(MeanRelativeError, double);
+  itkGetConstMacro(MaximumAbsoluteError, double);
+
+  /** Parameter with the largest relative error. */
+  itkGetConstMacro(WorstParameter, SizeValueType);
+
+  /** Indices of the checked parameters, in increasing order, and their
+   *  analytic and finite difference derivatives. */
+  const std::vector< SizeValueType > & GetCheckedParameters() const { return m_CheckedParameters; }
+  const std::vector< double > & GetAnalyticDerivatives() const { return m_AnalyticDerivatives; }
+  const std::vector< double > & GetNumericDerivatives() const { return m_NumericDerivatives; }
+
+  /** Wall time of the last Check(), in seconds. */
+  itkGetConstMacro(ElapsedTime, double);
+
+  /** Print the errors and the worst parameters. */
+  void Report(std::ostream & os = std::cout, unsigned int numberOfWorstParameters = 5) const;
+
+protected:
+  FiniteDifferenceGradientChecker();
+  virtual ~FiniteDifferenceGradientChecker() {}
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(FiniteDifferenceGradientChecker);
+
+  CostFunctionType::Pointer m_CostFunction;
+  double                    m_StepSize;
+  SizeValueType             m_NumberOfSamples;
+  uint32_t                  m_Seed;
+  double                    m_ErrorFloor;
+  ThreadIdType              m_NumberOfThreads;
+
+  std::vector< SizeValueType > m_CheckedParameters;
+  std::vector< double >        m_AnalyticDerivatives;
+  std::vector< double >        m_NumericDerivatives;
+  double                       m_MaximumRelativeError;
+  double                       m_MeanRelativeError;
+  double                       m_MaximumAbsoluteError;
+  SizeValueType                m_WorstParameter;
+  double                       m_ElapsedTime;
+
+  double GetRelativeError(double analytic, double numeric) const;
+
+  struct CheckThreadStruct
+    {
+    const Self *             Checker;
+    const ParametersType *   Position;
+    ThreadIdType             NumberOfThreads;
+    std::vector< double > *  NumericDerivatives;
+    std::vector< std::string > Errors;
+    };
+  static ITK_THREAD_RETURN_TYPE CheckThreaderCallback(void *arg);
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,143 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkFirstTouchArray_h
+#define itkFirstTouchArray_h
+
+#include "itkIntTypes.h"
+#include "itkMacro.h"
+#include "itkWorkerPool.h"
+#include "ExternalTemplateExport.h"
+#include <vector>
+
+namespace itk
+{
+/** \class FirstTouchArrayBase
+ * \brief Untyped storage of FirstTouchArray.
+ *
+ * The bytes are allocated as fresh pages from the operating system, which
+ * places a page on the memory node of the thread that first writes it
+ * rather than the one that allocates it.
+ *
+ */
+class ExternalTemplate_EXPORT FirstTouchArrayBase
+{
+public:
+  /** Size of the contents in bytes. */
+  SizeValueType GetSizeInBytes() const { return m_Bytes; }
+
+protected:
+  FirstTouchArrayBase();
+  ~FirstTouchArrayBase();
+
+  // drop the contents and allocate bytes that no thread has touched
+  void AllocateBytes(SizeValueType bytes);
+  void ReleaseBytes();
+
+  // Move the contents to new pages, or zero new pages when keepContents
+  // is false: part p of numberOfParts, the bytes [boundaries[p],
+  // boundaries[p+1]), is written by thread p of pool.
+  void PlaceBytes(WorkerPool *pool, const SizeValueType *boundaries, ThreadIdType numberOfParts,
+                  bool keepContents);
+
+  void *        m_Data;
+  SizeValueType m_Bytes;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(FirstTouchArrayBase);
+
+  typedef FirstTouchArrayBase Self;
+
+  static void * AllocatePages(SizeValueType bytes);
+  static void FreePages(void *data, SizeValueType bytes);
+
+  struct PlacementStruct
+    {
+    const char *          Source;
+    char *                Destination;
+    const SizeValueType * Boundaries;
+    ThreadIdType          NumberOfParts;
+    };
+  static void PlacementJob(void *data, ThreadIdType threadId, ThreadIdType numberOfThreads);
+};
+
+/** \class FirstTouchArray
+ * \brief Array of plain values placed on the memory nodes of the threads
+ * that use them.
+ *
+ * On a multi-socket machine a page lives on the node of the thread that
+ * first writes it. Arrays filled by one thread thus end up on one node,
+ * and the threads of the other sockets read them remotely in every
+ * evaluation. Place() copies the contents to new pages with the threads of
+ * a WorkerPool, each thread the part it will later work on, so that every
+ * part lives next to its thread; pinned pool threads (see
+ * WorkerPool::SetPinThreads()) keep it that way.
+ *
+ * T must be a type without constructor, such as double or uint32_t: the
+ * elements are not initialized by Allocate().
+ *
+ */
+template< typename T >
+class FirstTouchArray:public FirstTouchArrayBase
+{
+public:
+  FirstTouchArray() : m_Size(0) {}
+
+  /** Drop the contents and allocate size uninitialized elements. */
+  void Allocate(SizeValueType size)
+  {
+    this->AllocateBytes( size * sizeof( T ) );
+    m_Size = size;
+  }
+
+  /** Free the elements. */
+  void Clear()
+  {
+    this->ReleaseBytes();
+    m_Size = 0;
+  }
+
+  /** Move the elements to pages first written by the threads of pool:
+   *  elements [boundaries[p], boundaries[p+1]) by thread p, for p in
+   *  [0, numberOfParts). The boundaries must cover the whole array. With
+   *  keepContents false the elements are zeroed instead of copied. */
+  void Place(WorkerPool *pool, const SizeValueType *boundaries, ThreadIdType numberOfParts,
+             bool keepContents = true)
+  {
+    std::vector< SizeValueType > bytes( numberOfParts + 1 );
+    for ( ThreadIdType p = 0; p <= numberOfParts; ++p )
+      {
+      bytes[p] = boundaries[p] * sizeof( T );
+      }
+    this->PlaceBytes(pool, &bytes[0], numberOfParts, keepContents);
+  }
+
+  SizeValueType size() const { return m_Size; }
+  bool empty() const { return m_Size == 0; }
+
+  T * data() { return static_cast< T * >( m_Data ); }
+  const T * data() const { return static_cast< const T * >( m_Data ); }
+
+  T & operator[](SizeValueType i) { return data()[i]; }
+  const T & operator[](SizeValueType i) const { return data()[i]; }
+
+private:
+  SizeValueType m_Size;
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,140 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkFlatPointLocator_h
+#define itkFlatPointLocator_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkIntTypes.h"
+#include "itkMemoryMappedFile.h"
+#include "ExternalTemplateExport.h"
+#include <string>
+#include <vector>
+
+namespace itk
+{
+/** \class FlatPointLocator
+ * \brief Closest point queries on a fixed 3D point set, stored without pointers.
+ *
+ * The locator is an implicit kd-tree: the points are reordered so that the
+ * median of every range [begin, end) splits it into the two child ranges,
+ * and only the split axis of each median is stored. The whole structure is
+ * therefore three flat arrays (reordered coordinates, original indices,
+ * split axes) which can be written to disk and memory mapped read-only by
+ * any number of processes, so a job only pages in the index instead of
+ * rebuilding it.
+ *
+ * A serialized index records the coordinate hash of the points it was built
+ * from, and optionally the topology hash of the mesh they belong to (see
+ * NativeMeshFile). ReadMapped() checks them against the hashes expected by
+ * the caller.
+ *
+ * Queries return the same point as a linear scan: among points at the same
+ * squared distance the one with the smallest original index wins.
+ *
+ */
+class ExternalTemplate_EXPORT FlatPointLocator:public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef FlatPointLocator           Self;
+  typedef Object                     Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(FlatPointLocator, Object);
+
+  /** Ranges of at most this many points are scanned linearly. */
+  itkStaticConstMacro(LeafSize, unsigned int, 8);
+
+  /** Build the index over packed xyz coordinates. The coordinates are
+   *  copied. */
+  void Build(const double *points, SizeValueType numberOfPoints);
+
+  /** Index of the point closest to query, and its squared distance if
+   *  squaredDistance is not null. The locator must not be empty. */
+  SizeValueType FindClosestPoint(const double query[3], double *squaredDistance = ITK_NULLPTR) const;
+
+  /** Number of indexed points. */
+  SizeValueType GetNumberOfPoints() const { return m_NumberOfPoints; }
+
+  /** Hash of the coordinates the index was built from. */
+  uint64_t GetCoordinateHash() const { return m_CoordinateHash; }
+
+  /** Topology hash of the mesh the points belong to, stored with the index
+   *  when serialized. Zero when unknown. */
+  itkSetMacro(TopologyHash, uint64_t);
+  itkGetConstMacro(TopologyHash, uint64_t);
+
+  /** Serialize to a flat file. */
+  void Write(const std::string & fileName) const;
+
+  /** Memory map a file written by Write(). Throws if the file is invalid or
+   *  its hashes differ from the expected ones; pass zero to skip a check. */
+  void ReadMapped(const std::string & fileName, uint64_t expectedTopologyHash, uint64_t expectedCoordinateHash);
+
+  /** Use flat arrays living elsewhere, e.g. in shared memory. Nothing is
+   *  copied; the caller keeps the memory alive while the locator is used. */
+  void SetExternalArrays(const double *points, const uint32_t *indices, const uint8_t *splitAxes,
+                         SizeValueType numberOfPoints, uint64_t topologyHash, uint64_t coordinateHash);
+
+  /** The flat arrays, valid while the locator is unchanged. */
+  const double * GetPointArray() const { return m_Points; }
+  const uint32_t * GetIndexArray() const { return m_Indices; }
+  const uint8_t * GetSplitAxisArray() const { return m_SplitAxes; }
+
+  /** Bytes held by the flat arrays. */
+  SizeValueType GetSizeInBytes() const;
+
+protected:
+  FlatPointLocator();
+  virtual ~FlatPointLocator() {}
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(FlatPointLocator);
+
+  void BuildRange(const double *points, SizeValueType begin, SizeValueType end);
+  void SearchRange(SizeValueType begin, SizeValueType end, const double query[3],
+                   SizeValueType & best, double & bestDistance) const;
+  void ReleaseArrays();
+
+  // views the queries run on; point either into the storage below, into a
+  // mapped file or into external memory
+  const double *   m_Points;
+  const uint32_t * m_Indices;
+  const uint8_t *  m_SplitAxes;
+  SizeValueType    m_NumberOfPoints;
+
+  std::vector< double >   m_PointStorage;
+  std::vector< uint32_t > m_IndexStorage;
+  std::vector< uint8_t >  m_SplitAxisStorage;
+
+  MemoryMappedFile::Pointer m_MappedFile;
+
+  uint64_t m_TopologyHash;
+  uint64_t m_CoordinateHash;
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,140 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkHardwareCounters_h
+#define itkHardwareCounters_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkIntTypes.h"
+#include "itkWorkerPool.h"
+#include "ExternalTemplateExport.h"
+#include <string>
+#include <vector>
+
+namespace itk
+{
+/** \class HardwareCounters
+ * \brief CPU performance counters of the calling thread, through
+ * perf_event_open on Linux.
+ *
+ * Open() starts four user-space counters on the calling thread: cycles,
+ * retired instructions, last level cache misses and branch misses. They
+ * are inherited by threads created afterwards, whose counts are added when
+ * they exit, so a stage that starts and joins its own threads is counted
+ * in full. The persistent workers of a WorkerPool never exit during a
+ * stage, so Open() also opens counters on each worker of the global pool,
+ * and AddWorkerPool() does so for other pools. Read() returns the running
+ * totals of the calling thread and of those workers; differences between
+ * two reads give the counts of the code in between. Counts are scaled
+ * when the kernel multiplexes the hardware counters.
+ *
+ * The workers are counted whatever they run, including their spinning
+ * while they wait for the next job, and jobs of other threads sharing the
+ * pool. A pool whose workers are restarted after Open(), by
+ * SetNumberOfThreads() or SetPinThreads(), is no longer counted.
+ *
+ * Counters are often unavailable: other platforms, virtual machines
+ * without a PMU, or a kernel.perf_event_paranoid setting above 2. Open()
+ * then returns false and GetUnavailableReason() tells why; counters that
+ * fail individually are reported as unavailable in CountersType. Setting
+ * the environment variable ITK_DISABLE_HARDWARE_COUNTERS to a value other
+ * than 0 makes Open() fail the same way, e.g. to keep measurements alike
+ * across machines or to test the code that handles missing counters.
+ *
+ */
+class ExternalTemplate_EXPORT HardwareCounters:public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef HardwareCounters           Self;
+  typedef Object                     Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(HardwareCounters, Object);
+
+  typedef enum {
+    Cycles = 0,
+    Instructions,
+    CacheMisses,
+    BranchMisses,
+    NumberOfCounters
+    } CounterType;
+
+  struct CountersType
+    {
+    uint64_t Values[NumberOfCounters];
+    bool     Available[NumberOfCounters];
+    };
+
+  static const char * GetCounterName(CounterType counter);
+
+  /** Start counting on the calling thread and on the workers of
+   *  WorkerPool::GetGlobalPool(). Returns true if at least one counter is
+   *  available on the calling thread. */
+  bool Open();
+
+  /** Also count the workers of pool, after a successful Open(). Returns
+   *  false if no worker could be counted, e.g. when the pool was busy and
+   *  ran the query on the calling thread. */
+  bool AddWorkerPool(WorkerPool *pool);
+
+  /** Number of pool workers counted besides the calling thread. */
+  SizeValueType GetNumberOfWorkerThreads() const { return m_WorkerThreads.size(); }
+
+  /** Stop counting. */
+  void Close();
+
+  /** True after a successful Open(). */
+  bool IsAvailable() const { return m_Available; }
+
+  /** Why Open() failed, empty otherwise. */
+  const std::string & GetUnavailableReason() const { return m_UnavailableReason; }
+
+  /** True if called on the thread that opened the counters. Reads from
+   *  other threads would not see their own work. */
+  bool IsOwningThread() const;
+
+  /** Current totals. Returns false when not available. */
+  bool Read(CountersType & counters) const;
+
+protected:
+  HardwareCounters();
+  virtual ~HardwareCounters();
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(HardwareCounters);
+
+  int         m_FileDescriptors[NumberOfCounters];
+  bool        m_Available;
+  std::string m_UnavailableReason;
+  uint64_t    m_OwningThread;
+
+  // NumberOfCounters descriptors per counted worker
+  std::vector< uint64_t > m_WorkerThreads;
+  std::vector< int >      m_WorkerFileDescriptors;
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,90 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkMemoryMappedFile_h
+#define itkMemoryMappedFile_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "ExternalTemplateExport.h"
+#include <string>
+
+namespace itk
+{
+/** \class MemoryMappedFile
+ * \brief Read-only memory mapping of a whole file.
+ *
+ * The file is mapped shared, so several processes mapping the same file
+ * share the physical pages, and nothing is read from disk until a page is
+ * first touched. The mapping is released when the object is destroyed or
+ * Close() is called; pointers returned by GetData() are invalid afterwards.
+ *
+ */
+class ExternalTemplate_EXPORT MemoryMappedFile:public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef MemoryMappedFile           Self;
+  typedef Object                     Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(MemoryMappedFile, Object);
+
+  /** Map the whole file read-only. Throws if the file cannot be opened or
+   *  mapped. Any previous mapping is released first. */
+  void Open(const std::string & fileName);
+
+  /** Release the mapping. */
+  void Close();
+
+  /** Is a file currently mapped. */
+  bool IsOpen() const { return m_Data != ITK_NULLPTR; }
+
+  /** Start of the mapped bytes, or null when nothing is mapped. */
+  const void * GetData() const { return m_Data; }
+
+  /** Size of the mapped file in bytes. */
+  SizeValueType GetSize() const { return m_Size; }
+
+  /** Name of the mapped file. */
+  const std::string & GetFileName() const { return m_FileName; }
+
+protected:
+  MemoryMappedFile();
+  virtual ~MemoryMappedFile();
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(MemoryMappedFile);
+
+  std::string   m_FileName;
+  const void *  m_Data;
+  SizeValueType m_Size;
+#if defined( _WIN32 )
+  void *m_FileHandle;
+  void *m_MappingHandle;
+#endif
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,225 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkMeshToMeshBatchRegistration_h
+#define itkMeshToMeshBatchRegistration_h
+
+#include "itkObject.h"
+#include "itkAtomicInt.h"
+#include "itkBoundedQueue.h"
+#include "itkIntTypes.h"
+#include "itkMultiThreader.h"
+#include "itkNumericTraits.h"
+#include "itkRegistrationTracer.h"
+#include <string>
+#include <vector>
+
+namespace itk
+{
+/** \class MeshToMeshBatchRegistration
+ * \brief Registers a list of mesh pairs with reading, registration and
+ * writing overlapped.
+ *
+ * Each case is a fixed mesh file, a moving mesh file and an output file.
+ * Instead of handling the cases one after the other, Update() runs three
+ * groups of threads connected by BoundedQueue objects:
+ *
+ *   readers  load the meshes of the next cases,
+ *   workers  register them with MeshToMeshRegistrationMethod,
+ *   writers  write the registered moving meshes.
+ *
+ * While a case is registered the next ones are already being read and the
+ * previous ones written, so with enough readers and writers the throughput
+ * approaches that of the registrations alone. QueueCapacity bounds how many
+ * cases wait between two stages, and with it the number of meshes in
+ * memory. Cases are read in order but may finish out of order.
+ *
+ * Meshes are read with NativeMeshFileReader for ".tsdm" files and with
+ * VTKPolyDataReader otherwise, and written with NativeMeshFileWriter or
+ * FastVTKPolyDataWriter by the same rule. The default registration is
+ * ThinShellDemonsMetric with MeshDisplacementTransform and
+ * ConjugateGradientOptimizer, configured by StretchWeight and BendWeight.
+ * Subclasses change any stage by overriding ReadCase(), RegisterCase() or
+ * WriteCase(); these are called concurrently for different cases.
+ *
+ * A case that throws is marked as failed and skipped by the later stages;
+ * the other cases proceed.
+ *
+ */
+template< typename TFixedMesh, typename TMovingMesh >
+class ITK_TEMPLATE_EXPORT MeshToMeshBatchRegistration:public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef MeshToMeshBatchRegistration Self;
+  typedef Object                      Superclass;
+  typedef SmartPointer< Self >        Pointer;
+  typedef SmartPointer< const Self >  ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(MeshToMeshBatchRegistration, Object);
+
+  typedef TFixedMesh                          FixedMeshType;
+  typedef typename FixedMeshType::Pointer     FixedMeshPointer;
+  typedef TMovingMesh                         MovingMeshType;
+  typedef typename MovingMeshType::Pointer    MovingMeshPointer;
+
+  /** One registration job and, after Update(), its outcome. */
+  struct CaseType
+    {
+    std::string FixedFileName;
+    std::string MovingFileName;
+    std::string OutputFileName;
+
+    // in flight between the stages, released once written
+    FixedMeshPointer  FixedMesh;
+    MovingMeshPointer MovingMesh;
+
+    bool        Succeeded;
+    std::string ErrorMessage;
+
+    // seconds spent in each stage
+    double ReadTime;
+    double RegistrationTime;
+    double WriteTime;
+    };
+
+  /** Add a case. Returns its index. */
+  SizeValueType AddCase(const std::string & fixedFileName,
+                        const std::string & movingFileName,
+                        const std::string & outputFileName);
+
+  /** Remove all cases. */
+  void ClearCases();
+
+  SizeValueType GetNumberOfCases() const { return static_cast< SizeValueType >( m_Cases.size() ); }
+
+  /** Access a case and, after Update(), its outcome. */
+  const CaseType & GetCase(SizeValueType index) const;
+
+  /** Set/Get the number of threads of each stage. Default: one reader, one
+   *  writer and one worker per core not taken by them. */
+  itkSetClampMacro(NumberOfReaderThreads, ThreadIdType, 1, ITK_MAX_THREADS);
+  itkGetConstMacro(NumberOfReaderThreads, ThreadIdType);
+  itkSetClampMacro(NumberOfWorkerThreads, ThreadIdType, 1, ITK_MAX_THREADS);
+  itkGetConstMacro(NumberOfWorkerThreads, ThreadIdType);
+  itkSetClampMacro(NumberOfWriterThreads, ThreadIdType, 1, ITK_MAX_THREADS);
+  itkGetConstMacro(NumberOfWriterThreads, ThreadIdType);
+
+  /** Set/Get how many cases may wait between two stages. Default 2. */
+  itkSetClampMacro(QueueCapacity, SizeValueType, 1, NumericTraits< SizeValueType >::max());
+  itkGetConstMacro(QueueCapacity, SizeValueType);
+
+  /** Set/Get the weights of the default registration. */
+  itkSetMacro(StretchWeight, double);
+  itkGetConstMacro(StretchWeight, double);
+  itkSetMacro(BendWeight, double);
+  itkGetConstMacro(BendWeight, double);
+
+  /** Set/Get a tracer recording each stage of each case, on the thread
+   *  that runs it, and the phases of the default registration. None by
+   *  default. */
+  itkSetObjectMacro(Tracer, RegistrationTracer);
+  itkGetModifiableObjectMacro(Tracer, RegistrationTracer);
+
+  /** Process all cases. Returns when every case is written or failed. */
+  void Update();
+
+  /** Outcome of the last Update(). */
+  itkGetConstMacro(NumberOfFailedCases, SizeValueType);
+  itkGetConstMacro(ElapsedTime, double);
+
+  /** Sums of the per-case stage times of the last Update(). Comparing
+   *  RegistrationTime / NumberOfWorkerThreads with ElapsedTime shows how
+   *  much of the I/O was hidden. */
+  double GetTotalReadTime() const;
+  double GetTotalRegistrationTime() const;
+  double GetTotalWriteTime() const;
+
+protected:
+  MeshToMeshBatchRegistration();
+  virtual ~MeshToMeshBatchRegistration() {}
+
+  /** Fill FixedMesh and MovingMesh from the file names. */
+  virtual void ReadCase(CaseType & c) const;
+
+  /** Register the meshes and leave the result in MovingMesh. */
+  virtual void RegisterCase(CaseType & c) const;
+
+  /** Write MovingMesh to OutputFileName. */
+  virtual void WriteCase(CaseType & c) const;
+
+  void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(MeshToMeshBatchRegistration);
+
+  typedef BoundedQueue< CaseType * > QueueType;
+
+  std::vector< CaseType > m_Cases;
+
+  ThreadIdType  m_NumberOfReaderThreads;
+  ThreadIdType  m_NumberOfWorkerThreads;
+  ThreadIdType  m_NumberOfWriterThreads;
+  SizeValueType m_QueueCapacity;
+
+  double m_StretchWeight;
+  double m_BendWeight;
+
+  RegistrationTracer::Pointer m_Tracer;
+
+  SizeValueType m_NumberOfFailedCases;
+  double        m_ElapsedTime;
+
+  /** State shared by the threads of one Update(). */
+  struct PipelineStruct
+    {
+    Self *           Driver;
+    ThreadIdType     NumberOfReaders;
+    ThreadIdType     NumberOfWorkers;
+    QueueType *      RegisterQueue;
+    QueueType *      WriteQueue;
+    AtomicInt< int > NextCase;
+    AtomicInt< int > RunningReaders;
+    AtomicInt< int > RunningWorkers;
+    };
+
+  static ITK_THREAD_RETURN_TYPE PipelineThreaderCallback(void *arg);
+
+  /** Run one stage on a case, recording its time and any failure. */
+  typedef void ( Self::*StageType )(CaseType &) const;
+  void RunStage(StageType stage, const char *name, CaseType & c, double & time);
+
+  /** Run one case through all stages in the calling thread. */
+  void RunSequential(CaseType & c);
+
+  void RunReader(PipelineStruct & pipeline);
+  void RunWorker(PipelineStruct & pipeline);
+  void RunWriter(PipelineStruct & pipeline);
+
+  static bool HasExtension(const std::string & fileName, const char *extension);
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkMeshToMeshBatchRegistration.hxx"
+#endif
+
+#endif
@@ -0,0 +1,475 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkMeshToMeshBatchRegistration_hxx
+#define itkMeshToMeshBatchRegistration_hxx
+
+#include "itkMeshToMeshBatchRegistration.h"
+#include "itkConjugateGradientOptimizer.h"
+#include "itkFastVTKPolyDataWriter.h"
+#include "itkMeshDisplacementTransform.h"
+#include "itkMeshToMeshRegistrationMethod.h"
+#include "itkNativeMeshFileReader.h"
+#include "itkNativeMeshFileWriter.h"
+#include "itkRegistrationProfiler.h"
+#include "itkThinShellDemonsMetric.h"
+#include "itkTimeProbe.h"
+#include "itkVTKPolyDataReader.h"
+#include <algorithm>
+#include <exception>
+
+namespace itk
+{
+template< typename TFixedMesh, typename TMovingMesh >
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::MeshToMeshBatchRegistration()
+{
+  const ThreadIdType cores = MultiThreader::GetGlobalDefaultNumberOfThreads();
+
+  m_NumberOfReaderThreads = 1;
+  m_NumberOfWriterThreads = 1;
+  m_NumberOfWorkerThreads = cores > 3 ? cores - 2 : 1;
+  m_QueueCapacity = 2;
+  m_StretchWeight = 4.0;
+  m_BendWeight = 1.0;
+  m_NumberOfFailedCases = 0;
+  m_ElapsedTime = 0.0;
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+SizeValueType
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::AddCase(const std::string & fixedFileName,
+          const std::string & movingFileName,
+          const std::string & outputFileName)
+{
+  CaseType c;
+  c.FixedFileName = fixedFileName;
+  c.MovingFileName = movingFileName;
+  c.OutputFileName = outputFileName;
+  c.Succeeded = false;
+  c.ReadTime = 0.0;
+  c.RegistrationTime = 0.0;
+  c.WriteTime = 0.0;
+  m_Cases.push_back(c);
+  this->Modified();
+  return static_cast< SizeValueType >( m_Cases.size() - 1 );
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::ClearCases()
+{
+  m_Cases.clear();
+  this->Modified();
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+const typename MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >::CaseType &
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::GetCase(SizeValueType index) const
+{
+  if ( index >= m_Cases.size() )
+    {
+    itkExceptionMacro(<< "Case index " << index << " out of range, there are " << m_Cases.size() << " cases");
+    }
+  return m_Cases[index];
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::Update()
+{
+  TimeProbe clock;
+  clock.Start();
+
+  for ( typename std::vector< CaseType >::iterator it = m_Cases.begin(); it != m_Cases.end(); ++it )
+    {
+    it->Succeeded = true;
+    it->ErrorMessage = "";
+    it->ReadTime = 0.0;
+    it->RegistrationTime = 0.0;
+    it->WriteTime = 0.0;
+    }
+
+  MultiThreader::Pointer threader = MultiThreader::New();
+  threader->SetNumberOfThreads(m_NumberOfReaderThreads + m_NumberOfWorkerThreads + m_NumberOfWriterThreads);
+  const ThreadIdType numberOfThreads = threader->GetNumberOfThreads();
+
+  if ( numberOfThreads < 3 || m_Cases.size() < 2 )
+    {
+    // no room for a pipeline
+    for ( typename std::vector< CaseType >::iterator it = m_Cases.begin(); it != m_Cases.end(); ++it )
+      {
+      this->RunSequential(*it);
+      }
+    }
+  else
+    {
+    // The threader may grant fewer threads than asked for; take them from
+    // the workers first, then from the readers, keeping the writers.
+    ThreadIdType readers = m_NumberOfReaderThreads;
+    ThreadIdType writers = m_NumberOfWriterThreads;
+    while ( readers + writers + 1 > numberOfThreads )
+      {
+      if ( readers > 1 )
+        {
+        --readers;
+        }
+      else
+        {
+        --writers;
+        }
+      }
+    const ThreadIdType workers = std::min( m_NumberOfWorkerThreads,
+                                           static_cast< ThreadIdType >( numberOfThreads - readers - writers ) );
+
+    QueueType registerQueue(m_QueueCapacity);
+    QueueType writeQueue(m_QueueCapacity);
+
+    PipelineStruct pipeline;
+    pipeline.Driver = this;
+    pipeline.NumberOfReaders = readers;
+    pipeline.NumberOfWorkers = workers;
+    pipeline.RegisterQueue = &registerQueue;
+    pipeline.WriteQueue = &writeQueue;
+    pipeline.NextCase = 0;
+    pipeline.RunningReaders = static_cast< int >( readers );
+    pipeline.RunningWorkers = static_cast< int >( workers );
+
+    threader->SetNumberOfThreads(readers + workers + writers);
+    threader->SetSingleMethod(Self::PipelineThreaderCallback, &pipeline);
+    threader->SingleMethodExecute();
+    }
+
+  m_NumberOfFailedCases = 0;
+  for ( typename std::vector< CaseType >::iterator it = m_Cases.begin(); it != m_Cases.end(); ++it )
+    {
+    it->FixedMesh = ITK_NULLPTR;
+    it->MovingMesh = ITK_NULLPTR;
+    if ( !it->Succeeded )
+      {
+      ++m_NumberOfFailedCases;
+      }
+    }
+
+  clock.Stop();
+  m_ElapsedTime = clock.GetTotal();
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+ITK_THREAD_RETURN_TYPE
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::PipelineThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast< MultiThreader::ThreadInfoStruct * >( arg );
+  PipelineStruct *                 pipeline = static_cast< PipelineStruct * >( info->UserData );
+
+  const ThreadIdType threadId = info->ThreadID;
+  if ( threadId < pipeline->NumberOfReaders )
+    {
+    pipeline->Driver->RunReader(*pipeline);
+    }
+  else if ( threadId < pipeline->NumberOfReaders + pipeline->NumberOfWorkers )
+    {
+    pipeline->Driver->RunWorker(*pipeline);
+    }
+  else
+    {
+    pipeline->Driver->RunWriter(*pipeline);
+    }
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::RunStage(StageType stage, const char *name, CaseType & c, double & time)
+{
+  RegistrationTracer::Scope traceScope(m_Tracer.GetPointer(), name, "batch", &c - &m_Cases[0]);
+
+  TimeProbe clock;
+  clock.Start();
+  try
+    {
+    ( this->*stage )(c);
+    }
+  catch ( ExceptionObject & err )
+    {
+    c.Succeeded = false;
+    c.ErrorMessage = err.GetDescription();
+    }
+  catch ( std::exception & err )
+    {
+    c.Succeeded = false;
+    c.ErrorMessage = err.what();
+    }
+  clock.Stop();
+  time = clock.GetTotal();
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::RunSequential(CaseType & c)
+{
+  this->RunStage(&Self::ReadCase, "Read", c, c.ReadTime);
+  if ( c.Succeeded )
+    {
+    this->RunStage(&Self::RegisterCase, "Register", c, c.RegistrationTime);
+    }
+  c.FixedMesh = ITK_NULLPTR;
+  if ( c.Succeeded )
+    {
+    this->RunStage(&Self::WriteCase, "Write", c, c.WriteTime);
+    }
+  c.MovingMesh = ITK_NULLPTR;
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::RunReader(PipelineStruct & pipeline)
+{
+  const int numberOfCases = static_cast< int >( m_Cases.size() );
+  for ( int index = pipeline.NextCase++; index < numberOfCases; index = pipeline.NextCase++ )
+    {
+    CaseType & c = m_Cases[index];
+    this->RunStage(&Self::ReadCase, "Read", c, c.ReadTime);
+    if ( !c.Succeeded )
+      {
+      c.FixedMesh = ITK_NULLPTR;
+      c.MovingMesh = ITK_NULLPTR;
+      continue;
+      }
+    pipeline.RegisterQueue->Push(&c);
+    }
+
+  // the last reader out lets the workers drain and stop
+  if ( --pipeline.RunningReaders == 0 )
+    {
+    pipeline.RegisterQueue->Close();
+    }
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::RunWorker(PipelineStruct & pipeline)
+{
+  CaseType *item;
+  while ( pipeline.RegisterQueue->Pop(item) )
+    {
+    CaseType & c = *item;
+    this->RunStage(&Self::RegisterCase, "Register", c, c.RegistrationTime);
+    c.FixedMesh = ITK_NULLPTR;
+    if ( !c.Succeeded )
+      {
+      c.MovingMesh = ITK_NULLPTR;
+      continue;
+      }
+    pipeline.WriteQueue->Push(&c);
+    }
+
+  if ( --pipeline.RunningWorkers == 0 )
+    {
+    pipeline.WriteQueue->Close();
+    }
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::RunWriter(PipelineStruct & pipeline)
+{
+  CaseType *item;
+  while ( pipeline.WriteQueue->Pop(item) )
+    {
+    CaseType & c = *item;
+    this->RunStage(&Self::WriteCase, "Write", c, c.WriteTime);
+    c.MovingMesh = ITK_NULLPTR;
+    }
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+bool
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::HasExtension(const std::string & fileName, const char *extension)
+{
+  const std::string ext(extension);
+  return fileName.size() >= ext.size()
+         && fileName.compare(fileName.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::ReadCase(CaseType & c) const
+{
+  if ( HasExtension(c.FixedFileName, ".tsdm") )
+    {
+    typename NativeMeshFileReader< FixedMeshType >::Pointer reader = NativeMeshFileReader< FixedMeshType >::New();
+    reader->SetFileName(c.FixedFileName);
+    reader->Update();
+    c.FixedMesh = reader->GetOutput();
+    }
+  else
+    {
+    typename VTKPolyDataReader< FixedMeshType >::Pointer reader = VTKPolyDataReader< FixedMeshType >::New();
+    reader->SetFileName(c.FixedFileName);
+    reader->Update();
+    c.FixedMesh = reader->GetOutput();
+    }
+
+  if ( HasExtension(c.MovingFileName, ".tsdm") )
+    {
+    typename NativeMeshFileReader< MovingMeshType >::Pointer reader = NativeMeshFileReader< MovingMeshType >::New();
+    reader->SetFileName(c.MovingFileName);
+    reader->Update();
+    c.MovingMesh = reader->GetOutput();
+    }
+  else
+    {
+    typename VTKPolyDataReader< MovingMeshType >::Pointer reader = VTKPolyDataReader< MovingMeshType >::New();
+    reader->SetFileName(c.MovingFileName);
+    reader->Update();
+    c.MovingMesh = reader->GetOutput();
+    }
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::RegisterCase(CaseType & c) const
+{
+  typedef ThinShellDemonsMetric< FixedMeshType, MovingMeshType >            MetricType;
+  typedef MeshDisplacementTransform< typename MovingMeshType::CoordRepType,
+                                     MovingMeshType::PointDimension >       TransformType;
+  typedef ConjugateGradientOptimizer                                        OptimizerType;
+  typedef MeshToMeshRegistrationMethod< FixedMeshType, MovingMeshType >     RegistrationType;
+
+  typename MetricType::Pointer metric = MetricType::New();
+  metric->SetStretchWeight(m_StretchWeight);
+  metric->SetBendWeight(m_BendWeight);
+
+  typename TransformType::Pointer transform = TransformType::New();
+  transform->SetMeshTemplate(c.MovingMesh);
+  transform->Initialize();
+  transform->SetIdentity();
+
+  typename OptimizerType::Pointer optimizer = OptimizerType::New();
+
+  typename RegistrationType::Pointer registration = RegistrationType::New();
+  registration->SetMetric(metric);
+  registration->SetOptimizer(optimizer);
+  registration->SetTransform(transform);
+  registration->SetInitialTransformParameters( transform->GetParameters() );
+  registration->SetFixedMesh(c.FixedMesh);
+  registration->SetMovingMesh(c.MovingMesh);
+  if ( m_Tracer )
+    {
+    RegistrationProfiler::Pointer profiler = RegistrationProfiler::New();
+    profiler->SetTracer(m_Tracer);
+    registration->SetProfiler(profiler);
+    }
+  registration->Update();
+  registration->UpdateMovingMesh();
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::WriteCase(CaseType & c) const
+{
+  if ( HasExtension(c.OutputFileName, ".tsdm") )
+    {
+    typename NativeMeshFileWriter< MovingMeshType >::Pointer writer = NativeMeshFileWriter< MovingMeshType >::New();
+    writer->SetInput(c.MovingMesh);
+    writer->SetFileName(c.OutputFileName);
+    writer->Write();
+    }
+  else
+    {
+    typename FastVTKPolyDataWriter< MovingMeshType >::Pointer writer = FastVTKPolyDataWriter< MovingMeshType >::New();
+    writer->SetInput(c.MovingMesh);
+    writer->SetFileName(c.OutputFileName);
+    writer->SetNumberOfThreads(1);
+    writer->Write();
+    }
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+double
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::GetTotalReadTime() const
+{
+  double total = 0.0;
+  for ( typename std::vector< CaseType >::const_iterator it = m_Cases.begin(); it != m_Cases.end(); ++it )
+    {
+    total += it->ReadTime;
+    }
+  return total;
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+double
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::GetTotalRegistrationTime() const
+{
+  double total = 0.0;
+  for ( typename std::vector< CaseType >::const_iterator it = m_Cases.begin(); it != m_Cases.end(); ++it )
+    {
+    total += it->RegistrationTime;
+    }
+  return total;
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+double
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::GetTotalWriteTime() const
+{
+  double total = 0.0;
+  for ( typename std::vector< CaseType >::const_iterator it = m_Cases.begin(); it != m_Cases.end(); ++it )
+    {
+    total += it->WriteTime;
+    }
+  return total;
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshBatchRegistration< TFixedMesh, TMovingMesh >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfCases: " << m_Cases.size() << std::endl;
+  os << indent << "NumberOfReaderThreads: " << m_NumberOfReaderThreads << std::endl;
+  os << indent << "NumberOfWorkerThreads: " << m_NumberOfWorkerThreads << std::endl;
+  os << indent << "NumberOfWriterThreads: " << m_NumberOfWriterThreads << std::endl;
+  os << indent << "QueueCapacity: " << m_QueueCapacity << std::endl;
+  os << indent << "StretchWeight: " << m_StretchWeight << std::endl;
+  os << indent << "BendWeight: " << m_BendWeight << std::endl;
+  os << indent << "Tracer: " << m_Tracer.GetPointer() << std::endl;
+  os << indent << "NumberOfFailedCases: " << m_NumberOfFailedCases << std::endl;
+  os << indent << "ElapsedTime: " << m_ElapsedTime << std::endl;
+}
+} // end namespace itk
+
+#endif
@@ -23,6 +23,9 @@
 #include "itkSingleValuedCostFunction.h"
 #include "itkMacro.h"
 #include "itkGradientRecursiveGaussianImageFilter.h"
+#include "itkRegistrationMemoryUsage.h"
+#include "itkRegistrationProfiler.h"
+#include <vector>
 
 namespace itk
 {
@@ -90,6 +93,10 @@ public:
   /**  Type of the parameters. */
   typedef Superclass::ParametersType ParametersType;
 
+  /** Parameter vectors and their values, for GetValues(). */
+  typedef std::vector< ParametersType > ParametersListType;
+  typedef std::vector< MeasureType >    MeasureListType;
+
   /** Get/Set the Fixed Mesh.  */
   itkSetConstObjectMacro(FixedMesh, FixedMeshType);
   itkGetConstObjectMacro(FixedMesh, FixedMeshType);
@@ -116,6 +123,28 @@ public:
   virtual void Initialize(void)
   throw ( ExceptionObject );
 
+  /** Evaluate the metric at every vector of parameters, as by GetValue(),
+   *  into values, e.g. for the trial steps of a line search or the members
+   *  of a population. The base class calls GetValue() for each; metrics
+   *  that can share the work between the evaluations override it. */
+  virtual void GetValues(const ParametersListType & parameters, MeasureListType & values) const;
+
+  /** Report the bytes held by the metric's internal structures. The base
+   *  class holds none. */
+  virtual void UpdateMemoryUsage(RegistrationMemoryUsage *) const {}
+
+  /** The terms the value of the last GetValue() is the sum of, e.g. a data
+   *  term and regularizers, so that observers of the optimizer's iteration
+   *  events can see which one dominates. Each term is the weighted
+   *  contribution to the value. The base class reports none. */
+  virtual unsigned int GetNumberOfEnergyTerms() const { return 0; }
+  virtual const char * GetEnergyTermName(unsigned int) const { return ""; }
+  virtual double GetEnergyTerm(unsigned int) const { return 0.0; }
+
+  /** Set/Get the profiler recording the metric's phases. None by default. */
+  itkSetObjectMacro(Profiler, RegistrationProfiler);
+  itkGetModifiableObjectMacro(Profiler, RegistrationProfiler);
+
 protected:
   MeshToMeshMetric();
   virtual ~MeshToMeshMetric() {}
@@ -127,6 +156,8 @@ protected:
 
   mutable TransformPointer m_Transform;
 
+  RegistrationProfiler::Pointer m_Profiler;
+
 private:
   ITK_DISALLOW_COPY_AND_ASSIGN(MeshToMeshMetric);
 };
@@ -30,6 +30,7 @@ MeshToMeshMetric< TFixedMesh, TMovingMesh >
   m_FixedMesh = ITK_NULLPTR;    // has to be provided by the user.
   m_MovingMesh   = ITK_NULLPTR; // has to be provided by the user.
   m_Transform     = ITK_NULLPTR;    // has to be provided by the user.
+  m_Profiler      = ITK_NULLPTR;    // optional
 }
 
 /** Set the parameters that define a unique transform */
@@ -80,6 +81,18 @@ throw ( ExceptionObject )
     }
 }
 
+template< typename TFixedMesh, typename TMovingMesh >
+void
+MeshToMeshMetric< TFixedMesh, TMovingMesh >
+::GetValues(const ParametersListType & parameters, MeasureListType & values) const
+{
+  values.resize( parameters.size() );
+  for ( size_t k = 0; k < parameters.size(); ++k )
+    {
+    values[k] = this->GetValue(parameters[k]);
+    }
+}
+
 /** PrintSelf */
 template< typename TFixedMesh, typename TMovingMesh >
 void
@@ -90,6 +103,7 @@ MeshToMeshMetric< TFixedMesh, TMovingMesh >
   os << indent << "Moving Mesh: " << m_MovingMesh.GetPointer()  << std::endl;
   os << indent << "Fixed  Mesh: " << m_FixedMesh.GetPointer()   << std::endl;
   os << indent << "Transform:    " << m_Transform.GetPointer()    << std::endl;
+  os << indent << "Profiler:     " << m_Profiler.GetPointer()     << std::endl;
 }
 } // end namespace itk
 
@@ -94,6 +94,17 @@ public:
 	itkSetObjectMacro(Transform, TransformType);
 	itkGetModifiableObjectMacro(Transform, TransformType);
 
+	/** Set/Get the profiler recording the phases of the registration and
+	 *  of its metric. None by default. When set, ProfileReportEvent is
+	 *  invoked on it at the end of each Update(), and if the profiler has a
+	 *  tracer every optimizer iteration is traced too. */
+	itkSetObjectMacro(Profiler, RegistrationProfiler);
+	itkGetModifiableObjectMacro(Profiler, RegistrationProfiler);
+
+	/** Bytes held by the structures of the last registration, per
+	 *  component, and their peak. Filled during Update(). */
+	itkGetModifiableObjectMacro(MemoryUsage, RegistrationMemoryUsage);
+
 	/** Set/Get the initial transformation parameters. */
 	virtual void SetInitialTransformParameters(const ParametersType & param);
 
@@ -154,6 +165,18 @@ private:
 	ParametersType m_InitialTransformParameters;
 	ParametersType m_LastTransformParameters;
 
+	RegistrationProfiler::Pointer m_Profiler;
+
+	RegistrationMemoryUsage::Pointer m_MemoryUsage;
+
+	// reports the bytes held by the metric, parameters and meshes
+	void UpdateMemoryUsage();
+
+	// traces each optimizer iteration when the profiler has a tracer
+	void TraceIteration();
+	double        m_IterationStart;
+	SizeValueType m_NumberOfTracedIterations;
+
 };
 
 }
@@ -19,6 +19,7 @@
 #define itkMeshToMeshRegistrationMethod_hxx
 
 #include "itkMeshToMeshRegistrationMethod.h"
+#include "itkCommand.h"
 namespace itk
 {
 
@@ -34,6 +35,11 @@ MeshToMeshRegistrationMethod< TFixedMesh, TMovingMesh >
 	m_InitialTransformParameters.Fill( 0 );
 	m_LastTransformParameters.Fill( 0 );
 
+	m_IterationStart = 0.0;
+	m_NumberOfTracedIterations = 0;
+
+	m_MemoryUsage = RegistrationMemoryUsage::New();
+
 	TransformOutputPointer transformDecorator =
 		itkDynamicCastInDebugMode< TransformOutputType * >(this->MakeOutput(0).GetPointer() );
 
@@ -80,7 +86,13 @@ void
 		itkExceptionMacro(<< "Transform is not present");
 	}
 
+	RegistrationProfiler::Scope profilerScope(m_Profiler.GetPointer(), RegistrationProfiler::RegistrationInitializePhase);
+
 	// Set up the metric
+	if ( m_Profiler )
+	{
+		m_Metric->SetProfiler(m_Profiler);
+	}
 	m_Metric->SetMovingMesh(m_MovingMesh);
 	m_Metric->SetFixedMesh(m_FixedMesh);
 	m_Metric->SetTransform(m_Transform);
@@ -103,6 +115,26 @@ void
 		static_cast< TransformOutputType * >( this->ProcessObject::GetOutput(0) );
 
 	transformOutput->Set( m_Transform.GetPointer() );
+
+	m_MemoryUsage->Reset();
+	this->UpdateMemoryUsage();
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+	MeshToMeshRegistrationMethod< TFixedMesh, TMovingMesh >
+	::UpdateMemoryUsage()
+{
+	m_Metric->UpdateMemoryUsage(m_MemoryUsage);
+
+	const SizeValueType numberOfParameters = m_Transform->GetNumberOfParameters();
+	m_MemoryUsage->SetBytes( RegistrationMemoryUsage::ParametersComponent,
+		( m_InitialTransformParameters.Size() + m_LastTransformParameters.Size() + numberOfParameters ) * sizeof( double ) );
+	m_MemoryUsage->SetBytes( RegistrationMemoryUsage::OptimizerWorkspaceComponent,
+		RegistrationMemoryUsage::EstimateOptimizerBytes(numberOfParameters) );
+	m_MemoryUsage->SetBytes( RegistrationMemoryUsage::MeshesComponent,
+		RegistrationMemoryUsage::EstimateMeshBytes( m_FixedMesh->GetNumberOfPoints(), m_FixedMesh->GetNumberOfCells() )
+		+ RegistrationMemoryUsage::EstimateMeshBytes( m_MovingMesh->GetNumberOfPoints(), m_MovingMesh->GetNumberOfCells() ) );
 }
 
 template< typename TFixedMesh, typename TMovingMesh >
@@ -124,13 +156,32 @@ void
 		throw err;
 	}
 
+	// Trace the iterations as events of their own
+	RegistrationTracer *tracer = m_Profiler ? m_Profiler->GetTracer() : ITK_NULLPTR;
+	unsigned long iterationObserver = 0;
+	if ( tracer )
+	{
+		typedef SimpleMemberCommand< Self > IterationCommandType;
+		typename IterationCommandType::Pointer iterationCommand = IterationCommandType::New();
+		iterationCommand->SetCallbackFunction(this, &Self::TraceIteration);
+		iterationObserver = m_Optimizer->AddObserver(IterationEvent(), iterationCommand);
+		m_IterationStart = tracer->GetTime();
+		m_NumberOfTracedIterations = 0;
+	}
+
 	// Do the optimization
 	try
 	{
+		RegistrationProfiler::Scope profilerScope(m_Profiler.GetPointer(), RegistrationProfiler::OptimizationPhase);
 		m_Optimizer->StartOptimization();
 	}
 	catch ( ExceptionObject & err )
 	{
+		if ( tracer )
+		{
+			m_Optimizer->RemoveObserver(iterationObserver);
+		}
+
 		// An error has occurred in the optimization.
 		// Update the parameters
 		m_LastTransformParameters = m_Optimizer->GetCurrentPosition();
@@ -139,10 +190,38 @@ void
 		throw err;
 	}
 
+	if ( tracer )
+	{
+		m_Optimizer->RemoveObserver(iterationObserver);
+	}
+
 	// Get the results
 	m_LastTransformParameters = m_Optimizer->GetCurrentPosition();
 
 	m_Transform->SetParameters(m_LastTransformParameters);
+
+	this->UpdateMemoryUsage();
+
+	if ( m_Profiler )
+	{
+		m_Profiler->Publish();
+	}
+}
+
+template< typename TFixedMesh, typename TMovingMesh >
+void
+	MeshToMeshRegistrationMethod< TFixedMesh, TMovingMesh >
+	::TraceIteration()
+{
+	// one event from the previous iteration (or the start) to this one
+	RegistrationTracer *tracer = m_Profiler ? m_Profiler->GetTracer() : ITK_NULLPTR;
+	if ( tracer )
+	{
+		const double now = tracer->GetTime();
+		tracer->AddCompleteEvent("Iteration", "optimizer", m_IterationStart, now - m_IterationStart,
+			static_cast< int64_t >( m_NumberOfTracedIterations++ ));
+		m_IterationStart = now;
+	}
 }
 
 template< typename TFixedMesh, typename TMovingMesh >
@@ -172,6 +251,9 @@ template< typename TFixedMesh, typename TMovingMesh >
 void
 	MeshToMeshRegistrationMethod< TFixedMesh, TMovingMesh >
 	::UpdateMovingMesh(){
+		RegistrationProfiler::Scope profilerScope(m_Profiler.GetPointer(), RegistrationProfiler::UpdateMovingMeshPhase,
+			m_MovingMesh->GetNumberOfPoints() * ( 2 * sizeof( typename TMovingMesh::PointType ) + 3 * sizeof( double ) ));
+
 		// update the moving mesh with the current transformation
 		typedef typename MovingMeshType::PointsContainer  OutputPointsContainer;
 		typedef typename MovingMeshType::PointsContainer  InputPointsContainer;
@@ -183,7 +265,7 @@ void
 		typename InputPointsContainer::ConstIterator inputEnd  = inPoints->End();
 		typename OutputPointsContainer::Iterator outputPoint = outPoints->Begin();
 
-		ParametersType m_VectorField = m_Transform->GetParameters();
+		const ParametersType & vectorField = m_Transform->GetParameters();
 		int idx = 0;
 		while ( inputPoint != inputEnd )
 		{
@@ -192,7 +274,7 @@ void
 			
 			for ( unsigned int i = 0; i < 3; i++ )
 			{
-				displacedPoint[i] = originalPoint[i] + m_VectorField[idx*3 + i];
+				displacedPoint[i] = originalPoint[i] + vectorField[idx*3 + i];
 			}
 			outputPoint.Value() = displacedPoint;
 			++inputPoint;
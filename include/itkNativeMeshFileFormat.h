@@ -0,0 +1,116 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkNativeMeshFileFormat_h
+#define itkNativeMeshFileFormat_h
+
+#include "itkIntTypes.h"
+#include <cstring>
+
+namespace itk
+{
+/** \class NativeMeshFileHeader
+ * \brief On-disk header of the native triangle mesh format (".tsdm").
+ *
+ * The file is a 128 byte header followed by three arrays, each starting on
+ * a 64 byte boundary so that they can be used in place once the file is
+ * memory mapped:
+ *
+ *   points      NumberOfPoints * PointDimension doubles, packed xyz
+ *   triangles   NumberOfTriangles * 3 uint32 vertex indices
+ *   attributes  NumberOfPoints * NumberOfAttributeComponents floats (optional)
+ *
+ * Everything is stored in the byte order of the writing host; readers
+ * reject files whose ByteOrderMark does not match. TopologyHash covers the
+ * number of points and the triangle array, CoordinateHash the point array.
+ *
+ */
+struct NativeMeshFileHeader
+{
+  char     Magic[8];
+  uint32_t Version;
+  uint32_t ByteOrderMark;
+  uint32_t PointDimension;
+  uint32_t NumberOfAttributeComponents;
+  uint64_t NumberOfPoints;
+  uint64_t NumberOfTriangles;
+  uint64_t PointsOffset;
+  uint64_t TrianglesOffset;
+  uint64_t AttributesOffset;
+  uint64_t FileSize;
+  uint64_t TopologyHash;
+  uint64_t CoordinateHash;
+  uint64_t Reserved[5];
+};
+
+/** Helpers shared by the native mesh reader and writer, and by the other
+ *  flat on-disk structures of this module. */
+struct NativeMeshFile
+{
+  static const char * GetMagic() { return "TSDMESH1"; }
+  static uint32_t GetVersion() { return 1; }
+  static uint32_t GetByteOrderMark() { return 0x01020304u; }
+  static uint64_t GetAlignment() { return 64; }
+
+  static uint64_t Align(uint64_t offset)
+  {
+    return ( offset + GetAlignment() - 1 ) / GetAlignment() * GetAlignment();
+  }
+
+  /** Seed of the hash chain (FNV-1a offset basis). */
+  static uint64_t GetHashSeed() { return 14695981039346656037ULL; }
+
+  /** 64 bit hash of a byte range. Consumes 8 byte words, so hashing the
+   *  arrays of a large mesh costs a few milliseconds. The seed allows
+   *  chaining several ranges into one hash. */
+  static uint64_t Hash(const void *data, uint64_t numberOfBytes, uint64_t seed)
+  {
+    const unsigned char *bytes = static_cast< const unsigned char * >( data );
+    const uint64_t       prime = 1099511628211ULL;
+    uint64_t             h = seed;
+    uint64_t             i = 0;
+
+    for (; i + 8 <= numberOfBytes; i += 8 )
+      {
+      uint64_t word;
+      std::memcpy(&word, bytes + i, 8);
+      h = ( h ^ word ) * prime;
+      h ^= h >> 29;
+      }
+    for (; i < numberOfBytes; ++i )
+      {
+      h = ( h ^ bytes[i] ) * prime;
+      }
+    return h;
+  }
+
+  /** Hash identifying a triangulation: number of vertices and connectivity. */
+  static uint64_t TopologyHash(uint64_t numberOfPoints, const uint32_t *triangles, uint64_t numberOfTriangles)
+  {
+    const uint64_t h = Hash(&numberOfPoints, sizeof( numberOfPoints ), GetHashSeed());
+    return Hash(triangles, numberOfTriangles * 3 * sizeof( uint32_t ), h);
+  }
+
+  /** Hash identifying vertex positions, packed xyz doubles. */
+  static uint64_t CoordinateHash(const double *points, uint64_t numberOfValues)
+  {
+    return Hash(points, numberOfValues * sizeof( double ), GetHashSeed());
+  }
+};
+} // end namespace itk
+
+#endif
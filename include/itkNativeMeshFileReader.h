@@ -0,0 +1,123 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkNativeMeshFileReader_h
+#define itkNativeMeshFileReader_h
+
+#include "itkMeshSource.h"
+#include "itkTriangleCell.h"
+#include "itkMemoryMappedFile.h"
+#include "itkNativeMeshFileFormat.h"
+
+namespace itk
+{
+/** \class NativeMeshFileReader
+ * \brief Memory maps a native ".tsdm" mesh file.
+ *
+ * Nothing is parsed: the file is mapped read-only, the header is validated
+ * and the point, triangle and attribute arrays are exposed in place through
+ * GetPointBuffer(), GetTriangleBuffer() and GetAttributeBuffer(). These can
+ * be handed to ThinShellDemonsMetric directly (see
+ * ThinShellDemonsMetric::SetFixedPointBuffer()), and stay valid as long as
+ * the reader is alive and its file name is unchanged.
+ *
+ * The output mesh is only filled when GenerateOutputMesh is on (the
+ * default), since building the cell objects of a large mesh costs far more
+ * than mapping the file.
+ *
+ * \sa NativeMeshFileWriter
+ */
+template< typename TOutputMesh >
+class ITK_TEMPLATE_EXPORT NativeMeshFileReader:public MeshSource< TOutputMesh >
+{
+public:
+  /** Standard "Self" typedef. */
+  typedef NativeMeshFileReader       Self;
+  typedef MeshSource< TOutputMesh >  Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(NativeMeshFileReader, MeshSource);
+
+  /** Hold on to the type information specified by the template parameters. */
+  typedef TOutputMesh                              OutputMeshType;
+  typedef typename OutputMeshType::PointType       PointType;
+  typedef typename OutputMeshType::PointsContainer PointsContainer;
+  typedef typename OutputMeshType::CellsContainer  CellsContainer;
+  typedef typename OutputMeshType::CellAutoPointer CellAutoPointer;
+  typedef typename OutputMeshType::CellType        CellType;
+  typedef TriangleCell< CellType >                 TriangleCellType;
+
+  itkStaticConstMacro(PointDimension, unsigned int, TOutputMesh::PointDimension);
+
+  /** Set/Get the name of the file to be read. */
+  itkSetStringMacro(FileName);
+  itkGetStringMacro(FileName);
+
+  /** Set/Get whether the output mesh is filled from the mapped arrays. */
+  itkSetMacro(GenerateOutputMesh, bool);
+  itkGetConstMacro(GenerateOutputMesh, bool);
+  itkBooleanMacro(GenerateOutputMesh);
+
+  /** Set/Get whether the hashes stored in the header are recomputed and
+   *  checked on load. Off by default because it touches every page. */
+  itkSetMacro(VerifyHashes, bool);
+  itkGetConstMacro(VerifyHashes, bool);
+  itkBooleanMacro(VerifyHashes);
+
+  /** Mapped arrays, valid after Update(). */
+  const double * GetPointBuffer() const;
+  const uint32_t * GetTriangleBuffer() const;
+  const float * GetAttributeBuffer() const;
+
+  SizeValueType GetNumberOfPoints() const { return m_Header.NumberOfPoints; }
+  SizeValueType GetNumberOfTriangles() const { return m_Header.NumberOfTriangles; }
+  unsigned int GetNumberOfAttributeComponents() const { return m_Header.NumberOfAttributeComponents; }
+  uint64_t GetTopologyHash() const { return m_Header.TopologyHash; }
+  uint64_t GetCoordinateHash() const { return m_Header.CoordinateHash; }
+
+protected:
+  NativeMeshFileReader();
+  ~NativeMeshFileReader() {}
+
+  /** Map the file and fill the output mesh. */
+  virtual void GenerateData() ITK_OVERRIDE;
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(NativeMeshFileReader);
+
+  void ValidateHeader() const;
+
+  std::string               m_FileName;
+  bool                      m_GenerateOutputMesh;
+  bool                      m_VerifyHashes;
+  MemoryMappedFile::Pointer m_MappedFile;
+  NativeMeshFileHeader      m_Header;
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkNativeMeshFileReader.hxx"
+#endif
+
+#endif
@@ -0,0 +1,218 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkNativeMeshFileReader_hxx
+#define itkNativeMeshFileReader_hxx
+
+#include "itkNativeMeshFileReader.h"
+
+namespace itk
+{
+template< typename TOutputMesh >
+NativeMeshFileReader< TOutputMesh >
+::NativeMeshFileReader()
+{
+  // Create the output. We use static_cast<> here because we know the default
+  // output must be of type TOutputMesh
+  typename TOutputMesh::Pointer output =
+    static_cast< TOutputMesh * >( this->MakeOutput(0).GetPointer() );
+
+  this->ProcessObject::SetNumberOfRequiredOutputs(1);
+  this->ProcessObject::SetNthOutput( 0, output.GetPointer() );
+
+  m_GenerateOutputMesh = true;
+  m_VerifyHashes = false;
+  m_MappedFile = MemoryMappedFile::New();
+  std::memset( &m_Header, 0, sizeof( m_Header ) );
+}
+
+template< typename TOutputMesh >
+const double *
+NativeMeshFileReader< TOutputMesh >
+::GetPointBuffer() const
+{
+  if ( !m_MappedFile->IsOpen() )
+    {
+    return ITK_NULLPTR;
+    }
+  return reinterpret_cast< const double * >(
+           static_cast< const char * >( m_MappedFile->GetData() ) + m_Header.PointsOffset );
+}
+
+template< typename TOutputMesh >
+const uint32_t *
+NativeMeshFileReader< TOutputMesh >
+::GetTriangleBuffer() const
+{
+  if ( !m_MappedFile->IsOpen() )
+    {
+    return ITK_NULLPTR;
+    }
+  return reinterpret_cast< const uint32_t * >(
+           static_cast< const char * >( m_MappedFile->GetData() ) + m_Header.TrianglesOffset );
+}
+
+template< typename TOutputMesh >
+const float *
+NativeMeshFileReader< TOutputMesh >
+::GetAttributeBuffer() const
+{
+  if ( !m_MappedFile->IsOpen() || m_Header.NumberOfAttributeComponents == 0 )
+    {
+    return ITK_NULLPTR;
+    }
+  return reinterpret_cast< const float * >(
+           static_cast< const char * >( m_MappedFile->GetData() ) + m_Header.AttributesOffset );
+}
+
+template< typename TOutputMesh >
+void
+NativeMeshFileReader< TOutputMesh >
+::ValidateHeader() const
+{
+  const SizeValueType fileSize = m_MappedFile->GetSize();
+
+  if ( fileSize < sizeof( NativeMeshFileHeader )
+       || std::memcmp( m_Header.Magic, NativeMeshFile::GetMagic(), sizeof( m_Header.Magic ) ) != 0 )
+    {
+    itkExceptionMacro(<< m_FileName << " is not a native mesh file");
+    }
+  if ( m_Header.Version != NativeMeshFile::GetVersion() )
+    {
+    itkExceptionMacro(<< m_FileName << " has unsupported version " << m_Header.Version);
+    }
+  if ( m_Header.ByteOrderMark != NativeMeshFile::GetByteOrderMark() )
+    {
+    itkExceptionMacro(<< m_FileName << " was written on a host with a different byte order");
+    }
+  if ( m_Header.PointDimension != PointDimension )
+    {
+    itkExceptionMacro(<< m_FileName << " has point dimension " << m_Header.PointDimension
+                      << ", expected " << PointDimension);
+    }
+
+  const uint64_t pointsEnd = m_Header.PointsOffset + m_Header.NumberOfPoints * PointDimension * sizeof( double );
+  const uint64_t trianglesEnd = m_Header.TrianglesOffset + m_Header.NumberOfTriangles * 3 * sizeof( uint32_t );
+  const uint64_t attributesEnd = m_Header.AttributesOffset
+                                 + m_Header.NumberOfPoints * m_Header.NumberOfAttributeComponents * sizeof( float );
+  if ( m_Header.FileSize != fileSize || pointsEnd > m_Header.TrianglesOffset
+       || trianglesEnd > m_Header.AttributesOffset || attributesEnd > fileSize
+       || m_Header.PointsOffset % NativeMeshFile::GetAlignment() != 0
+       || m_Header.TrianglesOffset % NativeMeshFile::GetAlignment() != 0
+       || m_Header.AttributesOffset % NativeMeshFile::GetAlignment() != 0 )
+    {
+    itkExceptionMacro(<< m_FileName << " is truncated or has an inconsistent layout");
+    }
+
+  if ( m_VerifyHashes )
+    {
+    if ( NativeMeshFile::TopologyHash(m_Header.NumberOfPoints, this->GetTriangleBuffer(),
+                                      m_Header.NumberOfTriangles) != m_Header.TopologyHash )
+      {
+      itkExceptionMacro(<< m_FileName << " failed the topology hash check");
+      }
+    if ( NativeMeshFile::CoordinateHash(this->GetPointBuffer(),
+                                        m_Header.NumberOfPoints * PointDimension) != m_Header.CoordinateHash )
+      {
+      itkExceptionMacro(<< m_FileName << " failed the coordinate hash check");
+      }
+    }
+}
+
+template< typename TOutputMesh >
+void
+NativeMeshFileReader< TOutputMesh >
+::GenerateData()
+{
+  if ( m_FileName == "" )
+    {
+    itkExceptionMacro("No input FileName");
+    }
+
+  m_MappedFile->Open(m_FileName);
+  if ( m_MappedFile->GetSize() < sizeof( NativeMeshFileHeader ) )
+    {
+    m_MappedFile->Close();
+    itkExceptionMacro(<< m_FileName << " is not a native mesh file");
+    }
+  std::memcpy( &m_Header, m_MappedFile->GetData(), sizeof( m_Header ) );
+
+  try
+    {
+    this->ValidateHeader();
+    }
+  catch ( ExceptionObject & )
+    {
+    m_MappedFile->Close();
+    throw;
+    }
+
+  if ( !m_GenerateOutputMesh )
+    {
+    return;
+    }
+
+  typename OutputMeshType::Pointer outputMesh = this->GetOutput();
+
+  const SizeValueType numberOfPoints = m_Header.NumberOfPoints;
+  const double *      points = this->GetPointBuffer();
+
+  typename PointsContainer::Pointer pointsContainer = PointsContainer::New();
+  pointsContainer->Reserve(numberOfPoints);
+  for ( SizeValueType i = 0; i < numberOfPoints; ++i )
+    {
+    PointType point;
+    for ( unsigned int d = 0; d < PointDimension; ++d )
+      {
+      point[d] = points[i * PointDimension + d];
+      }
+    pointsContainer->SetElement(i, point);
+    }
+  outputMesh->SetPoints(pointsContainer);
+
+  const SizeValueType numberOfTriangles = m_Header.NumberOfTriangles;
+  const uint32_t *    triangles = this->GetTriangleBuffer();
+
+  outputMesh->SetCells( CellsContainer::New() );
+  for ( SizeValueType i = 0; i < numberOfTriangles; ++i )
+    {
+    CellAutoPointer cell;
+    cell.TakeOwnership(new TriangleCellType);
+    for ( unsigned int k = 0; k < 3; ++k )
+      {
+      cell->SetPointId(k, triangles[3 * i + k]);
+      }
+    outputMesh->SetCell(i, cell);
+    }
+}
+
+template< typename TOutputMesh >
+void
+NativeMeshFileReader< TOutputMesh >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+
+  os << indent << "FileName: " << m_FileName << std::endl;
+  os << indent << "GenerateOutputMesh: " << m_GenerateOutputMesh << std::endl;
+  os << indent << "VerifyHashes: " << m_VerifyHashes << std::endl;
+  os << indent << "NumberOfPoints: " << m_Header.NumberOfPoints << std::endl;
+  os << indent << "NumberOfTriangles: " << m_Header.NumberOfTriangles << std::endl;
+}
+} // end namespace itk
+
+#endif
@@ -0,0 +1,98 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkNativeMeshFileWriter_h
+#define itkNativeMeshFileWriter_h
+
+#include "itkObject.h"
+#include "itkNativeMeshFileFormat.h"
+#include <string>
+
+namespace itk
+{
+/** \class NativeMeshFileWriter
+ * \brief Writes the points and triangles of a mesh in the native ".tsdm" format.
+ *
+ * See NativeMeshFileHeader for the layout. Only triangle cells are stored.
+ * Optional per-vertex attributes (e.g. curvature) can be attached as a
+ * caller owned array of floats, NumberOfPoints * components long.
+ *
+ * \sa NativeMeshFileReader
+ */
+template< typename TInputMesh >
+class ITK_TEMPLATE_EXPORT NativeMeshFileWriter:public Object
+{
+public:
+  /** Standard "Self" typedef. */
+  typedef NativeMeshFileWriter       Self;
+  typedef Object                     Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(NativeMeshFileWriter, Object);
+
+  /** Hold on to the type information specified by the template parameters. */
+  typedef TInputMesh                           InputMeshType;
+  typedef typename InputMeshType::ConstPointer InputMeshConstPointer;
+  typedef typename InputMeshType::CellType     CellType;
+
+  itkStaticConstMacro(PointDimension, unsigned int, TInputMesh::PointDimension);
+
+  /** Set/Get the input mesh to be written. */
+  void SetInput(const InputMeshType *input);
+  const InputMeshType * GetInput() const;
+
+  /** Set/Get the filename. */
+  itkSetStringMacro(FileName);
+  itkGetStringMacro(FileName);
+
+  /** Attach per-vertex attributes. The array is not copied and must stay
+   *  valid until Write() returns. Pass a null pointer to write none. */
+  void SetPointAttributes(const float *attributes, unsigned int numberOfComponents);
+
+  /** Invoke the writer. */
+  void Update();
+  void Write();
+
+protected:
+  NativeMeshFileWriter();
+  virtual ~NativeMeshFileWriter() {}
+
+  void GenerateData();
+
+  void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+  InputMeshConstPointer m_Input;
+  std::string           m_FileName;
+
+  const float *m_PointAttributes;
+  unsigned int m_NumberOfAttributeComponents;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(NativeMeshFileWriter);
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkNativeMeshFileWriter.hxx"
+#endif
+
+#endif
@@ -0,0 +1,201 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkNativeMeshFileWriter_hxx
+#define itkNativeMeshFileWriter_hxx
+
+#include "itkNativeMeshFileWriter.h"
+#include <fstream>
+#include <vector>
+
+namespace itk
+{
+template< typename TInputMesh >
+NativeMeshFileWriter< TInputMesh >
+::NativeMeshFileWriter()
+{
+  m_Input = ITK_NULLPTR;
+  m_FileName = "";
+  m_PointAttributes = ITK_NULLPTR;
+  m_NumberOfAttributeComponents = 0;
+}
+
+template< typename TInputMesh >
+void
+NativeMeshFileWriter< TInputMesh >
+::SetInput(const InputMeshType *input)
+{
+  m_Input = input;
+}
+
+template< typename TInputMesh >
+const typename NativeMeshFileWriter< TInputMesh >::InputMeshType *
+NativeMeshFileWriter< TInputMesh >
+::GetInput() const
+{
+  return m_Input.GetPointer();
+}
+
+template< typename TInputMesh >
+void
+NativeMeshFileWriter< TInputMesh >
+::SetPointAttributes(const float *attributes, unsigned int numberOfComponents)
+{
+  m_PointAttributes = attributes;
+  m_NumberOfAttributeComponents = attributes ? numberOfComponents : 0;
+  this->Modified();
+}
+
+template< typename TInputMesh >
+void
+NativeMeshFileWriter< TInputMesh >
+::Write()
+{
+  this->GenerateData();
+}
+
+template< typename TInputMesh >
+void
+NativeMeshFileWriter< TInputMesh >
+::Update()
+{
+  this->GenerateData();
+}
+
+template< typename TInputMesh >
+void
+NativeMeshFileWriter< TInputMesh >
+::GenerateData()
+{
+  if ( m_FileName == "" )
+    {
+    itkExceptionMacro("No FileName");
+    }
+
+  if ( !m_Input )
+    {
+    itkExceptionMacro("No input mesh");
+    }
+
+  // Pack the arrays first: both hashes have to be known before the header
+  // can be written.
+  const SizeValueType numberOfPoints = m_Input->GetNumberOfPoints();
+
+  std::vector< double > points;
+  points.reserve(numberOfPoints * PointDimension);
+  for ( typename InputMeshType::PointsContainer::ConstIterator it = m_Input->GetPoints()->Begin();
+        it != m_Input->GetPoints()->End(); ++it )
+    {
+    for ( unsigned int d = 0; d < PointDimension; ++d )
+      {
+      points.push_back( static_cast< double >( it.Value()[d] ) );
+      }
+    }
+
+  std::vector< uint32_t > triangles;
+  if ( m_Input->GetCells() )
+    {
+    triangles.reserve(m_Input->GetNumberOfCells() * 3);
+    for ( typename InputMeshType::CellsContainer::ConstIterator it = m_Input->GetCells()->Begin();
+          it != m_Input->GetCells()->End(); ++it )
+      {
+      const CellType *cell = it.Value();
+      if ( cell->GetType() != CellType::TRIANGLE_CELL )
+        {
+        continue;
+        }
+      for ( typename CellType::PointIdConstIterator pit = cell->PointIdsBegin();
+            pit != cell->PointIdsEnd(); ++pit )
+        {
+        if ( *pit >= numberOfPoints )
+          {
+          itkExceptionMacro("Cell " << it.Index() << " references point " << *pit
+                                    << " outside of the point container");
+          }
+        triangles.push_back( static_cast< uint32_t >( *pit ) );
+        }
+      }
+    }
+  const SizeValueType numberOfTriangles = triangles.size() / 3;
+
+  NativeMeshFileHeader header;
+  std::memset( &header, 0, sizeof( header ) );
+  std::memcpy( header.Magic, NativeMeshFile::GetMagic(), sizeof( header.Magic ) );
+  header.Version = NativeMeshFile::GetVersion();
+  header.ByteOrderMark = NativeMeshFile::GetByteOrderMark();
+  header.PointDimension = PointDimension;
+  header.NumberOfAttributeComponents = m_NumberOfAttributeComponents;
+  header.NumberOfPoints = numberOfPoints;
+  header.NumberOfTriangles = numberOfTriangles;
+  header.PointsOffset = NativeMeshFile::Align( sizeof( header ) );
+  header.TrianglesOffset = NativeMeshFile::Align( header.PointsOffset + points.size() * sizeof( double ) );
+  header.AttributesOffset = NativeMeshFile::Align( header.TrianglesOffset + triangles.size() * sizeof( uint32_t ) );
+  header.FileSize = header.AttributesOffset
+                    + static_cast< uint64_t >( numberOfPoints ) * m_NumberOfAttributeComponents * sizeof( float );
+  header.TopologyHash = NativeMeshFile::TopologyHash( numberOfPoints,
+                                                      triangles.empty() ? ITK_NULLPTR : &triangles[0],
+                                                      numberOfTriangles );
+  header.CoordinateHash = NativeMeshFile::CoordinateHash( points.empty() ? ITK_NULLPTR : &points[0],
+                                                          points.size() );
+
+  std::ofstream outputFile( m_FileName.c_str(), std::ios::out | std::ios::binary );
+  if ( !outputFile.is_open() )
+    {
+    itkExceptionMacro("Unable to open file\n"
+                      "outputFilename= " << m_FileName);
+    }
+
+  const char padding[64] = { 0 };
+  outputFile.write( reinterpret_cast< const char * >( &header ), sizeof( header ) );
+  outputFile.write( padding, header.PointsOffset - sizeof( header ) );
+  if ( !points.empty() )
+    {
+    outputFile.write( reinterpret_cast< const char * >( &points[0] ), points.size() * sizeof( double ) );
+    }
+  outputFile.write( padding, header.TrianglesOffset - header.PointsOffset - points.size() * sizeof( double ) );
+  if ( !triangles.empty() )
+    {
+    outputFile.write( reinterpret_cast< const char * >( &triangles[0] ), triangles.size() * sizeof( uint32_t ) );
+    }
+  outputFile.write( padding, header.AttributesOffset - header.TrianglesOffset - triangles.size() * sizeof( uint32_t ) );
+  if ( m_NumberOfAttributeComponents > 0 )
+    {
+    outputFile.write( reinterpret_cast< const char * >( m_PointAttributes ),
+                      header.FileSize - header.AttributesOffset );
+    }
+
+  if ( !outputFile )
+    {
+    itkExceptionMacro("Error while writing file\n"
+                      "outputFilename= " << m_FileName);
+    }
+  outputFile.close();
+}
+
+template< typename TInputMesh >
+void
+NativeMeshFileWriter< TInputMesh >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+
+  os << indent << "FileName: " << m_FileName << std::endl;
+  os << indent << "NumberOfAttributeComponents: " << m_NumberOfAttributeComponents << std::endl;
+}
+} // end namespace itk
+
+#endif
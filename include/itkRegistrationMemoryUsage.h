@@ -0,0 +1,132 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkRegistrationMemoryUsage_h
+#define itkRegistrationMemoryUsage_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkIntTypes.h"
+#include "ExternalTemplateExport.h"
+
+namespace itk
+{
+/** \class RegistrationMemoryUsage
+ * \brief Bytes held by each structure of a registration, and their peak.
+ *
+ * MeshToMeshRegistrationMethod fills one of these during Update(): the
+ * metric reports the packed points, target positions, neighborhoods and
+ * spatial index it owns (buffers supplied by the caller are not counted),
+ * the registration method the transform parameters, an estimate of the
+ * optimizer workspace and the meshes themselves. The peak
+ * is the largest total seen while the components were set, so it covers
+ * structures released before the end of the run.
+ *
+ * Estimate() predicts the same table from the mesh sizes alone, so that a
+ * scheduler can size a job before loading anything. The entries of the
+ * metric match GetMemoryUsage() after Update() when the metric copies the
+ * meshes, builds its own spatial index and was given the same precision
+ * and number of evaluation workspaces; caller supplied buffers make the
+ * actual entries smaller. The mesh entry approximates the heap overhead of
+ * the mesh containers, and the optimizer entry the vnl workspace.
+ *
+ */
+class ExternalTemplate_EXPORT RegistrationMemoryUsage:public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef RegistrationMemoryUsage    Self;
+  typedef Object                     Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(RegistrationMemoryUsage, Object);
+
+  typedef enum {
+    FixedPointsComponent = 0,
+    MovingPointsComponent,
+    TargetPositionsComponent,
+    NeighborhoodsComponent,
+    SpatialIndexComponent,
+    ParametersComponent,
+    OptimizerWorkspaceComponent,
+    MeshesComponent,
+    NumberOfComponents
+    } ComponentType;
+
+  static const char * GetComponentName(ComponentType component);
+
+  /** Set the bytes currently held by a component. Updates the peak. */
+  void SetBytes(ComponentType component, uint64_t bytes);
+  uint64_t GetBytes(ComponentType component) const;
+
+  /** Sum over all components. */
+  uint64_t GetTotalBytes() const;
+
+  /** Largest total since the last Reset(). */
+  itkGetConstMacro(PeakBytes, uint64_t);
+
+  /** Clear all components and the peak. */
+  void Reset();
+
+  /** Peak resident set size of the whole process, zero where unknown.
+   *  Includes everything else the process holds. */
+  static uint64_t GetProcessPeakResidentBytes();
+
+  /** Fill usage with the predicted footprint of registering a moving mesh
+   *  of the given size to a fixed mesh, using a ThinShellDemonsMetric and a
+   *  conjugate gradient optimizer. bytesPerCoordinate is the size of the
+   *  PrecisionType of the metric, in which the moving points and target
+   *  positions are stored. Each evaluation workspace holds the laplacians
+   *  of the moving points; the metric creates one at Initialize() and one
+   *  more for each further evaluation running at the same time (see
+   *  ThinShellDemonsMetric::GetNumberOfEvaluationWorkspaces()). The peak
+   *  is the predicted total. */
+  static void Estimate(SizeValueType numberOfFixedPoints, SizeValueType numberOfFixedTriangles,
+                       SizeValueType numberOfMovingPoints, SizeValueType numberOfMovingTriangles,
+                       Self *usage, SizeValueType bytesPerCoordinate = sizeof( double ),
+                       SizeValueType numberOfWorkspaces = 1);
+
+  /** Rough bytes held by a mesh with triangle cells in the default ITK
+   *  containers, including per-cell heap allocations. */
+  static uint64_t EstimateMeshBytes(SizeValueType numberOfPoints, SizeValueType numberOfTriangles);
+
+  /** Bytes of the optimizer workspace for the given number of parameters. */
+  static uint64_t EstimateOptimizerBytes(SizeValueType numberOfParameters);
+
+  /** Print one line per component, the total and the peak. */
+  void Report(std::ostream & os = std::cout) const;
+
+protected:
+  RegistrationMemoryUsage();
+  virtual ~RegistrationMemoryUsage() {}
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(RegistrationMemoryUsage);
+
+  uint64_t m_Bytes[NumberOfComponents];
+  uint64_t m_PeakBytes;
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,215 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkRegistrationProfiler_h
+#define itkRegistrationProfiler_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkEventObject.h"
+#include "itkIntTypes.h"
+#include "itkHardwareCounters.h"
+#include "itkRealTimeClock.h"
+#include "itkRegistrationTracer.h"
+#include "itkSimpleFastMutexLock.h"
+#include "ExternalTemplateExport.h"
+
+namespace itk
+{
+/** Invoked by a RegistrationProfiler when its counters are complete, e.g.
+ *  at the end of MeshToMeshRegistrationMethod::Update(). The caller is the
+ *  profiler. */
+itkEventMacro(ProfileReportEvent, AnyEvent);
+
+/** \class RegistrationProfiler
+ * \brief Wall time, call counts and bytes touched per registration phase.
+ *
+ * Attach a profiler to a MeshToMeshRegistrationMethod (which hands it on to
+ * its metric) or directly to a metric with SetProfiler(). Each phase keeps
+ * the number of calls, the total, minimum and maximum wall time and an
+ * estimate of the bytes read and written. Read the counters after Update()
+ * or observe ProfileReportEvent.
+ *
+ * With a RegistrationTracer attached, every recorded phase is also traced
+ * as an event on the calling thread. With HardwareCounters attached, the
+ * phases also accumulate cycles, instructions, cache misses and branch
+ * misses, which tell memory bound phases from compute bound ones. The
+ * counts cover the thread that opened them and the workers of the global
+ * WorkerPool that run the parallel parts of the metric.
+ *
+ * Without a profiler the instrumented code only tests a null pointer: no
+ * clock is read and nothing is counted. Phases may be recorded from
+ * several threads at once.
+ *
+ */
+class ExternalTemplate_EXPORT RegistrationProfiler:public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef RegistrationProfiler       Self;
+  typedef Object                     Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(RegistrationProfiler, Object);
+
+  typedef enum {
+    RegistrationInitializePhase = 0,
+    MetricInitializePhase,
+    CorrespondencePhase,
+    NeighborhoodPhase,
+    GetValuePhase,
+    GetDerivativePhase,
+    OptimizationPhase,
+    UpdateMovingMeshPhase,
+    NumberOfPhases
+    } PhaseType;
+
+  struct PhaseStatistics
+    {
+    SizeValueType NumberOfCalls;
+    double        TotalTime;
+    double        MinimumTime;
+    double        MaximumTime;
+    uint64_t      Bytes;
+    // hardware counter totals over the calls that could be counted
+    SizeValueType NumberOfCountedCalls;
+    uint64_t      Counters[HardwareCounters::NumberOfCounters];
+    };
+
+  static const char * GetPhaseName(PhaseType phase);
+
+  /** Counters of one phase. Times are in seconds. */
+  PhaseStatistics GetPhaseStatistics(PhaseType phase) const;
+
+  SizeValueType GetNumberOfCalls(PhaseType phase) const { return this->GetPhaseStatistics(phase).NumberOfCalls; }
+  double GetTotalTime(PhaseType phase) const { return this->GetPhaseStatistics(phase).TotalTime; }
+  uint64_t GetBytes(PhaseType phase) const { return this->GetPhaseStatistics(phase).Bytes; }
+
+  /** Time spent in the optimizer itself: the optimization phase minus the
+   *  metric evaluations it made. */
+  double GetOptimizerOverhead() const;
+
+  /** Record one call of a phase. */
+  void AddSample(PhaseType phase, double seconds, uint64_t bytes);
+
+  /** Read the hardware counters at the start of a phase. Returns false if
+   *  none are attached or the calling thread is not the one they count. */
+  bool BeginCounting(HardwareCounters::CountersType & counters) const;
+
+  /** Record a call of a phase that started at start (see GetTime()) and
+   *  ends now, and trace it if a tracer is attached. startCounters, if not
+   *  null, are the counters read by BeginCounting(). */
+  void EndPhase(PhaseType phase, double start, uint64_t bytes,
+                const HardwareCounters::CountersType *startCounters = ITK_NULLPTR);
+
+  /** Set/Get hardware counters to read around every phase recorded on the
+   *  thread that opened them, e.g.
+   *
+   * \code
+   * HardwareCounters::Pointer counters = HardwareCounters::New();
+   * if ( counters->Open() )
+   *   {
+   *   profiler->SetHardwareCounters(counters);
+   *   }
+   * \endcode
+   */
+  itkSetObjectMacro(HardwareCounters, HardwareCounters);
+  itkGetModifiableObjectMacro(HardwareCounters, HardwareCounters);
+
+  /** Set/Get a tracer receiving every recorded phase as an event. */
+  itkSetObjectMacro(Tracer, RegistrationTracer);
+  itkGetModifiableObjectMacro(Tracer, RegistrationTracer);
+
+  /** Clear all counters. */
+  void Reset();
+
+  /** Invoke ProfileReportEvent. */
+  void Publish();
+
+  /** Print a table of all phases with at least one call. */
+  void Report(std::ostream & os = std::cout) const;
+
+  /** Seconds on the profiler's clock. */
+  double GetTime() const { return m_Clock->GetTimeInSeconds(); }
+
+  /** Records the lifetime of a block as one call of a phase. Does nothing
+   *  when constructed with a null profiler.
+   *
+   * \code
+   * RegistrationProfiler::Scope scope(m_Profiler.GetPointer(), RegistrationProfiler::GetValuePhase, bytes);
+   * \endcode
+   */
+  class Scope
+  {
+  public:
+    Scope(RegistrationProfiler *profiler, PhaseType phase, uint64_t bytes = 0) :
+      m_Profiler( profiler ), m_Phase( phase ), m_Bytes( bytes ), m_Start( 0.0 ), m_Counting( false )
+    {
+      if ( m_Profiler )
+        {
+        m_Counting = m_Profiler->BeginCounting(m_StartCounters);
+        m_Start = m_Profiler->GetTime();
+        }
+    }
+
+    ~Scope()
+    {
+      if ( m_Profiler )
+        {
+        m_Profiler->EndPhase(m_Phase, m_Start, m_Bytes, m_Counting ? &m_StartCounters : ITK_NULLPTR);
+        }
+    }
+
+    /** Set the bytes recorded, when known only at the end of the block. */
+    void SetBytes(uint64_t bytes) { m_Bytes = bytes; }
+
+  private:
+    Scope(const Scope &);          // purposely not implemented
+    void operator=(const Scope &); // purposely not implemented
+
+    RegistrationProfiler *m_Profiler;
+    PhaseType             m_Phase;
+    uint64_t              m_Bytes;
+    double                m_Start;
+    bool                  m_Counting;
+
+    HardwareCounters::CountersType m_StartCounters;
+  };
+
+protected:
+  RegistrationProfiler();
+  virtual ~RegistrationProfiler() {}
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(RegistrationProfiler);
+
+  RealTimeClock::Pointer      m_Clock;
+  RegistrationTracer::Pointer m_Tracer;
+  HardwareCounters::Pointer   m_HardwareCounters;
+  PhaseStatistics             m_Phases[NumberOfPhases];
+  mutable SimpleFastMutexLock m_Mutex;
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,175 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkRegistrationTracer_h
+#define itkRegistrationTracer_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkAtomicInt.h"
+#include "itkIntTypes.h"
+#include "itkNumericTraits.h"
+#include "itkRealTimeClock.h"
+#include "ExternalTemplateExport.h"
+#include <string>
+#include <vector>
+
+namespace itk
+{
+/** \class RegistrationTracer
+ * \brief Records timed events per thread and writes them as a Chrome trace.
+ *
+ * Each thread appends to its own fixed size buffer, so recording takes no
+ * lock and threads never wait for each other. A thread claims its buffer on
+ * its first event; a full buffer drops further events and counts them.
+ * Buffer slots are numbered per process. On POSIX systems the slot of a
+ * thread that exits goes to the next new thread, so one track of the trace
+ * may show several threads one after the other. Events of threads beyond
+ * MaximumNumberOfThreads alive at once are dropped and counted as well.
+ * Event names and categories are not copied and must be string literals.
+ *
+ * After the run, WriteChromeTrace() writes the events in the Trace Event
+ * JSON format understood by chrome://tracing and Perfetto, one track per
+ * thread. Writing and Clear() must not overlap with recording.
+ *
+ * Registration phases are traced by attaching the tracer to a
+ * RegistrationProfiler; MeshToMeshBatchRegistration traces its reader,
+ * worker and writer tasks directly.
+ *
+ */
+class ExternalTemplate_EXPORT RegistrationTracer:public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef RegistrationTracer         Self;
+  typedef Object                     Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(RegistrationTracer, Object);
+
+  /** Threads beyond this many (alive at once, per process) are not
+   *  traced; see GetNumberOfDroppedEvents(). */
+  itkStaticConstMacro(MaximumNumberOfThreads, unsigned int, 256);
+
+  /** Set/Get the capacity of each thread's buffer. Takes effect for
+   *  buffers claimed after the call. Default 65536 events. */
+  itkSetClampMacro(EventsPerThread, SizeValueType, 1, NumericTraits< SizeValueType >::max());
+  itkGetConstMacro(EventsPerThread, SizeValueType);
+
+  /** Seconds on the tracer's clock. */
+  double GetTime() const { return m_Clock->GetTimeInSeconds(); }
+
+  /** Record an event that started at start (seconds, see GetTime()) and
+   *  lasted duration seconds. argument is shown with the event when not
+   *  negative, e.g. a case or iteration number. */
+  void AddCompleteEvent(const char *name, const char *category, double start, double duration,
+                        int64_t argument = -1);
+
+  /** Record a point in time. */
+  void AddInstantEvent(const char *name, const char *category, int64_t argument = -1);
+
+  /** Events recorded and dropped so far, over all threads. The dropped
+   *  events include those of threads that got no buffer. */
+  SizeValueType GetNumberOfEvents() const;
+  SizeValueType GetNumberOfDroppedEvents() const;
+
+  /** Forget all events. */
+  void Clear();
+
+  /** Write all events as Chrome trace JSON. */
+  void WriteChromeTrace(std::ostream & os) const;
+  void WriteChromeTrace(const std::string & fileName) const;
+
+  /** Records the lifetime of a block as a complete event. Does nothing
+   *  when constructed with a null tracer. */
+  class Scope
+  {
+  public:
+    Scope(RegistrationTracer *tracer, const char *name, const char *category, int64_t argument = -1) :
+      m_Tracer( tracer ), m_Name( name ), m_Category( category ), m_Argument( argument ), m_Start( 0.0 )
+    {
+      if ( m_Tracer )
+        {
+        m_Start = m_Tracer->GetTime();
+        }
+    }
+
+    ~Scope()
+    {
+      if ( m_Tracer )
+        {
+        m_Tracer->AddCompleteEvent(m_Name, m_Category, m_Start, m_Tracer->GetTime() - m_Start, m_Argument);
+        }
+    }
+
+  private:
+    Scope(const Scope &);          // purposely not implemented
+    void operator=(const Scope &); // purposely not implemented
+
+    RegistrationTracer *m_Tracer;
+    const char *        m_Name;
+    const char *        m_Category;
+    int64_t             m_Argument;
+    double              m_Start;
+  };
+
+protected:
+  RegistrationTracer();
+  virtual ~RegistrationTracer();
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(RegistrationTracer);
+
+  struct EventType
+    {
+    const char *Name;
+    const char *Category;
+    double      Start;
+    double      Duration; // negative for instant events
+    int64_t     Argument;
+    };
+
+  struct ThreadBufferType
+    {
+    std::vector< EventType > Events;
+    SizeValueType            Dropped;
+    };
+
+  /** The calling thread's buffer, claimed on first use; null if the
+   *  thread is beyond MaximumNumberOfThreads. */
+  ThreadBufferType * GetThreadBuffer();
+
+  static int GetThreadNumber();
+
+  RealTimeClock::Pointer m_Clock;
+  double                 m_Origin;
+  SizeValueType          m_EventsPerThread;
+  ThreadBufferType *     m_Buffers[MaximumNumberOfThreads];
+
+  // events of threads without a buffer slot
+  AtomicInt< int64_t > m_NumberOfUntracedEvents;
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,174 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkSharedTemplateCache_h
+#define itkSharedTemplateCache_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkIntTypes.h"
+#include "itkFlatPointLocator.h"
+#include "ExternalTemplateExport.h"
+#include <string>
+#include <vector>
+
+namespace itk
+{
+/** \class SharedTemplateCache
+ * \brief Shares a template mesh and its derived structures between processes.
+ *
+ * Worker processes on one node usually register against the same fixed
+ * templates. The first process to Publish() a template copies its points
+ * and triangles into a POSIX shared memory segment named after the
+ * template's content hash, together with the vertex neighborhoods
+ * (TriangleVertexNeighborhood) and the spatial index (FlatPointLocator).
+ * Later processes Attach() to the segment read-only and use the arrays in
+ * place, so a node holds one copy of each template and only the first
+ * process pays for building the neighborhoods and the index.
+ *
+ * Typical use, with the hashes taken from a NativeMeshFileReader:
+ *
+ * \code
+ * cache->SetTopologyHash( reader->GetTopologyHash() );
+ * cache->SetCoordinateHash( reader->GetCoordinateHash() );
+ * if ( !cache->Attach() )
+ *   {
+ *   cache->Publish( reader->GetPointBuffer(), reader->GetNumberOfPoints(),
+ *                   reader->GetTriangleBuffer(), reader->GetNumberOfTriangles() );
+ *   }
+ * metric->SetFixedPointBuffer( cache->GetPointBuffer(), cache->GetNumberOfPoints() );
+ * metric->SetFixedPointLocator( cache->GetPointLocator() );
+ * \endcode
+ *
+ * Segments outlive the processes; remove them with Unlink() when a
+ * template is retired, or let the publisher remove its segment when it
+ * detaches with UnlinkOnDetach. A publisher holds an exclusive flock() on
+ * the segment until it is complete, so a segment left incomplete by a
+ * process that died while publishing is detected by Attach() and Publish()
+ * and removed, instead of blocking the template until someone unlinks
+ * it. On platforms without POSIX shared memory Attach() always fails and
+ * Publish() keeps a private copy, so the calling code does not change.
+ *
+ */
+class ExternalTemplate_EXPORT SharedTemplateCache:public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef SharedTemplateCache        Self;
+  typedef Object                     Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(SharedTemplateCache, Object);
+
+  /** Set/Get the hashes identifying the template, see NativeMeshFile.
+   *  Publish() computes them from the arrays when left at zero. */
+  itkSetMacro(TopologyHash, uint64_t);
+  itkGetConstMacro(TopologyHash, uint64_t);
+  itkSetMacro(CoordinateHash, uint64_t);
+  itkGetConstMacro(CoordinateHash, uint64_t);
+
+  /** Set/Get how long Attach() waits, in seconds, for a segment another
+   *  process is still publishing. */
+  itkSetMacro(AttachTimeout, double);
+  itkGetConstMacro(AttachTimeout, double);
+
+  /** Set/Get whether the segment is removed when the process that
+   *  published it detaches, including on destruction. Attached processes
+   *  keep their mapping. Off by default, so that later processes can
+   *  attach. */
+  itkSetMacro(UnlinkOnDetach, bool);
+  itkGetConstMacro(UnlinkOnDetach, bool);
+  itkBooleanMacro(UnlinkOnDetach);
+
+  /** Attach read-only to the published segment of the template identified
+   *  by the hashes. Returns false if no process has published it, or if
+   *  its publisher died before completing it; that segment is removed. */
+  bool Attach();
+
+  /** Publish the template. If another process publishes the same template
+   *  concurrently, attaches to its segment instead. The arrays are copied. */
+  void Publish(const double *points, SizeValueType numberOfPoints,
+               const uint32_t *triangles, SizeValueType numberOfTriangles);
+
+  /** Detach from the segment, or release the private copy. */
+  void Detach();
+
+  /** Remove the segment of the current template from the system. Processes
+   *  attached to it keep their mapping. */
+  void Unlink();
+
+  /** True after Publish() created the segment in this process. */
+  itkGetConstMacro(IsPublisher, bool);
+
+  /** Name of the segment for the current hashes. */
+  std::string GetSegmentName() const;
+
+  /** The shared arrays, valid while attached. */
+  SizeValueType GetNumberOfPoints() const { return m_NumberOfPoints; }
+  SizeValueType GetNumberOfTriangles() const { return m_NumberOfTriangles; }
+  const double * GetPointBuffer() const { return m_Points; }
+  const uint32_t * GetTriangleBuffer() const { return m_Triangles; }
+  const SizeValueType * GetNeighborOffsetBuffer() const { return m_NeighborOffsets; }
+  const uint32_t * GetNeighborBuffer() const { return m_Neighbors; }
+
+  /** Spatial index over the shared points, backed by the segment. */
+  FlatPointLocator * GetPointLocator() const { return m_PointLocator.GetPointer(); }
+
+  /** Size of the segment in bytes. */
+  SizeValueType GetSizeInBytes() const { return m_Size; }
+
+protected:
+  SharedTemplateCache();
+  virtual ~SharedTemplateCache();
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(SharedTemplateCache);
+
+  void Fill(char *segment, const double *points, SizeValueType numberOfPoints,
+            const uint32_t *triangles, SizeValueType numberOfTriangles, SizeValueType size) const;
+  SizeValueType ComputeSize(SizeValueType numberOfPoints, SizeValueType numberOfTriangles) const;
+  bool SetViews(const char *segment, SizeValueType size);
+
+  uint64_t m_TopologyHash;
+  uint64_t m_CoordinateHash;
+  double   m_AttachTimeout;
+  bool     m_UnlinkOnDetach;
+  bool     m_IsPublisher;
+
+  const void *        m_Segment;
+  SizeValueType       m_Size;
+  std::vector< char > m_PrivateCopy;
+
+  SizeValueType         m_NumberOfPoints;
+  SizeValueType         m_NumberOfTriangles;
+  const double *        m_Points;
+  const uint32_t *      m_Triangles;
+  const SizeValueType * m_NeighborOffsets;
+  const uint32_t *      m_Neighbors;
+
+  FlatPointLocator::Pointer m_PointLocator;
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,236 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkSpeculativeLineSearchOptimizer_h
+#define itkSpeculativeLineSearchOptimizer_h
+
+#include "itkSingleValuedNonLinearOptimizer.h"
+#include "itkIntTypes.h"
+#include "itkNumericTraits.h"
+#include "itkWorkerPool.h"
+#include "ExternalTemplateExport.h"
+#include <string>
+#include <vector>
+
+namespace itk
+{
+/** \class SpeculativeLineSearchOptimizer
+ * \brief Nonlinear conjugate gradient descent whose line search evaluates
+ * several step lengths at once.
+ *
+ * Every iteration searches along a Polak-Ribiere conjugate direction of
+ * the gradient divided by the scales. Instead of trying one step length
+ * after the other, the line search evaluates NumberOfCandidates steps
+ * spread geometrically by StepLengthRatio around a guess, all at the same
+ * time on a WorkerPool, and takes the one with the lowest value among
+ * those that satisfy the strong Wolfe conditions
+ *
+ *   f(x + a d) <= f(x) + SufficientDecrease a g.d
+ *   |g(x + a d).d| <= CurvatureCondition |g.d|
+ *
+ * When none does, the next round moves the candidates below the smallest
+ * or beyond the largest one, or refines them around the best, for at most
+ * MaximumNumberOfLineSearchRounds rounds. A metric evaluation that cannot
+ * keep a wide node busy on its own thus costs one evaluation of wall time
+ * per round instead of one per trial step.
+ *
+ * The candidates call GetValueAndDerivative() of the cost function from
+ * several threads at once, so it must be safe to call concurrently, as
+ * ThinShellDemonsMetric is. While the candidates run, the pool is busy and
+ * a metric sharing it runs each evaluation on the thread of its candidate.
+ * With UseConcurrentEvaluations off the candidates are evaluated one after
+ * the other; the path of the optimizer is the same either way.
+ *
+ */
+class ExternalTemplate_EXPORT SpeculativeLineSearchOptimizer:public SingleValuedNonLinearOptimizer
+{
+public:
+  /** Standard class typedefs. */
+  typedef SpeculativeLineSearchOptimizer Self;
+  typedef SingleValuedNonLinearOptimizer Superclass;
+  typedef SmartPointer< Self >           Pointer;
+  typedef SmartPointer< const Self >     ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(SpeculativeLineSearchOptimizer, SingleValuedNonLinearOptimizer);
+
+  typedef Superclass::ParametersType ParametersType;
+  typedef Superclass::MeasureType    MeasureType;
+  typedef Superclass::DerivativeType DerivativeType;
+
+  /** Why the last optimization stopped. */
+  typedef enum {
+    Unknown,
+    MaximumNumberOfIterations,
+    GradientMagnitudeTolerance,
+    ValueTolerance,
+    LineSearchFailed,
+    StoppedByUser
+    } StopConditionType;
+
+  /** Start or stop the optimization. */
+  virtual void StartOptimization() ITK_OVERRIDE;
+  void StopOptimization();
+
+  /** Set/Get the largest number of iterations. Defaults to 100. */
+  itkSetMacro(NumberOfIterations, SizeValueType);
+  itkGetConstMacro(NumberOfIterations, SizeValueType);
+
+  /** Set/Get the number of step lengths evaluated at once. 0, the default,
+   *  takes the number of threads of the worker pool, at least 2. */
+  itkSetMacro(NumberOfCandidates, unsigned int);
+  itkGetConstMacro(NumberOfCandidates, unsigned int);
+
+  /** Set/Get the ratio between neighboring candidate steps. Defaults to 2. */
+  itkSetClampMacro(StepLengthRatio, double, 1.0 + 1e-6, NumericTraits< double >::max());
+  itkGetConstMacro(StepLengthRatio, double);
+
+  /** Set/Get how far the first line search reaches: its middle candidate
+   *  moves the parameter with the largest component of the direction by
+   *  this much. Later searches start from the previous step. Defaults to 1. */
+  itkSetMacro(InitialStepLength, double);
+  itkGetConstMacro(InitialStepLength, double);
+
+  /** Set/Get the constants of the sufficient decrease and the curvature
+   *  condition, 0 < SufficientDecrease < CurvatureCondition < 1. Default
+   *  to 1e-4 and 0.1. */
+  itkSetMacro(SufficientDecrease, double);
+  itkGetConstMacro(SufficientDecrease, double);
+  itkSetMacro(CurvatureCondition, double);
+  itkGetConstMacro(CurvatureCondition, double);
+
+  /** Set/Get the largest number of rounds of candidates per line search.
+   *  When no candidate satisfies both conditions by then, the one with
+   *  the lowest value that decreases enough is taken. Defaults to 4. */
+  itkSetClampMacro(MaximumNumberOfLineSearchRounds, unsigned int, 1, NumericTraits< unsigned int >::max());
+  itkGetConstMacro(MaximumNumberOfLineSearchRounds, unsigned int);
+
+  /** Set/Get the gradient magnitude below which the optimization stops.
+   *  Defaults to 1e-6. */
+  itkSetMacro(GradientMagnitudeTolerance, double);
+  itkGetConstMacro(GradientMagnitudeTolerance, double);
+
+  /** Set/Get the decrease of the value, relative to the larger of 1 and
+   *  the value, below which the optimization stops. Defaults to 1e-10. */
+  itkSetMacro(ValueTolerance, double);
+  itkGetConstMacro(ValueTolerance, double);
+
+  /** Set/Get whether the candidates of a round run at the same time.
+   *  Defaults to on. */
+  itkSetMacro(UseConcurrentEvaluations, bool);
+  itkGetConstMacro(UseConcurrentEvaluations, bool);
+  itkBooleanMacro(UseConcurrentEvaluations);
+
+  /** Set/Get the threads that evaluate the candidates. When none is set,
+   *  WorkerPool::GetGlobalPool() is used. */
+  itkSetObjectMacro(WorkerPool, WorkerPool);
+  itkGetModifiableObjectMacro(WorkerPool, WorkerPool);
+
+  /** Value and gradient at the current position. */
+  itkGetConstReferenceMacro(Value, MeasureType);
+  itkGetConstReferenceMacro(Gradient, DerivativeType);
+
+  /** Iterations done, and the step length of the last one. */
+  itkGetConstMacro(CurrentIteration, SizeValueType);
+  itkGetConstMacro(CurrentStepLength, double);
+
+  /** Cost function evaluations and line search rounds of the last
+   *  optimization. */
+  itkGetConstMacro(NumberOfEvaluations, SizeValueType);
+  itkGetConstMacro(NumberOfLineSearchRounds, SizeValueType);
+
+  itkGetConstMacro(StopCondition, StopConditionType);
+  virtual const std::string GetStopConditionDescription() const ITK_OVERRIDE;
+
+protected:
+  SpeculativeLineSearchOptimizer();
+  virtual ~SpeculativeLineSearchOptimizer() {}
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(SpeculativeLineSearchOptimizer);
+
+  SizeValueType       m_NumberOfIterations;
+  unsigned int        m_NumberOfCandidates;
+  double              m_StepLengthRatio;
+  double              m_InitialStepLength;
+  double              m_SufficientDecrease;
+  double              m_CurvatureCondition;
+  unsigned int        m_MaximumNumberOfLineSearchRounds;
+  double              m_GradientMagnitudeTolerance;
+  double              m_ValueTolerance;
+  bool                m_UseConcurrentEvaluations;
+  WorkerPool::Pointer m_WorkerPool;
+
+  MeasureType       m_Value;
+  DerivativeType    m_Gradient;
+  SizeValueType     m_CurrentIteration;
+  double            m_CurrentStepLength;
+  SizeValueType     m_NumberOfEvaluations;
+  SizeValueType     m_NumberOfLineSearchRounds;
+  StopConditionType m_StopCondition;
+  std::string       m_StopConditionDescription;
+  bool              m_Stop;
+
+  // search direction, and the gradient of the last iteration divided by
+  // the scales
+  ParametersType m_Direction;
+  DerivativeType m_PreviousGradient;
+  DerivativeType m_PreviousPreconditioned;
+
+  // the best candidate of the current line search that decreases enough
+  ParametersType m_BestPosition;
+  DerivativeType m_BestDerivative;
+
+  // the candidates of a round: step lengths, positions and results
+  std::vector< double >         m_CandidateSteps;
+  std::vector< ParametersType > m_CandidatePositions;
+  std::vector< MeasureType >    m_CandidateValues;
+  std::vector< DerivativeType > m_CandidateDerivatives;
+  std::vector< std::string >    m_CandidateErrors;
+
+  WorkerPool * GetActiveWorkerPool() const;
+
+  // preconditioned gradient: the gradient divided by the scales
+  void Precondition(const DerivativeType & gradient, DerivativeType & preconditioned) const;
+
+  // update m_Direction for the current gradient, falling back to steepest
+  // descent when the conjugate direction does not descend
+  void ComputeDirection(const DerivativeType & preconditioned);
+
+  // move along m_Direction from the current position, whose directional
+  // derivative is slope, starting with a guess of the step length; false
+  // when no candidate decreased the value enough
+  bool LineSearch(double guess, double slope);
+
+  // evaluate candidates [0, count) at m_CandidateSteps along m_Direction
+  void EvaluateCandidates(unsigned int count);
+
+  struct CandidateStruct
+    {
+    Self *       Optimizer;
+    unsigned int NumberOfCandidates;
+    };
+  static void CandidateJob(void *data, ThreadIdType threadId, ThreadIdType numberOfThreads);
+};
+} // end namespace itk
+
+#endif
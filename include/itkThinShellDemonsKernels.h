@@ -0,0 +1,325 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkThinShellDemonsKernels_h
+#define itkThinShellDemonsKernels_h
+
+#include "itkIntTypes.h"
+
+namespace itk
+{
+/** \class ThinShellDemonsKernels
+ * \brief The inner loops of ThinShellDemonsMetric, on packed arrays.
+ *
+ * Displacements u (the transform parameters) and laplacians are packed xyz
+ * doubles; points and target positions packed xyz values of type TPoint,
+ * float or double, which are widened to double before any arithmetic, so
+ * that float storage only rounds the inputs. Neighborhoods are in the
+ * compressed row form of TriangleVertexNeighborhood. Every kernel handles the
+ * vertices [begin, end), so that the metric can split the work between
+ * threads, and reads nothing it does not write outside of that range
+ * except the displacements and laplacians of neighbors.
+ *
+ * Kept apart from the metric so that they can be benchmarked and checked
+ * against reference implementations on their own.
+ *
+ */
+struct ThinShellDemonsKernels
+{
+  /** Sum over the vertices of |t - (x + u)|^2. */
+  template< typename TPoint >
+  static double DataEnergy(const TPoint *targets, const TPoint *points, const double *u,
+                           SizeValueType begin, SizeValueType end)
+  {
+    double energy = 0.0;
+    for ( SizeValueType i = 3 * begin; i < 3 * end; ++i )
+      {
+      const double r = static_cast< double >( targets[i] ) - ( static_cast< double >( points[i] ) + u[i] );
+      energy += r * r;
+      }
+    return energy;
+  }
+
+  /** Sum over the vertices i and their neighbors j of |u_i - u_j|^2. */
+  static double StretchEnergy(const SizeValueType *offsets, const uint32_t *neighbors, const double *u,
+                              SizeValueType begin, SizeValueType end)
+  {
+    double energy = 0.0;
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      const double *ui = u + 3 * i;
+      for ( SizeValueType n = offsets[i]; n < offsets[i + 1]; ++n )
+        {
+        const double *uj = u + 3 * static_cast< SizeValueType >( neighbors[n] );
+        const double  dx = ui[0] - uj[0];
+        const double  dy = ui[1] - uj[1];
+        const double  dz = ui[2] - uj[2];
+        energy += dx * dx + dy * dy + dz * dz;
+        }
+      }
+    return energy;
+  }
+
+  /** Sum over the vertices i of |sum over the neighbors j of (u_i - u_j)|^2. */
+  static double BendEnergy(const SizeValueType *offsets, const uint32_t *neighbors, const double *u,
+                           SizeValueType begin, SizeValueType end)
+  {
+    double energy = 0.0;
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      double l[3];
+      Laplacian(offsets, neighbors, u, i, l);
+      energy += l[0] * l[0] + l[1] * l[1] + l[2] * l[2];
+      }
+    return energy;
+  }
+
+  /** StretchEnergy() and BendEnergy() in one pass over the neighborhoods. */
+  static void RegularizerEnergy(const SizeValueType *offsets, const uint32_t *neighbors, const double *u,
+                                SizeValueType begin, SizeValueType end, double & stretch, double & bend)
+  {
+    stretch = 0.0;
+    bend = 0.0;
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      const double *ui = u + 3 * i;
+      double        lx = 0.0;
+      double        ly = 0.0;
+      double        lz = 0.0;
+      for ( SizeValueType n = offsets[i]; n < offsets[i + 1]; ++n )
+        {
+        const double *uj = u + 3 * static_cast< SizeValueType >( neighbors[n] );
+        const double  dx = ui[0] - uj[0];
+        const double  dy = ui[1] - uj[1];
+        const double  dz = ui[2] - uj[2];
+        stretch += dx * dx + dy * dy + dz * dz;
+        lx += dx;
+        ly += dy;
+        lz += dz;
+        }
+      bend += lx * lx + ly * ly + lz * lz;
+      }
+  }
+
+  /** Largest number of displacements BatchEnergy() evaluates in one pass. */
+  enum { MaximumBatchSize = 8 };
+
+  /** DataEnergy() and RegularizerEnergy() of count <= MaximumBatchSize
+   *  displacements u[0] ... u[count-1] in one pass: the targets, points and
+   *  neighborhoods, which the evaluations share, are read once, and the
+   *  count accumulators of each term vectorize across the displacements.
+   *  Every sum is accumulated in the order of the single kernels. */
+  template< typename TPoint >
+  static void BatchEnergy(const TPoint *targets, const TPoint *points, const SizeValueType *offsets,
+                          const uint32_t *neighbors, const double * const *u, unsigned int count,
+                          SizeValueType begin, SizeValueType end, double *data, double *stretch, double *bend)
+  {
+    switch ( count )
+      {
+      case 1: BatchEnergy< 1 >(targets, points, offsets, neighbors, u, begin, end, data, stretch, bend); break;
+      case 2: BatchEnergy< 2 >(targets, points, offsets, neighbors, u, begin, end, data, stretch, bend); break;
+      case 3: BatchEnergy< 3 >(targets, points, offsets, neighbors, u, begin, end, data, stretch, bend); break;
+      case 4: BatchEnergy< 4 >(targets, points, offsets, neighbors, u, begin, end, data, stretch, bend); break;
+      case 5: BatchEnergy< 5 >(targets, points, offsets, neighbors, u, begin, end, data, stretch, bend); break;
+      case 6: BatchEnergy< 6 >(targets, points, offsets, neighbors, u, begin, end, data, stretch, bend); break;
+      case 7: BatchEnergy< 7 >(targets, points, offsets, neighbors, u, begin, end, data, stretch, bend); break;
+      case 8: BatchEnergy< 8 >(targets, points, offsets, neighbors, u, begin, end, data, stretch, bend); break;
+      default: break;
+      }
+  }
+
+  // the batch size as a constant, so that the accumulators stay in registers
+  template< unsigned int K, typename TPoint >
+  static void BatchEnergy(const TPoint *targets, const TPoint *points, const SizeValueType *offsets,
+                          const uint32_t *neighbors, const double * const *u,
+                          SizeValueType begin, SizeValueType end, double *data, double *stretch, double *bend)
+  {
+    const double *v[K];
+    double        d[K];
+    double        s[K];
+    double        b[K];
+    for ( unsigned int k = 0; k < K; ++k )
+      {
+      v[k] = u[k];
+      d[k] = 0.0;
+      s[k] = 0.0;
+      b[k] = 0.0;
+      }
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      for ( SizeValueType c = 3 * i; c < 3 * i + 3; ++c )
+        {
+        const double t = static_cast< double >( targets[c] );
+        const double x = static_cast< double >( points[c] );
+        for ( unsigned int k = 0; k < K; ++k )
+          {
+          const double r = t - ( x + v[k][c] );
+          d[k] += r * r;
+          }
+        }
+
+      double ux[K];
+      double uy[K];
+      double uz[K];
+      double lx[K];
+      double ly[K];
+      double lz[K];
+      for ( unsigned int k = 0; k < K; ++k )
+        {
+        ux[k] = v[k][3 * i];
+        uy[k] = v[k][3 * i + 1];
+        uz[k] = v[k][3 * i + 2];
+        lx[k] = 0.0;
+        ly[k] = 0.0;
+        lz[k] = 0.0;
+        }
+      for ( SizeValueType n = offsets[i]; n < offsets[i + 1]; ++n )
+        {
+        const SizeValueType j = 3 * static_cast< SizeValueType >( neighbors[n] );
+        for ( unsigned int k = 0; k < K; ++k )
+          {
+          const double dx = ux[k] - v[k][j];
+          const double dy = uy[k] - v[k][j + 1];
+          const double dz = uz[k] - v[k][j + 2];
+          s[k] += dx * dx + dy * dy + dz * dz;
+          lx[k] += dx;
+          ly[k] += dy;
+          lz[k] += dz;
+          }
+        }
+      for ( unsigned int k = 0; k < K; ++k )
+        {
+        b[k] += lx[k] * lx[k] + ly[k] * ly[k] + lz[k] * lz[k];
+        }
+      }
+    for ( unsigned int k = 0; k < K; ++k )
+      {
+      data[k] = d[k];
+      stretch[k] = s[k];
+      bend[k] = b[k];
+      }
+  }
+
+  /** Laplacian of the displacement at vertex i: sum over its neighbors j of
+   *  u_i - u_j. */
+  static void Laplacian(const SizeValueType *offsets, const uint32_t *neighbors, const double *u,
+                        SizeValueType i, double *laplacian)
+  {
+    const double *ui = u + 3 * i;
+    double        lx = 0.0;
+    double        ly = 0.0;
+    double        lz = 0.0;
+    for ( SizeValueType n = offsets[i]; n < offsets[i + 1]; ++n )
+      {
+      const double *uj = u + 3 * static_cast< SizeValueType >( neighbors[n] );
+      lx += ui[0] - uj[0];
+      ly += ui[1] - uj[1];
+      lz += ui[2] - uj[2];
+      }
+    laplacian[0] = lx;
+    laplacian[1] = ly;
+    laplacian[2] = lz;
+  }
+
+  /** Sparse matrix-vector product with the graph laplacian (degree minus
+   *  adjacency) of the neighborhoods: laplacians = L u on [begin, end). */
+  static void LaplacianProduct(const SizeValueType *offsets, const uint32_t *neighbors, const double *u,
+                               SizeValueType begin, SizeValueType end, double *laplacians)
+  {
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      Laplacian(offsets, neighbors, u, i, laplacians + 3 * i);
+      }
+  }
+
+  /** Derivative of the weighted stretch and bend energies, gathered per
+   *  vertex: from the edges to its neighbors, and from the edges of the
+   *  vertices that have it as a neighbor (the transposed neighborhoods).
+   *  Only the degrees are needed from the own neighborhoods. laplacians
+   *  must hold LaplacianProduct() of every vertex referenced.
+   *  The data term derivative -2 (t - (x + u)) is added first. */
+  template< typename TPoint >
+  static void GatherDerivative(const TPoint *targets, const TPoint *points, const double *u,
+                               const SizeValueType *offsets,
+                               const SizeValueType *reverseOffsets, const uint32_t *reverseNeighbors,
+                               const double *laplacians, double stretchWeight, double bendWeight,
+                               SizeValueType begin, SizeValueType end, double *derivative)
+  {
+    const double s = 2.0 * stretchWeight;
+    const double b = 2.0 * bendWeight;
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      const double *ui = u + 3 * i;
+      const double *li = laplacians + 3 * i;
+      const double  count = static_cast< double >( offsets[i + 1] - offsets[i] );
+
+      // data term, then the own edges, 2 ws (u_i - u_j) + 2 wb L_i each,
+      // which sum to 2 ws L_i + 2 wb |N_i| L_i
+      double gx = -2.0 * ( static_cast< double >( targets[3 * i] ) - points[3 * i] - ui[0] );
+      double gy = -2.0 * ( static_cast< double >( targets[3 * i + 1] ) - points[3 * i + 1] - ui[1] );
+      double gz = -2.0 * ( static_cast< double >( targets[3 * i + 2] ) - points[3 * i + 2] - ui[2] );
+      gx += s * li[0] + count * b * li[0];
+      gy += s * li[1] + count * b * li[1];
+      gz += s * li[2] + count * b * li[2];
+
+      // every edge j -> i: -2 ws (u_j - u_i) - 2 wb L_j
+      for ( SizeValueType n = reverseOffsets[i]; n < reverseOffsets[i + 1]; ++n )
+        {
+        const SizeValueType j = reverseNeighbors[n];
+        const double *      uj = u + 3 * j;
+        const double *      lj = laplacians + 3 * j;
+        gx -= s * ( uj[0] - ui[0] ) + b * lj[0];
+        gy -= s * ( uj[1] - ui[1] ) + b * lj[1];
+        gz -= s * ( uj[2] - ui[2] ) + b * lj[2];
+        }
+
+      derivative[3 * i] = gx;
+      derivative[3 * i + 1] = gy;
+      derivative[3 * i + 2] = gz;
+      }
+  }
+
+  /** Apply the displacement: displaced = x + u on [begin, end). */
+  static void Displace(const double *points, const double *u, SizeValueType begin, SizeValueType end,
+                       double *displaced)
+  {
+    for ( SizeValueType i = 3 * begin; i < 3 * end; ++i )
+      {
+      displaced[i] = points[i] + u[i];
+      }
+  }
+
+  /** Sum of values[0], values[stride] ... values[(count-1)*stride] by a
+   *  balanced binary tree whose shape depends only on count, so that the
+   *  result is the same however the values were computed. */
+  static double PairwiseSum(const double *values, SizeValueType stride, SizeValueType count)
+  {
+    if ( count == 0 )
+      {
+      return 0.0;
+      }
+    if ( count == 1 )
+      {
+      return values[0];
+      }
+    const SizeValueType half = count / 2;
+    return PairwiseSum(values, stride, half) + PairwiseSum(values + half * stride, stride, count - half);
+  }
+};
+} // end namespace itk
+
+#endif
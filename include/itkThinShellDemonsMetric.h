@@ -22,8 +22,20 @@
 #include "itkCovariantVector.h"
 #include "itkMesh.h"
 #include "itkImage.h"
-#include "itkMeshTovtkPolyData.h"
-#include "vtkSmartPointer.h"
+#include "itkIntTypes.h"
+#include "itkNumericTraits.h"
+#include "itkFlatPointLocator.h"
+#include "itkTriangleVertexNeighborhood.h"
+#include "itkThinShellDemonsKernels.h"
+#include "itkMultiThreader.h"
+#include "itkWorkerPool.h"
+#include "itkWorkStealingScheduler.h"
+#include "itkFirstTouchArray.h"
+#include "itkRealTimeClock.h"
+#include "itkSimpleFastMutexLock.h"
+#include "itkMutexLockHolder.h"
+#include <algorithm>
+#include <vector>
 
 namespace itk
 {
@@ -34,10 +46,35 @@ namespace itk
  *
  *  Reference: "Thin Shell Demons: Zhao Q, Price T, Pizer S, Niethammer M, Alterovitz R, Rosenman J, MIUA 2015
  *
+ * After Initialize(), GetValue(), GetDerivative() and
+ * GetValueAndDerivative() read the parameters they are given and change
+ * nothing but the records of the last evaluation (energy terms, thread
+ * times), which are guarded by a lock. They may be called from several
+ * threads at once, at different parameters, e.g. by a parallel line
+ * search. Every call has a workspace of its own; setters and Initialize()
+ * must not run concurrently with evaluations.
+ *
+ * TPrecision is the type the packed moving points and target positions
+ * are stored in. With float they take half the memory and bandwidth; the
+ * kernels widen them to double, and the parameters, energies, derivatives
+ * and all sums stay double, so only the rounding of the stored
+ * coordinates changes. The parameters are double in either case, as the
+ * cost function interface requires.
+ *
+ * Initialize() places the arrays the metric owns on the memory nodes of
+ * the threads that evaluate them (see FirstTouchArray): part p of the
+ * vertices on worker p of the pool. Part 0 is written and evaluated by
+ * the calling thread, so it stays on the right node only when Initialize()
+ * and the evaluations run on the same thread. When the pool is busy, e.g.
+ * under concurrent evaluations, the caller evaluates every part itself and
+ * reads most of them from other nodes. The results do not change, only
+ * the memory traffic.
+ *
  */
 template< typename TFixedMesh, typename TMovingMesh,
           typename TDistanceMap =
-            ::itk::Image< unsigned short, TMovingMesh::PointDimension > >
+            ::itk::Image< unsigned short, TMovingMesh::PointDimension >,
+          typename TPrecision = double >
 class ITK_TEMPLATE_EXPORT ThinShellDemonsMetric:
   public MeshToMeshMetric< TFixedMesh, TMovingMesh >
 {
@@ -64,6 +101,8 @@ public:
 
   typedef typename Superclass::MeasureType                MeasureType;
   typedef typename Superclass::DerivativeType             DerivativeType;
+  typedef typename Superclass::ParametersListType         ParametersListType;
+  typedef typename Superclass::MeasureListType            MeasureListType;
   typedef typename Superclass::FixedMeshType          FixedMeshType;
   typedef typename Superclass::MovingMeshType         MovingMeshType;
   typedef typename Superclass::FixedMeshConstPointer  FixedMeshConstPointer;
@@ -76,6 +115,7 @@ public:
   typedef typename Superclass::MovingPointDataIterator MovingPointDataIterator;
 
   typedef typename Superclass::InputPointType InputPointType;
+  typedef TPrecision                          PrecisionType;
   typedef typename itk::Vector<double, TMovingMesh::PointDimension> InputVectorType;
   typedef itk::MapContainer<int, InputPointType> TargetMapType;
 
@@ -87,10 +127,33 @@ public:
   /**  Get the match measure, i.e. the value for single valued optimizers. */
   MeasureType GetValue(const TransformParametersType & parameters) const ITK_OVERRIDE;
 
+  /** Evaluate the metric at several parameter vectors at once. Up to
+   *  ThinShellDemonsKernels::MaximumBatchSize of them share one pass over
+   *  the targets, points and neighborhoods, updating an accumulator per
+   *  vector, which costs far less than as many GetValue() calls. Each
+   *  value is that of GetValue(), in either mode. The energy terms of the
+   *  last GetValue() are not changed. */
+  virtual void GetValues(const ParametersListType & parameters, MeasureListType & values) const ITK_OVERRIDE;
+
+  /** The terms of the energy, in the order of GetEnergyTerm(). */
+  enum EnergyTermType { DataTerm = 0, StretchTerm, BendTerm, NumberOfEnergyTerms };
+
+  /** Data, stretch and bend contributions (StretchWeight and BendWeight
+   *  applied) to the value of the last GetValue(), accumulated in the same
+   *  pass as the value. When several threads call GetValue() at once, the
+   *  terms of the one that finished last are kept. */
+  virtual unsigned int GetNumberOfEnergyTerms() const ITK_OVERRIDE { return NumberOfEnergyTerms; }
+  virtual const char * GetEnergyTermName(unsigned int term) const ITK_OVERRIDE;
+  virtual double GetEnergyTerm(unsigned int term) const ITK_OVERRIDE;
+
   /**  Get value and derivatives for multiple valued optimizers. */
   void GetValueAndDerivative(const TransformParametersType & parameters,
                              MeasureType & Value, DerivativeType & Derivative) const;
 
+  /** Report the bytes of the packed points, target positions, neighborhoods
+   *  and spatial index owned by the metric. */
+  virtual void UpdateMemoryUsage(RegistrationMemoryUsage *usage) const ITK_OVERRIDE;
+
   /** Initialize the Metric by computing a target position for each vertex in the fixed mesh using
       Euclidean + Curvature distance */
   virtual void Initialize(void) throw ( ExceptionObject ) ITK_OVERRIDE;
@@ -100,9 +163,84 @@ public:
   double getStretchWeight(){return m_StretchWeight;}
   void SetBendWeight(double weight){m_BendWeight = weight;}
   double getBendWeight(){return m_BendWeight;}
+
+  /** Evaluate on externally owned, packed arrays instead of copies of the
+   *  mesh containers, e.g. the mapped arrays of a NativeMeshFileReader.
+   *  Points are packed xyz doubles, triangles three vertex indices each.
+   *  The buffers are not copied and must stay valid while the metric is in
+   *  use. Pass a null pointer to go back to the mesh. Takes effect at the
+   *  next Initialize(). A metric with a PrecisionType other than double
+   *  keeps a rounded copy of the moving points. */
+  void SetFixedPointBuffer(const double *points, SizeValueType numberOfPoints);
+  void SetMovingPointBuffer(const double *points, SizeValueType numberOfPoints);
+  void SetMovingTriangleBuffer(const uint32_t *triangles, SizeValueType numberOfTriangles);
+
+  /** Use prebuilt vertex neighborhoods of the moving mesh in the layout of
+   *  TriangleVertexNeighborhood, e.g. from a SharedTemplateCache. offsets
+   *  has one entry per moving vertex plus one. Takes precedence over the
+   *  triangles. Pass null pointers to build them at Initialize() again. */
+  void SetMovingNeighborhoodBuffer(const SizeValueType *offsets, const uint32_t *neighbors);
+
+  /** Set/Get the spatial index over the fixed points used by the closest
+   *  point search, e.g. one mapped with FlatPointLocator::ReadMapped(). It
+   *  must index the same fixed points in the same order; Initialize()
+   *  throws if its coordinate hash differs from that of the fixed points.
+   *  When none is set, one is built at Initialize(). */
+  itkSetObjectMacro(FixedPointLocator, FlatPointLocator);
+  itkGetModifiableObjectMacro(FixedPointLocator, FlatPointLocator);
+
+  /** Set/Get the number of threads used by the closest point search,
+   *  GetValue() and GetDerivative(). The moving vertices are split into
+   *  that many contiguous parts at Initialize(), fewer if a part would have
+   *  less than MinimumVerticesPerThread vertices or the worker pool has
+   *  fewer threads. Defaults to the global default number of threads. */
+  itkSetClampMacro(NumberOfThreads, ThreadIdType, 1, ITK_MAX_THREADS);
+  itkGetConstMacro(NumberOfThreads, ThreadIdType);
+
+  /** Set/Get the smallest part worth a thread of its own, so that the
+   *  parallel sections of small meshes are not slower than serial ones.
+   *  Takes effect at the next Initialize(). Defaults to 2048. */
+  itkSetClampMacro(MinimumVerticesPerThread, SizeValueType, 1, NumericTraits< SizeValueType >::max());
+  itkGetConstMacro(MinimumVerticesPerThread, SizeValueType);
+
+  /** Set/Get the number of moving vertices a thread takes at a time in
+   *  the closest point search. The cost of a query depends on how far the
+   *  vertex is from the fixed points, so instead of the fixed parts the
+   *  search hands out chunks of vertices in Morton order and idle threads
+   *  steal chunks from busy ones. Defaults to 64. */
+  itkSetClampMacro(CorrespondenceChunkSize, SizeValueType, 1, NumericTraits< SizeValueType >::max());
+  itkGetConstMacro(CorrespondenceChunkSize, SizeValueType);
+
+  /** Set/Get whether GetValue() returns bit-identical results for any
+   *  number of threads. The fast mode adds one partial sum per thread, so
+   *  the rounding of the sum depends on the thread count. The deterministic
+   *  mode sums every block of ReductionBlockSize vertices on its own and
+   *  adds the block sums by a pairwise tree whose shape depends only on the
+   *  number of vertices. The derivative is gathered per vertex and is
+   *  reproducible in both modes. Defaults to off. */
+  itkSetMacro(Deterministic, bool);
+  itkGetConstMacro(Deterministic, bool);
+  itkBooleanMacro(Deterministic);
+
+  /** Set/Get the persistent threads that run the parallel sections. When
+   *  none is set, WorkerPool::GetGlobalPool() is used. */
+  itkSetObjectMacro(WorkerPool, WorkerPool);
+  itkGetModifiableObjectMacro(WorkerPool, WorkerPool);
+
+  /** Busy time in seconds of each part in the last parallel section
+   *  (closest point search, GetValue() or GetDerivative()), to measure load
+   *  imbalance. When several threads call GetValue() at once, the times of
+   *  the one that finished last are kept. */
+  const std::vector< double > & GetThreadTimes() const { return m_ThreadTimes; }
+
+  /** Number of evaluation workspaces created so far. GetValue() and
+   *  GetDerivative() take a workspace sized at Initialize() and return it
+   *  afterwards, so they do not allocate once running. A new workspace is
+   *  only created when more threads than ever before evaluate at once. */
+  SizeValueType GetNumberOfEvaluationWorkspaces() const;
 protected:
   ThinShellDemonsMetric();
-  virtual ~ThinShellDemonsMetric() {}
+  virtual ~ThinShellDemonsMetric();
 
   void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
 
@@ -110,14 +248,210 @@ private:
   ITK_DISALLOW_COPY_AND_ASSIGN(ThinShellDemonsMetric);
 
   bool               m_TargetPositionComputed;
-  TargetMapType targetMap;
-    
-  vtkSmartPointer<vtkPolyData> movingVTKMesh; // a VTKPolyData copy of the moving mesh
-    
+
   double m_StretchWeight;
   double m_BendWeight;
 
+  // user supplied buffers, null when the mesh containers are used
+  const double *   m_FixedPointBuffer;
+  SizeValueType    m_FixedPointBufferSize;
+  const double *   m_MovingPointBuffer;
+  SizeValueType    m_MovingPointBufferSize;
+  const uint32_t * m_MovingTriangleBuffer;
+  SizeValueType    m_MovingTriangleBufferSize;
+  const SizeValueType * m_MovingNeighborOffsetBuffer;
+  const uint32_t *      m_MovingNeighborBuffer;
+
+  // packed copies of the mesh points, only filled when no buffer is
+  // supplied, or for the moving points when the buffer is not of
+  // PrecisionType
+  std::vector< double >              m_FixedPointStorage;
+  FirstTouchArray< PrecisionType >   m_MovingPointStorage;
+
+  // packed xyz views the evaluation runs on
+  const double *        m_FixedPoints;
+  SizeValueType         m_NumberOfFixedPoints;
+  const PrecisionType * m_MovingPoints;
+  SizeValueType         m_NumberOfMovingPoints;
+
+  // a double buffer can be used as is only by a metric that stores doubles
+  static const double * SharedPoints(const double *buffer, const double *) { return buffer; }
+  template< typename T >
+  static const T * SharedPoints(const double *, const T *) { return ITK_NULLPTR; }
+
+  // spatial index over the fixed points: user supplied, or built here
+  FlatPointLocator::Pointer m_FixedPointLocator;
+  FlatPointLocator::Pointer m_InternalFixedPointLocator;
+
+  // target position of each moving vertex, packed xyz
+  FirstTouchArray< PrecisionType > m_TargetPositions;
+
+  // Neighbors of each moving vertex in compressed row form, see
+  // TriangleVertexNeighborhood: vertex i has m_Neighbors[m_NeighborOffsets[i]]
+  // ... m_Neighbors[m_NeighborOffsets[i+1]-1]. The views point into the
+  // storage or into the user supplied buffers.
+  FirstTouchArray< SizeValueType > m_NeighborOffsetStorage;
+  FirstTouchArray< uint32_t >      m_NeighborStorage;
+  const SizeValueType *            m_NeighborOffsets;
+  const uint32_t *                 m_Neighbors;
+
+  // Transposed neighborhoods: vertex j lists the vertices that have j as a
+  // neighbor, so that the derivative is gathered without write conflicts.
+  FirstTouchArray< SizeValueType > m_ReverseNeighborOffsets;
+  FirstTouchArray< uint32_t >      m_ReverseNeighbors;
+
+  // estimated bytes read and written by one GetValue(), for the profiler
+  uint64_t m_EvaluationBytes;
+
+  ThreadIdType                  m_NumberOfThreads;
+  SizeValueType                 m_MinimumVerticesPerThread;
+  SizeValueType                 m_CorrespondenceChunkSize;
+  bool                          m_Deterministic;
+  WorkerPool::Pointer           m_WorkerPool;
+  RealTimeClock::Pointer        m_Clock;
+  mutable std::vector< double > m_ThreadTimes;
+
+  // terms of the last GetValue()
+  mutable double m_EnergyTerms[NumberOfEnergyTerms];
+
+  // guards the records of the last evaluation above
+  mutable SimpleFastMutexLock m_EvaluationMutex;
+
   void ComputeTargetPosition();
+  void PackMeshPoints();
+  void BuildNeighborhoods();
+  void BuildReverseNeighborhoods();
+  void ComputePartition();
+  void PlaceVertexBuffers();
+  void ComputeVertexOrder();
+  WorkerPool * GetActiveWorkerPool() const;
+
+  // Part p of every parallel section is the moving vertices
+  // [m_Partition[p], m_Partition[p+1]), fixed at Initialize(). The inner
+  // boundaries are multiples of ReductionBlockSize, so that no block of
+  // the deterministic sum is split between threads.
+  std::vector< SizeValueType > m_Partition;
+  enum { ReductionBlockSize = 1024 };
+
+  // The moving vertices sorted along a Morton curve through their bounding
+  // box, so that a chunk of the closest point search queries one region of
+  // the fixed point index.
+  std::vector< uint32_t > m_VertexOrder;
+
+  struct EvaluationStruct;
+  typedef void ( Self::*RangeMethodType )( EvaluationStruct *, SizeValueType, SizeValueType, ThreadIdType ) const;
+
+  // State shared by the threads of one parallel section. ThreadValues
+  // holds NumberOfEnergyTerms partial sums per part and evaluation,
+  // BlockValues, when not empty, as many per block of ReductionBlockSize
+  // vertices instead. An evaluation is Parameters, or when BatchSize is not
+  // zero, each of BatchParameters[0] ... BatchParameters[BatchSize-1].
+  // ThreadTimes is the busy time of each part. When Order is set, the range
+  // methods visit vertex Order[k] for k in [begin, end) instead of vertex k.
+  struct EvaluationStruct
+    {
+    const Self *             Metric;
+    RangeMethodType          Method;
+    const SizeValueType *    Partition;
+    ThreadIdType             NumberOfParts;
+    const uint32_t *         Order;
+    WorkStealingScheduler *  Scheduler;
+    const double *           Parameters;
+    const double *           BatchParameters[ThinShellDemonsKernels::MaximumBatchSize];
+    unsigned int             BatchSize;
+    double *                 Output;
+    PrecisionType *          Targets;
+    const FlatPointLocator * Locator;
+    std::vector< double >    ThreadValues;
+    std::vector< double >    BlockValues;
+    std::vector< double >    ThreadTimes;
+
+    // laplacian of the displacement at each vertex, scratch of
+    // GetDerivative(); kept by Reset()
+    FirstTouchArray< double > Laplacians;
+
+    EvaluationStruct() :
+      Metric(ITK_NULLPTR), Method(ITK_NULLPTR), Partition(ITK_NULLPTR), NumberOfParts(1),
+      Order(ITK_NULLPTR), Scheduler(ITK_NULLPTR), Parameters(ITK_NULLPTR), BatchSize(0), Output(ITK_NULLPTR),
+      Targets(ITK_NULLPTR), Locator(ITK_NULLPTR) {}
+
+    // partial sums per part or block
+    SizeValueType GetNumberOfValues() const
+      {
+      return NumberOfEnergyTerms * std::max< SizeValueType >( BatchSize, 1 );
+      }
+
+    // back to the state of a new one, keeping the capacity of the vectors
+    void Reset()
+      {
+      Metric = ITK_NULLPTR;
+      Method = ITK_NULLPTR;
+      Partition = ITK_NULLPTR;
+      NumberOfParts = 1;
+      Order = ITK_NULLPTR;
+      Scheduler = ITK_NULLPTR;
+      Parameters = ITK_NULLPTR;
+      BatchSize = 0;
+      Output = ITK_NULLPTR;
+      Targets = ITK_NULLPTR;
+      Locator = ITK_NULLPTR;
+      ThreadValues.clear();
+      BlockValues.clear();
+      ThreadTimes.clear();
+      }
+    };
+
+  // Workspaces of GetValue() and GetDerivative() not in use. A call takes
+  // one, or creates one when the list is empty, and puts it back at the
+  // end, so that concurrent calls never share scratch memory; the buffers
+  // keep their capacity between calls.
+  mutable std::vector< EvaluationStruct * > m_FreeEvaluations;
+  mutable SizeValueType                     m_NumberOfEvaluationWorkspaces;
+  mutable SimpleFastMutexLock               m_FreeEvaluationsMutex;
+
+  EvaluationStruct * AcquireEvaluation() const;
+  void ReleaseEvaluation(EvaluationStruct *str) const;
+  void ReserveEvaluations();
+  SizeValueType GetWorkspaceSizeInBytes() const;
+
+  // a workspace from the free list for the lifetime of the holder
+  class EvaluationHolder
+    {
+  public:
+    explicit EvaluationHolder(const Self *metric) :
+      m_Metric(metric), m_Evaluation( metric->AcquireEvaluation() ) {}
+    ~EvaluationHolder() { m_Metric->ReleaseEvaluation(m_Evaluation); }
+    EvaluationStruct & operator*() const { return *m_Evaluation; }
+
+  private:
+    EvaluationHolder(const EvaluationHolder &); // purposely not implemented
+    void operator=(const EvaluationHolder &);   // purposely not implemented
+
+    const Self *       m_Metric;
+    EvaluationStruct * m_Evaluation;
+    };
+
+  // Run str->Method over every part of the moving vertices on the worker
+  // pool, then record the part times.
+  void ParallelForVertices(EvaluationStruct & str) const;
+  static void EvaluationJob(void *data, ThreadIdType threadId, ThreadIdType numberOfThreads);
+
+  // Run str->Method over chunks of m_VertexOrder, balanced by work
+  // stealing, for work whose cost varies between vertices. Part t is the
+  // chunks thread t ran.
+  void ParallelForVertexChunks(EvaluationStruct & str, SizeValueType chunkSize) const;
+  static void StealingJob(void *data, ThreadIdType threadId, ThreadIdType numberOfThreads);
+
+  void ComputeTargetPositionRange(EvaluationStruct *str, SizeValueType begin, SizeValueType end,
+                                  ThreadIdType part) const;
+  void ComputeValueRange(EvaluationStruct *str, SizeValueType begin, SizeValueType end,
+                         ThreadIdType part) const;
+  void ComputeEnergyTerms(const EvaluationStruct *str, SizeValueType begin, SizeValueType end,
+                          double *terms) const;
+  void ComputeLaplacianRange(EvaluationStruct *str, SizeValueType begin, SizeValueType end,
+                             ThreadIdType part) const;
+  void ComputeDerivativeRange(EvaluationStruct *str, SizeValueType begin, SizeValueType end,
+                              ThreadIdType part) const;
 };
 } // end namespace itk
 
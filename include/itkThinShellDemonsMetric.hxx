@@ -20,25 +20,111 @@
 
 #include "itkThinShellDemonsMetric.h"
 #include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkNativeMeshFileFormat.h"
+#include <algorithm>
 
 namespace itk
 {
 
-template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap >
-ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap >
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
 ::ThinShellDemonsMetric() :
   m_TargetPositionComputed( false )
 {
 	m_BendWeight = 1;
 	m_StretchWeight = 1;
+
+	m_FixedPointBuffer = ITK_NULLPTR;
+	m_FixedPointBufferSize = 0;
+	m_MovingPointBuffer = ITK_NULLPTR;
+	m_MovingPointBufferSize = 0;
+	m_MovingTriangleBuffer = ITK_NULLPTR;
+	m_MovingTriangleBufferSize = 0;
+	m_MovingNeighborOffsetBuffer = ITK_NULLPTR;
+	m_MovingNeighborBuffer = ITK_NULLPTR;
+
+	m_NeighborOffsets = ITK_NULLPTR;
+	m_Neighbors = ITK_NULLPTR;
+
+	m_FixedPoints = ITK_NULLPTR;
+	m_NumberOfFixedPoints = 0;
+	m_MovingPoints = ITK_NULLPTR;
+	m_NumberOfMovingPoints = 0;
+
+	m_EvaluationBytes = 0;
+
+	m_NumberOfThreads = MultiThreader::GetGlobalDefaultNumberOfThreads();
+	m_MinimumVerticesPerThread = 2048;
+	m_CorrespondenceChunkSize = 64;
+	m_Deterministic = false;
+	m_NumberOfEvaluationWorkspaces = 0;
+	m_Clock = RealTimeClock::New();
+	std::fill( m_EnergyTerms, m_EnergyTerms + NumberOfEnergyTerms, 0.0 );
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::~ThinShellDemonsMetric()
+{
+	for ( size_t i = 0; i < m_FreeEvaluations.size(); ++i )
+	{
+		delete m_FreeEvaluations[i];
+	}
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::SetFixedPointBuffer(const double *points, SizeValueType numberOfPoints)
+{
+	m_FixedPointBuffer = points;
+	m_FixedPointBufferSize = points ? numberOfPoints : 0;
+	m_TargetPositionComputed = false;
+	this->Modified();
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::SetMovingPointBuffer(const double *points, SizeValueType numberOfPoints)
+{
+	m_MovingPointBuffer = points;
+	m_MovingPointBufferSize = points ? numberOfPoints : 0;
+	m_TargetPositionComputed = false;
+	this->Modified();
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::SetMovingTriangleBuffer(const uint32_t *triangles, SizeValueType numberOfTriangles)
+{
+	m_MovingTriangleBuffer = triangles;
+	m_MovingTriangleBufferSize = triangles ? numberOfTriangles : 0;
+	m_TargetPositionComputed = false;
+	this->Modified();
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::SetMovingNeighborhoodBuffer(const SizeValueType *offsets, const uint32_t *neighbors)
+{
+	m_MovingNeighborOffsetBuffer = neighbors ? offsets : ITK_NULLPTR;
+	m_MovingNeighborBuffer = offsets ? neighbors : ITK_NULLPTR;
+	m_TargetPositionComputed = false;
+	this->Modified();
 }
+
   /** Initialize the metric */
-  template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap >
+  template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
   void
-	  ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap >
+	  ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
 	  ::Initialize(void)
 	  throw ( ExceptionObject )
   {
+	  RegistrationProfiler::Scope profilerScope(this->m_Profiler.GetPointer(), RegistrationProfiler::MetricInitializePhase);
+
 	  if ( !m_Transform )
 	  {
 		  itkExceptionMacro(<< "Transform is not present");
@@ -66,87 +152,579 @@ ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap >
 		  m_FixedMesh->GetSource()->Update();
 	  }
 
+	  // Set up the packed point arrays and the vertex neighborhoods
+	  PackMeshPoints();
+	  BuildNeighborhoods();
+	  ComputePartition();
+	  PlaceVertexBuffers();
+	  ComputeVertexOrder();
+	  ReserveEvaluations();
+
+	  // points, targets and parameters, plus the neighborhoods
+	  m_EvaluationBytes = m_NumberOfMovingPoints * ( 6 * sizeof( PrecisionType ) + 3 * sizeof( double ) )
+		  + ( m_NumberOfMovingPoints + 1 ) * sizeof( SizeValueType )
+		  + m_NeighborOffsets[m_NumberOfMovingPoints] * sizeof( uint32_t );
+
 	  // Preprocessing: compute the target position of each vertex in the fixed mesh
       // using Euclidean + Curvature distance
 	  ComputeTargetPosition();
   }
 
-template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap >
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::PackMeshPoints()
+{
+	if ( m_FixedPointBuffer )
+	{
+		m_FixedPointStorage.clear();
+		m_FixedPoints = m_FixedPointBuffer;
+		m_NumberOfFixedPoints = m_FixedPointBufferSize;
+	}
+	else
+	{
+		m_FixedPointStorage.resize( m_FixedMesh->GetNumberOfPoints() * 3 );
+		double *dst = m_FixedPointStorage.empty() ? ITK_NULLPTR : &m_FixedPointStorage[0];
+		for ( FixedPointIterator it = m_FixedMesh->GetPoints()->Begin(); it != m_FixedMesh->GetPoints()->End(); ++it )
+		{
+			*dst++ = it.Value()[0];
+			*dst++ = it.Value()[1];
+			*dst++ = it.Value()[2];
+		}
+		m_FixedPoints = m_FixedPointStorage.empty() ? ITK_NULLPTR : &m_FixedPointStorage[0];
+		m_NumberOfFixedPoints = m_FixedMesh->GetNumberOfPoints();
+	}
+
+	if ( m_MovingPointBuffer )
+	{
+		m_NumberOfMovingPoints = m_MovingPointBufferSize;
+		m_MovingPoints = Self::SharedPoints( m_MovingPointBuffer, static_cast< const PrecisionType * >( ITK_NULLPTR ) );
+		if ( m_MovingPoints )
+		{
+			m_MovingPointStorage.Clear();
+		}
+		else
+		{
+			// a copy rounded to the storage precision
+			m_MovingPointStorage.Allocate( m_NumberOfMovingPoints * 3 );
+			for ( SizeValueType i = 0; i < m_NumberOfMovingPoints * 3; ++i )
+			{
+				m_MovingPointStorage[i] = static_cast< PrecisionType >( m_MovingPointBuffer[i] );
+			}
+			m_MovingPoints = m_MovingPointStorage.data();
+		}
+	}
+	else
+	{
+		m_MovingPointStorage.Allocate( m_MovingMesh->GetNumberOfPoints() * 3 );
+		PrecisionType *dst = m_MovingPointStorage.empty() ? ITK_NULLPTR : &m_MovingPointStorage[0];
+		for ( MovingPointIterator it = m_MovingMesh->GetPoints()->Begin(); it != m_MovingMesh->GetPoints()->End(); ++it )
+		{
+			*dst++ = static_cast< PrecisionType >( it.Value()[0] );
+			*dst++ = static_cast< PrecisionType >( it.Value()[1] );
+			*dst++ = static_cast< PrecisionType >( it.Value()[2] );
+		}
+		m_MovingPoints = m_MovingPointStorage.empty() ? ITK_NULLPTR : &m_MovingPointStorage[0];
+		m_NumberOfMovingPoints = m_MovingMesh->GetNumberOfPoints();
+	}
+
+	if ( m_NumberOfMovingPoints * 3 != this->GetNumberOfParameters() )
+	{
+		itkExceptionMacro(<< "The transform has " << this->GetNumberOfParameters()
+			<< " parameters, expected 3 per moving vertex (" << m_NumberOfMovingPoints << ")");
+	}
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::BuildNeighborhoods()
+{
+	RegistrationProfiler::Scope profilerScope(this->m_Profiler.GetPointer(), RegistrationProfiler::NeighborhoodPhase);
+
+	if ( m_MovingNeighborOffsetBuffer )
+	{
+		m_NeighborOffsetStorage.Clear();
+		m_NeighborStorage.Clear();
+		m_NeighborOffsets = m_MovingNeighborOffsetBuffer;
+		m_Neighbors = m_MovingNeighborBuffer;
+		this->BuildReverseNeighborhoods();
+		return;
+	}
+
+	// gather the triangle connectivity of the moving mesh
+	std::vector< uint32_t > meshTriangles;
+	const uint32_t *triangles = m_MovingTriangleBuffer;
+	SizeValueType numberOfTriangles = m_MovingTriangleBufferSize;
+	if ( !triangles )
+	{
+		typedef typename MovingMeshType::CellType CellType;
+		if ( m_MovingMesh->GetCells() )
+		{
+			meshTriangles.reserve( m_MovingMesh->GetNumberOfCells() * 3 );
+			typename MovingMeshType::CellsContainer::ConstIterator cellItr = m_MovingMesh->GetCells()->Begin();
+			typename MovingMeshType::CellsContainer::ConstIterator cellEnd = m_MovingMesh->GetCells()->End();
+			for ( ; cellItr != cellEnd; ++cellItr )
+			{
+				const CellType *cell = cellItr.Value();
+				if ( cell->GetType() != CellType::TRIANGLE_CELL )
+				{
+					continue;
+				}
+				typename CellType::PointIdConstIterator pointIdItr = cell->PointIdsBegin();
+				for ( unsigned int k = 0; k < 3; k++ )
+				{
+					meshTriangles.push_back( static_cast< uint32_t >( *pointIdItr++ ) );
+				}
+			}
+		}
+		triangles = meshTriangles.empty() ? ITK_NULLPTR : &meshTriangles[0];
+		numberOfTriangles = meshTriangles.size() / 3;
+	}
+
+	m_NeighborOffsetStorage.Allocate( m_NumberOfMovingPoints + 1 );
+	m_NeighborStorage.Allocate( TriangleVertexNeighborhood::GetNumberOfNeighbors( numberOfTriangles ) );
+	if ( !TriangleVertexNeighborhood::Build( triangles, numberOfTriangles, m_NumberOfMovingPoints,
+		&m_NeighborOffsetStorage[0], m_NeighborStorage.empty() ? ITK_NULLPTR : &m_NeighborStorage[0] ) )
+	{
+		itkExceptionMacro(<< "A triangle references a vertex outside of the moving mesh");
+	}
+	m_NeighborOffsets = &m_NeighborOffsetStorage[0];
+	m_Neighbors = m_NeighborStorage.empty() ? ITK_NULLPTR : &m_NeighborStorage[0];
+	this->BuildReverseNeighborhoods();
+
+	profilerScope.SetBytes( numberOfTriangles * 3 * sizeof( uint32_t )
+		+ 2 * m_NeighborOffsetStorage.size() * sizeof( SizeValueType )
+		+ 2 * m_NeighborStorage.size() * sizeof( uint32_t ) );
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::BuildReverseNeighborhoods()
+{
+	const SizeValueType numberOfNeighbors = m_NeighborOffsets[m_NumberOfMovingPoints];
+	m_ReverseNeighborOffsets.Allocate( m_NumberOfMovingPoints + 1 );
+	m_ReverseNeighbors.Allocate( numberOfNeighbors );
+	TriangleVertexNeighborhood::Transpose( m_NeighborOffsets, m_Neighbors, m_NumberOfMovingPoints,
+		&m_ReverseNeighborOffsets[0], m_ReverseNeighbors.empty() ? ITK_NULLPTR : &m_ReverseNeighbors[0] );
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
 void
-	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap >
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
 	::ComputeTargetPosition() 
 {
-	FixedMeshConstPointer fixedMesh = this->GetFixedMesh();
+	RegistrationProfiler::Scope profilerScope(this->m_Profiler.GetPointer(), RegistrationProfiler::CorrespondencePhase,
+		m_NumberOfMovingPoints * 6 * sizeof( PrecisionType ));
 
-	if ( !fixedMesh )
+	if ( !m_FixedPoints || m_NumberOfFixedPoints == 0 )
 	{
-		itkExceptionMacro(<< "Fixed point set has not been assigned");
+		itkExceptionMacro(<< "Fixed point set is empty");
 	}
 
-	MovingMeshConstPointer movingMesh = this->GetMovingMesh();
+	const FlatPointLocator *locator = m_FixedPointLocator.GetPointer();
+	if ( !locator )
+	{
+		if ( !m_InternalFixedPointLocator )
+		{
+			m_InternalFixedPointLocator = FlatPointLocator::New();
+		}
+		m_InternalFixedPointLocator->Build( m_FixedPoints, m_NumberOfFixedPoints );
+		locator = m_InternalFixedPointLocator.GetPointer();
+	}
+	else if ( locator->GetNumberOfPoints() != m_NumberOfFixedPoints )
+	{
+		itkExceptionMacro(<< "The fixed point locator indexes " << locator->GetNumberOfPoints()
+			<< " points, the fixed point set has " << m_NumberOfFixedPoints);
+	}
+	else if ( locator->GetCoordinateHash() != NativeMeshFile::CoordinateHash( m_FixedPoints, 3 * m_NumberOfFixedPoints ) )
+	{
+		// same count, different points: the correspondences would be wrong
+		itkExceptionMacro(<< "The fixed point locator was built for other fixed points than the "
+			<< m_NumberOfFixedPoints << " of this metric");
+	}
 
-	if ( !movingMesh )
+	if ( m_TargetPositions.size() != m_NumberOfMovingPoints * 3 )
 	{
-		itkExceptionMacro(<< "Moving point set has not been assigned");
+		m_TargetPositions.Allocate( m_NumberOfMovingPoints * 3 );
 	}
 
-	this->targetMap.Initialize();
+	EvaluationStruct str;
+	str.Method = &Self::ComputeTargetPositionRange;
+	str.Targets = m_TargetPositions.empty() ? ITK_NULLPTR : &m_TargetPositions[0];
+	str.Locator = locator;
+	this->ParallelForVertexChunks( str, m_CorrespondenceChunkSize );
 
-	MovingPointIterator pointItr = movingMesh->GetPoints()->Begin();
-	MovingPointIterator pointEnd = movingMesh->GetPoints()->End();
+	m_TargetPositionComputed = true;
+	profilerScope.SetBytes( m_NumberOfMovingPoints * 6 * sizeof( PrecisionType ) + locator->GetSizeInBytes() );
+}
 
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::ComputeTargetPositionRange(EvaluationStruct *str, SizeValueType begin, SizeValueType end, ThreadIdType) const
+{
     // In principal, this part should implement Euclidean + geometric feature similarity
     // Currently, this is simply a closest point search
-	int identifier = 0;
-	while ( pointItr != pointEnd )
+	for ( SizeValueType k = begin; k < end; k++ )
 	{
+		const SizeValueType identifier = str->Order ? str->Order[k] : k;
+
 		InputPointType inputPoint;
-		inputPoint.CastFrom( pointItr.Value() );
+		inputPoint[0] = m_MovingPoints[identifier*3];
+		inputPoint[1] = m_MovingPoints[identifier*3+1];
+		inputPoint[2] = m_MovingPoints[identifier*3+2];
 		typename Superclass::OutputPointType transformedPoint =
 			this->m_Transform->TransformPoint(inputPoint);
-		InputPointType targetPoint;
+		const double query[3] = { transformedPoint[0], transformedPoint[1], transformedPoint[2] };
 
-		double minimumDistance = NumericTraits< double >::max();
-		bool   closestPoint = false;
+		// closest fixed point; ties resolve to the lowest index, as a linear scan would
+		const double *targetPoint = m_FixedPoints + str->Locator->FindClosestPoint( query ) * 3;
+
+		str->Targets[identifier*3]   = static_cast< PrecisionType >( targetPoint[0] );
+		str->Targets[identifier*3+1] = static_cast< PrecisionType >( targetPoint[1] );
+		str->Targets[identifier*3+2] = static_cast< PrecisionType >( targetPoint[2] );
+	}
+}
 
-		// If the closestPoint has not been found, go through the list of fixed
-		// points and find the closest distance
-		if ( !closestPoint )
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::ComputePartition()
+{
+	// Enough vertices per part that a parallel section is not slower than
+	// a serial one, at most one part per thread.
+	WorkerPool *pool = this->GetActiveWorkerPool();
+	SizeValueType numberOfParts = std::min< SizeValueType >( m_NumberOfThreads, pool->GetNumberOfThreads() );
+	numberOfParts = std::min< SizeValueType >( numberOfParts, m_NumberOfMovingPoints / m_MinimumVerticesPerThread );
+	numberOfParts = std::max< SizeValueType >( numberOfParts, 1 );
+
+	// inner boundaries rounded to whole reduction blocks
+	const SizeValueType block = ReductionBlockSize;
+	m_Partition.resize( numberOfParts + 1 );
+	m_Partition[0] = 0;
+	for ( SizeValueType p = 1; p < numberOfParts; ++p )
+	{
+		const SizeValueType boundary = ( m_NumberOfMovingPoints * p / numberOfParts + block / 2 ) / block * block;
+		m_Partition[p] = std::min( boundary, m_NumberOfMovingPoints );
+	}
+	m_Partition[numberOfParts] = m_NumberOfMovingPoints;
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::PlaceVertexBuffers()
+{
+	m_TargetPositions.Allocate( m_NumberOfMovingPoints * 3 );
+
+	// Part p of the vertices is evaluated by worker p of the pool whenever
+	// the pool is free, part 0 by the calling thread. Move the arrays the
+	// metric owns to pages first written by those threads, so that on a
+	// NUMA machine each part lives on the memory node of its thread; see
+	// the class documentation for when that does not hold. User supplied
+	// buffers stay where they are.
+	const ThreadIdType numberOfParts = static_cast< ThreadIdType >( m_Partition.size() - 1 );
+	if ( numberOfParts <= 1 )
+	{
+		return;
+	}
+
+	std::vector< SizeValueType > vertices( numberOfParts + 1 );
+	std::vector< SizeValueType > coordinates( numberOfParts + 1 );
+	std::vector< SizeValueType > neighbors( numberOfParts + 1 );
+	std::vector< SizeValueType > reverseNeighbors( numberOfParts + 1 );
+	for ( ThreadIdType p = 0; p <= numberOfParts; ++p )
+	{
+		vertices[p] = m_Partition[p];
+		coordinates[p] = 3 * m_Partition[p];
+		neighbors[p] = m_NeighborOffsets[m_Partition[p]];
+		reverseNeighbors[p] = m_ReverseNeighborOffsets[m_Partition[p]];
+	}
+	// the offsets have one more entry than there are vertices
+	vertices[numberOfParts] = m_NumberOfMovingPoints + 1;
+
+	WorkerPool *pool = this->GetActiveWorkerPool();
+	m_TargetPositions.Place( pool, &coordinates[0], numberOfParts, false );
+	if ( !m_MovingPointStorage.empty() )
+	{
+		m_MovingPointStorage.Place( pool, &coordinates[0], numberOfParts );
+		m_MovingPoints = m_MovingPointStorage.data();
+	}
+	if ( !m_NeighborOffsetStorage.empty() )
+	{
+		m_NeighborOffsetStorage.Place( pool, &vertices[0], numberOfParts );
+		m_NeighborOffsets = m_NeighborOffsetStorage.data();
+		m_NeighborStorage.Place( pool, &neighbors[0], numberOfParts );
+		m_Neighbors = m_NeighborStorage.data();
+	}
+	m_ReverseNeighborOffsets.Place( pool, &vertices[0], numberOfParts );
+	m_ReverseNeighbors.Place( pool, &reverseNeighbors[0], numberOfParts );
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::ComputeVertexOrder()
+{
+	m_VertexOrder.resize( m_NumberOfMovingPoints );
+	if ( m_NumberOfMovingPoints == 0 )
+	{
+		return;
+	}
+
+	double lower[3];
+	double upper[3];
+	for ( unsigned int axis = 0; axis < 3; ++axis )
+	{
+		lower[axis] = upper[axis] = m_MovingPoints[axis];
+	}
+	for ( SizeValueType i = 1; i < m_NumberOfMovingPoints; ++i )
+	{
+		for ( unsigned int axis = 0; axis < 3; ++axis )
 		{
-			FixedPointIterator pointItr2 = fixedMesh->GetPoints()->Begin();
-			FixedPointIterator pointEnd2 = fixedMesh->GetPoints()->End();
+			lower[axis] = std::min( lower[axis], static_cast< double >( m_MovingPoints[i*3+axis] ) );
+			upper[axis] = std::max( upper[axis], static_cast< double >( m_MovingPoints[i*3+axis] ) );
+		}
+	}
 
-			while ( pointItr2 != pointEnd2 )
+	// 10 bits per axis, interleaved into a 30 bit code
+	const uint32_t cells = 1u << 10;
+	std::vector< std::pair< uint32_t, uint32_t > > codes( m_NumberOfMovingPoints );
+	for ( SizeValueType i = 0; i < m_NumberOfMovingPoints; ++i )
+	{
+		uint32_t code = 0;
+		for ( unsigned int axis = 0; axis < 3; ++axis )
+		{
+			const double extent = upper[axis] - lower[axis];
+			const double position = extent > 0.0 ? ( m_MovingPoints[i*3+axis] - lower[axis] ) / extent : 0.0;
+			const uint32_t cell = std::min( static_cast< uint32_t >( position * cells ), cells - 1 );
+			for ( unsigned int bit = 0; bit < 10; ++bit )
 			{
-				double dist = pointItr2.Value().SquaredEuclideanDistanceTo(transformedPoint);
+				code |= ( ( cell >> bit ) & 1u ) << ( 3 * bit + axis );
+			}
+		}
+		codes[i] = std::make_pair( code, static_cast< uint32_t >( i ) );
+	}
+	std::sort( codes.begin(), codes.end() );
 
+	for ( SizeValueType i = 0; i < m_NumberOfMovingPoints; ++i )
+	{
+		m_VertexOrder[i] = codes[i].second;
+	}
+}
 
-				if ( dist < minimumDistance )
-				{
-					targetPoint.CastFrom( pointItr2.Value() );
-					minimumDistance = dist;
-				}
-				pointItr2++;
-			}
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+typename ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >::EvaluationStruct *
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::AcquireEvaluation() const
+{
+	MutexLockHolder< SimpleFastMutexLock > holder( m_FreeEvaluationsMutex );
+	if ( m_FreeEvaluations.empty() )
+	{
+		// room to take every workspace back without growing the list
+		m_FreeEvaluations.reserve( ++m_NumberOfEvaluationWorkspaces );
+		return new EvaluationStruct;
+	}
+	EvaluationStruct *str = m_FreeEvaluations.back();
+	m_FreeEvaluations.pop_back();
+	return str;
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::ReleaseEvaluation(EvaluationStruct *str) const
+{
+	str->Reset();
+	MutexLockHolder< SimpleFastMutexLock > holder( m_FreeEvaluationsMutex );
+	m_FreeEvaluations.push_back( str );
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::ReserveEvaluations()
+{
+	// Size the workspaces for the largest parallel section, so that the
+	// evaluations that follow do not allocate.
+	const SizeValueType numberOfParts = std::max< SizeValueType >( m_Partition.size(), 2 ) - 1;
+	const SizeValueType numberOfBlocks = ( m_NumberOfMovingPoints + ReductionBlockSize - 1 ) / ReductionBlockSize;
+	const SizeValueType numberOfTimes = std::max< SizeValueType >( numberOfParts, m_NumberOfThreads );
+
+	// the laplacians are placed like the other vertex arrays
+	std::vector< SizeValueType > coordinates( numberOfParts + 1 );
+	for ( SizeValueType p = 0; p <= numberOfParts; ++p )
+	{
+		coordinates[p] = 3 * m_Partition[p];
+	}
+	WorkerPool *pool = this->GetActiveWorkerPool();
+
+	MutexLockHolder< SimpleFastMutexLock > holder( m_FreeEvaluationsMutex );
+	if ( m_FreeEvaluations.empty() )
+	{
+		m_FreeEvaluations.reserve( ++m_NumberOfEvaluationWorkspaces );
+		m_FreeEvaluations.push_back( new EvaluationStruct );
+	}
+	for ( size_t i = 0; i < m_FreeEvaluations.size(); ++i )
+	{
+		EvaluationStruct *str = m_FreeEvaluations[i];
+		str->ThreadValues.reserve( numberOfParts * NumberOfEnergyTerms * ThinShellDemonsKernels::MaximumBatchSize );
+		str->BlockValues.reserve( numberOfBlocks * NumberOfEnergyTerms * ThinShellDemonsKernels::MaximumBatchSize );
+		str->ThreadTimes.reserve( numberOfTimes );
+		str->Laplacians.Allocate( m_NumberOfMovingPoints * 3 );
+		if ( numberOfParts > 1 )
+		{
+			str->Laplacians.Place( pool, &coordinates[0], static_cast< ThreadIdType >( numberOfParts ), false );
 		}
+	}
+	m_ThreadTimes.reserve( numberOfTimes );
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+SizeValueType
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::GetWorkspaceSizeInBytes() const
+{
+	// the idle workspaces; the ones of running evaluations are not counted
+	MutexLockHolder< SimpleFastMutexLock > holder( m_FreeEvaluationsMutex );
+	SizeValueType bytes = 0;
+	for ( size_t i = 0; i < m_FreeEvaluations.size(); ++i )
+	{
+		bytes += m_FreeEvaluations[i]->Laplacians.GetSizeInBytes();
+	}
+	return bytes;
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+SizeValueType
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::GetNumberOfEvaluationWorkspaces() const
+{
+	MutexLockHolder< SimpleFastMutexLock > holder( m_FreeEvaluationsMutex );
+	return m_NumberOfEvaluationWorkspaces;
+}
 
-		targetMap[identifier] = targetPoint;
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+WorkerPool *
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::GetActiveWorkerPool() const
+{
+	return m_WorkerPool ? m_WorkerPool.GetPointer() : WorkerPool::GetGlobalPool();
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::ParallelForVertices(EvaluationStruct & str) const
+{
+	str.Metric = this;
+	str.Partition = m_Partition.empty() ? ITK_NULLPTR : &m_Partition[0];
+	str.NumberOfParts = m_Partition.empty() ? 0 : static_cast< ThreadIdType >( m_Partition.size() - 1 );
+	str.ThreadValues.assign( std::max< ThreadIdType >( str.NumberOfParts, 1 ) * str.GetNumberOfValues(), 0.0 );
+	if ( str.NumberOfParts == 0 || m_NumberOfMovingPoints == 0 )
+	{
+		// nothing to evaluate
+		str.NumberOfParts = 1;
+		MutexLockHolder< SimpleFastMutexLock > holder( m_EvaluationMutex );
+		m_ThreadTimes.assign( 1, 0.0 );
+		return;
+	}
 
-		++pointItr;
-		identifier++;
+	if ( str.NumberOfParts == 1 )
+	{
+		const double start = m_Clock->GetTimeInSeconds();
+		( this->*str.Method )( &str, 0, m_NumberOfMovingPoints, 0 );
+		const double elapsed = m_Clock->GetTimeInSeconds() - start;
+		MutexLockHolder< SimpleFastMutexLock > holder( m_EvaluationMutex );
+		m_ThreadTimes.assign( 1, elapsed );
+		return;
 	}
 
-	m_TargetPositionComputed = true;
+	str.ThreadTimes.assign( str.NumberOfParts, 0.0 );
+	this->GetActiveWorkerPool()->Execute( Self::EvaluationJob, &str, str.NumberOfParts );
 
-	//generate a VTK copy of the same mesh
-	itkMeshTovtkPolyData* dataTransfer = new itkMeshTovtkPolyData();
-	dataTransfer->SetInput(movingMesh);
-	movingVTKMesh = dataTransfer->GetOutput();
+	MutexLockHolder< SimpleFastMutexLock > holder( m_EvaluationMutex );
+	m_ThreadTimes = str.ThreadTimes;
 }
 
-template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap >
-typename ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap >::MeasureType
-ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap >
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::EvaluationJob(void *data, ThreadIdType threadId, ThreadIdType numberOfThreads)
+{
+	EvaluationStruct *str = static_cast< EvaluationStruct * >( data );
+
+	// The pool may run fewer threads than there are parts, e.g. when it is
+	// busy; the results are stored per part either way.
+	for ( ThreadIdType part = threadId; part < str->NumberOfParts; part += numberOfThreads )
+	{
+		const double start = str->Metric->m_Clock->GetTimeInSeconds();
+		( str->Metric->*str->Method )( str, str->Partition[part], str->Partition[part + 1], part );
+		str->ThreadTimes[part] = str->Metric->m_Clock->GetTimeInSeconds() - start;
+	}
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::ParallelForVertexChunks(EvaluationStruct & str, SizeValueType chunkSize) const
+{
+	// A closest point query costs far more than the energy of a vertex, so
+	// MinimumVerticesPerThread does not apply; one chunk per thread does.
+	WorkerPool *pool = this->GetActiveWorkerPool();
+	const SizeValueType numberOfChunks = ( m_NumberOfMovingPoints + chunkSize - 1 ) / chunkSize;
+	ThreadIdType numberOfThreads = std::min( m_NumberOfThreads, pool->GetNumberOfThreads() );
+	numberOfThreads = static_cast< ThreadIdType >( std::min< SizeValueType >( numberOfThreads, numberOfChunks ) );
+
+	str.Metric = this;
+	str.Order = m_VertexOrder.size() == m_NumberOfMovingPoints && !m_VertexOrder.empty() ? &m_VertexOrder[0] : ITK_NULLPTR;
+	str.NumberOfParts = std::max< ThreadIdType >( numberOfThreads, 1 );
+	str.ThreadValues.assign( str.NumberOfParts * NumberOfEnergyTerms, 0.0 );
+	if ( numberOfThreads <= 1 )
+	{
+		const double start = m_Clock->GetTimeInSeconds();
+		if ( m_NumberOfMovingPoints > 0 )
+		{
+			( this->*str.Method )( &str, 0, m_NumberOfMovingPoints, 0 );
+		}
+		const double elapsed = m_Clock->GetTimeInSeconds() - start;
+		MutexLockHolder< SimpleFastMutexLock > holder( m_EvaluationMutex );
+		m_ThreadTimes.assign( 1, elapsed );
+		return;
+	}
+
+	WorkStealingScheduler scheduler;
+	scheduler.Initialize( m_NumberOfMovingPoints, chunkSize, numberOfThreads );
+	str.Scheduler = &scheduler;
+	str.ThreadTimes.assign( numberOfThreads, 0.0 );
+	pool->Execute( Self::StealingJob, &str, numberOfThreads );
+
+	MutexLockHolder< SimpleFastMutexLock > holder( m_EvaluationMutex );
+	m_ThreadTimes = str.ThreadTimes;
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+	ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+	::StealingJob(void *data, ThreadIdType threadId, ThreadIdType)
+{
+	EvaluationStruct *str = static_cast< EvaluationStruct * >( data );
+
+	const double  start = str->Metric->m_Clock->GetTimeInSeconds();
+	SizeValueType begin;
+	SizeValueType end;
+	while ( str->Scheduler->NextChunk( threadId, begin, end ) )
+	{
+		( str->Metric->*str->Method )( str, begin, end, threadId );
+	}
+	str->ThreadTimes[threadId] = str->Metric->m_Clock->GetTimeInSeconds() - start;
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+typename ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >::MeasureType
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
 ::GetValue(const TransformParametersType & parameters) const
 {
   FixedMeshConstPointer fixedMesh = this->GetFixedMesh();
@@ -163,87 +741,252 @@ ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap >
     itkExceptionMacro(<< "Moving point set has not been assigned");
     }
 
-  MovingPointIterator pointItr = movingMesh->GetPoints()->Begin();
-  MovingPointIterator pointEnd = movingMesh->GetPoints()->End();
+  if ( !m_TargetPositionComputed )
+    {
+    itkExceptionMacro(<< "Metric has not been initialized");
+    }
 
+  if ( parameters.Size() != m_NumberOfMovingPoints * 3 )
+    {
+    itkExceptionMacro(<< "Parameters have " << parameters.Size() << " values, expected "
+                      << m_NumberOfMovingPoints * 3);
+    }
 
-  this->SetTransformParameters(parameters);
+  RegistrationProfiler::Scope profilerScope(this->m_Profiler.GetPointer(), RegistrationProfiler::GetValuePhase,
+                                            m_EvaluationBytes);
+
+  // the parameters are only read, not stored in the transform, so that
+  // several threads may evaluate the metric at once, e.g. when checking
+  // the derivative against finite differences
+  EvaluationHolder  evaluation( this );
+  EvaluationStruct &str = *evaluation;
+  str.Method = &Self::ComputeValueRange;
+  str.Parameters = parameters.data_block();
+  const SizeValueType numberOfBlocks = ( m_NumberOfMovingPoints + ReductionBlockSize - 1 ) / ReductionBlockSize;
+  if ( m_Deterministic )
+    {
+    str.BlockValues.assign( numberOfBlocks * NumberOfEnergyTerms, 0.0 );
+    }
+  this->ParallelForVertices( str );
 
-  // data fidelity energy (squared distance to target position)
-  int identifier = 0;
-  double functionValue = 0;
-  while ( pointItr != pointEnd )
+  double terms[NumberOfEnergyTerms] = { 0.0, 0.0, 0.0 };
+  if ( !str.BlockValues.empty() )
+    {
+    for ( unsigned int k = 0; k < NumberOfEnergyTerms; k++ )
+      {
+      terms[k] = ThinShellDemonsKernels::PairwiseSum( &str.BlockValues[k], NumberOfEnergyTerms, numberOfBlocks );
+      }
+    }
+  else
     {
-	// get the current position of the vertex
-    InputPointType inputPoint;
-    inputPoint.CastFrom( pointItr.Value() );
-	InputVectorType vec;
-	vec[0] = parameters[identifier*3];
-	vec[1] = parameters[identifier*3+1];
-	vec[2] = parameters[identifier*3+2];
-    // get the transformed vertex
-	typename Superclass::OutputPointType transformedPoint = inputPoint + vec;
-
-    // compute squared Euclidean distance to its target position
-	InputPointType targetPoint = targetMap.ElementAt (identifier);
-	double dist = targetPoint.SquaredEuclideanDistanceTo(transformedPoint);
-
-	functionValue += dist;
-
-    ++pointItr;
-    identifier++;
+    for ( ThreadIdType part = 0; part < str.NumberOfParts; part++ )
+      {
+      for ( unsigned int k = 0; k < NumberOfEnergyTerms; k++ )
+        {
+        terms[k] += str.ThreadValues[part * NumberOfEnergyTerms + k];
+        }
+      }
     }
 
-  // stretching energy
-  identifier = 0;
-  pointItr = movingMesh->GetPoints()->Begin();
-  pointEnd = movingMesh->GetPoints()->End();
-  while ( pointItr != pointEnd )
-  {
-	  vtkSmartPointer<vtkIdList> cellIdList =
-		  vtkSmartPointer<vtkIdList>::New();
-	  movingVTKMesh->GetPointCells(identifier, cellIdList);
-
-	  //enumerate all the neighboring vertices (edges) of a given vertex
-	  //stretching energy : measure the squared derivative along different edge directions
-	  //bending energy : measure the local laplacian around the local patch using the given vertex and all neighboring vertices
-	  int neighborIdx;
-	  double lx = 0; //laplacian
-	  double ly = 0;
-	  double lz = 0;
-	  for(int i = 0; i < cellIdList->GetNumberOfIds(); i++)
-	  {
-		  vtkSmartPointer<vtkIdList> pointIdList =
-			  vtkSmartPointer<vtkIdList>::New();
-		  movingVTKMesh->GetCellPoints(cellIdList->GetId(i), pointIdList);
-
-		  if(pointIdList->GetId(0) != identifier)
-			  neighborIdx = pointIdList->GetId(0);
-		  else
-			  neighborIdx = pointIdList->GetId(1);
-
-		  //derivative
-		  double dx = parameters[identifier*3] - parameters[neighborIdx*3];
-		  double dy = parameters[identifier*3+1] - parameters[neighborIdx*3+1];
-		  double dz = parameters[identifier*3+2] - parameters[neighborIdx*3+2];
-          // stretching energy associated with an edge
-		  functionValue += m_StretchWeight * (dx*dx + dy*dy + dz*dz);
-
-		  lx += dx; ly += dy; lz += dz;
-	  }
+  double functionValue = 0;
+  for ( unsigned int k = 0; k < NumberOfEnergyTerms; k++ )
+    {
+    functionValue += terms[k];
+    }
 
-      //bending energy associated with a vertex-ring stencil
-	  functionValue += m_BendWeight * (lx*lx + ly*ly + lz*lz);
-	  ++pointItr;
-	  identifier++;
-  }
+  MutexLockHolder< SimpleFastMutexLock > holder( m_EvaluationMutex );
+  std::copy( terms, terms + NumberOfEnergyTerms, m_EnergyTerms );
 
   return functionValue;
 }
 
-template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap >
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
 void
-ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap >
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::GetValues(const ParametersListType & parameters, MeasureListType & values) const
+{
+  if ( !this->GetFixedMesh() )
+    {
+    itkExceptionMacro(<< "Fixed point set has not been assigned");
+    }
+
+  if ( !this->GetMovingMesh() )
+    {
+    itkExceptionMacro(<< "Moving point set has not been assigned");
+    }
+
+  if ( !m_TargetPositionComputed )
+    {
+    itkExceptionMacro(<< "Metric has not been initialized");
+    }
+
+  for ( size_t k = 0; k < parameters.size(); ++k )
+    {
+    if ( parameters[k].Size() != m_NumberOfMovingPoints * 3 )
+      {
+      itkExceptionMacro(<< "Parameters " << k << " have " << parameters[k].Size() << " values, expected "
+                        << m_NumberOfMovingPoints * 3);
+      }
+    }
+
+  values.resize( parameters.size() );
+  if ( parameters.empty() )
+    {
+    return;
+    }
+
+  // the shared arrays once per batch, the displacements once per evaluation
+  const SizeValueType numberOfEvaluations = parameters.size();
+  const SizeValueType numberOfBatches =
+    ( numberOfEvaluations + ThinShellDemonsKernels::MaximumBatchSize - 1 ) / ThinShellDemonsKernels::MaximumBatchSize;
+  RegistrationProfiler::Scope profilerScope(this->m_Profiler.GetPointer(), RegistrationProfiler::GetValuePhase,
+                                            numberOfBatches * m_EvaluationBytes
+                                            + ( numberOfEvaluations - numberOfBatches ) * m_NumberOfMovingPoints * 3
+                                              * sizeof( double ));
+
+  EvaluationHolder  evaluation( this );
+  EvaluationStruct &str = *evaluation;
+  str.Method = &Self::ComputeValueRange;
+  const SizeValueType numberOfBlocks = ( m_NumberOfMovingPoints + ReductionBlockSize - 1 ) / ReductionBlockSize;
+  for ( SizeValueType first = 0; first < numberOfEvaluations; first += ThinShellDemonsKernels::MaximumBatchSize )
+    {
+    str.BatchSize = static_cast< unsigned int >(
+      std::min< SizeValueType >( numberOfEvaluations - first, ThinShellDemonsKernels::MaximumBatchSize ) );
+    for ( unsigned int k = 0; k < str.BatchSize; ++k )
+      {
+      str.BatchParameters[k] = parameters[first + k].data_block();
+      }
+    const SizeValueType numberOfValues = str.GetNumberOfValues();
+    if ( m_Deterministic )
+      {
+      str.BlockValues.assign( numberOfBlocks * numberOfValues, 0.0 );
+      }
+    this->ParallelForVertices( str );
+
+    // each evaluation as GetValue() sums it
+    for ( unsigned int k = 0; k < str.BatchSize; ++k )
+      {
+      double terms[NumberOfEnergyTerms] = { 0.0, 0.0, 0.0 };
+      for ( unsigned int t = 0; t < NumberOfEnergyTerms; t++ )
+        {
+        const SizeValueType offset = k * NumberOfEnergyTerms + t;
+        if ( !str.BlockValues.empty() )
+          {
+          terms[t] = ThinShellDemonsKernels::PairwiseSum( &str.BlockValues[offset], numberOfValues, numberOfBlocks );
+          }
+        else
+          {
+          for ( ThreadIdType part = 0; part < str.NumberOfParts; part++ )
+            {
+            terms[t] += str.ThreadValues[part * numberOfValues + offset];
+            }
+          }
+        }
+
+      double functionValue = 0;
+      for ( unsigned int t = 0; t < NumberOfEnergyTerms; t++ )
+        {
+        functionValue += terms[t];
+        }
+      values[first + k] = functionValue;
+      }
+    }
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::ComputeValueRange(EvaluationStruct *str, SizeValueType begin, SizeValueType end, ThreadIdType part) const
+{
+  const SizeValueType numberOfValues = str->GetNumberOfValues();
+  if ( str->BlockValues.empty() )
+    {
+    this->ComputeEnergyTerms( str, begin, end, &str->ThreadValues[part * numberOfValues] );
+    return;
+    }
+
+  // the part starts on a block boundary, see ComputePartition()
+  for ( SizeValueType blockBegin = begin; blockBegin < end; blockBegin += ReductionBlockSize )
+    {
+    const SizeValueType blockEnd = std::min< SizeValueType >( blockBegin + ReductionBlockSize, end );
+    this->ComputeEnergyTerms( str, blockBegin, blockEnd,
+                              &str->BlockValues[blockBegin / ReductionBlockSize * numberOfValues] );
+    }
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::ComputeEnergyTerms(const EvaluationStruct *str, SizeValueType begin, SizeValueType end, double *terms) const
+{
+  if ( str->BatchSize > 0 )
+    {
+    // NumberOfEnergyTerms terms per evaluation of the batch
+    double data[ThinShellDemonsKernels::MaximumBatchSize];
+    double stretch[ThinShellDemonsKernels::MaximumBatchSize];
+    double bend[ThinShellDemonsKernels::MaximumBatchSize];
+    ThinShellDemonsKernels::BatchEnergy( &m_TargetPositions[0], m_MovingPoints, m_NeighborOffsets, m_Neighbors,
+                                         str->BatchParameters, str->BatchSize, begin, end, data, stretch, bend );
+    for ( unsigned int k = 0; k < str->BatchSize; ++k )
+      {
+      terms[k * NumberOfEnergyTerms + DataTerm] = data[k];
+      terms[k * NumberOfEnergyTerms + StretchTerm] = m_StretchWeight * stretch[k];
+      terms[k * NumberOfEnergyTerms + BendTerm] = m_BendWeight * bend[k];
+      }
+    return;
+    }
+
+  const double *parameters = str->Parameters;
+  // data fidelity energy (squared distance to target position)
+  const double data = ThinShellDemonsKernels::DataEnergy( &m_TargetPositions[0], m_MovingPoints, parameters,
+                                                         begin, end );
+
+  // stretching energy: squared derivative along the edges to the neighbors;
+  // bending energy: squared laplacian over the one ring of each vertex
+  double stretch;
+  double bend;
+  ThinShellDemonsKernels::RegularizerEnergy( m_NeighborOffsets, m_Neighbors, parameters, begin, end,
+                                             stretch, bend );
+
+  terms[DataTerm] = data;
+  terms[StretchTerm] = m_StretchWeight * stretch;
+  terms[BendTerm] = m_BendWeight * bend;
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+const char *
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::GetEnergyTermName(unsigned int term) const
+{
+  switch ( term )
+    {
+    case DataTerm:
+      return "data";
+    case StretchTerm:
+      return "stretch";
+    case BendTerm:
+      return "bend";
+    default:
+      return "";
+    }
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+double
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::GetEnergyTerm(unsigned int term) const
+{
+  if ( term >= NumberOfEnergyTerms )
+    {
+    return 0.0;
+    }
+  MutexLockHolder< SimpleFastMutexLock > holder( m_EvaluationMutex );
+  return m_EnergyTerms[term];
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
 ::GetDerivative( const TransformParametersType & parameters,
                  DerivativeType & derivative ) const
 {
@@ -261,123 +1004,117 @@ ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap >
 		itkExceptionMacro(<< "Moving point set has not been assigned");
 	}
 
+	if ( !m_TargetPositionComputed )
+	{
+		itkExceptionMacro(<< "Metric has not been initialized");
+	}
 
-	if( derivative.GetSize() != movingMesh->GetNumberOfPoints() * 3 )
+	if ( parameters.Size() != m_NumberOfMovingPoints * 3 )
 	{
-		derivative = DerivativeType(movingMesh->GetNumberOfPoints() * 3);
+		itkExceptionMacro(<< "Parameters have " << parameters.Size() << " values, expected "
+			<< m_NumberOfMovingPoints * 3);
 	}
-	memset( derivative.data_block(),
-		0,
-		movingMesh->GetNumberOfPoints() * 3 * sizeof( double ) );
 
-	// derivative of data fidelity energy (squared distance to target position)
-	MovingPointIterator pointItr = movingMesh->GetPoints()->Begin();
-	MovingPointIterator pointEnd = movingMesh->GetPoints()->End();
+	RegistrationProfiler::Scope profilerScope(this->m_Profiler.GetPointer(), RegistrationProfiler::GetDerivativePhase,
+		m_EvaluationBytes + m_NumberOfMovingPoints * 3 * sizeof( double ));
 
-	int identifier = 0;
-	double functionValue = 0;
-	while ( pointItr != pointEnd )
+	if( derivative.GetSize() != m_NumberOfMovingPoints * 3 )
 	{
-		InputPointType inputPoint;
-		inputPoint.CastFrom( pointItr.Value() );
-		InputVectorType vec;
-		vec[0] = parameters[identifier*3];
-		vec[1] = parameters[identifier*3+1];
-		vec[2] = parameters[identifier*3+2];
-		typename Superclass::OutputPointType transformedPoint = inputPoint + vec;
-
-		InputPointType targetPoint = targetMap.ElementAt (identifier);
-
-		InputPointType::VectorType distVec = targetPoint - inputPoint;
-		derivative[identifier*3]     = -2 * distVec[0];
-		derivative[identifier*3 + 1] = -2 * distVec[1];
-		derivative[identifier*3 + 2] = -2 * distVec[2];
-
-		++pointItr;
-		identifier++;
-	}
-
-	// derivative of stretching & bending energy
-	identifier = 0;
-	pointItr = movingMesh->GetPoints()->Begin();
-	pointEnd = movingMesh->GetPoints()->End();
-	while ( pointItr != pointEnd )
-	{
-		vtkSmartPointer<vtkIdList> cellIdList =
-			vtkSmartPointer<vtkIdList>::New();
-		movingVTKMesh->GetPointCells(identifier, cellIdList);
-
-		int neighborIdx;
-		double lx = 0;
-		double ly = 0;
-		double lz = 0;
-		for(int i = 0; i < cellIdList->GetNumberOfIds(); i++)
-		{
-			vtkSmartPointer<vtkIdList> pointIdList =
-				vtkSmartPointer<vtkIdList>::New();
-			movingVTKMesh->GetCellPoints(cellIdList->GetId(i), pointIdList);
-
-			if(pointIdList->GetId(0) != identifier)
-				neighborIdx = pointIdList->GetId(0);
-			else
-				neighborIdx = pointIdList->GetId(1);
-
-			double dx = parameters[identifier*3] - parameters[neighborIdx*3];
-			double dy = parameters[identifier*3+1] - parameters[neighborIdx*3+1];
-			double dz = parameters[identifier*3+2] - parameters[neighborIdx*3+2];
-
-            // derivative of stretching energy
-			derivative[identifier*3]   += 2 * dx * m_StretchWeight;
-			derivative[identifier*3+1] += 2 * dy * m_StretchWeight;
-			derivative[identifier*3+2] += 2 * dz * m_StretchWeight;
-			derivative[neighborIdx*3]   -= 2 * dx * m_StretchWeight;
-			derivative[neighborIdx*3+1] -= 2 * dy * m_StretchWeight;
-			derivative[neighborIdx*3+2] -= 2 * dz * m_StretchWeight;
-
-			lx += dx; ly += dy; lz += dz;
-		}
-
-		for(int i = 0; i < cellIdList->GetNumberOfIds(); i++)
-		{
-			vtkSmartPointer<vtkIdList> pointIdList =
-				vtkSmartPointer<vtkIdList>::New();
-			movingVTKMesh->GetCellPoints(cellIdList->GetId(i), pointIdList);
-
-			if(pointIdList->GetId(0) != identifier)
-				neighborIdx = pointIdList->GetId(0);
-			else
-				neighborIdx = pointIdList->GetId(1);
-
-            // derivative of bending energy
-			derivative[identifier*3]   += 2 * lx * m_BendWeight;
-			derivative[identifier*3+1] += 2 * ly * m_BendWeight;
-			derivative[identifier*3+2] += 2 * lz * m_BendWeight;
-			derivative[neighborIdx*3]   -= 2 * lx * m_BendWeight;
-			derivative[neighborIdx*3+1] -= 2 * ly * m_BendWeight;
-			derivative[neighborIdx*3+2] -= 2 * lz * m_BendWeight;
-		}
+		derivative = DerivativeType(m_NumberOfMovingPoints * 3);
+	}
 
-		++pointItr;
-		identifier++;
+	// Two passes, so that every vertex gathers its own derivative and the
+	// threads never write to the same entry: the laplacian of each vertex,
+	// then the derivative from the vertex's neighbors and from the vertices
+	// it is a neighbor of.
+	EvaluationHolder  evaluation( this );
+	EvaluationStruct &str = *evaluation;
+	str.Parameters = parameters.data_block();
+	str.Output = derivative.data_block();
+	if ( str.Laplacians.size() != m_NumberOfMovingPoints * 3 )
+	{
+		// a workspace created for a concurrent call
+		str.Laplacians.Allocate( m_NumberOfMovingPoints * 3 );
 	}
+
+	str.Method = &Self::ComputeLaplacianRange;
+	this->ParallelForVertices( str );
+
+	str.Method = &Self::ComputeDerivativeRange;
+	this->ParallelForVertices( str );
 }
 
-template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap >
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
 void
-ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap >
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::ComputeLaplacianRange(EvaluationStruct *str, SizeValueType begin, SizeValueType end, ThreadIdType) const
+{
+	ThinShellDemonsKernels::LaplacianProduct( m_NeighborOffsets, m_Neighbors, str->Parameters, begin, end,
+		&str->Laplacians[0] );
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::ComputeDerivativeRange(EvaluationStruct *str, SizeValueType begin, SizeValueType end, ThreadIdType) const
+{
+	ThinShellDemonsKernels::GatherDerivative( &m_TargetPositions[0], m_MovingPoints, str->Parameters,
+		m_NeighborOffsets,
+		m_ReverseNeighborOffsets.empty() ? ITK_NULLPTR : &m_ReverseNeighborOffsets[0],
+		m_ReverseNeighbors.empty() ? ITK_NULLPTR : &m_ReverseNeighbors[0],
+		&str->Laplacians[0], m_StretchWeight, m_BendWeight, begin, end, str->Output );
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
 ::GetValueAndDerivative(const TransformParametersType & parameters,
                         MeasureType & value, DerivativeType  & derivative) const
 {
+  if ( m_TargetPositionComputed && parameters.Size() != m_NumberOfMovingPoints * 3 )
+    {
+    itkExceptionMacro(<< "Parameters have " << parameters.Size() << " values, expected "
+                      << m_NumberOfMovingPoints * 3);
+    }
   value = this->GetValue(parameters);
   this->GetDerivative(parameters, derivative);
 }
 
-template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap >
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
 void
-ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap >
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
+::UpdateMemoryUsage(RegistrationMemoryUsage *usage) const
+{
+  if ( !usage )
+    {
+    return;
+    }
+  usage->SetBytes( RegistrationMemoryUsage::FixedPointsComponent, m_FixedPointStorage.capacity() * sizeof( double ) );
+  usage->SetBytes( RegistrationMemoryUsage::MovingPointsComponent, m_MovingPointStorage.GetSizeInBytes() );
+  usage->SetBytes( RegistrationMemoryUsage::TargetPositionsComponent, m_TargetPositions.GetSizeInBytes() );
+  usage->SetBytes( RegistrationMemoryUsage::NeighborhoodsComponent,
+                   m_NeighborOffsetStorage.GetSizeInBytes() + m_ReverseNeighborOffsets.GetSizeInBytes()
+                   + m_NeighborStorage.GetSizeInBytes() + m_ReverseNeighbors.GetSizeInBytes()
+                   + this->GetWorkspaceSizeInBytes() );
+  usage->SetBytes( RegistrationMemoryUsage::SpatialIndexComponent,
+                   m_InternalFixedPointLocator && !m_FixedPointLocator ? m_InternalFixedPointLocator->GetSizeInBytes() : 0 );
+}
+
+template< typename TFixedMesh, typename TMovingMesh, typename TDistanceMap, typename TPrecision >
+void
+ThinShellDemonsMetric< TFixedMesh, TMovingMesh, TDistanceMap, TPrecision >
 ::PrintSelf(std::ostream & os, Indent indent) const
 {
   Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfThreads: " << m_NumberOfThreads << std::endl;
+  os << indent << "MinimumVerticesPerThread: " << m_MinimumVerticesPerThread << std::endl;
+  os << indent << "CorrespondenceChunkSize: " << m_CorrespondenceChunkSize << std::endl;
+  os << indent << "Deterministic: " << m_Deterministic << std::endl;
+  os << indent << "WorkerPool: " << m_WorkerPool.GetPointer() << std::endl;
+  for ( unsigned int k = 0; k < NumberOfEnergyTerms; k++ )
+    {
+    os << indent << "EnergyTerm " << this->GetEnergyTermName(k) << ": " << this->GetEnergyTerm(k) << std::endl;
+    }
 }
 } // end namespace itk
 
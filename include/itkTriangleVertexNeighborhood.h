@@ -0,0 +1,125 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkTriangleVertexNeighborhood_h
+#define itkTriangleVertexNeighborhood_h
+
+#include "itkIntTypes.h"
+
+namespace itk
+{
+/** \class TriangleVertexNeighborhood
+ * \brief Builds the vertex neighborhoods used by the thin shell energy.
+ *
+ * The neighborhoods are stored in compressed row form: vertex i has the
+ * neighbors neighbors[offsets[i]] ... neighbors[offsets[i+1]-1], one entry
+ * per incident triangle, namely the first vertex of that triangle which is
+ * not i. Triangles are visited in order, so each vertex lists its incident
+ * triangles by increasing cell id.
+ *
+ * Shared by ThinShellDemonsMetric and SharedTemplateCache so that both
+ * produce the same arrays.
+ *
+ */
+struct TriangleVertexNeighborhood
+{
+  /** Number of neighbor entries for the given number of triangles. */
+  static SizeValueType GetNumberOfNeighbors(SizeValueType numberOfTriangles)
+  {
+    return 3 * numberOfTriangles;
+  }
+
+  /** Fill offsets (numberOfPoints + 1 entries) and neighbors
+   *  (GetNumberOfNeighbors() entries). Returns false, leaving the arrays
+   *  undefined, if a triangle references a vertex out of range. */
+  static bool Build(const uint32_t *triangles, SizeValueType numberOfTriangles, SizeValueType numberOfPoints,
+                    SizeValueType *offsets, uint32_t *neighbors)
+  {
+    // counting sort by vertex
+    for ( SizeValueType i = 0; i <= numberOfPoints; ++i )
+      {
+      offsets[i] = 0;
+      }
+    for ( SizeValueType i = 0; i < 3 * numberOfTriangles; ++i )
+      {
+      if ( triangles[i] >= numberOfPoints )
+        {
+        return false;
+        }
+      offsets[triangles[i] + 1]++;
+      }
+    for ( SizeValueType i = 0; i < numberOfPoints; ++i )
+      {
+      offsets[i + 1] += offsets[i];
+      }
+
+    // offsets[i] is used as the fill position of vertex i, which moves it to
+    // the start of vertex i+1; shift back afterwards
+    for ( SizeValueType t = 0; t < numberOfTriangles; ++t )
+      {
+      const uint32_t *triangle = triangles + 3 * t;
+      for ( unsigned int k = 0; k < 3; ++k )
+        {
+        const uint32_t vertex = triangle[k];
+        neighbors[offsets[vertex]++] = ( triangle[0] != vertex ) ? triangle[0] : triangle[1];
+        }
+      }
+    for ( SizeValueType i = numberOfPoints; i > 0; --i )
+      {
+      offsets[i] = offsets[i - 1];
+      }
+    offsets[0] = 0;
+    return true;
+  }
+
+  /** Fill the transposed neighborhoods: vertex j lists every vertex i that
+   *  has j among its neighbors, once per occurrence, by increasing i. This
+   *  lets a derivative be gathered per vertex instead of scattered to the
+   *  neighbors. transposedOffsets has numberOfPoints + 1 entries,
+   *  transposedNeighbors as many as neighbors. */
+  static void Transpose(const SizeValueType *offsets, const uint32_t *neighbors, SizeValueType numberOfPoints,
+                        SizeValueType *transposedOffsets, uint32_t *transposedNeighbors)
+  {
+    for ( SizeValueType i = 0; i <= numberOfPoints; ++i )
+      {
+      transposedOffsets[i] = 0;
+      }
+    for ( SizeValueType n = 0; n < offsets[numberOfPoints]; ++n )
+      {
+      transposedOffsets[neighbors[n] + 1]++;
+      }
+    for ( SizeValueType i = 0; i < numberOfPoints; ++i )
+      {
+      transposedOffsets[i + 1] += transposedOffsets[i];
+      }
+    for ( SizeValueType i = 0; i < numberOfPoints; ++i )
+      {
+      for ( SizeValueType n = offsets[i]; n < offsets[i + 1]; ++n )
+        {
+        transposedNeighbors[transposedOffsets[neighbors[n]]++] = static_cast< uint32_t >( i );
+        }
+      }
+    for ( SizeValueType i = numberOfPoints; i > 0; --i )
+      {
+      transposedOffsets[i] = transposedOffsets[i - 1];
+      }
+    transposedOffsets[0] = 0;
+  }
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,179 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkWorkStealingScheduler_h
+#define itkWorkStealingScheduler_h
+
+#include "itkIntTypes.h"
+#include "itkMacro.h"
+#include "itkSimpleFastMutexLock.h"
+#include "itkMutexLockHolder.h"
+#include <algorithm>
+
+namespace itk
+{
+/** \class WorkStealingScheduler
+ * \brief Hands out chunks of an index range to threads, which steal from
+ * each other when they run out.
+ *
+ * Initialize() splits [0, numberOfItems) into chunks of chunkSize items
+ * and gives every thread a contiguous run of chunks. NextChunk() returns
+ * the next chunk of the calling thread's run; when that is exhausted the
+ * thread takes the back half of the longest remaining run of another
+ * thread. Work whose cost varies between items, such as closest point
+ * queries, thus stays balanced, while each thread still mostly works on
+ * neighboring chunks.
+ *
+ * A run is guarded by a lock of its own, held for a few instructions per
+ * chunk; chunks should be large enough that this does not matter.
+ *
+ */
+class WorkStealingScheduler
+{
+public:
+  WorkStealingScheduler() :
+    m_NumberOfItems(0), m_ChunkSize(1), m_NumberOfThreads(0) {}
+
+  /** Split numberOfItems into chunks and deal them to numberOfThreads
+   *  threads. Not thread safe. */
+  void Initialize(SizeValueType numberOfItems, SizeValueType chunkSize, ThreadIdType numberOfThreads)
+  {
+    m_NumberOfItems = numberOfItems;
+    m_ChunkSize = std::max< SizeValueType >( chunkSize, 1 );
+    m_NumberOfThreads = std::max< ThreadIdType >( 1, std::min< ThreadIdType >( numberOfThreads, ITK_MAX_THREADS ) );
+    const SizeValueType numberOfChunks = this->GetNumberOfChunks();
+    for ( ThreadIdType t = 0; t < m_NumberOfThreads; ++t )
+      {
+      m_Runs[t].Front = numberOfChunks * t / m_NumberOfThreads;
+      m_Runs[t].Back = numberOfChunks * ( t + 1 ) / m_NumberOfThreads;
+      m_Runs[t].Steals = 0;
+      }
+  }
+
+  SizeValueType GetNumberOfChunks() const
+  {
+    return ( m_NumberOfItems + m_ChunkSize - 1 ) / m_ChunkSize;
+  }
+
+  ThreadIdType GetNumberOfThreads() const { return m_NumberOfThreads; }
+
+  /** The next items [begin, end) for thread threadId, false when every
+   *  chunk has been handed out. */
+  bool NextChunk(ThreadIdType threadId, SizeValueType & begin, SizeValueType & end)
+  {
+    SizeValueType chunk;
+    if ( !this->PopFront(threadId, chunk) )
+      {
+      if ( !this->Steal(threadId) || !this->PopFront(threadId, chunk) )
+        {
+        return false;
+        }
+      }
+    begin = chunk * m_ChunkSize;
+    end = std::min(begin + m_ChunkSize, m_NumberOfItems);
+    return true;
+  }
+
+  /** Number of successful steals by all threads since Initialize(). */
+  SizeValueType GetNumberOfSteals() const
+  {
+    SizeValueType steals = 0;
+    for ( ThreadIdType t = 0; t < m_NumberOfThreads; ++t )
+      {
+      steals += m_Runs[t].Steals;
+      }
+    return steals;
+  }
+
+private:
+  // chunks [Front, Back) of one thread, padded to a cache line of its own
+  struct RunType
+    {
+    SimpleFastMutexLock Lock;
+    SizeValueType       Front;
+    SizeValueType       Back;
+    SizeValueType       Steals;
+    char                Padding[64];
+    };
+
+  bool PopFront(ThreadIdType threadId, SizeValueType & chunk)
+  {
+    RunType &                              run = m_Runs[threadId];
+    MutexLockHolder< SimpleFastMutexLock > holder(run.Lock);
+    if ( run.Front >= run.Back )
+      {
+      return false;
+      }
+    chunk = run.Front++;
+    return true;
+  }
+
+  // move the back half of the longest other run to this thread's run
+  bool Steal(ThreadIdType threadId)
+  {
+    while ( true )
+      {
+      ThreadIdType  victim = threadId;
+      SizeValueType longest = 0;
+      for ( ThreadIdType k = 1; k < m_NumberOfThreads; ++k )
+        {
+        const ThreadIdType t = ( threadId + k ) % m_NumberOfThreads;
+        // unlocked peek, confirmed under the lock below
+        const SizeValueType length = m_Runs[t].Back > m_Runs[t].Front ? m_Runs[t].Back - m_Runs[t].Front : 0;
+        if ( length > longest )
+          {
+          longest = length;
+          victim = t;
+          }
+        }
+      if ( victim == threadId )
+        {
+        return false;
+        }
+
+      SizeValueType begin;
+      SizeValueType end;
+      {
+      MutexLockHolder< SimpleFastMutexLock > holder(m_Runs[victim].Lock);
+      RunType & run = m_Runs[victim];
+      if ( run.Front >= run.Back )
+        {
+        // emptied meanwhile, look again
+        continue;
+        }
+      const SizeValueType taken = ( run.Back - run.Front + 1 ) / 2;
+      end = run.Back;
+      begin = run.Back - taken;
+      run.Back = begin;
+      }
+
+      MutexLockHolder< SimpleFastMutexLock > holder(m_Runs[threadId].Lock);
+      m_Runs[threadId].Front = begin;
+      m_Runs[threadId].Back = end;
+      ++m_Runs[threadId].Steals;
+      return true;
+      }
+  }
+
+  SizeValueType m_NumberOfItems;
+  SizeValueType m_ChunkSize;
+  ThreadIdType  m_NumberOfThreads;
+  RunType       m_Runs[ITK_MAX_THREADS];
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,173 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkWorkerPool_h
+#define itkWorkerPool_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkIntTypes.h"
+#include "itkAtomicInt.h"
+#include "itkMultiThreader.h"
+#include "itkSimpleMutexLock.h"
+#include "itkConditionVariable.h"
+#include "ExternalTemplateExport.h"
+#include <vector>
+
+namespace itk
+{
+/** \class WorkerPool
+ * \brief Persistent threads for the short parallel sections of the metric.
+ *
+ * MultiThreader::SingleMethodExecute() creates and joins its threads on
+ * every call, which costs tens of microseconds per call; a metric
+ * evaluated thousands of times on a mid-size mesh spends a noticeable part
+ * of its time there. The pool starts its workers once and hands them jobs
+ * through a generation counter: Execute(job, data, n) runs job(data, t, n)
+ * for t = 0 ... n-1, part 0 on the calling thread and the others on
+ * workers, and returns when all are done. Idle workers spin for
+ * SpinCount polls before blocking on a condition variable, so back to back
+ * jobs start without a wake up.
+ *
+ * One job runs at a time. When the pool is busy, e.g. when two metrics
+ * share it from different threads or a job calls Execute() itself, the
+ * caller runs all n parts in turn instead of waiting, which keeps the
+ * result the same and cannot deadlock. Jobs must not throw.
+ *
+ * Part t of every job runs on the same worker, so data first written by
+ * part t lives on the memory node of that worker (see FirstTouchArray).
+ * This holds only while the pool is free: part 0 runs on whichever thread
+ * calls Execute(), and a busy pool runs every part on the caller.
+ * SetPinThreads(true) binds worker t to the t-th processor the process may
+ * run on, so that the operating system does not move it away from its
+ * data; the calling thread, which runs part 0, is left alone.
+ *
+ * GetGlobalPool() returns a pool with the global default number of
+ * threads, shared by everything that is not given a pool of its own.
+ *
+ */
+class ExternalTemplate_EXPORT WorkerPool:public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef WorkerPool                 Self;
+  typedef Object                     Superclass;
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(WorkerPool, Object);
+
+  /** A job: part threadId of numberOfThreads. */
+  typedef void ( *JobFunctionType )( void *data, ThreadIdType threadId, ThreadIdType numberOfThreads );
+
+  /** The pool shared by default, created at the first call. */
+  static WorkerPool * GetGlobalPool();
+
+  /** Set the number of threads, counting the calling thread, and start or
+   *  stop workers accordingly. Must not be called while a job runs.
+   *  Defaults to the global default number of threads. */
+  void SetNumberOfThreads(ThreadIdType numberOfThreads);
+  itkGetConstMacro(NumberOfThreads, ThreadIdType);
+
+  /** Set/Get the number of polls an idle thread spins before it blocks.
+   *  Defaults to 20000, a few tens of microseconds. Threads do not spin
+   *  when the pool has more threads than the host has processors. */
+  void SetSpinCount(unsigned int spinCount);
+  itkGetConstMacro(SpinCount, unsigned int);
+
+  /** Set/Get whether the workers are bound to processors. Restarts the
+   *  workers; must not be called while a job runs. Supported on Linux and
+   *  Windows, ignored elsewhere. Defaults to off. */
+  void SetPinThreads(bool pinThreads);
+  itkGetConstMacro(PinThreads, bool);
+  itkBooleanMacro(PinThreads);
+
+  /** Number of workers bound to a processor. */
+  SizeValueType GetNumberOfPinnedThreads() const { return m_NumberOfPinnedThreads; }
+
+  /** Run job(data, t, numberOfThreads) for t in [0, numberOfThreads) and
+   *  wait for all of them. numberOfThreads is clamped to the pool size. */
+  void Execute(JobFunctionType job, void *data, ThreadIdType numberOfThreads);
+
+  /** Jobs run on the workers, and jobs run inline because the pool was
+   *  busy. */
+  SizeValueType GetNumberOfJobs() const { return m_NumberOfJobs; }
+  SizeValueType GetNumberOfInlineJobs() const { return m_NumberOfInlineJobs; }
+
+protected:
+  WorkerPool();
+  virtual ~WorkerPool();
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(WorkerPool);
+
+  void StartWorkers();
+  void StopWorkers();
+  void UpdateActiveSpinCount();
+
+  // bind the calling thread to the index-th usable processor
+  static bool PinCurrentThread(ThreadIdType index);
+
+  static ITK_THREAD_RETURN_TYPE WorkerThreadCallback(void *arg);
+
+  struct WorkerType
+    {
+    WorkerPool * Pool;
+    ThreadIdType ThreadId;
+    ThreadIdType SpawnId;
+    int          Generation;
+    };
+
+  ThreadIdType              m_NumberOfThreads;
+  unsigned int              m_SpinCount;
+  unsigned int              m_ActiveSpinCount;
+  bool                      m_PinThreads;
+  MultiThreader::Pointer    m_Threader;
+  std::vector< WorkerType > m_Workers;
+
+  // the current job, written before m_Generation is advanced
+  JobFunctionType m_Job;
+  void *          m_JobData;
+  ThreadIdType    m_JobThreads;
+
+  // advanced once per job; workers run a job when it changes
+  AtomicInt< int >  m_Generation;
+  AtomicInt< int >  m_Stop;
+  SimpleMutexLock   m_WakeMutex;
+  ConditionVariable::Pointer m_Wake;
+
+  // workers that have not finished the current job
+  AtomicInt< int >  m_Pending;
+  SimpleMutexLock   m_DoneMutex;
+  ConditionVariable::Pointer m_Done;
+
+  // 1 while a job runs
+  AtomicInt< int >  m_Busy;
+
+  AtomicInt< int > m_NumberOfJobs;
+  AtomicInt< int > m_NumberOfInlineJobs;
+  AtomicInt< int > m_NumberOfPinnedThreads;
+};
+} // end namespace itk
+
+#endif
@@ -16,6 +16,7 @@ Cerdan, P.H. \"ITK Wavelet Module\".
 
 # define the dependencies of the include module and the tests
 itk_module(ExternalTemplate
+  ENABLE_SHARED
   DEPENDS
     ITKCommon
 	ITKMesh
@@ -0,0 +1,249 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkAsyncIterationLogger.h"
+#include "itkSingleValuedNonLinearVnlOptimizer.h"
+#include "itksys/SystemTools.hxx"
+#include <cmath>
+#include <cstdio>
+
+namespace itk
+{
+AsyncIterationLogger
+::AsyncIterationLogger() :
+  m_Capacity(4096),
+  m_SamplingInterval(1),
+  m_MinimumInterval(0.0),
+  m_RecordDerivativeNorm(false),
+  m_PollInterval(5),
+  m_Mask(0),
+  m_NumberOfEvents(0),
+  m_NumberOfDroppedRecords(0),
+  m_NumberOfSkippedEvents(0),
+  m_LastKeptTime(0.0),
+  m_NumberOfWrittenRecords(0),
+  m_Stream(ITK_NULLPTR),
+  m_StartTime(0.0),
+  m_WriterThread(0),
+  m_Running(false)
+{
+  m_Clock = RealTimeClock::New();
+  m_Head = 0;
+  m_Tail = 0;
+  m_StopRequested = 0;
+}
+
+AsyncIterationLogger
+::~AsyncIterationLogger()
+{
+  this->Stop();
+}
+
+void
+AsyncIterationLogger
+::Start()
+{
+  if ( m_Running )
+    {
+    itkExceptionMacro(<< "The logger is already running");
+    }
+
+  m_Stream = &std::cout;
+  if ( !m_FileName.empty() )
+    {
+    m_File.open( m_FileName.c_str() );
+    if ( !m_File )
+      {
+      itkExceptionMacro(<< "Unable to open " << m_FileName);
+      }
+    m_Stream = &m_File;
+    }
+  *m_Stream << "event,name,time,value,derivative_norm\n";
+
+  SizeValueType capacity = 2;
+  while ( capacity < m_Capacity )
+    {
+    capacity *= 2;
+    }
+  m_Records.resize(capacity);
+  m_Mask = static_cast< uint32_t >( capacity - 1 );
+  m_Head = 0;
+  m_Tail = 0;
+
+  m_NumberOfEvents = 0;
+  m_NumberOfDroppedRecords = 0;
+  m_NumberOfSkippedEvents = 0;
+  m_NumberOfWrittenRecords = 0;
+  m_StartTime = m_Clock->GetTimeInSeconds();
+  m_LastKeptTime = -m_MinimumInterval;
+
+  m_StopRequested = 0;
+  m_Threader = MultiThreader::New();
+  m_WriterThread = m_Threader->SpawnThread(Self::WriterThreadCallback, this);
+  m_Running = true;
+}
+
+void
+AsyncIterationLogger
+::Stop()
+{
+  if ( !m_Running )
+    {
+    return;
+    }
+  m_StopRequested = 1;
+  m_Threader->TerminateThread(m_WriterThread);
+  m_Threader = ITK_NULLPTR;
+  m_Running = false;
+
+  // whatever arrived after the writer's last pass
+  this->Drain();
+  m_Stream->flush();
+  if ( m_File.is_open() )
+    {
+    m_File.close();
+    }
+}
+
+void
+AsyncIterationLogger
+::Execute(Object *caller, const EventObject & event)
+{
+  this->Execute(static_cast< const Object * >( caller ), event);
+}
+
+void
+AsyncIterationLogger
+::Execute(const Object *caller, const EventObject & event)
+{
+  if ( !m_Running || !IterationEvent().CheckEvent(&event) )
+    {
+    return;
+    }
+
+  const SizeValueType number = m_NumberOfEvents++;
+  if ( number % m_SamplingInterval != 0 )
+    {
+    ++m_NumberOfSkippedEvents;
+    return;
+    }
+  const double time = m_Clock->GetTimeInSeconds() - m_StartTime;
+  if ( time - m_LastKeptTime < m_MinimumInterval )
+    {
+    ++m_NumberOfSkippedEvents;
+    return;
+    }
+
+  const uint32_t head = m_Head;
+  if ( head - m_Tail.load() > m_Mask )
+    {
+    ++m_NumberOfDroppedRecords;
+    return;
+    }
+  m_LastKeptTime = time;
+
+  RecordType & record = m_Records[head & m_Mask];
+  record.Event = number;
+  record.EventName = event.GetEventName();
+  record.Time = time;
+  record.Value = 0.0;
+  record.DerivativeNorm = -1.0;
+  const SingleValuedNonLinearVnlOptimizer *optimizer =
+    dynamic_cast< const SingleValuedNonLinearVnlOptimizer * >( caller );
+  if ( optimizer )
+    {
+    record.Value = optimizer->GetCachedValue();
+    if ( m_RecordDerivativeNorm )
+      {
+      const SingleValuedNonLinearVnlOptimizer::DerivativeType & derivative = optimizer->GetCachedDerivative();
+      double                                                    sum = 0.0;
+      for ( unsigned int i = 0; i < derivative.Size(); ++i )
+        {
+        sum += derivative[i] * derivative[i];
+        }
+      record.DerivativeNorm = std::sqrt(sum);
+      }
+    }
+
+  // publish the record
+  m_Head = head + 1;
+}
+
+void
+AsyncIterationLogger
+::Drain()
+{
+  uint32_t       tail = m_Tail;
+  const uint32_t head = m_Head.load();
+  while ( tail != head )
+    {
+    this->WriteRecord(*m_Stream, m_Records[tail & m_Mask]);
+    ++m_NumberOfWrittenRecords;
+    ++tail;
+    // hand the slot back to the optimizer thread
+    m_Tail = tail;
+    }
+}
+
+void
+AsyncIterationLogger
+::WriteRecord(std::ostream & os, const RecordType & record)
+{
+  char line[256];
+  std::snprintf(line, sizeof( line ), "%lu,%s,%.6f,%.17g,%.17g\n", static_cast< unsigned long >( record.Event ),
+                record.EventName, record.Time, record.Value, record.DerivativeNorm);
+  os << line;
+}
+
+ITK_THREAD_RETURN_TYPE
+AsyncIterationLogger
+::WriterThreadCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast< MultiThreader::ThreadInfoStruct * >( arg );
+  Self *                           logger = static_cast< Self * >( info->UserData );
+
+  while ( !logger->m_StopRequested.load() )
+    {
+    if ( logger->m_Head.load() == logger->m_Tail.load() )
+      {
+      itksys::SystemTools::Delay(logger->m_PollInterval);
+      continue;
+      }
+    logger->Drain();
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+void
+AsyncIterationLogger
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "FileName: " << m_FileName << std::endl;
+  os << indent << "Capacity: " << m_Capacity << std::endl;
+  os << indent << "SamplingInterval: " << m_SamplingInterval << std::endl;
+  os << indent << "MinimumInterval: " << m_MinimumInterval << std::endl;
+  os << indent << "RecordDerivativeNorm: " << m_RecordDerivativeNorm << std::endl;
+  os << indent << "PollInterval: " << m_PollInterval << std::endl;
+  os << indent << "Running: " << m_Running << std::endl;
+  os << indent << "NumberOfEvents: " << m_NumberOfEvents << std::endl;
+  os << indent << "NumberOfWrittenRecords: " << m_NumberOfWrittenRecords << std::endl;
+  os << indent << "NumberOfDroppedRecords: " << m_NumberOfDroppedRecords << std::endl;
+  os << indent << "NumberOfSkippedEvents: " << m_NumberOfSkippedEvents << std::endl;
+}
+} // end namespace itk
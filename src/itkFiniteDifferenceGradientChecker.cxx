@@ -0,0 +1,240 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkFiniteDifferenceGradientChecker.h"
+#include "itkRealTimeClock.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <set>
+
+namespace itk
+{
+FiniteDifferenceGradientChecker
+::FiniteDifferenceGradientChecker() :
+  m_StepSize(1e-4),
+  m_NumberOfSamples(0),
+  m_Seed(1),
+  m_ErrorFloor(1e-8),
+  m_NumberOfThreads( MultiThreader::GetGlobalDefaultNumberOfThreads() ),
+  m_MaximumRelativeError(0.0),
+  m_MeanRelativeError(0.0),
+  m_MaximumAbsoluteError(0.0),
+  m_WorstParameter(0),
+  m_ElapsedTime(0.0)
+{
+}
+
+double
+FiniteDifferenceGradientChecker
+::GetRelativeError(double analytic, double numeric) const
+{
+  const double scale = std::max( m_ErrorFloor, std::max( std::fabs(analytic), std::fabs(numeric) ) );
+  return std::fabs(analytic - numeric) / scale;
+}
+
+void
+FiniteDifferenceGradientChecker
+::Check(const ParametersType & position)
+{
+  if ( !m_CostFunction )
+    {
+    itkExceptionMacro(<< "CostFunction is not present");
+    }
+  if ( m_StepSize <= 0.0 )
+    {
+    itkExceptionMacro(<< "StepSize must be positive");
+    }
+
+  RealTimeClock::Pointer clock = RealTimeClock::New();
+  const double           start = clock->GetTimeInSeconds();
+
+  // the parameters to check: all, or a sample drawn with Floyd's algorithm
+  const SizeValueType numberOfParameters = position.Size();
+  m_CheckedParameters.clear();
+  if ( m_NumberOfSamples == 0 || m_NumberOfSamples >= numberOfParameters )
+    {
+    m_CheckedParameters.resize(numberOfParameters);
+    for ( SizeValueType k = 0; k < numberOfParameters; ++k )
+      {
+      m_CheckedParameters[k] = k;
+      }
+    }
+  else
+    {
+    std::set< SizeValueType > sample;
+    uint64_t                  state = m_Seed;
+    for ( SizeValueType j = numberOfParameters - m_NumberOfSamples; j < numberOfParameters; ++j )
+      {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      const SizeValueType k = static_cast< SizeValueType >( ( state >> 33 ) % ( j + 1 ) );
+      sample.insert( sample.count(k) ? j : k );
+      }
+    m_CheckedParameters.assign( sample.begin(), sample.end() );
+    }
+
+  DerivativeType derivative;
+  m_CostFunction->GetDerivative(position, derivative);
+  if ( derivative.Size() != numberOfParameters )
+    {
+    itkExceptionMacro(<< "The derivative has " << derivative.Size() << " components, expected "
+                      << numberOfParameters);
+    }
+  m_AnalyticDerivatives.resize( m_CheckedParameters.size() );
+  for ( SizeValueType i = 0; i < m_CheckedParameters.size(); ++i )
+    {
+    m_AnalyticDerivatives[i] = derivative[m_CheckedParameters[i]];
+    }
+
+  m_NumericDerivatives.assign(m_CheckedParameters.size(), 0.0);
+  if ( !m_CheckedParameters.empty() )
+    {
+    CheckThreadStruct str;
+    str.Checker = this;
+    str.Position = &position;
+    str.NumericDerivatives = &m_NumericDerivatives;
+    str.NumberOfThreads = m_CheckedParameters.size() < m_NumberOfThreads ?
+                          static_cast< ThreadIdType >( m_CheckedParameters.size() ) : m_NumberOfThreads;
+
+    MultiThreader::Pointer threader = MultiThreader::New();
+    threader->SetNumberOfThreads(str.NumberOfThreads);
+    str.NumberOfThreads = threader->GetNumberOfThreads();
+    str.Errors.resize(str.NumberOfThreads);
+    threader->SetSingleMethod(Self::CheckThreaderCallback, &str);
+    threader->SingleMethodExecute();
+
+    for ( ThreadIdType t = 0; t < str.NumberOfThreads; ++t )
+      {
+      if ( !str.Errors[t].empty() )
+        {
+        itkExceptionMacro(<< "The cost function failed: " << str.Errors[t]);
+        }
+      }
+    }
+
+  m_MaximumRelativeError = 0.0;
+  m_MeanRelativeError = 0.0;
+  m_MaximumAbsoluteError = 0.0;
+  m_WorstParameter = 0;
+  for ( SizeValueType i = 0; i < m_CheckedParameters.size(); ++i )
+    {
+    const double relative = this->GetRelativeError(m_AnalyticDerivatives[i], m_NumericDerivatives[i]);
+    m_MeanRelativeError += relative;
+    m_MaximumAbsoluteError = std::max( m_MaximumAbsoluteError,
+                                       std::fabs(m_AnalyticDerivatives[i] - m_NumericDerivatives[i]) );
+    if ( relative > m_MaximumRelativeError || i == 0 )
+      {
+      m_MaximumRelativeError = relative;
+      m_WorstParameter = m_CheckedParameters[i];
+      }
+    }
+  if ( !m_CheckedParameters.empty() )
+    {
+    m_MeanRelativeError /= m_CheckedParameters.size();
+    }
+
+  m_ElapsedTime = clock->GetTimeInSeconds() - start;
+}
+
+ITK_THREAD_RETURN_TYPE
+FiniteDifferenceGradientChecker
+::CheckThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast< MultiThreader::ThreadInfoStruct * >( arg );
+  CheckThreadStruct *              str = static_cast< CheckThreadStruct * >( info->UserData );
+
+  const ThreadIdType threadId = info->ThreadID;
+  if ( threadId >= str->NumberOfThreads )
+    {
+    return ITK_THREAD_RETURN_VALUE;
+    }
+
+  const Self *                         checker = str->Checker;
+  const std::vector< SizeValueType > & checked = checker->m_CheckedParameters;
+  const SizeValueType                  begin = checked.size() * threadId / str->NumberOfThreads;
+  const SizeValueType                  end = checked.size() * ( threadId + 1 ) / str->NumberOfThreads;
+  const double                         h = checker->m_StepSize;
+
+  // exceptions must not leave the thread; they are rethrown by Check()
+  try
+    {
+    ParametersType perturbed = *str->Position;
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      const SizeValueType k = checked[i];
+      const double        original = perturbed[k];
+      perturbed[k] = original + h;
+      const double plus = checker->m_CostFunction->GetValue(perturbed);
+      perturbed[k] = original - h;
+      const double minus = checker->m_CostFunction->GetValue(perturbed);
+      perturbed[k] = original;
+      ( *str->NumericDerivatives )[i] = ( plus - minus ) / ( 2.0 * h );
+      }
+    }
+  catch ( ExceptionObject & e )
+    {
+    str->Errors[threadId] = e.GetDescription();
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+void
+FiniteDifferenceGradientChecker
+::Report(std::ostream & os, unsigned int numberOfWorstParameters) const
+{
+  char line[256];
+  std::snprintf(line, sizeof( line ), "Checked %lu parameters in %.3f s (h = %g)\n",
+                static_cast< unsigned long >( m_CheckedParameters.size() ), m_ElapsedTime, m_StepSize);
+  os << line;
+  std::snprintf(line, sizeof( line ), "Relative error: max %.3e, mean %.3e; absolute error: max %.3e\n",
+                m_MaximumRelativeError, m_MeanRelativeError, m_MaximumAbsoluteError);
+  os << line;
+
+  // the worst components, largest relative error first
+  std::vector< std::pair< double, SizeValueType > > errors;
+  for ( SizeValueType i = 0; i < m_CheckedParameters.size(); ++i )
+    {
+    errors.push_back( std::make_pair(this->GetRelativeError(m_AnalyticDerivatives[i], m_NumericDerivatives[i]), i) );
+    }
+  const SizeValueType count = std::min< SizeValueType >( numberOfWorstParameters, errors.size() );
+  std::partial_sort( errors.begin(), errors.begin() + count, errors.end(),
+                     std::greater< std::pair< double, SizeValueType > >() );
+  for ( SizeValueType j = 0; j < count; ++j )
+    {
+    const SizeValueType i = errors[j].second;
+    std::snprintf(line, sizeof( line ), "  parameter %10lu: analytic % .9e numeric % .9e relative error %.3e\n",
+                  static_cast< unsigned long >( m_CheckedParameters[i] ), m_AnalyticDerivatives[i],
+                  m_NumericDerivatives[i], errors[j].first);
+    os << line;
+    }
+}
+
+void
+FiniteDifferenceGradientChecker
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "StepSize: " << m_StepSize << std::endl;
+  os << indent << "NumberOfSamples: " << m_NumberOfSamples << std::endl;
+  os << indent << "Seed: " << m_Seed << std::endl;
+  os << indent << "ErrorFloor: " << m_ErrorFloor << std::endl;
+  os << indent << "NumberOfThreads: " << m_NumberOfThreads << std::endl;
+  os << indent << "MaximumRelativeError: " << m_MaximumRelativeError << std::endl;
+  os << indent << "MeanRelativeError: " << m_MeanRelativeError << std::endl;
+}
+} // end namespace itk
@@ -0,0 +1,150 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkFirstTouchArray.h"
+#include <cstring>
+
+#if defined( _WIN32 )
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace itk
+{
+FirstTouchArrayBase
+::FirstTouchArrayBase() :
+  m_Data( ITK_NULLPTR ),
+  m_Bytes( 0 )
+{
+}
+
+FirstTouchArrayBase
+::~FirstTouchArrayBase()
+{
+  this->ReleaseBytes();
+}
+
+void *
+FirstTouchArrayBase
+::AllocatePages(SizeValueType bytes)
+{
+  // Pages straight from the system: a heap allocation may reuse memory that
+  // another thread has touched already.
+#if defined( _WIN32 )
+  void *data = VirtualAlloc(ITK_NULLPTR, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+  void *data = mmap(ITK_NULLPTR, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if ( data == MAP_FAILED )
+    {
+    data = ITK_NULLPTR;
+    }
+#endif
+  if ( data == ITK_NULLPTR )
+    {
+    itkGenericExceptionMacro(<< "Unable to allocate " << bytes << " bytes");
+    }
+  return data;
+}
+
+void
+FirstTouchArrayBase
+::FreePages(void *data, SizeValueType bytes)
+{
+#if defined( _WIN32 )
+  (void)bytes;
+  VirtualFree(data, 0, MEM_RELEASE);
+#else
+  munmap(data, bytes);
+#endif
+}
+
+void
+FirstTouchArrayBase
+::AllocateBytes(SizeValueType bytes)
+{
+  this->ReleaseBytes();
+  if ( bytes > 0 )
+    {
+    m_Data = Self::AllocatePages(bytes);
+    m_Bytes = bytes;
+    }
+}
+
+void
+FirstTouchArrayBase
+::ReleaseBytes()
+{
+  if ( m_Data )
+    {
+    Self::FreePages(m_Data, m_Bytes);
+    }
+  m_Data = ITK_NULLPTR;
+  m_Bytes = 0;
+}
+
+void
+FirstTouchArrayBase
+::PlaceBytes(WorkerPool *pool, const SizeValueType *boundaries, ThreadIdType numberOfParts, bool keepContents)
+{
+  if ( m_Bytes == 0 )
+    {
+    return;
+    }
+  if ( boundaries[0] != 0 || boundaries[numberOfParts] != m_Bytes )
+    {
+    itkGenericExceptionMacro(<< "The parts cover bytes " << boundaries[0] << " to " << boundaries[numberOfParts]
+                             << " of " << m_Bytes);
+    }
+
+  PlacementStruct str;
+  str.Source = keepContents ? static_cast< const char * >( m_Data ) : ITK_NULLPTR;
+  str.Destination = static_cast< char * >( Self::AllocatePages(m_Bytes) );
+  str.Boundaries = boundaries;
+  str.NumberOfParts = numberOfParts;
+  pool->Execute(Self::PlacementJob, &str, numberOfParts);
+
+  Self::FreePages(m_Data, m_Bytes);
+  m_Data = str.Destination;
+}
+
+void
+FirstTouchArrayBase
+::PlacementJob(void *data, ThreadIdType threadId, ThreadIdType numberOfThreads)
+{
+  PlacementStruct *str = static_cast< PlacementStruct * >( data );
+
+  // part p on thread p, unless the pool runs fewer threads
+  for ( ThreadIdType part = threadId; part < str->NumberOfParts; part += numberOfThreads )
+    {
+    const SizeValueType begin = str->Boundaries[part];
+    const SizeValueType end = str->Boundaries[part + 1];
+    if ( end <= begin )
+      {
+      continue;
+      }
+    if ( str->Source )
+      {
+      std::memcpy(str->Destination + begin, str->Source + begin, end - begin);
+      }
+    else
+      {
+      std::memset(str->Destination + begin, 0, end - begin);
+      }
+    }
+}
+} // end namespace itk
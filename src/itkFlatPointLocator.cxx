@@ -0,0 +1,395 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkFlatPointLocator.h"
+#include "itkNativeMeshFileFormat.h"
+#include "itkNumericTraits.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace itk
+{
+namespace
+{
+/** On-disk header of a serialized FlatPointLocator. */
+struct FlatPointLocatorFileHeader
+{
+  char     Magic[8];
+  uint32_t Version;
+  uint32_t ByteOrderMark;
+  uint32_t LeafSize;
+  uint32_t Reserved0;
+  uint64_t NumberOfPoints;
+  uint64_t PointsOffset;
+  uint64_t IndicesOffset;
+  uint64_t SplitAxesOffset;
+  uint64_t FileSize;
+  uint64_t TopologyHash;
+  uint64_t CoordinateHash;
+  uint64_t Reserved[6];
+};
+
+const char FlatPointLocatorMagic[] = "TSDKDTR1";
+
+/** Orders point indices by one coordinate. */
+struct CoordinateLess
+{
+  const double *Points;
+  unsigned int  Axis;
+
+  bool operator()(uint32_t a, uint32_t b) const
+  {
+    return Points[3 * a + Axis] < Points[3 * b + Axis];
+  }
+};
+} // end anonymous namespace
+
+FlatPointLocator
+::FlatPointLocator() :
+  m_Points( ITK_NULLPTR ),
+  m_Indices( ITK_NULLPTR ),
+  m_SplitAxes( ITK_NULLPTR ),
+  m_NumberOfPoints( 0 ),
+  m_TopologyHash( 0 ),
+  m_CoordinateHash( 0 )
+{
+  m_MappedFile = MemoryMappedFile::New();
+}
+
+void
+FlatPointLocator
+::ReleaseArrays()
+{
+  m_MappedFile->Close();
+  m_PointStorage.clear();
+  m_IndexStorage.clear();
+  m_SplitAxisStorage.clear();
+  m_Points = ITK_NULLPTR;
+  m_Indices = ITK_NULLPTR;
+  m_SplitAxes = ITK_NULLPTR;
+  m_NumberOfPoints = 0;
+  m_CoordinateHash = 0;
+}
+
+void
+FlatPointLocator
+::Build(const double *points, SizeValueType numberOfPoints)
+{
+  this->ReleaseArrays();
+
+  if ( numberOfPoints > NumericTraits< uint32_t >::max() )
+    {
+    itkExceptionMacro(<< "Too many points for a 32 bit index: " << numberOfPoints);
+    }
+
+  m_IndexStorage.resize(numberOfPoints);
+  for ( SizeValueType i = 0; i < numberOfPoints; ++i )
+    {
+    m_IndexStorage[i] = static_cast< uint32_t >( i );
+    }
+  m_SplitAxisStorage.assign(numberOfPoints, 0);
+
+  if ( numberOfPoints > 0 )
+    {
+    this->BuildRange(points, 0, numberOfPoints);
+    }
+
+  // store the coordinates in tree order, so that a query walks memory
+  // mostly forward
+  m_PointStorage.resize(3 * numberOfPoints);
+  for ( SizeValueType i = 0; i < numberOfPoints; ++i )
+    {
+    const double *src = points + 3 * static_cast< SizeValueType >( m_IndexStorage[i] );
+    m_PointStorage[3 * i] = src[0];
+    m_PointStorage[3 * i + 1] = src[1];
+    m_PointStorage[3 * i + 2] = src[2];
+    }
+
+  m_NumberOfPoints = numberOfPoints;
+  if ( numberOfPoints > 0 )
+    {
+    m_Points = &m_PointStorage[0];
+    m_Indices = &m_IndexStorage[0];
+    m_SplitAxes = &m_SplitAxisStorage[0];
+    }
+  m_CoordinateHash = NativeMeshFile::CoordinateHash(points, 3 * numberOfPoints);
+  this->Modified();
+}
+
+void
+FlatPointLocator
+::BuildRange(const double *points, SizeValueType begin, SizeValueType end)
+{
+  if ( end - begin <= LeafSize )
+    {
+    return;
+    }
+
+  // split along the axis of largest spread
+  double lower[3];
+  double upper[3];
+  for ( unsigned int d = 0; d < 3; ++d )
+    {
+    lower[d] = upper[d] = points[3 * m_IndexStorage[begin] + d];
+    }
+  for ( SizeValueType i = begin + 1; i < end; ++i )
+    {
+    const double *p = points + 3 * static_cast< SizeValueType >( m_IndexStorage[i] );
+    for ( unsigned int d = 0; d < 3; ++d )
+      {
+      lower[d] = std::min(lower[d], p[d]);
+      upper[d] = std::max(upper[d], p[d]);
+      }
+    }
+  unsigned int axis = 0;
+  for ( unsigned int d = 1; d < 3; ++d )
+    {
+    if ( upper[d] - lower[d] > upper[axis] - lower[axis] )
+      {
+      axis = d;
+      }
+    }
+
+  const SizeValueType median = begin + ( end - begin ) / 2;
+  CoordinateLess      less;
+  less.Points = points;
+  less.Axis = axis;
+  std::nth_element(m_IndexStorage.begin() + begin, m_IndexStorage.begin() + median,
+                   m_IndexStorage.begin() + end, less);
+  m_SplitAxisStorage[median] = static_cast< uint8_t >( axis );
+
+  this->BuildRange(points, begin, median);
+  this->BuildRange(points, median + 1, end);
+}
+
+SizeValueType
+FlatPointLocator
+::FindClosestPoint(const double query[3], double *squaredDistance) const
+{
+  if ( m_NumberOfPoints == 0 )
+    {
+    itkExceptionMacro(<< "The locator is empty");
+    }
+
+  SizeValueType best = NumericTraits< SizeValueType >::max();
+  double        bestDistance = NumericTraits< double >::max();
+  this->SearchRange(0, m_NumberOfPoints, query, best, bestDistance);
+
+  if ( squaredDistance )
+    {
+    *squaredDistance = bestDistance;
+    }
+  return best;
+}
+
+void
+FlatPointLocator
+::SearchRange(SizeValueType begin, SizeValueType end, const double query[3],
+              SizeValueType & best, double & bestDistance) const
+{
+  if ( end - begin <= LeafSize )
+    {
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      const double *p = m_Points + 3 * i;
+      double        dist = 0;
+      for ( unsigned int d = 0; d < 3; ++d )
+        {
+        const double component = p[d] - query[d];
+        dist += component * component;
+        }
+      if ( dist < bestDistance || ( dist == bestDistance && m_Indices[i] < best ) )
+        {
+        best = m_Indices[i];
+        bestDistance = dist;
+        }
+      }
+    return;
+    }
+
+  const SizeValueType median = begin + ( end - begin ) / 2;
+  const double *      p = m_Points + 3 * median;
+  double              dist = 0;
+  for ( unsigned int d = 0; d < 3; ++d )
+    {
+    const double component = p[d] - query[d];
+    dist += component * component;
+    }
+  if ( dist < bestDistance || ( dist == bestDistance && m_Indices[median] < best ) )
+    {
+    best = m_Indices[median];
+    bestDistance = dist;
+    }
+
+  const double diff = query[m_SplitAxes[median]] - p[m_SplitAxes[median]];
+  if ( diff < 0 )
+    {
+    this->SearchRange(begin, median, query, best, bestDistance);
+    if ( diff * diff <= bestDistance )
+      {
+      this->SearchRange(median + 1, end, query, best, bestDistance);
+      }
+    }
+  else
+    {
+    this->SearchRange(median + 1, end, query, best, bestDistance);
+    if ( diff * diff <= bestDistance )
+      {
+      this->SearchRange(begin, median, query, best, bestDistance);
+      }
+    }
+}
+
+SizeValueType
+FlatPointLocator
+::GetSizeInBytes() const
+{
+  return m_NumberOfPoints * ( 3 * sizeof( double ) + sizeof( uint32_t ) + sizeof( uint8_t ) );
+}
+
+void
+FlatPointLocator
+::Write(const std::string & fileName) const
+{
+  FlatPointLocatorFileHeader header;
+  std::memset( &header, 0, sizeof( header ) );
+  std::memcpy( header.Magic, FlatPointLocatorMagic, sizeof( header.Magic ) );
+  header.Version = 1;
+  header.ByteOrderMark = NativeMeshFile::GetByteOrderMark();
+  header.LeafSize = LeafSize;
+  header.NumberOfPoints = m_NumberOfPoints;
+  header.PointsOffset = NativeMeshFile::Align( sizeof( header ) );
+  header.IndicesOffset = NativeMeshFile::Align( header.PointsOffset + 3 * m_NumberOfPoints * sizeof( double ) );
+  header.SplitAxesOffset = NativeMeshFile::Align( header.IndicesOffset + m_NumberOfPoints * sizeof( uint32_t ) );
+  header.FileSize = header.SplitAxesOffset + m_NumberOfPoints * sizeof( uint8_t );
+  header.TopologyHash = m_TopologyHash;
+  header.CoordinateHash = m_CoordinateHash;
+
+  std::ofstream outputFile( fileName.c_str(), std::ios::out | std::ios::binary );
+  if ( !outputFile.is_open() )
+    {
+    itkExceptionMacro(<< "Unable to open file " << fileName);
+    }
+
+  const char padding[64] = { 0 };
+  outputFile.write( reinterpret_cast< const char * >( &header ), sizeof( header ) );
+  outputFile.write( padding, header.PointsOffset - sizeof( header ) );
+  if ( m_NumberOfPoints > 0 )
+    {
+    outputFile.write( reinterpret_cast< const char * >( m_Points ), 3 * m_NumberOfPoints * sizeof( double ) );
+    outputFile.write( padding, header.IndicesOffset - header.PointsOffset - 3 * m_NumberOfPoints * sizeof( double ) );
+    outputFile.write( reinterpret_cast< const char * >( m_Indices ), m_NumberOfPoints * sizeof( uint32_t ) );
+    outputFile.write( padding, header.SplitAxesOffset - header.IndicesOffset - m_NumberOfPoints * sizeof( uint32_t ) );
+    outputFile.write( reinterpret_cast< const char * >( m_SplitAxes ), m_NumberOfPoints * sizeof( uint8_t ) );
+    }
+
+  if ( !outputFile )
+    {
+    itkExceptionMacro(<< "Error while writing file " << fileName);
+    }
+}
+
+void
+FlatPointLocator
+::ReadMapped(const std::string & fileName, uint64_t expectedTopologyHash, uint64_t expectedCoordinateHash)
+{
+  this->ReleaseArrays();
+
+  m_MappedFile->Open(fileName);
+
+  FlatPointLocatorFileHeader header;
+  if ( m_MappedFile->GetSize() < sizeof( header ) )
+    {
+    m_MappedFile->Close();
+    itkExceptionMacro(<< fileName << " is not a point locator file");
+    }
+  std::memcpy( &header, m_MappedFile->GetData(), sizeof( header ) );
+
+  const char *problem = ITK_NULLPTR;
+  if ( std::memcmp( header.Magic, FlatPointLocatorMagic, sizeof( header.Magic ) ) != 0 || header.Version != 1 )
+    {
+    problem = "is not a point locator file";
+    }
+  else if ( header.ByteOrderMark != NativeMeshFile::GetByteOrderMark() )
+    {
+    problem = "was written on a host with a different byte order";
+    }
+  else if ( header.LeafSize != LeafSize )
+    {
+    problem = "was built with a different leaf size";
+    }
+  else if ( header.FileSize != m_MappedFile->GetSize()
+            || header.PointsOffset + 3 * header.NumberOfPoints * sizeof( double ) > header.IndicesOffset
+            || header.IndicesOffset + header.NumberOfPoints * sizeof( uint32_t ) > header.SplitAxesOffset
+            || header.SplitAxesOffset + header.NumberOfPoints * sizeof( uint8_t ) > header.FileSize
+            || header.PointsOffset % NativeMeshFile::GetAlignment() != 0
+            || header.IndicesOffset % NativeMeshFile::GetAlignment() != 0 )
+    {
+    problem = "is truncated or has an inconsistent layout";
+    }
+  else if ( expectedTopologyHash != 0 && header.TopologyHash != expectedTopologyHash )
+    {
+    problem = "was built for a different mesh topology";
+    }
+  else if ( expectedCoordinateHash != 0 && header.CoordinateHash != expectedCoordinateHash )
+    {
+    problem = "was built for different point coordinates";
+    }
+  if ( problem )
+    {
+    m_MappedFile->Close();
+    itkExceptionMacro(<< fileName << " " << problem);
+    }
+
+  const char *data = static_cast< const char * >( m_MappedFile->GetData() );
+  m_Points = reinterpret_cast< const double * >( data + header.PointsOffset );
+  m_Indices = reinterpret_cast< const uint32_t * >( data + header.IndicesOffset );
+  m_SplitAxes = reinterpret_cast< const uint8_t * >( data + header.SplitAxesOffset );
+  m_NumberOfPoints = header.NumberOfPoints;
+  m_TopologyHash = header.TopologyHash;
+  m_CoordinateHash = header.CoordinateHash;
+  this->Modified();
+}
+
+void
+FlatPointLocator
+::SetExternalArrays(const double *points, const uint32_t *indices, const uint8_t *splitAxes,
+                    SizeValueType numberOfPoints, uint64_t topologyHash, uint64_t coordinateHash)
+{
+  this->ReleaseArrays();
+
+  m_Points = points;
+  m_Indices = indices;
+  m_SplitAxes = splitAxes;
+  m_NumberOfPoints = numberOfPoints;
+  m_TopologyHash = topologyHash;
+  m_CoordinateHash = coordinateHash;
+  this->Modified();
+}
+
+void
+FlatPointLocator
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfPoints: " << m_NumberOfPoints << std::endl;
+  os << indent << "Mapped: " << ( m_MappedFile->IsOpen() ? m_MappedFile->GetFileName() : "no" ) << std::endl;
+  os << indent << "TopologyHash: " << m_TopologyHash << std::endl;
+  os << indent << "CoordinateHash: " << m_CoordinateHash << std::endl;
+}
+} // end namespace itk
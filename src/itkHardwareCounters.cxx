@@ -0,0 +1,311 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkHardwareCounters.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#if defined( __linux__ )
+#define ITK_HARDWARE_COUNTERS_USE_PERF
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace itk
+{
+namespace
+{
+#if defined( ITK_HARDWARE_COUNTERS_USE_PERF )
+// thread 0 is the calling thread; inherited counters also count the
+// threads it creates afterwards
+int
+OpenCounter(uint64_t config, pid_t thread, bool inherit)
+{
+  struct perf_event_attr attr;
+  std::memset( &attr, 0, sizeof( attr ) );
+  attr.size = sizeof( attr );
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.inherit = inherit ? 1 : 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // the thread, any CPU, no group
+  return static_cast< int >( syscall(__NR_perf_event_open, &attr, thread, -1, -1, 0) );
+}
+
+// count of one counter, scaled for multiplexing
+bool
+ReadCounter(int fd, uint64_t & value)
+{
+  // value, time enabled, time running
+  uint64_t data[3];
+  if ( fd < 0 || read( fd, data, sizeof( data ) ) != static_cast< ssize_t >( sizeof( data ) ) || data[2] == 0 )
+    {
+    return false;
+    }
+  value = data[2] < data[1]
+          ? static_cast< uint64_t >( static_cast< double >( data[0] ) * data[1] / data[2] )
+          : data[0];
+  return true;
+}
+
+const uint64_t CounterConfigs[HardwareCounters::NumberOfCounters] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_MISSES };
+
+uint64_t
+CurrentThread()
+{
+  return static_cast< uint64_t >( syscall(SYS_gettid) );
+}
+#else
+uint64_t
+CurrentThread()
+{
+  return 0;
+}
+#endif
+
+// part t of the job stores the thread it runs on
+void
+RecordThreadJob(void *data, ThreadIdType threadId, ThreadIdType)
+{
+  ( *static_cast< std::vector< uint64_t > * >( data ) )[threadId] = CurrentThread();
+}
+} // end anonymous namespace
+
+HardwareCounters
+::HardwareCounters() :
+  m_Available( false ),
+  m_OwningThread( 0 )
+{
+  for ( unsigned int c = 0; c < NumberOfCounters; ++c )
+    {
+    m_FileDescriptors[c] = -1;
+    }
+}
+
+HardwareCounters
+::~HardwareCounters()
+{
+  this->Close();
+}
+
+const char *
+HardwareCounters
+::GetCounterName(CounterType counter)
+{
+  switch ( counter )
+    {
+    case Cycles:
+      return "cycles";
+    case Instructions:
+      return "instructions";
+    case CacheMisses:
+      return "cache-misses";
+    case BranchMisses:
+      return "branch-misses";
+    default:
+      return "unknown";
+    }
+}
+
+bool
+HardwareCounters
+::Open()
+{
+  this->Close();
+
+  const char *disable = std::getenv("ITK_DISABLE_HARDWARE_COUNTERS");
+  if ( disable && *disable && std::strcmp(disable, "0") != 0 )
+    {
+    m_UnavailableReason = "disabled by ITK_DISABLE_HARDWARE_COUNTERS";
+    this->Modified();
+    return false;
+    }
+
+#if defined( ITK_HARDWARE_COUNTERS_USE_PERF )
+  // created before the counters, so that its workers do not also inherit
+  // them and get counted twice when they exit
+  WorkerPool *pool = WorkerPool::GetGlobalPool();
+
+  int firstError = 0;
+  for ( unsigned int c = 0; c < NumberOfCounters; ++c )
+    {
+    m_FileDescriptors[c] = OpenCounter(CounterConfigs[c], 0, true);
+    if ( m_FileDescriptors[c] < 0 && firstError == 0 )
+      {
+      firstError = errno;
+      }
+    if ( m_FileDescriptors[c] >= 0 )
+      {
+      m_Available = true;
+      }
+    }
+
+  if ( !m_Available )
+    {
+    m_UnavailableReason = std::string("perf_event_open failed: ") + std::strerror(firstError);
+    if ( firstError == EACCES || firstError == EPERM )
+      {
+      m_UnavailableReason += " (check /proc/sys/kernel/perf_event_paranoid)";
+      }
+    }
+  m_OwningThread = CurrentThread();
+  if ( m_Available )
+    {
+    this->AddWorkerPool(pool);
+    }
+#else
+  m_UnavailableReason = "hardware counters are only supported on Linux";
+#endif
+
+  this->Modified();
+  return m_Available;
+}
+
+bool
+HardwareCounters
+::AddWorkerPool(WorkerPool *pool)
+{
+  if ( !m_Available || !pool )
+    {
+    return false;
+    }
+
+  // part t runs on worker t, unless the pool is busy
+  std::vector< uint64_t > threads( pool->GetNumberOfThreads(), 0 );
+  pool->Execute( RecordThreadJob, &threads[0], static_cast< ThreadIdType >( threads.size() ) );
+
+  bool added = false;
+#if defined( ITK_HARDWARE_COUNTERS_USE_PERF )
+  for ( SizeValueType t = 0; t < threads.size(); ++t )
+    {
+    if ( threads[t] == m_OwningThread
+         || std::find(m_WorkerThreads.begin(), m_WorkerThreads.end(), threads[t]) != m_WorkerThreads.end() )
+      {
+      continue;
+      }
+    int  fds[NumberOfCounters];
+    bool opened = false;
+    for ( unsigned int c = 0; c < NumberOfCounters; ++c )
+      {
+      fds[c] = m_FileDescriptors[c] >= 0 ? OpenCounter(CounterConfigs[c], static_cast< pid_t >( threads[t] ), false) : -1;
+      opened = opened || fds[c] >= 0;
+      }
+    if ( opened )
+      {
+      m_WorkerThreads.push_back(threads[t]);
+      m_WorkerFileDescriptors.insert(m_WorkerFileDescriptors.end(), fds, fds + NumberOfCounters);
+      added = true;
+      }
+    }
+#endif
+  return added;
+}
+
+void
+HardwareCounters
+::Close()
+{
+#if defined( ITK_HARDWARE_COUNTERS_USE_PERF )
+  for ( unsigned int c = 0; c < NumberOfCounters; ++c )
+    {
+    if ( m_FileDescriptors[c] >= 0 )
+      {
+      close(m_FileDescriptors[c]);
+      }
+    }
+  for ( SizeValueType i = 0; i < m_WorkerFileDescriptors.size(); ++i )
+    {
+    if ( m_WorkerFileDescriptors[i] >= 0 )
+      {
+      close(m_WorkerFileDescriptors[i]);
+      }
+    }
+#endif
+  for ( unsigned int c = 0; c < NumberOfCounters; ++c )
+    {
+    m_FileDescriptors[c] = -1;
+    }
+  m_WorkerThreads.clear();
+  m_WorkerFileDescriptors.clear();
+  m_Available = false;
+  m_UnavailableReason = "";
+}
+
+bool
+HardwareCounters
+::IsOwningThread() const
+{
+  return m_Available && CurrentThread() == m_OwningThread;
+}
+
+bool
+HardwareCounters
+::Read(CountersType & counters) const
+{
+  for ( unsigned int c = 0; c < NumberOfCounters; ++c )
+    {
+    counters.Values[c] = 0;
+    counters.Available[c] = false;
+    }
+  if ( !m_Available )
+    {
+    return false;
+    }
+
+#if defined( ITK_HARDWARE_COUNTERS_USE_PERF )
+  for ( unsigned int c = 0; c < NumberOfCounters; ++c )
+    {
+    if ( !ReadCounter(m_FileDescriptors[c], counters.Values[c]) )
+      {
+      continue;
+      }
+    counters.Available[c] = true;
+    for ( SizeValueType w = 0; w < m_WorkerThreads.size(); ++w )
+      {
+      uint64_t value;
+      if ( ReadCounter(m_WorkerFileDescriptors[w * NumberOfCounters + c], value) )
+        {
+        counters.Values[c] += value;
+        }
+      }
+    }
+#endif
+  return true;
+}
+
+void
+HardwareCounters
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Available: " << m_Available << std::endl;
+  os << indent << "NumberOfWorkerThreads: " << m_WorkerThreads.size() << std::endl;
+  if ( !m_Available )
+    {
+    os << indent << "UnavailableReason: " << m_UnavailableReason << std::endl;
+    }
+}
+} // end namespace itk
@@ -0,0 +1,140 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkMemoryMappedFile.h"
+
+#if defined( _WIN32 )
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace itk
+{
+MemoryMappedFile
+::MemoryMappedFile() :
+  m_Data( ITK_NULLPTR ),
+  m_Size( 0 )
+{
+#if defined( _WIN32 )
+  m_FileHandle = ITK_NULLPTR;
+  m_MappingHandle = ITK_NULLPTR;
+#endif
+}
+
+MemoryMappedFile
+::~MemoryMappedFile()
+{
+  this->Close();
+}
+
+void
+MemoryMappedFile
+::Open(const std::string & fileName)
+{
+  this->Close();
+
+#if defined( _WIN32 )
+  HANDLE file = CreateFileA( fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, ITK_NULLPTR,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, ITK_NULLPTR );
+  if ( file == INVALID_HANDLE_VALUE )
+    {
+    itkExceptionMacro(<< "Unable to open file " << fileName);
+    }
+  LARGE_INTEGER size;
+  if ( !GetFileSizeEx(file, &size) || size.QuadPart == 0 )
+    {
+    CloseHandle(file);
+    itkExceptionMacro(<< "Unable to map empty or unreadable file " << fileName);
+    }
+  HANDLE mapping = CreateFileMappingA(file, ITK_NULLPTR, PAGE_READONLY, 0, 0, ITK_NULLPTR);
+  if ( mapping == ITK_NULLPTR )
+    {
+    CloseHandle(file);
+    itkExceptionMacro(<< "Unable to map file " << fileName);
+    }
+  const void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if ( data == ITK_NULLPTR )
+    {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    itkExceptionMacro(<< "Unable to map file " << fileName);
+    }
+  m_FileHandle = file;
+  m_MappingHandle = mapping;
+  m_Size = static_cast< SizeValueType >( size.QuadPart );
+  m_Data = data;
+#else
+  const int fd = open(fileName.c_str(), O_RDONLY);
+  if ( fd < 0 )
+    {
+    itkExceptionMacro(<< "Unable to open file " << fileName);
+    }
+  struct stat info;
+  if ( fstat(fd, &info) != 0 || info.st_size == 0 )
+    {
+    close(fd);
+    itkExceptionMacro(<< "Unable to map empty or unreadable file " << fileName);
+    }
+  void *data = mmap(ITK_NULLPTR, static_cast< size_t >( info.st_size ), PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping keeps its own reference to the file
+  close(fd);
+  if ( data == MAP_FAILED )
+    {
+    itkExceptionMacro(<< "Unable to map file " << fileName);
+    }
+  m_Size = static_cast< SizeValueType >( info.st_size );
+  m_Data = data;
+#endif
+
+  m_FileName = fileName;
+}
+
+void
+MemoryMappedFile
+::Close()
+{
+  if ( m_Data == ITK_NULLPTR )
+    {
+    return;
+    }
+#if defined( _WIN32 )
+  UnmapViewOfFile(m_Data);
+  CloseHandle(m_MappingHandle);
+  CloseHandle(m_FileHandle);
+  m_MappingHandle = ITK_NULLPTR;
+  m_FileHandle = ITK_NULLPTR;
+#else
+  munmap(const_cast< void * >( m_Data ), static_cast< size_t >( m_Size ) );
+#endif
+  m_Data = ITK_NULLPTR;
+  m_Size = 0;
+  m_FileName = "";
+}
+
+void
+MemoryMappedFile
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "FileName: " << m_FileName << std::endl;
+  os << indent << "Size: " << m_Size << std::endl;
+}
+} // end namespace itk
@@ -0,0 +1,223 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkRegistrationMemoryUsage.h"
+#include "itkTriangleVertexNeighborhood.h"
+#include <cstdio>
+
+#if defined( _WIN32 )
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace itk
+{
+RegistrationMemoryUsage
+::RegistrationMemoryUsage()
+{
+  this->Reset();
+}
+
+const char *
+RegistrationMemoryUsage
+::GetComponentName(ComponentType component)
+{
+  switch ( component )
+    {
+    case FixedPointsComponent:
+      return "FixedPoints";
+    case MovingPointsComponent:
+      return "MovingPoints";
+    case TargetPositionsComponent:
+      return "TargetPositions";
+    case NeighborhoodsComponent:
+      return "Neighborhoods";
+    case SpatialIndexComponent:
+      return "SpatialIndex";
+    case ParametersComponent:
+      return "Parameters";
+    case OptimizerWorkspaceComponent:
+      return "OptimizerWorkspace";
+    case MeshesComponent:
+      return "Meshes";
+    default:
+      return "Unknown";
+    }
+}
+
+void
+RegistrationMemoryUsage
+::SetBytes(ComponentType component, uint64_t bytes)
+{
+  if ( component < 0 || component >= NumberOfComponents )
+    {
+    itkExceptionMacro(<< "Invalid component " << component);
+    }
+  m_Bytes[component] = bytes;
+  const uint64_t total = this->GetTotalBytes();
+  if ( total > m_PeakBytes )
+    {
+    m_PeakBytes = total;
+    }
+  this->Modified();
+}
+
+uint64_t
+RegistrationMemoryUsage
+::GetBytes(ComponentType component) const
+{
+  if ( component < 0 || component >= NumberOfComponents )
+    {
+    itkExceptionMacro(<< "Invalid component " << component);
+    }
+  return m_Bytes[component];
+}
+
+uint64_t
+RegistrationMemoryUsage
+::GetTotalBytes() const
+{
+  uint64_t total = 0;
+  for ( unsigned int c = 0; c < NumberOfComponents; ++c )
+    {
+    total += m_Bytes[c];
+    }
+  return total;
+}
+
+void
+RegistrationMemoryUsage
+::Reset()
+{
+  for ( unsigned int c = 0; c < NumberOfComponents; ++c )
+    {
+    m_Bytes[c] = 0;
+    }
+  m_PeakBytes = 0;
+  this->Modified();
+}
+
+uint64_t
+RegistrationMemoryUsage
+::GetProcessPeakResidentBytes()
+{
+#if defined( _WIN32 )
+  PROCESS_MEMORY_COUNTERS counters;
+  if ( GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+    {
+    return static_cast< uint64_t >( counters.PeakWorkingSetSize );
+    }
+  return 0;
+#else
+  struct rusage usage;
+  if ( getrusage(RUSAGE_SELF, &usage) != 0 )
+    {
+    return 0;
+    }
+#if defined( __APPLE__ )
+  return static_cast< uint64_t >( usage.ru_maxrss );        // bytes
+#else
+  return static_cast< uint64_t >( usage.ru_maxrss ) * 1024; // kilobytes
+#endif
+#endif
+}
+
+uint64_t
+RegistrationMemoryUsage
+::EstimateMeshBytes(SizeValueType numberOfPoints, SizeValueType numberOfTriangles)
+{
+  // Points in a vector container; every cell is a separate heap object
+  // (vtable, three ids, allocator header) referenced from the cells
+  // container, plus the cell links the mesh may build.
+  const uint64_t pointBytes = 3 * sizeof( double );
+  const uint64_t cellBytes = sizeof( void * ) + 3 * sizeof( IdentifierType ) + 2 * sizeof( void * );
+  return numberOfPoints * pointBytes + numberOfTriangles * ( cellBytes + sizeof( void * ) );
+}
+
+uint64_t
+RegistrationMemoryUsage
+::EstimateOptimizerBytes(SizeValueType numberOfParameters)
+{
+  // vnl conjugate gradient: position, gradient, search direction and line
+  // search copies, plus the ITK adaptor's position and derivative
+  // conversions and the optimizer's cached position and derivative.
+  return static_cast< uint64_t >( 10 ) * numberOfParameters * sizeof( double );
+}
+
+void
+RegistrationMemoryUsage
+::Estimate(SizeValueType numberOfFixedPoints, SizeValueType numberOfFixedTriangles,
+           SizeValueType numberOfMovingPoints, SizeValueType numberOfMovingTriangles,
+           Self *usage, SizeValueType bytesPerCoordinate, SizeValueType numberOfWorkspaces)
+{
+  if ( !usage )
+    {
+    return;
+    }
+  const SizeValueType numberOfParameters = 3 * numberOfMovingPoints;
+  const SizeValueType numberOfNeighbors = TriangleVertexNeighborhood::GetNumberOfNeighbors(numberOfMovingTriangles);
+
+  usage->Reset();
+  usage->SetBytes( MeshesComponent,
+                   EstimateMeshBytes(numberOfFixedPoints, numberOfFixedTriangles)
+                   + EstimateMeshBytes(numberOfMovingPoints, numberOfMovingTriangles) );
+  usage->SetBytes( FixedPointsComponent, numberOfFixedPoints * 3 * sizeof( double ) );
+  usage->SetBytes( MovingPointsComponent, numberOfMovingPoints * 3 * bytesPerCoordinate );
+  // the neighborhoods and their transpose, and the laplacians (always
+  // double) of every evaluation workspace
+  usage->SetBytes( NeighborhoodsComponent,
+                   2 * ( ( numberOfMovingPoints + 1 ) * sizeof( SizeValueType ) + numberOfNeighbors * sizeof( uint32_t ) )
+                   + numberOfWorkspaces * numberOfMovingPoints * 3 * sizeof( double ) );
+  usage->SetBytes( SpatialIndexComponent,
+                   numberOfFixedPoints * ( 3 * sizeof( double ) + sizeof( uint32_t ) + sizeof( uint8_t ) ) );
+  usage->SetBytes( TargetPositionsComponent, numberOfMovingPoints * 3 * bytesPerCoordinate );
+  // transform, initial and last parameters
+  usage->SetBytes( ParametersComponent, 3 * numberOfParameters * sizeof( double ) );
+  usage->SetBytes( OptimizerWorkspaceComponent, EstimateOptimizerBytes(numberOfParameters) );
+}
+
+void
+RegistrationMemoryUsage
+::Report(std::ostream & os) const
+{
+  char line[128];
+  for ( unsigned int c = 0; c < NumberOfComponents; ++c )
+    {
+    snprintf( line, sizeof( line ), "%-24s %14.3f MB\n",
+              GetComponentName( static_cast< ComponentType >( c ) ), m_Bytes[c] / 1048576.0 );
+    os << line;
+    }
+  snprintf( line, sizeof( line ), "%-24s %14.3f MB\n", "Total", this->GetTotalBytes() / 1048576.0 );
+  os << line;
+  snprintf( line, sizeof( line ), "%-24s %14.3f MB\n", "Peak", m_PeakBytes / 1048576.0 );
+  os << line;
+}
+
+void
+RegistrationMemoryUsage
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  for ( unsigned int c = 0; c < NumberOfComponents; ++c )
+    {
+    os << indent << GetComponentName( static_cast< ComponentType >( c ) ) << ": " << m_Bytes[c] << std::endl;
+    }
+  os << indent << "PeakBytes: " << m_PeakBytes << std::endl;
+}
+} // end namespace itk
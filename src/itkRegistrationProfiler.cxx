@@ -0,0 +1,248 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkRegistrationProfiler.h"
+#include "itkNumericTraits.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace itk
+{
+RegistrationProfiler
+::RegistrationProfiler()
+{
+  m_Clock = RealTimeClock::New();
+  this->Reset();
+}
+
+const char *
+RegistrationProfiler
+::GetPhaseName(PhaseType phase)
+{
+  switch ( phase )
+    {
+    case RegistrationInitializePhase:
+      return "RegistrationInitialize";
+    case MetricInitializePhase:
+      return "MetricInitialize";
+    case CorrespondencePhase:
+      return "Correspondence";
+    case NeighborhoodPhase:
+      return "Neighborhood";
+    case GetValuePhase:
+      return "GetValue";
+    case GetDerivativePhase:
+      return "GetDerivative";
+    case OptimizationPhase:
+      return "Optimization";
+    case UpdateMovingMeshPhase:
+      return "UpdateMovingMesh";
+    default:
+      return "Unknown";
+    }
+}
+
+RegistrationProfiler::PhaseStatistics
+RegistrationProfiler
+::GetPhaseStatistics(PhaseType phase) const
+{
+  if ( phase < 0 || phase >= NumberOfPhases )
+    {
+    itkExceptionMacro(<< "Invalid phase " << phase);
+    }
+  m_Mutex.Lock();
+  const PhaseStatistics statistics = m_Phases[phase];
+  m_Mutex.Unlock();
+  return statistics;
+}
+
+double
+RegistrationProfiler
+::GetOptimizerOverhead() const
+{
+  m_Mutex.Lock();
+  const double overhead = m_Phases[OptimizationPhase].TotalTime
+                          - m_Phases[GetValuePhase].TotalTime
+                          - m_Phases[GetDerivativePhase].TotalTime;
+  const bool optimized = m_Phases[OptimizationPhase].NumberOfCalls > 0;
+  m_Mutex.Unlock();
+  return optimized && overhead > 0.0 ? overhead : 0.0;
+}
+
+void
+RegistrationProfiler
+::AddSample(PhaseType phase, double seconds, uint64_t bytes)
+{
+  if ( phase < 0 || phase >= NumberOfPhases )
+    {
+    return;
+    }
+  m_Mutex.Lock();
+  PhaseStatistics & statistics = m_Phases[phase];
+  ++statistics.NumberOfCalls;
+  statistics.TotalTime += seconds;
+  statistics.MinimumTime = std::min(statistics.MinimumTime, seconds);
+  statistics.MaximumTime = std::max(statistics.MaximumTime, seconds);
+  statistics.Bytes += bytes;
+  m_Mutex.Unlock();
+}
+
+bool
+RegistrationProfiler
+::BeginCounting(HardwareCounters::CountersType & counters) const
+{
+  return m_HardwareCounters && m_HardwareCounters->IsOwningThread() && m_HardwareCounters->Read(counters);
+}
+
+void
+RegistrationProfiler
+::EndPhase(PhaseType phase, double start, uint64_t bytes, const HardwareCounters::CountersType *startCounters)
+{
+  HardwareCounters::CountersType endCounters;
+  const bool                     counted = startCounters && m_HardwareCounters->Read(endCounters);
+  const double                   duration = this->GetTime() - start;
+
+  this->AddSample(phase, duration, bytes);
+  if ( counted && phase >= 0 && phase < NumberOfPhases )
+    {
+    m_Mutex.Lock();
+    PhaseStatistics & statistics = m_Phases[phase];
+    ++statistics.NumberOfCountedCalls;
+    for ( unsigned int c = 0; c < HardwareCounters::NumberOfCounters; ++c )
+      {
+      if ( startCounters->Available[c] && endCounters.Available[c] && endCounters.Values[c] >= startCounters->Values[c] )
+        {
+        statistics.Counters[c] += endCounters.Values[c] - startCounters->Values[c];
+        }
+      }
+    m_Mutex.Unlock();
+    }
+  if ( m_Tracer )
+    {
+    m_Tracer->AddCompleteEvent(GetPhaseName(phase), "registration", start, duration);
+    }
+}
+
+void
+RegistrationProfiler
+::Reset()
+{
+  m_Mutex.Lock();
+  for ( unsigned int p = 0; p < NumberOfPhases; ++p )
+    {
+    m_Phases[p].NumberOfCalls = 0;
+    m_Phases[p].TotalTime = 0.0;
+    m_Phases[p].MinimumTime = NumericTraits< double >::max();
+    m_Phases[p].MaximumTime = 0.0;
+    m_Phases[p].Bytes = 0;
+    m_Phases[p].NumberOfCountedCalls = 0;
+    for ( unsigned int c = 0; c < HardwareCounters::NumberOfCounters; ++c )
+      {
+      m_Phases[p].Counters[c] = 0;
+      }
+    }
+  m_Mutex.Unlock();
+  this->Modified();
+}
+
+void
+RegistrationProfiler
+::Publish()
+{
+  this->InvokeEvent( ProfileReportEvent() );
+}
+
+void
+RegistrationProfiler
+::Report(std::ostream & os) const
+{
+  char line[160];
+  snprintf( line, sizeof( line ), "%-24s %10s %14s %14s %14s %12s\n",
+            "Phase", "Calls", "Total (s)", "Mean (ms)", "Max (ms)", "GB/s" );
+  os << line;
+  for ( unsigned int p = 0; p < NumberOfPhases; ++p )
+    {
+    const PhaseStatistics statistics = this->GetPhaseStatistics( static_cast< PhaseType >( p ) );
+    if ( statistics.NumberOfCalls == 0 )
+      {
+      continue;
+      }
+    const double mean = statistics.TotalTime / statistics.NumberOfCalls;
+    const double bandwidth = statistics.TotalTime > 0.0 ? statistics.Bytes / statistics.TotalTime / 1e9 : 0.0;
+    snprintf( line, sizeof( line ), "%-24s %10lu %14.6f %14.4f %14.4f %12.3f\n",
+              GetPhaseName( static_cast< PhaseType >( p ) ),
+              static_cast< unsigned long >( statistics.NumberOfCalls ),
+              statistics.TotalTime, 1e3 * mean, 1e3 * statistics.MaximumTime, bandwidth );
+    os << line;
+    }
+  bool counted = false;
+  for ( unsigned int p = 0; p < NumberOfPhases; ++p )
+    {
+    counted = counted || this->GetPhaseStatistics( static_cast< PhaseType >( p ) ).NumberOfCountedCalls > 0;
+    }
+  if ( counted )
+    {
+    snprintf( line, sizeof( line ), "%-24s %16s %16s %8s %14s %14s\n",
+              "Phase", "Cycles", "Instructions", "IPC", "Cache misses", "Branch misses" );
+    os << line;
+    for ( unsigned int p = 0; p < NumberOfPhases; ++p )
+      {
+      const PhaseStatistics statistics = this->GetPhaseStatistics( static_cast< PhaseType >( p ) );
+      if ( statistics.NumberOfCountedCalls == 0 )
+        {
+        continue;
+        }
+      const uint64_t *counters = statistics.Counters;
+      const double    ipc = counters[HardwareCounters::Cycles] > 0
+                            ? static_cast< double >( counters[HardwareCounters::Instructions] ) / counters[HardwareCounters::Cycles]
+                            : 0.0;
+      snprintf( line, sizeof( line ), "%-24s %16.0f %16.0f %8.2f %14.0f %14.0f\n",
+                GetPhaseName( static_cast< PhaseType >( p ) ),
+                static_cast< double >( counters[HardwareCounters::Cycles] ),
+                static_cast< double >( counters[HardwareCounters::Instructions] ), ipc,
+                static_cast< double >( counters[HardwareCounters::CacheMisses] ),
+                static_cast< double >( counters[HardwareCounters::BranchMisses] ) );
+      os << line;
+      }
+    }
+  else if ( m_HardwareCounters && !m_HardwareCounters->IsAvailable() )
+    {
+    os << "Hardware counters unavailable: " << m_HardwareCounters->GetUnavailableReason() << std::endl;
+    }
+
+  if ( this->GetNumberOfCalls(OptimizationPhase) > 0 )
+    {
+    os << "Optimizer overhead (s): " << this->GetOptimizerOverhead() << std::endl;
+    }
+}
+
+void
+RegistrationProfiler
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Tracer: " << m_Tracer.GetPointer() << std::endl;
+  os << indent << "HardwareCounters: " << m_HardwareCounters.GetPointer() << std::endl;
+  for ( unsigned int p = 0; p < NumberOfPhases; ++p )
+    {
+    const PhaseStatistics statistics = this->GetPhaseStatistics( static_cast< PhaseType >( p ) );
+    os << indent << GetPhaseName( static_cast< PhaseType >( p ) ) << ": "
+       << statistics.NumberOfCalls << " calls, " << statistics.TotalTime << " s, "
+       << statistics.Bytes << " bytes" << std::endl;
+    }
+}
+} // end namespace itk
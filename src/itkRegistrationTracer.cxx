@@ -0,0 +1,310 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkRegistrationTracer.h"
+#include "itkSimpleFastMutexLock.h"
+#include <cstdio>
+#include <fstream>
+
+#if !defined( _WIN32 )
+#include <pthread.h>
+#endif
+
+#if defined( _MSC_VER )
+#define ITK_TRACER_THREAD_LOCAL __declspec( thread )
+#else
+#define ITK_TRACER_THREAD_LOCAL __thread
+#endif
+
+namespace itk
+{
+namespace
+{
+// Threads are numbered in the order of their first traced event, once per
+// process, so every tracer uses the same buffer slot for a thread. The
+// number of a thread that exits is handed to the next new thread, so that
+// the slots are not used up by threaders that start fresh threads for
+// every call.
+AtomicInt< int >            tracerThreadCount;
+ITK_TRACER_THREAD_LOCAL int tracerThreadNumber = -1;
+SimpleFastMutexLock         tracerFreeNumbersLock;
+std::vector< int >          tracerFreeNumbers;
+
+#if !defined( _WIN32 )
+pthread_key_t  tracerThreadKey;
+pthread_once_t tracerThreadKeyOnce = PTHREAD_ONCE_INIT;
+
+// called on thread exit with the thread number plus one
+void
+ReleaseTracerThreadNumber(void *value)
+{
+  tracerFreeNumbersLock.Lock();
+  tracerFreeNumbers.push_back( static_cast< int >( reinterpret_cast< intptr_t >( value ) - 1 ) );
+  tracerFreeNumbersLock.Unlock();
+}
+
+void
+CreateTracerThreadKey()
+{
+  pthread_key_create(&tracerThreadKey, ReleaseTracerThreadNumber);
+}
+#endif
+
+int
+ClaimTracerThreadNumber()
+{
+  int number = -1;
+  tracerFreeNumbersLock.Lock();
+  if ( !tracerFreeNumbers.empty() )
+    {
+    number = tracerFreeNumbers.back();
+    tracerFreeNumbers.pop_back();
+    }
+  tracerFreeNumbersLock.Unlock();
+  if ( number < 0 )
+    {
+    number = tracerThreadCount++;
+    }
+#if !defined( _WIN32 )
+  pthread_once(&tracerThreadKeyOnce, CreateTracerThreadKey);
+  pthread_setspecific( tracerThreadKey, reinterpret_cast< void * >( static_cast< intptr_t >( number ) + 1 ) );
+#endif
+  return number;
+}
+
+/** Write a string literal as a JSON string. */
+void
+WriteJSONString(std::ostream & os, const char *text)
+{
+  os << '"';
+  for ( const char *c = text; *c; ++c )
+    {
+    if ( *c == '"' || *c == '\\' )
+      {
+      os << '\\';
+      }
+    os << *c;
+    }
+  os << '"';
+}
+} // end anonymous namespace
+
+RegistrationTracer
+::RegistrationTracer()
+{
+  m_Clock = RealTimeClock::New();
+  m_Origin = m_Clock->GetTimeInSeconds();
+  m_EventsPerThread = 65536;
+  m_NumberOfUntracedEvents = 0;
+  for ( unsigned int t = 0; t < MaximumNumberOfThreads; ++t )
+    {
+    m_Buffers[t] = ITK_NULLPTR;
+    }
+}
+
+RegistrationTracer
+::~RegistrationTracer()
+{
+  for ( unsigned int t = 0; t < MaximumNumberOfThreads; ++t )
+    {
+    delete m_Buffers[t];
+    }
+}
+
+int
+RegistrationTracer
+::GetThreadNumber()
+{
+  if ( tracerThreadNumber < 0 )
+    {
+    tracerThreadNumber = ClaimTracerThreadNumber();
+    }
+  return tracerThreadNumber;
+}
+
+RegistrationTracer::ThreadBufferType *
+RegistrationTracer
+::GetThreadBuffer()
+{
+  const int thread = GetThreadNumber();
+  if ( thread >= static_cast< int >( MaximumNumberOfThreads ) )
+    {
+    return ITK_NULLPTR;
+    }
+  // only this thread writes this slot
+  if ( !m_Buffers[thread] )
+    {
+    ThreadBufferType *buffer = new ThreadBufferType;
+    buffer->Events.reserve(m_EventsPerThread);
+    buffer->Dropped = 0;
+    m_Buffers[thread] = buffer;
+    }
+  return m_Buffers[thread];
+}
+
+void
+RegistrationTracer
+::AddCompleteEvent(const char *name, const char *category, double start, double duration, int64_t argument)
+{
+  ThreadBufferType *buffer = this->GetThreadBuffer();
+  if ( !buffer )
+    {
+    ++m_NumberOfUntracedEvents;
+    return;
+    }
+  if ( buffer->Events.size() >= buffer->Events.capacity() )
+    {
+    ++buffer->Dropped;
+    return;
+    }
+  EventType event;
+  event.Name = name;
+  event.Category = category;
+  event.Start = start;
+  event.Duration = duration;
+  event.Argument = argument;
+  buffer->Events.push_back(event);
+}
+
+void
+RegistrationTracer
+::AddInstantEvent(const char *name, const char *category, int64_t argument)
+{
+  this->AddCompleteEvent(name, category, this->GetTime(), -1.0, argument);
+}
+
+SizeValueType
+RegistrationTracer
+::GetNumberOfEvents() const
+{
+  SizeValueType count = 0;
+  for ( unsigned int t = 0; t < MaximumNumberOfThreads; ++t )
+    {
+    if ( m_Buffers[t] )
+      {
+      count += m_Buffers[t]->Events.size();
+      }
+    }
+  return count;
+}
+
+SizeValueType
+RegistrationTracer
+::GetNumberOfDroppedEvents() const
+{
+  SizeValueType count = static_cast< SizeValueType >( m_NumberOfUntracedEvents.load() );
+  for ( unsigned int t = 0; t < MaximumNumberOfThreads; ++t )
+    {
+    if ( m_Buffers[t] )
+      {
+      count += m_Buffers[t]->Dropped;
+      }
+    }
+  return count;
+}
+
+void
+RegistrationTracer
+::Clear()
+{
+  for ( unsigned int t = 0; t < MaximumNumberOfThreads; ++t )
+    {
+    delete m_Buffers[t];
+    m_Buffers[t] = ITK_NULLPTR;
+    }
+  m_NumberOfUntracedEvents = 0;
+  m_Origin = m_Clock->GetTimeInSeconds();
+  this->Modified();
+}
+
+void
+RegistrationTracer
+::WriteChromeTrace(std::ostream & os) const
+{
+  char number[64];
+  bool first = true;
+
+  os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  for ( unsigned int t = 0; t < MaximumNumberOfThreads; ++t )
+    {
+    const ThreadBufferType *buffer = m_Buffers[t];
+    if ( !buffer )
+      {
+      continue;
+      }
+
+    os << ( first ? "" : ",\n" )
+       << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+       << ",\"args\":{\"name\":\"thread " << t << "\"}}";
+    first = false;
+
+    for ( std::vector< EventType >::const_iterator it = buffer->Events.begin(); it != buffer->Events.end(); ++it )
+      {
+      os << ",\n{\"name\":";
+      WriteJSONString(os, it->Name);
+      os << ",\"cat\":";
+      WriteJSONString(os, it->Category);
+      // timestamps in microseconds
+      snprintf( number, sizeof( number ), "%.3f", 1e6 * ( it->Start - m_Origin ) );
+      os << ",\"ts\":" << number;
+      if ( it->Duration >= 0.0 )
+        {
+        snprintf( number, sizeof( number ), "%.3f", 1e6 * it->Duration );
+        os << ",\"ph\":\"X\",\"dur\":" << number;
+        }
+      else
+        {
+        os << ",\"ph\":\"i\",\"s\":\"t\"";
+        }
+      os << ",\"pid\":1,\"tid\":" << t;
+      if ( it->Argument >= 0 )
+        {
+        os << ",\"args\":{\"id\":" << it->Argument << "}";
+        }
+      os << "}";
+      }
+    }
+  os << "\n]}\n";
+}
+
+void
+RegistrationTracer
+::WriteChromeTrace(const std::string & fileName) const
+{
+  std::ofstream file( fileName.c_str(), std::ios::out | std::ios::binary );
+  if ( !file.is_open() )
+    {
+    itkExceptionMacro(<< "Unable to open " << fileName);
+    }
+  this->WriteChromeTrace(file);
+  if ( !file )
+    {
+    itkExceptionMacro(<< "Error writing " << fileName);
+    }
+}
+
+void
+RegistrationTracer
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "EventsPerThread: " << m_EventsPerThread << std::endl;
+  os << indent << "NumberOfEvents: " << this->GetNumberOfEvents() << std::endl;
+  os << indent << "NumberOfDroppedEvents: " << this->GetNumberOfDroppedEvents() << std::endl;
+  os << indent << "NumberOfUntracedEvents: " << m_NumberOfUntracedEvents.load() << std::endl;
+}
+} // end namespace itk
@@ -0,0 +1,465 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkSharedTemplateCache.h"
+#include "itkNativeMeshFileFormat.h"
+#include "itkTriangleVertexNeighborhood.h"
+#include <cstdio>
+#include <cstring>
+
+#if !defined( _WIN32 )
+#define ITK_SHARED_TEMPLATE_CACHE_USE_SHM
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace itk
+{
+namespace
+{
+/** Layout of a shared template segment. Every array starts on a 64 byte
+ *  boundary. Ready is set last by the publisher, which holds an exclusive
+ *  flock() on the segment from its creation until then. */
+struct SharedTemplateCacheHeader
+{
+  char     Magic[8];
+  uint32_t Version;
+  uint32_t Ready;
+  uint32_t SizeOfSizeValueType;
+  uint32_t LeafSize;
+  uint64_t NumberOfPoints;
+  uint64_t NumberOfTriangles;
+  uint64_t TopologyHash;
+  uint64_t CoordinateHash;
+  uint64_t PointsOffset;
+  uint64_t TrianglesOffset;
+  uint64_t NeighborOffsetsOffset;
+  uint64_t NeighborsOffset;
+  uint64_t LocatorPointsOffset;
+  uint64_t LocatorIndicesOffset;
+  uint64_t LocatorSplitAxesOffset;
+  uint64_t Size;
+};
+
+const char SharedTemplateCacheMagic[] = "TSDSHM01";
+
+void
+ComputeLayout(SharedTemplateCacheHeader & header, SizeValueType numberOfPoints, SizeValueType numberOfTriangles)
+{
+  header.NumberOfPoints = numberOfPoints;
+  header.NumberOfTriangles = numberOfTriangles;
+  header.PointsOffset = NativeMeshFile::Align( sizeof( SharedTemplateCacheHeader ) );
+  header.TrianglesOffset = NativeMeshFile::Align( header.PointsOffset + 3 * numberOfPoints * sizeof( double ) );
+  header.NeighborOffsetsOffset =
+    NativeMeshFile::Align( header.TrianglesOffset + 3 * numberOfTriangles * sizeof( uint32_t ) );
+  header.NeighborsOffset =
+    NativeMeshFile::Align( header.NeighborOffsetsOffset + ( numberOfPoints + 1 ) * sizeof( SizeValueType ) );
+  header.LocatorPointsOffset = NativeMeshFile::Align( header.NeighborsOffset
+                                                      + TriangleVertexNeighborhood::GetNumberOfNeighbors(
+                                                        numberOfTriangles) * sizeof( uint32_t ) );
+  header.LocatorIndicesOffset = NativeMeshFile::Align( header.LocatorPointsOffset + 3 * numberOfPoints * sizeof( double ) );
+  header.LocatorSplitAxesOffset = NativeMeshFile::Align( header.LocatorIndicesOffset + numberOfPoints * sizeof( uint32_t ) );
+  header.Size = header.LocatorSplitAxesOffset + numberOfPoints * sizeof( uint8_t );
+}
+
+#if defined( ITK_SHARED_TEMPLATE_CACHE_USE_SHM )
+uint32_t
+LoadReady(const SharedTemplateCacheHeader *header)
+{
+  return __atomic_load_n(&header->Ready, __ATOMIC_ACQUIRE);
+}
+
+/** Remove the segment if its publisher died before setting Ready. The lock
+ *  of a publisher is released with its process, so a segment that is not
+ *  ready while nobody holds the lock cannot become ready any more. A
+ *  publisher between shm_open() and flock() blocks on the lock taken here
+ *  and completes a segment that is no longer linked, which only costs the
+ *  work. */
+bool
+ReclaimIfAbandoned(int fd, const std::string & name)
+{
+  if ( flock(fd, LOCK_EX | LOCK_NB) != 0 )
+    {
+    return false;
+    }
+
+  bool        ready = false;
+  struct stat info;
+  if ( fstat(fd, &info) == 0 && static_cast< SizeValueType >( info.st_size ) >= sizeof( SharedTemplateCacheHeader ) )
+    {
+    void *data = mmap(ITK_NULLPTR, sizeof( SharedTemplateCacheHeader ), PROT_READ, MAP_SHARED, fd, 0);
+    if ( data == MAP_FAILED )
+      {
+      // cannot tell, leave it alone
+      flock(fd, LOCK_UN);
+      return false;
+      }
+    ready = LoadReady( static_cast< const SharedTemplateCacheHeader * >( data ) ) == 1;
+    munmap(data, sizeof( SharedTemplateCacheHeader ));
+    }
+  if ( !ready )
+    {
+    shm_unlink( name.c_str() );
+    }
+  flock(fd, LOCK_UN);
+  return !ready;
+}
+#endif
+} // end anonymous namespace
+
+SharedTemplateCache
+::SharedTemplateCache() :
+  m_TopologyHash( 0 ),
+  m_CoordinateHash( 0 ),
+  m_AttachTimeout( 30.0 ),
+  m_UnlinkOnDetach( false ),
+  m_IsPublisher( false ),
+  m_Segment( ITK_NULLPTR ),
+  m_Size( 0 ),
+  m_NumberOfPoints( 0 ),
+  m_NumberOfTriangles( 0 ),
+  m_Points( ITK_NULLPTR ),
+  m_Triangles( ITK_NULLPTR ),
+  m_NeighborOffsets( ITK_NULLPTR ),
+  m_Neighbors( ITK_NULLPTR )
+{
+  m_PointLocator = FlatPointLocator::New();
+}
+
+SharedTemplateCache
+::~SharedTemplateCache()
+{
+  this->Detach();
+}
+
+std::string
+SharedTemplateCache
+::GetSegmentName() const
+{
+  // short enough for the 31 character limit of some systems
+  const uint64_t key = NativeMeshFile::Hash( &m_CoordinateHash, sizeof( m_CoordinateHash ),
+                                             NativeMeshFile::Hash( &m_TopologyHash, sizeof( m_TopologyHash ),
+                                                                   NativeMeshFile::GetHashSeed() ) );
+  char name[32];
+  snprintf( name, sizeof( name ), "/itktsd-%08x%08x",
+            static_cast< unsigned int >( key >> 32 ), static_cast< unsigned int >( key & 0xffffffffu ) );
+  return std::string(name);
+}
+
+SizeValueType
+SharedTemplateCache
+::ComputeSize(SizeValueType numberOfPoints, SizeValueType numberOfTriangles) const
+{
+  SharedTemplateCacheHeader header;
+  ComputeLayout(header, numberOfPoints, numberOfTriangles);
+  return header.Size;
+}
+
+void
+SharedTemplateCache
+::Fill(char *segment, const double *points, SizeValueType numberOfPoints,
+       const uint32_t *triangles, SizeValueType numberOfTriangles, SizeValueType size) const
+{
+  SharedTemplateCacheHeader header;
+  std::memset( &header, 0, sizeof( header ) );
+  std::memcpy( header.Magic, SharedTemplateCacheMagic, sizeof( header.Magic ) );
+  header.Version = 1;
+  header.SizeOfSizeValueType = sizeof( SizeValueType );
+  header.LeafSize = FlatPointLocator::LeafSize;
+  header.TopologyHash = m_TopologyHash;
+  header.CoordinateHash = m_CoordinateHash;
+  ComputeLayout(header, numberOfPoints, numberOfTriangles);
+  if ( header.Size != size )
+    {
+    itkExceptionMacro(<< "Segment size mismatch");
+    }
+
+  std::memcpy( segment + header.PointsOffset, points, 3 * numberOfPoints * sizeof( double ) );
+  std::memcpy( segment + header.TrianglesOffset, triangles, 3 * numberOfTriangles * sizeof( uint32_t ) );
+
+  if ( !TriangleVertexNeighborhood::Build( triangles, numberOfTriangles, numberOfPoints,
+                                           reinterpret_cast< SizeValueType * >( segment + header.NeighborOffsetsOffset ),
+                                           reinterpret_cast< uint32_t * >( segment + header.NeighborsOffset ) ) )
+    {
+    itkExceptionMacro(<< "A triangle references a vertex outside of the template");
+    }
+
+  FlatPointLocator::Pointer locator = FlatPointLocator::New();
+  locator->Build(points, numberOfPoints);
+  std::memcpy( segment + header.LocatorPointsOffset, locator->GetPointArray(), 3 * numberOfPoints * sizeof( double ) );
+  std::memcpy( segment + header.LocatorIndicesOffset, locator->GetIndexArray(), numberOfPoints * sizeof( uint32_t ) );
+  std::memcpy( segment + header.LocatorSplitAxesOffset, locator->GetSplitAxisArray(), numberOfPoints * sizeof( uint8_t ) );
+
+  // the header goes in last, Ready still zero
+  std::memcpy( segment, &header, sizeof( header ) );
+}
+
+bool
+SharedTemplateCache
+::SetViews(const char *segment, SizeValueType size)
+{
+  SharedTemplateCacheHeader header;
+  if ( size < sizeof( header ) )
+    {
+    return false;
+    }
+  std::memcpy( &header, segment, sizeof( header ) );
+
+  if ( std::memcmp( header.Magic, SharedTemplateCacheMagic, sizeof( header.Magic ) ) != 0
+       || header.Version != 1 || header.Ready != 1
+       || header.SizeOfSizeValueType != sizeof( SizeValueType )
+       || header.LeafSize != FlatPointLocator::LeafSize
+       || header.Size != size
+       || header.TopologyHash != m_TopologyHash
+       || header.CoordinateHash != m_CoordinateHash )
+    {
+    return false;
+    }
+
+  m_Segment = segment;
+  m_Size = size;
+  m_NumberOfPoints = header.NumberOfPoints;
+  m_NumberOfTriangles = header.NumberOfTriangles;
+  m_Points = reinterpret_cast< const double * >( segment + header.PointsOffset );
+  m_Triangles = reinterpret_cast< const uint32_t * >( segment + header.TrianglesOffset );
+  m_NeighborOffsets = reinterpret_cast< const SizeValueType * >( segment + header.NeighborOffsetsOffset );
+  m_Neighbors = reinterpret_cast< const uint32_t * >( segment + header.NeighborsOffset );
+  m_PointLocator->SetExternalArrays( reinterpret_cast< const double * >( segment + header.LocatorPointsOffset ),
+                                     reinterpret_cast< const uint32_t * >( segment + header.LocatorIndicesOffset ),
+                                     reinterpret_cast< const uint8_t * >( segment + header.LocatorSplitAxesOffset ),
+                                     m_NumberOfPoints, m_TopologyHash, m_CoordinateHash );
+  this->Modified();
+  return true;
+}
+
+bool
+SharedTemplateCache
+::Attach()
+{
+  this->Detach();
+
+#if defined( ITK_SHARED_TEMPLATE_CACHE_USE_SHM )
+  const std::string name = this->GetSegmentName();
+  const int         fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if ( fd < 0 )
+    {
+    return false;
+    }
+
+  // The publisher may still be sizing or filling the segment; a segment
+  // whose publisher died is removed, and the caller may publish again.
+  const long  pollMicroseconds = 1000;
+  const long  maximumPolls = static_cast< long >( m_AttachTimeout * 1e6 / pollMicroseconds );
+  long        polls = 0;
+  struct stat info;
+  while ( fstat(fd, &info) == 0 && static_cast< SizeValueType >( info.st_size ) < sizeof( SharedTemplateCacheHeader ) )
+    {
+    if ( ReclaimIfAbandoned(fd, name) )
+      {
+      close(fd);
+      itkWarningMacro(<< "Removed shared template segment " << name << ", abandoned by its publisher");
+      return false;
+      }
+    if ( polls++ >= maximumPolls )
+      {
+      break;
+      }
+    usleep(pollMicroseconds);
+    }
+  if ( static_cast< SizeValueType >( info.st_size ) < sizeof( SharedTemplateCacheHeader ) )
+    {
+    close(fd);
+    itkWarningMacro(<< "Shared template segment " << name << " was never sized");
+    return false;
+    }
+
+  const SizeValueType size = static_cast< SizeValueType >( info.st_size );
+  void *              data = mmap(ITK_NULLPTR, size, PROT_READ, MAP_SHARED, fd, 0);
+  if ( data == MAP_FAILED )
+    {
+    close(fd);
+    return false;
+    }
+
+  const SharedTemplateCacheHeader *header = static_cast< const SharedTemplateCacheHeader * >( data );
+  while ( LoadReady(header) != 1 )
+    {
+    if ( ReclaimIfAbandoned(fd, name) )
+      {
+      munmap(data, size);
+      close(fd);
+      itkWarningMacro(<< "Removed shared template segment " << name << ", abandoned by its publisher");
+      return false;
+      }
+    if ( polls++ >= maximumPolls )
+      {
+      break;
+      }
+    usleep(pollMicroseconds);
+    }
+  close(fd);
+  if ( LoadReady(header) != 1 || !this->SetViews(static_cast< const char * >( data ), size) )
+    {
+    munmap(data, size);
+    itkWarningMacro(<< "Shared template segment " << name << " is incomplete or does not match the template");
+    return false;
+    }
+  m_IsPublisher = false;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void
+SharedTemplateCache
+::Publish(const double *points, SizeValueType numberOfPoints,
+          const uint32_t *triangles, SizeValueType numberOfTriangles)
+{
+  this->Detach();
+
+  if ( m_TopologyHash == 0 )
+    {
+    m_TopologyHash = NativeMeshFile::TopologyHash(numberOfPoints, triangles, numberOfTriangles);
+    }
+  if ( m_CoordinateHash == 0 )
+    {
+    m_CoordinateHash = NativeMeshFile::CoordinateHash(points, 3 * numberOfPoints);
+    }
+
+  const SizeValueType size = this->ComputeSize(numberOfPoints, numberOfTriangles);
+
+#if defined( ITK_SHARED_TEMPLATE_CACHE_USE_SHM )
+  const std::string name = this->GetSegmentName();
+  int               fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if ( fd < 0 && errno == EEXIST )
+    {
+    // somebody else won the race, or died publishing, in which case
+    // Attach() removes the segment and it can be created again
+    if ( this->Attach() )
+      {
+      return;
+      }
+    fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if ( fd < 0 && errno == EEXIST )
+      {
+      itkExceptionMacro(<< "Shared template segment " << name << " exists but cannot be used; "
+                        "remove it with Unlink()");
+      }
+    }
+  if ( fd >= 0 )
+    {
+    // held until Ready is set, so that attachers can tell a slow publisher
+    // from a dead one
+    void *data = MAP_FAILED;
+    if ( flock(fd, LOCK_EX) == 0 && ftruncate( fd, static_cast< off_t >( size ) ) == 0 )
+      {
+      data = mmap(ITK_NULLPTR, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      }
+    if ( data == MAP_FAILED )
+      {
+      shm_unlink( name.c_str() );
+      close(fd);
+      itkExceptionMacro(<< "Unable to size or map shared template segment " << name);
+      }
+    try
+      {
+      this->Fill(static_cast< char * >( data ), points, numberOfPoints, triangles, numberOfTriangles, size);
+      }
+    catch ( ExceptionObject & )
+      {
+      munmap(data, size);
+      shm_unlink( name.c_str() );
+      close(fd);
+      throw;
+      }
+    __atomic_store_n(&static_cast< SharedTemplateCacheHeader * >( data )->Ready, 1u, __ATOMIC_RELEASE);
+    close(fd);
+    this->SetViews(static_cast< const char * >( data ), size);
+    m_IsPublisher = true;
+    return;
+    }
+  itkWarningMacro(<< "Unable to create shared template segment " << name << ", keeping a private copy");
+#endif
+
+  m_PrivateCopy.assign(size, 0);
+  this->Fill(&m_PrivateCopy[0], points, numberOfPoints, triangles, numberOfTriangles, size);
+  reinterpret_cast< SharedTemplateCacheHeader * >( &m_PrivateCopy[0] )->Ready = 1;
+  this->SetViews(&m_PrivateCopy[0], size);
+  m_IsPublisher = true;
+}
+
+void
+SharedTemplateCache
+::Detach()
+{
+  if ( m_Segment == ITK_NULLPTR )
+    {
+    return;
+    }
+#if defined( ITK_SHARED_TEMPLATE_CACHE_USE_SHM )
+  if ( m_PrivateCopy.empty() )
+    {
+    munmap(const_cast< void * >( m_Segment ), m_Size);
+    if ( m_IsPublisher && m_UnlinkOnDetach )
+      {
+      this->Unlink();
+      }
+    }
+#endif
+  m_PrivateCopy.clear();
+  m_Segment = ITK_NULLPTR;
+  m_Size = 0;
+  m_NumberOfPoints = 0;
+  m_NumberOfTriangles = 0;
+  m_Points = ITK_NULLPTR;
+  m_Triangles = ITK_NULLPTR;
+  m_NeighborOffsets = ITK_NULLPTR;
+  m_Neighbors = ITK_NULLPTR;
+  m_PointLocator->SetExternalArrays(ITK_NULLPTR, ITK_NULLPTR, ITK_NULLPTR, 0, 0, 0);
+  m_IsPublisher = false;
+}
+
+void
+SharedTemplateCache
+::Unlink()
+{
+#if defined( ITK_SHARED_TEMPLATE_CACHE_USE_SHM )
+  shm_unlink( this->GetSegmentName().c_str() );
+#endif
+}
+
+void
+SharedTemplateCache
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "SegmentName: " << this->GetSegmentName() << std::endl;
+  os << indent << "TopologyHash: " << m_TopologyHash << std::endl;
+  os << indent << "CoordinateHash: " << m_CoordinateHash << std::endl;
+  os << indent << "AttachTimeout: " << m_AttachTimeout << std::endl;
+  os << indent << "UnlinkOnDetach: " << m_UnlinkOnDetach << std::endl;
+  os << indent << "IsPublisher: " << m_IsPublisher << std::endl;
+  os << indent << "NumberOfPoints: " << m_NumberOfPoints << std::endl;
+  os << indent << "NumberOfTriangles: " << m_NumberOfTriangles << std::endl;
+  os << indent << "SizeInBytes: " << m_Size << std::endl;
+}
+} // end namespace itk
@@ -0,0 +1,435 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkSpeculativeLineSearchOptimizer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace itk
+{
+SpeculativeLineSearchOptimizer
+::SpeculativeLineSearchOptimizer() :
+  m_NumberOfIterations(100),
+  m_NumberOfCandidates(0),
+  m_StepLengthRatio(2.0),
+  m_InitialStepLength(1.0),
+  m_SufficientDecrease(1e-4),
+  m_CurvatureCondition(0.1),
+  m_MaximumNumberOfLineSearchRounds(4),
+  m_GradientMagnitudeTolerance(1e-6),
+  m_ValueTolerance(1e-10),
+  m_UseConcurrentEvaluations(true),
+  m_Value(0.0),
+  m_CurrentIteration(0),
+  m_CurrentStepLength(0.0),
+  m_NumberOfEvaluations(0),
+  m_NumberOfLineSearchRounds(0),
+  m_StopCondition(Unknown),
+  m_Stop(false)
+{
+}
+
+WorkerPool *
+SpeculativeLineSearchOptimizer
+::GetActiveWorkerPool() const
+{
+  return m_WorkerPool ? m_WorkerPool.GetPointer() : WorkerPool::GetGlobalPool();
+}
+
+void
+SpeculativeLineSearchOptimizer
+::StopOptimization()
+{
+  m_Stop = true;
+}
+
+const std::string
+SpeculativeLineSearchOptimizer
+::GetStopConditionDescription() const
+{
+  return m_StopConditionDescription;
+}
+
+void
+SpeculativeLineSearchOptimizer
+::StartOptimization()
+{
+  if ( !m_CostFunction )
+    {
+    itkExceptionMacro(<< "CostFunction is not present");
+    }
+  if ( !( m_SufficientDecrease > 0.0 && m_SufficientDecrease < m_CurvatureCondition && m_CurvatureCondition < 1.0 ) )
+    {
+    itkExceptionMacro(<< "Wolfe constants must satisfy 0 < SufficientDecrease < CurvatureCondition < 1, got "
+                      << m_SufficientDecrease << " and " << m_CurvatureCondition);
+    }
+
+  m_Stop = false;
+  m_StopCondition = Unknown;
+  m_StopConditionDescription = "Running";
+  m_CurrentIteration = 0;
+  m_CurrentStepLength = 0.0;
+  m_NumberOfEvaluations = 0;
+  m_NumberOfLineSearchRounds = 0;
+
+  this->SetCurrentPosition( this->GetInitialPosition() );
+  const SizeValueType numberOfParameters = m_CurrentPosition.Size();
+  m_Direction.SetSize(numberOfParameters);
+  m_Direction.Fill(0.0);
+
+  this->InvokeEvent( StartEvent() );
+
+  m_CostFunction->GetValueAndDerivative(m_CurrentPosition, m_Value, m_Gradient);
+  ++m_NumberOfEvaluations;
+  if ( m_Gradient.Size() != numberOfParameters )
+    {
+    itkExceptionMacro(<< "The derivative has " << m_Gradient.Size() << " components, expected "
+                      << numberOfParameters);
+    }
+
+  DerivativeType preconditioned;
+  double         previousSlope = 0.0;
+  while ( true )
+    {
+    if ( m_Stop )
+      {
+      m_StopCondition = StoppedByUser;
+      m_StopConditionDescription = "StopOptimization() called";
+      break;
+      }
+    if ( m_CurrentIteration >= m_NumberOfIterations )
+      {
+      m_StopCondition = MaximumNumberOfIterations;
+      m_StopConditionDescription = "Maximum number of iterations reached";
+      break;
+      }
+
+    this->Precondition(m_Gradient, preconditioned);
+    double largest = 0.0;
+    for ( SizeValueType i = 0; i < numberOfParameters; ++i )
+      {
+      largest = std::max( largest, std::fabs(preconditioned[i]) );
+      }
+    if ( preconditioned.magnitude() <= m_GradientMagnitudeTolerance || largest == 0.0 )
+      {
+      m_StopCondition = GradientMagnitudeTolerance;
+      m_StopConditionDescription = "Gradient magnitude tolerance reached";
+      break;
+      }
+
+    this->ComputeDirection(preconditioned);
+    double slope = 0.0;
+    double reach = 0.0;
+    for ( SizeValueType i = 0; i < numberOfParameters; ++i )
+      {
+      slope += m_Gradient[i] * m_Direction[i];
+      reach = std::max( reach, std::fabs(m_Direction[i]) );
+      }
+
+    // the first step moves the largest parameter by InitialStepLength; the
+    // later ones expect the same decrease along the new direction as along
+    // the last
+    double guess = m_InitialStepLength / reach;
+    if ( m_CurrentIteration > 0 )
+      {
+      const double scaled = m_CurrentStepLength * previousSlope / slope;
+      if ( scaled > 0.0 && scaled <= NumericTraits< double >::max() )
+        {
+        guess = scaled;
+        }
+      }
+
+    const MeasureType previousValue = m_Value;
+    m_PreviousGradient = m_Gradient;
+    m_PreviousPreconditioned = preconditioned;
+    if ( !this->LineSearch(guess, slope) )
+      {
+      m_StopCondition = LineSearchFailed;
+      m_StopConditionDescription = "No step length decreased the value enough";
+      break;
+      }
+    previousSlope = slope;
+    ++m_CurrentIteration;
+    this->InvokeEvent( IterationEvent() );
+
+    if ( previousValue - m_Value <= m_ValueTolerance * std::max( 1.0, std::fabs(m_Value) ) )
+      {
+      m_StopCondition = ValueTolerance;
+      m_StopConditionDescription = "Value tolerance reached";
+      break;
+      }
+    }
+
+  this->InvokeEvent( EndEvent() );
+}
+
+void
+SpeculativeLineSearchOptimizer
+::Precondition(const DerivativeType & gradient, DerivativeType & preconditioned) const
+{
+  // as GradientDescentOptimizer, the gradient divided by the scales, when
+  // they are set
+  const ScalesType & scales = this->GetScales();
+  const bool         scaled = scales.Size() == gradient.Size();
+  preconditioned.SetSize( gradient.Size() );
+  for ( SizeValueType i = 0; i < gradient.Size(); ++i )
+    {
+    preconditioned[i] = scaled ? gradient[i] / scales[i] : gradient[i];
+    }
+}
+
+void
+SpeculativeLineSearchOptimizer
+::ComputeDirection(const DerivativeType & preconditioned)
+{
+  const SizeValueType numberOfParameters = preconditioned.Size();
+
+  // Polak-Ribiere with restarts: beta = z.(g - g') / z'.g', at least 0
+  double beta = 0.0;
+  if ( m_CurrentIteration > 0 && m_PreviousGradient.Size() == numberOfParameters )
+    {
+    double numerator = 0.0;
+    double denominator = 0.0;
+    for ( SizeValueType i = 0; i < numberOfParameters; ++i )
+      {
+      numerator += preconditioned[i] * ( m_Gradient[i] - m_PreviousGradient[i] );
+      denominator += m_PreviousPreconditioned[i] * m_PreviousGradient[i];
+      }
+    beta = denominator > 0.0 ? std::max( 0.0, numerator / denominator ) : 0.0;
+    }
+
+  double slope = 0.0;
+  for ( SizeValueType i = 0; i < numberOfParameters; ++i )
+    {
+    m_Direction[i] = -preconditioned[i] + beta * m_Direction[i];
+    slope += m_Gradient[i] * m_Direction[i];
+    }
+  if ( !( slope < 0.0 ) )
+    {
+    for ( SizeValueType i = 0; i < numberOfParameters; ++i )
+      {
+      m_Direction[i] = -preconditioned[i];
+      }
+    }
+}
+
+bool
+SpeculativeLineSearchOptimizer
+::LineSearch(double guess, double slope)
+{
+  const unsigned int numberOfCandidates = m_NumberOfCandidates > 0 ? m_NumberOfCandidates :
+                                          std::max< unsigned int >( 2, this->GetActiveWorkerPool()->GetNumberOfThreads() );
+  m_CandidateSteps.resize(numberOfCandidates);
+  m_CandidatePositions.resize(numberOfCandidates);
+  m_CandidateValues.resize(numberOfCandidates);
+  m_CandidateDerivatives.resize(numberOfCandidates);
+  m_CandidateErrors.resize(numberOfCandidates);
+
+  // the candidates are middle * ratio^(i - center), in increasing order
+  const int    center = static_cast< int >( numberOfCandidates - 1 ) / 2;
+  double       middle = guess;
+  double       ratio = m_StepLengthRatio;
+  bool         haveBest = false;
+  MeasureType  bestValue = 0.0;
+  double       bestStep = 0.0;
+  const double curvature = m_CurvatureCondition * std::fabs(slope);
+
+  for ( unsigned int round = 0; round < m_MaximumNumberOfLineSearchRounds; ++round )
+    {
+    for ( unsigned int i = 0; i < numberOfCandidates; ++i )
+      {
+      m_CandidateSteps[i] = middle * std::pow( ratio, static_cast< double >( static_cast< int >( i ) - center ) );
+      }
+    this->EvaluateCandidates(numberOfCandidates);
+    ++m_NumberOfLineSearchRounds;
+
+    int accepted = -1;     // lowest value satisfying both conditions
+    int lowest = -1;       // lowest value decreasing enough
+    int longest = -1;      // longest step decreasing enough
+    for ( unsigned int i = 0; i < numberOfCandidates; ++i )
+      {
+      const MeasureType value = m_CandidateValues[i];
+      if ( !( value <= m_Value + m_SufficientDecrease * m_CandidateSteps[i] * slope ) )
+        {
+        continue;
+        }
+      longest = i;
+      if ( lowest < 0 || value < m_CandidateValues[lowest] )
+        {
+        lowest = i;
+        }
+      double candidateSlope = 0.0;
+      for ( SizeValueType j = 0; j < m_Direction.Size(); ++j )
+        {
+        candidateSlope += m_CandidateDerivatives[i][j] * m_Direction[j];
+        }
+      if ( std::fabs(candidateSlope) <= curvature && ( accepted < 0 || value < m_CandidateValues[accepted] ) )
+        {
+        accepted = i;
+        }
+      }
+
+    if ( accepted >= 0 )
+      {
+      this->SetCurrentPosition(m_CandidatePositions[accepted]);
+      m_Value = m_CandidateValues[accepted];
+      m_Gradient = m_CandidateDerivatives[accepted];
+      m_CurrentStepLength = m_CandidateSteps[accepted];
+      return true;
+      }
+
+    if ( lowest >= 0 && ( !haveBest || m_CandidateValues[lowest] < bestValue ) )
+      {
+      m_BestPosition = m_CandidatePositions[lowest];
+      m_BestDerivative = m_CandidateDerivatives[lowest];
+      bestValue = m_CandidateValues[lowest];
+      bestStep = m_CandidateSteps[lowest];
+      haveBest = true;
+      }
+
+    // next round: below the shortest step when every step was too long,
+    // beyond the longest when it still descends steeply, else finer around
+    // the lowest value
+    double longestSlope = 0.0;
+    if ( longest == static_cast< int >( numberOfCandidates ) - 1 )
+      {
+      for ( SizeValueType j = 0; j < m_Direction.Size(); ++j )
+        {
+        longestSlope += m_CandidateDerivatives[longest][j] * m_Direction[j];
+        }
+      }
+    if ( longest < 0 )
+      {
+      middle = m_CandidateSteps[0] / std::pow( ratio, static_cast< double >( numberOfCandidates - center ) );
+      }
+    else if ( longestSlope < 0.0 )
+      {
+      middle = m_CandidateSteps[longest] * std::pow( ratio, static_cast< double >( center + 1 ) );
+      }
+    else
+      {
+      middle = m_CandidateSteps[lowest];
+      ratio = std::sqrt(ratio);
+      }
+    }
+
+  if ( !haveBest )
+    {
+    return false;
+    }
+  this->SetCurrentPosition(m_BestPosition);
+  m_Value = bestValue;
+  m_Gradient = m_BestDerivative;
+  m_CurrentStepLength = bestStep;
+  return true;
+}
+
+void
+SpeculativeLineSearchOptimizer
+::EvaluateCandidates(unsigned int count)
+{
+  for ( unsigned int i = 0; i < count; ++i )
+    {
+    if ( m_CandidatePositions[i].Size() != m_CurrentPosition.Size() )
+      {
+      m_CandidatePositions[i].SetSize( m_CurrentPosition.Size() );
+      }
+    m_CandidateErrors[i].clear();
+    }
+
+  CandidateStruct str;
+  str.Optimizer = this;
+  str.NumberOfCandidates = count;
+  WorkerPool *pool = this->GetActiveWorkerPool();
+  if ( m_UseConcurrentEvaluations && count > 1 && pool->GetNumberOfThreads() > 1 )
+    {
+    pool->Execute( Self::CandidateJob, &str,
+                   static_cast< ThreadIdType >( std::min< unsigned int >( count, pool->GetNumberOfThreads() ) ) );
+    }
+  else
+    {
+    Self::CandidateJob(&str, 0, 1);
+    }
+  m_NumberOfEvaluations += count;
+
+  for ( unsigned int i = 0; i < count; ++i )
+    {
+    if ( !m_CandidateErrors[i].empty() )
+      {
+      itkExceptionMacro(<< "Evaluation at step length " << m_CandidateSteps[i] << " failed: "
+                        << m_CandidateErrors[i]);
+      }
+    }
+}
+
+void
+SpeculativeLineSearchOptimizer
+::CandidateJob(void *data, ThreadIdType threadId, ThreadIdType numberOfThreads)
+{
+  CandidateStruct *str = static_cast< CandidateStruct * >( data );
+  Self *           optimizer = str->Optimizer;
+
+  // jobs must not throw; the errors are raised on the calling thread
+  for ( unsigned int c = threadId; c < str->NumberOfCandidates; c += numberOfThreads )
+    {
+    ParametersType &       position = optimizer->m_CandidatePositions[c];
+    const ParametersType & current = optimizer->m_CurrentPosition;
+    const double           step = optimizer->m_CandidateSteps[c];
+    for ( SizeValueType j = 0; j < position.Size(); ++j )
+      {
+      position[j] = current[j] + step * optimizer->m_Direction[j];
+      }
+    try
+      {
+      optimizer->m_CostFunction->GetValueAndDerivative(position, optimizer->m_CandidateValues[c],
+                                                       optimizer->m_CandidateDerivatives[c]);
+      }
+    catch ( ExceptionObject & e )
+      {
+      optimizer->m_CandidateErrors[c] = e.GetDescription();
+      }
+    catch ( std::exception & e )
+      {
+      optimizer->m_CandidateErrors[c] = e.what();
+      }
+    }
+}
+
+void
+SpeculativeLineSearchOptimizer
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfIterations: " << m_NumberOfIterations << std::endl;
+  os << indent << "NumberOfCandidates: " << m_NumberOfCandidates << std::endl;
+  os << indent << "StepLengthRatio: " << m_StepLengthRatio << std::endl;
+  os << indent << "InitialStepLength: " << m_InitialStepLength << std::endl;
+  os << indent << "SufficientDecrease: " << m_SufficientDecrease << std::endl;
+  os << indent << "CurvatureCondition: " << m_CurvatureCondition << std::endl;
+  os << indent << "MaximumNumberOfLineSearchRounds: " << m_MaximumNumberOfLineSearchRounds << std::endl;
+  os << indent << "GradientMagnitudeTolerance: " << m_GradientMagnitudeTolerance << std::endl;
+  os << indent << "ValueTolerance: " << m_ValueTolerance << std::endl;
+  os << indent << "UseConcurrentEvaluations: " << ( m_UseConcurrentEvaluations ? "On" : "Off" ) << std::endl;
+  os << indent << "WorkerPool: " << m_WorkerPool.GetPointer() << std::endl;
+  os << indent << "Value: " << m_Value << std::endl;
+  os << indent << "CurrentIteration: " << m_CurrentIteration << std::endl;
+  os << indent << "CurrentStepLength: " << m_CurrentStepLength << std::endl;
+  os << indent << "NumberOfEvaluations: " << m_NumberOfEvaluations << std::endl;
+  os << indent << "NumberOfLineSearchRounds: " << m_NumberOfLineSearchRounds << std::endl;
+  os << indent << "StopCondition: " << m_StopConditionDescription << std::endl;
+}
+} // end namespace itk
@@ -0,0 +1,337 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include "itkWorkerPool.h"
+#include "itkMutexLockHolder.h"
+#include "itkSimpleFastMutexLock.h"
+#include <algorithm>
+
+#if defined( _WIN32 )
+#include <windows.h>
+#elif defined( __linux__ )
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace itk
+{
+namespace
+{
+SimpleFastMutexLock globalPoolMutex;
+WorkerPool::Pointer globalPool;
+} // end anonymous namespace
+
+WorkerPool *
+WorkerPool
+::GetGlobalPool()
+{
+  MutexLockHolder< SimpleFastMutexLock > holder(globalPoolMutex);
+  if ( !globalPool )
+    {
+    globalPool = WorkerPool::New();
+    }
+  return globalPool.GetPointer();
+}
+
+WorkerPool
+::WorkerPool() :
+  m_NumberOfThreads(1),
+  m_SpinCount(20000),
+  m_ActiveSpinCount(0),
+  m_PinThreads(false),
+  m_Job(ITK_NULLPTR),
+  m_JobData(ITK_NULLPTR),
+  m_JobThreads(0)
+{
+  m_Generation = 0;
+  m_Stop = 0;
+  m_Pending = 0;
+  m_Busy = 0;
+  m_NumberOfJobs = 0;
+  m_NumberOfInlineJobs = 0;
+  m_NumberOfPinnedThreads = 0;
+  m_Wake = ConditionVariable::New();
+  m_Done = ConditionVariable::New();
+  this->SetNumberOfThreads( MultiThreader::GetGlobalDefaultNumberOfThreads() );
+}
+
+WorkerPool
+::~WorkerPool()
+{
+  this->StopWorkers();
+}
+
+void
+WorkerPool
+::SetNumberOfThreads(ThreadIdType numberOfThreads)
+{
+  numberOfThreads = std::max< ThreadIdType >( 1, std::min< ThreadIdType >( numberOfThreads, ITK_MAX_THREADS ) );
+  if ( numberOfThreads == m_NumberOfThreads && m_Workers.size() + 1 == numberOfThreads )
+    {
+    return;
+    }
+  this->StopWorkers();
+  m_NumberOfThreads = numberOfThreads;
+  this->UpdateActiveSpinCount();
+  this->StartWorkers();
+  this->Modified();
+}
+
+void
+WorkerPool
+::SetSpinCount(unsigned int spinCount)
+{
+  if ( m_SpinCount != spinCount )
+    {
+    m_SpinCount = spinCount;
+    this->UpdateActiveSpinCount();
+    this->Modified();
+    }
+}
+
+void
+WorkerPool
+::SetPinThreads(bool pinThreads)
+{
+  if ( m_PinThreads != pinThreads )
+    {
+    this->StopWorkers();
+    m_PinThreads = pinThreads;
+    this->StartWorkers();
+    this->Modified();
+    }
+}
+
+bool
+WorkerPool
+::PinCurrentThread(ThreadIdType index)
+{
+#if defined( _WIN32 )
+  DWORD_PTR processMask;
+  DWORD_PTR systemMask;
+  if ( !GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask) || processMask == 0 )
+    {
+    return false;
+    }
+  ThreadIdType usable = 0;
+  for ( DWORD_PTR bit = 1; bit != 0; bit <<= 1 )
+    {
+    usable += ( processMask & bit ) ? 1 : 0;
+    }
+  index %= usable;
+  for ( DWORD_PTR bit = 1; bit != 0; bit <<= 1 )
+    {
+    if ( ( processMask & bit ) && index-- == 0 )
+      {
+      return SetThreadAffinityMask(GetCurrentThread(), bit) != 0;
+      }
+    }
+  return false;
+#elif defined( __linux__ )
+  // the processors of the affinity mask the thread inherited, so that
+  // taskset and cgroup limits are respected
+  cpu_set_t usable;
+  CPU_ZERO(&usable);
+  if ( sched_getaffinity(0, sizeof( usable ), &usable) != 0 || CPU_COUNT(&usable) == 0 )
+    {
+    return false;
+    }
+  index %= CPU_COUNT(&usable);
+  for ( int cpu = 0; cpu < CPU_SETSIZE; ++cpu )
+    {
+    if ( CPU_ISSET(cpu, &usable) && index-- == 0 )
+      {
+      cpu_set_t target;
+      CPU_ZERO(&target);
+      CPU_SET(cpu, &target);
+      return pthread_setaffinity_np(pthread_self(), sizeof( target ), &target) == 0;
+      }
+    }
+  return false;
+#else
+  (void)index;
+  return false;
+#endif
+}
+
+void
+WorkerPool
+::UpdateActiveSpinCount()
+{
+  // a spinning thread on an oversubscribed host takes the processor from
+  // the thread it waits for
+  const ThreadIdType processors = MultiThreader::GetGlobalDefaultNumberOfThreadsByPlatform();
+  m_ActiveSpinCount = m_NumberOfThreads <= processors ? m_SpinCount : 0;
+}
+
+void
+WorkerPool
+::StartWorkers()
+{
+  m_Stop = 0;
+  m_NumberOfPinnedThreads = 0;
+  m_Threader = MultiThreader::New();
+  // reserved up front: the workers keep pointers to their entries
+  m_Workers.resize(m_NumberOfThreads - 1);
+  for ( ThreadIdType t = 1; t < m_NumberOfThreads; ++t )
+    {
+    WorkerType & worker = m_Workers[t - 1];
+    worker.Pool = this;
+    worker.ThreadId = t;
+    // taken here rather than by the thread, which may only start after the
+    // first job is published
+    worker.Generation = m_Generation.load();
+    worker.SpawnId = m_Threader->SpawnThread(Self::WorkerThreadCallback, &worker);
+    }
+}
+
+void
+WorkerPool
+::StopWorkers()
+{
+  if ( m_Workers.empty() )
+    {
+    return;
+    }
+  {
+  MutexLockHolder< SimpleMutexLock > holder(m_WakeMutex);
+  m_Stop = 1;
+  m_Wake->Broadcast();
+  }
+  for ( size_t w = 0; w < m_Workers.size(); ++w )
+    {
+    m_Threader->TerminateThread(m_Workers[w].SpawnId);
+    }
+  m_Workers.clear();
+  m_Threader = ITK_NULLPTR;
+}
+
+void
+WorkerPool
+::Execute(JobFunctionType job, void *data, ThreadIdType numberOfThreads)
+{
+  numberOfThreads = std::max< ThreadIdType >( 1, std::min(numberOfThreads, m_NumberOfThreads) );
+
+  // Another job is running: do this one on the calling thread.
+  if ( numberOfThreads == 1 || ++m_Busy != 1 )
+    {
+    if ( numberOfThreads > 1 )
+      {
+      --m_Busy;
+      ++m_NumberOfInlineJobs;
+      }
+    for ( ThreadIdType t = 0; t < numberOfThreads; ++t )
+      {
+      job(data, t, numberOfThreads);
+      }
+    return;
+    }
+
+  m_Job = job;
+  m_JobData = data;
+  m_JobThreads = numberOfThreads;
+  m_Pending = static_cast< int >( m_Workers.size() );
+  {
+  MutexLockHolder< SimpleMutexLock > holder(m_WakeMutex);
+  ++m_Generation;
+  m_Wake->Broadcast();
+  }
+
+  job(data, 0, numberOfThreads);
+
+  // spin for the workers, then sleep until the last one signals
+  for ( unsigned int spin = 0; spin < m_ActiveSpinCount && m_Pending.load() != 0; ++spin )
+    {
+    }
+  if ( m_Pending.load() != 0 )
+    {
+    MutexLockHolder< SimpleMutexLock > holder(m_DoneMutex);
+    while ( m_Pending.load() != 0 )
+      {
+      m_Done->Wait(&m_DoneMutex);
+      }
+    }
+
+  ++m_NumberOfJobs;
+  --m_Busy;
+}
+
+ITK_THREAD_RETURN_TYPE
+WorkerPool
+::WorkerThreadCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast< MultiThreader::ThreadInfoStruct * >( arg );
+  WorkerType *                     worker = static_cast< WorkerType * >( info->UserData );
+  Self *                           pool = worker->Pool;
+
+  if ( pool->m_PinThreads && Self::PinCurrentThread(worker->ThreadId) )
+    {
+    ++pool->m_NumberOfPinnedThreads;
+    }
+
+  int seen = worker->Generation;
+  while ( true )
+    {
+    // spin, then block until the next job or the stop request
+    for ( unsigned int spin = 0; spin < pool->m_ActiveSpinCount; ++spin )
+      {
+      if ( pool->m_Generation.load() != seen || pool->m_Stop.load() )
+        {
+        break;
+        }
+      }
+    if ( pool->m_Generation.load() == seen && !pool->m_Stop.load() )
+      {
+      MutexLockHolder< SimpleMutexLock > holder(pool->m_WakeMutex);
+      while ( pool->m_Generation.load() == seen && !pool->m_Stop.load() )
+        {
+        pool->m_Wake->Wait(&pool->m_WakeMutex);
+        }
+      }
+    if ( pool->m_Stop.load() )
+      {
+      break;
+      }
+    seen = pool->m_Generation.load();
+
+    if ( worker->ThreadId < pool->m_JobThreads )
+      {
+      pool->m_Job(pool->m_JobData, worker->ThreadId, pool->m_JobThreads);
+      }
+
+    if ( --pool->m_Pending == 0 )
+      {
+      MutexLockHolder< SimpleMutexLock > holder(pool->m_DoneMutex);
+      pool->m_Done->Signal();
+      }
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+void
+WorkerPool
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfThreads: " << m_NumberOfThreads << std::endl;
+  os << indent << "SpinCount: " << m_SpinCount << std::endl;
+  os << indent << "PinThreads: " << m_PinThreads << std::endl;
+  os << indent << "NumberOfJobs: " << static_cast< int >( m_NumberOfJobs ) << std::endl;
+  os << indent << "NumberOfInlineJobs: " << static_cast< int >( m_NumberOfInlineJobs ) << std::endl;
+}
+} // end namespace itk
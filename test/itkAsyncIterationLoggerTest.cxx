@@ -0,0 +1,241 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "itkAsyncIterationLogger.h"
+#include "itkCommand.h"
+#include "itksys/SystemTools.hxx"
+
+// Sends iteration events to an AsyncIterationLogger faster than its writer
+// thread can take them, with a tiny ring buffer, with sampling and with a
+// minimum interval, and checks after Stop() that every event was written,
+// dropped or skipped, and that the file holds exactly the records kept.
+//
+//   itkAsyncIterationLoggerTest outputDirectory
+//
+// An event is kept if neither the dropped nor the skipped count grew when
+// it was sent; both are only changed by the sending thread.
+
+namespace
+{
+typedef itk::AsyncIterationLogger LoggerType;
+
+struct LineType
+  {
+  itk::SizeValueType Event;
+  double             Time;
+  };
+
+// send count iteration events, pausing delay milliseconds after each;
+// appends the numbers of the kept ones
+void
+Send(LoggerType *logger, itk::SizeValueType count, unsigned int delay, std::vector< itk::SizeValueType > & kept)
+{
+  itk::Object::Pointer caller = itk::Object::New();
+  for ( itk::SizeValueType i = 0; i < count; ++i )
+    {
+    const itk::SizeValueType number = logger->GetNumberOfEvents();
+    const itk::SizeValueType lost = logger->GetNumberOfDroppedRecords() + logger->GetNumberOfSkippedEvents();
+    logger->Execute( caller.GetPointer(), itk::IterationEvent() );
+    if ( logger->GetNumberOfDroppedRecords() + logger->GetNumberOfSkippedEvents() == lost )
+      {
+      kept.push_back(number);
+      }
+    // not counted
+    logger->Execute( caller.GetPointer(), itk::ModifiedEvent() );
+    if ( delay > 0 )
+      {
+      itksys::SystemTools::Delay(delay);
+      }
+    }
+}
+
+// number of errors; the lines of the file in lines
+unsigned int
+ReadLog(const std::string & fileName, std::vector< LineType > & lines)
+{
+  std::ifstream file( fileName.c_str() );
+  std::string   line;
+  if ( !std::getline(file, line) || line != "event,name,time,value,derivative_norm" )
+    {
+    std::cerr << fileName << ": missing header" << std::endl;
+    return 1;
+    }
+  unsigned int errors = 0;
+  while ( std::getline(file, line) )
+    {
+    std::istringstream is(line);
+    std::string        event, name, time;
+    std::getline(is, event, ',');
+    std::getline(is, name, ',');
+    std::getline(is, time, ',');
+    if ( name != "IterationEvent" )
+      {
+      ++errors;
+      }
+    LineType l;
+    l.Event = std::strtoul(event.c_str(), ITK_NULLPTR, 10);
+    l.Time = std::atof( time.c_str() );
+    lines.push_back(l);
+    }
+  return errors;
+}
+
+unsigned int
+Check(const LoggerType *logger, const std::vector< itk::SizeValueType > & kept, itk::SizeValueType events,
+      std::vector< LineType > & lines, const char *what)
+{
+  std::cout << what << ": " << logger->GetNumberOfEvents() << " events, " << logger->GetNumberOfWrittenRecords()
+            << " written, " << logger->GetNumberOfDroppedRecords() << " dropped, "
+            << logger->GetNumberOfSkippedEvents() << " skipped" << std::endl;
+
+  unsigned int errors = ReadLog(logger->GetFileName(), lines);
+  if ( logger->IsRunning() || logger->GetNumberOfEvents() != events
+       || logger->GetNumberOfWrittenRecords() + logger->GetNumberOfDroppedRecords()
+       + logger->GetNumberOfSkippedEvents() != events
+       || logger->GetNumberOfWrittenRecords() != kept.size() )
+    {
+    std::cerr << what << ": the counts do not add up to the " << events << " events sent" << std::endl;
+    ++errors;
+    }
+  if ( lines.size() != kept.size() )
+    {
+    std::cerr << what << ": " << lines.size() << " records in the file, " << kept.size() << " kept" << std::endl;
+    return errors + 1;
+    }
+  for ( itk::SizeValueType i = 0; i < kept.size(); ++i )
+    {
+    if ( lines[i].Event != kept[i] )
+      {
+      std::cerr << what << ": record " << i << " is event " << lines[i].Event << ", expected " << kept[i]
+                << std::endl;
+      return errors + 1;
+      }
+    }
+  return errors;
+}
+} // end anonymous namespace
+
+int itkAsyncIterationLoggerTest( int argc, char * argv[] )
+{
+  if ( argc < 2 )
+    {
+    std::cerr << "Usage: " << argv[0] << " outputDirectory" << std::endl;
+    return EXIT_FAILURE;
+    }
+  const std::string directory = argv[1];
+
+  unsigned int errors = 0;
+  try
+    {
+    LoggerType::Pointer logger = LoggerType::New();
+
+    // Two slots and a writer that sleeps for a second when it finds the
+    // ring empty, which it does at Start(): nearly everything is dropped,
+    // and what was kept is only written by the drain in Stop().
+    {
+    std::vector< itk::SizeValueType > kept;
+    std::vector< LineType >           lines;
+    logger->SetFileName(directory + "/itkAsyncIterationLoggerTest-drop.csv");
+    logger->SetCapacity(2);
+    logger->SetPollInterval(1000);
+    logger->Start();
+    Send(logger, 10000, 0, kept);
+    logger->Stop();
+    errors += Check(logger, kept, 10000, lines, "Tiny buffer");
+    errors += logger->GetNumberOfDroppedRecords() == 0 || logger->GetNumberOfSkippedEvents() != 0;
+    }
+
+    // every third event, none dropped
+    {
+    std::vector< itk::SizeValueType > kept;
+    std::vector< LineType >           lines;
+    logger->SetFileName(directory + "/itkAsyncIterationLoggerTest-sampling.csv");
+    logger->SetCapacity(1024);
+    logger->SetPollInterval(1);
+    logger->SetSamplingInterval(3);
+    logger->Start();
+    Send(logger, 300, 0, kept);
+    logger->Stop();
+    errors += Check(logger, kept, 300, lines, "Sampling");
+    errors += logger->GetNumberOfWrittenRecords() != 100 || logger->GetNumberOfSkippedEvents() != 200;
+    for ( itk::SizeValueType i = 0; i < lines.size(); ++i )
+      {
+      errors += lines[i].Event % 3 != 0;
+      }
+    }
+
+    // an event every millisecond or more, kept at most every 10 ms
+    {
+    std::vector< itk::SizeValueType > kept;
+    std::vector< LineType >           lines;
+    const double                      interval = 0.01;
+    logger->SetFileName(directory + "/itkAsyncIterationLoggerTest-interval.csv");
+    logger->SetSamplingInterval(1);
+    logger->SetMinimumInterval(interval);
+    logger->Start();
+    Send(logger, 100, 1, kept);
+    logger->Stop();
+    errors += Check(logger, kept, 100, lines, "Minimum interval");
+    errors += logger->GetNumberOfSkippedEvents() == 0 || lines.empty() || lines[0].Event != 0;
+    for ( itk::SizeValueType i = 1; i < lines.size(); ++i )
+      {
+      // the file rounds times to microseconds
+      if ( lines[i].Time - lines[i - 1].Time < interval - 2e-6 )
+        {
+        std::cerr << "Events " << lines[i - 1].Event << " and " << lines[i].Event << " are only "
+                  << lines[i].Time - lines[i - 1].Time << " s apart" << std::endl;
+        ++errors;
+        }
+      }
+    }
+
+    // events outside Start() and Stop() are ignored, and a second Start() throws
+    {
+    std::vector< itk::SizeValueType > kept;
+    Send(logger, 10, 0, kept);
+    errors += logger->GetNumberOfEvents() != 100;
+    logger->SetMinimumInterval(0.0);
+    logger->Start();
+    bool caught = false;
+    try
+      {
+      logger->Start();
+      }
+    catch ( itk::ExceptionObject & )
+      {
+      caught = true;
+      }
+    logger->Stop();
+    errors += !caught || logger->GetNumberOfEvents() != 0;
+    }
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -18,7 +18,7 @@
 #include <cstdlib>
 
 #include "itkVTKPolyDataReader.h"
-#include "itkVTKPolyDataWriter.h"
+#include "itkFastVTKPolyDataWriter.h"
 #include "itkThinShellDemonsMetric.h"
 #include "itkTranslationTransform.h"
 #include "itkConjugateGradientOptimizer.h"
@@ -33,10 +33,15 @@ public:
 	typedef itk::SmartPointer<Self>   Pointer;
 	itkNewMacro( Self );
 protected:
-	CommandIterationUpdate() {};
+	CommandIterationUpdate() : m_Metric( ITK_NULLPTR ) {};
 public:
 	typedef itk::ConjugateGradientOptimizer     OptimizerType;
 	typedef const OptimizerType *                OptimizerPointer;
+	typedef itk::MeshToMeshMetric< itk::Mesh< double, 3 >, itk::Mesh< double, 3 > > MetricType;
+
+	// the metric whose energy terms are printed with the value
+	void SetMetric( const MetricType * metric ) { m_Metric = metric; }
+
 	void Execute(itk::Object *caller, const itk::EventObject & event)
 	{
 		Execute( (const itk::Object *)caller, event);
@@ -50,8 +55,20 @@ public:
 		}
 
 		std::cout << "Position = "  << optimizer->GetCachedValue();
+
+		// the iteration events follow every evaluation, so the terms are
+		// those of the cached value
+		if( m_Metric )
+		{
+			for( unsigned int k = 0; k < m_Metric->GetNumberOfEnergyTerms(); k++ )
+			{
+				std::cout << " " << m_Metric->GetEnergyTermName(k) << " = " << m_Metric->GetEnergyTerm(k);
+			}
+		}
 		std::cout << std::endl << std::endl;
 	}
+private:
+	const MetricType * m_Metric;
 };
 
 int itkEmptyTest( int , char * [])
@@ -163,6 +180,7 @@ int itkEmptyTest( int , char * [])
 
 	// Connect an observer
 	CommandIterationUpdate::Pointer observer = CommandIterationUpdate::New();
+	observer->SetMetric( metric );
 	optimizer->AddObserver( itk::IterationEvent(), observer );
 
 	try
@@ -180,7 +198,7 @@ int itkEmptyTest( int , char * [])
 	/*
 		output mesh
 	*/
-	typedef itk::VTKPolyDataWriter<MeshType>   WriterType;
+	typedef itk::FastVTKPolyDataWriter<MeshType>   WriterType;
 	WriterType::Pointer writer = WriterType::New();
 	registration->UpdateMovingMesh();
 	MeshType::ConstPointer registeredMesh = registration->GetMovingMesh();
@@ -0,0 +1,200 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "itkDefaultDynamicMeshTraits.h"
+#include "itkFastVTKPolyDataWriter.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkTriangleCell.h"
+#include "itkVTKPolyDataReader.h"
+
+// Writes a mesh with FastVTKPolyDataWriter, in binary and in ASCII, reads
+// it back with VTKPolyDataReader and compares the points and the cells.
+//
+//   itkFastVTKPolyDataWriterTest outputDirectory [points]
+//
+// The mesh keeps its points in a map with identifiers 1, 3, 5 ..., so that
+// the cells only come out right when the writer maps identifiers to
+// positions. A cell that refers to a missing point must be rejected.
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::DefaultDynamicMeshTraits< double, Dimension, Dimension > DynamicTraitsType;
+typedef itk::Mesh< double, Dimension, DynamicTraitsType >              MeshType;
+typedef itk::Mesh< double, Dimension >                                 ReadMeshType;
+typedef itk::SyntheticMeshGenerator< ReadMeshType >                    GeneratorType;
+typedef MeshType::CellType                                             CellType;
+typedef itk::TriangleCell< CellType >                                  TriangleCellType;
+typedef itk::FastVTKPolyDataWriter< MeshType >                         WriterType;
+typedef itk::VTKPolyDataReader< ReadMeshType >                         ReaderType;
+
+MeshType::PointIdentifier
+PointId(itk::SizeValueType index)
+{
+  return 2 * index + 1;
+}
+
+MeshType::Pointer
+MakeSparseMesh(const GeneratorType::SurfaceType & surface)
+{
+  MeshType::Pointer mesh = MeshType::New();
+  for ( itk::SizeValueType i = 0; i < surface.GetNumberOfPoints(); ++i )
+    {
+    MeshType::PointType p;
+    for ( unsigned int d = 0; d < Dimension; ++d )
+      {
+      p[d] = surface.Points[3 * i + d];
+      }
+    mesh->SetPoint(PointId(i), p);
+    }
+  for ( itk::SizeValueType c = 0; c < surface.GetNumberOfTriangles(); ++c )
+    {
+    MeshType::CellAutoPointer cell;
+    cell.TakeOwnership( new TriangleCellType );
+    for ( unsigned int k = 0; k < 3; ++k )
+      {
+      cell->SetPointId( k, PointId(surface.Triangles[3 * c + k]) );
+      }
+    mesh->SetCell(c, cell);
+    }
+  return mesh;
+}
+
+// number of mismatches between the surface and the file read back
+unsigned int
+WriteAndCompare(const MeshType *mesh, const GeneratorType::SurfaceType & surface, const std::string & fileName,
+                bool binary)
+{
+  WriterType::Pointer writer = WriterType::New();
+  writer->SetInput(mesh);
+  writer->SetFileName(fileName);
+  writer->SetFileType(binary ? WriterType::BINARY : WriterType::ASCII);
+  writer->SetNumberOfThreads(3);
+  writer->Update();
+
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(fileName);
+  reader->Update();
+  const ReadMeshType *output = reader->GetOutput();
+
+  unsigned int errors = 0;
+  if ( output->GetNumberOfPoints() != surface.GetNumberOfPoints()
+       || output->GetNumberOfCells() != surface.GetNumberOfTriangles() )
+    {
+    std::cerr << fileName << ": " << output->GetNumberOfPoints() << " points and " << output->GetNumberOfCells()
+              << " cells, expected " << surface.GetNumberOfPoints() << " and " << surface.GetNumberOfTriangles()
+              << std::endl;
+    return 1;
+    }
+
+  for ( itk::SizeValueType i = 0; i < surface.GetNumberOfPoints(); ++i )
+    {
+    const ReadMeshType::PointType p = output->GetPoint(i);
+    for ( unsigned int d = 0; d < Dimension; ++d )
+      {
+      if ( std::fabs(p[d] - surface.Points[3 * i + d]) > 1e-12 )
+        {
+        ++errors;
+        }
+      }
+    }
+
+  itk::SizeValueType c = 0;
+  for ( ReadMeshType::CellsContainer::ConstIterator it = output->GetCells()->Begin();
+        it != output->GetCells()->End(); ++it, ++c )
+    {
+    const ReadMeshType::CellType *cell = it.Value();
+    if ( cell->GetNumberOfPoints() != 3 )
+      {
+      ++errors;
+      continue;
+      }
+    for ( unsigned int k = 0; k < 3; ++k )
+      {
+      if ( cell->GetPointIds()[k] != surface.Triangles[3 * c + k] )
+        {
+        ++errors;
+        }
+      }
+    }
+
+  std::cout << fileName << ": " << errors << " mismatches" << std::endl;
+  return errors;
+}
+} // end anonymous namespace
+
+int itkFastVTKPolyDataWriterTest( int argc, char * argv[] )
+{
+  if ( argc < 2 )
+    {
+    std::cerr << "Usage: " << argv[0] << " outputDirectory [points]" << std::endl;
+    return EXIT_FAILURE;
+    }
+  const std::string        directory = argv[1];
+  const itk::SizeValueType size = argc > 2 ? std::atol(argv[2]) : 2000;
+
+  const GeneratorType::SurfaceType surface = GeneratorType::Generate("icosphere", size);
+  MeshType::Pointer                mesh = MakeSparseMesh(surface);
+
+  unsigned int errors = 0;
+  try
+    {
+    errors += WriteAndCompare(mesh, surface, directory + "/itkFastVTKPolyDataWriterTestBinary.vtk", true);
+    errors += WriteAndCompare(mesh, surface, directory + "/itkFastVTKPolyDataWriterTestASCII.vtk", false);
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // a triangle with a point identifier that has no point
+  MeshType::CellAutoPointer cell;
+  cell.TakeOwnership( new TriangleCellType );
+  cell->SetPointId( 0, PointId(0) );
+  cell->SetPointId( 1, PointId(1) );
+  cell->SetPointId( 2, PointId(0) + 1 );
+  mesh->SetCell(surface.GetNumberOfTriangles(), cell);
+
+  WriterType::Pointer writer = WriterType::New();
+  writer->SetInput(mesh);
+  writer->SetFileName(directory + "/itkFastVTKPolyDataWriterTestMissingPoint.vtk");
+  bool rejected = false;
+  try
+    {
+    writer->Update();
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cout << "Missing point rejected: " << e.GetDescription() << std::endl;
+    rejected = true;
+    }
+  if ( !rejected )
+    {
+    std::cerr << "A cell with a missing point was written" << std::endl;
+    ++errors;
+    }
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,276 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "itkFlatPointLocator.h"
+#include "itkMeshDisplacementTransform.h"
+#include "itkNativeMeshFileFormat.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+
+// Checks FlatPointLocator queries against the brute force closest point,
+// for a built index and for the same index written and memory mapped, and
+// that ReadMapped() rejects truncated and foreign files and unexpected
+// hashes. Then checks that ThinShellDemonsMetric rejects a locator built
+// for other fixed points with the same count.
+//
+//   itkFlatPointLocatorTest outputDirectory [points] [queries]
+//
+// Some points are duplicated, so that ties have to go to the smallest
+// index, as with a linear scan.
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >                      MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType >             GeneratorType;
+typedef itk::ThinShellDemonsMetric< MeshType, MeshType >    MetricType;
+typedef itk::MeshDisplacementTransform< double, Dimension > TransformType;
+
+double
+Random(uint32_t & state)
+{
+  state = state * 1664525u + 1013904223u;
+  return ( state >> 8 ) / 16777216.0;
+}
+
+// index of the closest point by a linear scan, the smallest on ties
+itk::SizeValueType
+BruteForceClosestPoint(const std::vector< double > & points, const double query[3], double & best)
+{
+  itk::SizeValueType closest = 0;
+  best = -1.0;
+  for ( itk::SizeValueType i = 0; i < points.size() / 3; ++i )
+    {
+    double distance = 0.0;
+    for ( unsigned int d = 0; d < 3; ++d )
+      {
+      const double r = points[3 * i + d] - query[d];
+      distance += r * r;
+      }
+    if ( best < 0.0 || distance < best )
+      {
+      best = distance;
+      closest = i;
+      }
+    }
+  return closest;
+}
+
+// number of queries answered differently from the linear scan
+unsigned int
+CheckQueries(const itk::FlatPointLocator *locator, const std::vector< double > & points,
+             const std::vector< double > & queries, const char *what)
+{
+  unsigned int errors = 0;
+  for ( itk::SizeValueType q = 0; q < queries.size() / 3; ++q )
+    {
+    double                   expectedDistance;
+    const itk::SizeValueType expected = BruteForceClosestPoint(points, &queries[3 * q], expectedDistance);
+    double                   distance;
+    const itk::SizeValueType found = locator->FindClosestPoint(&queries[3 * q], &distance);
+    if ( found != expected || distance != expectedDistance )
+      {
+      if ( errors++ < 10 )
+        {
+        std::cerr << what << " query " << q << ": point " << found << " at " << distance << ", expected "
+                  << expected << " at " << expectedDistance << std::endl;
+        }
+      }
+    }
+  std::cout << what << ": " << errors << " of " << queries.size() / 3 << " queries differ" << std::endl;
+  return errors;
+}
+
+// 1 when ReadMapped() accepts the file
+unsigned int
+ExpectRejected(const std::string & fileName, uint64_t topologyHash, uint64_t coordinateHash, const char *what)
+{
+  itk::FlatPointLocator::Pointer locator = itk::FlatPointLocator::New();
+  try
+    {
+    locator->ReadMapped(fileName, topologyHash, coordinateHash);
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cout << what << " rejected: " << e.GetDescription() << std::endl;
+    return 0;
+    }
+  std::cerr << "A locator file with " << what << " was mapped" << std::endl;
+  return 1;
+}
+
+void
+WriteBytes(const std::string & fileName, const std::vector< char > & bytes, std::size_t size)
+{
+  std::ofstream output( fileName.c_str(), std::ios::out | std::ios::binary );
+  output.write( &bytes[0], size );
+}
+
+// 1 when the metric accepts a locator of other points with the same count
+unsigned int
+CheckMetricRejectsForeignLocator(const GeneratorType::SurfaceType & surface)
+{
+  GeneratorType::SurfaceType otherSurface = surface;
+  GeneratorType::Deform(otherSurface, 0.02, 0.5);
+
+  itk::FlatPointLocator::Pointer locator = itk::FlatPointLocator::New();
+  locator->Build( &otherSurface.Points[0], otherSurface.GetNumberOfPoints() );
+
+  MeshType::Pointer      fixedMesh = GeneratorType::MakeMesh(surface);
+  MeshType::Pointer      movingMesh = GeneratorType::MakeMesh(otherSurface);
+  TransformType::Pointer transform = TransformType::New();
+  transform->SetMeshTemplate(movingMesh);
+  transform->Initialize();
+  transform->SetIdentity();
+
+  MetricType::Pointer metric = MetricType::New();
+  metric->SetFixedMesh(fixedMesh);
+  metric->SetMovingMesh(movingMesh);
+  metric->SetTransform(transform);
+  metric->SetFixedPointLocator(locator);
+  try
+    {
+    metric->Initialize();
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cout << "Foreign locator rejected by the metric: " << e.GetDescription() << std::endl;
+    return 0;
+    }
+  std::cerr << "The metric used a locator built for other fixed points" << std::endl;
+  return 1;
+}
+} // end anonymous namespace
+
+int itkFlatPointLocatorTest( int argc, char * argv[] )
+{
+  if ( argc < 2 )
+    {
+    std::cerr << "Usage: " << argv[0] << " outputDirectory [points] [queries]" << std::endl;
+    return EXIT_FAILURE;
+    }
+  const std::string        directory = argv[1];
+  const itk::SizeValueType size = argc > 2 ? std::atol(argv[2]) : 5000;
+  const itk::SizeValueType numberOfQueries = argc > 3 ? std::atol(argv[3]) : 2000;
+  const std::string        fileName = directory + "/itkFlatPointLocatorTest.tsdk";
+
+  const GeneratorType::SurfaceType surface = GeneratorType::Generate("bumps", size);
+
+  // the surface points followed by copies of every 10th one
+  std::vector< double > points = surface.Points;
+  for ( itk::SizeValueType i = 0; i < surface.GetNumberOfPoints(); i += 10 )
+    {
+    points.insert( points.end(), surface.Points.begin() + 3 * i, surface.Points.begin() + 3 * i + 3 );
+    }
+  const itk::SizeValueType numberOfPoints = points.size() / 3;
+
+  // random queries around the surface, and every 7th point exactly
+  std::vector< double > queries;
+  uint32_t              state = 12345;
+  for ( itk::SizeValueType q = 0; q < numberOfQueries; ++q )
+    {
+    for ( unsigned int d = 0; d < 3; ++d )
+      {
+      queries.push_back( 3.0 * Random(state) - 1.5 );
+      }
+    }
+  for ( itk::SizeValueType i = 0; i < numberOfPoints; i += 7 )
+    {
+    queries.insert( queries.end(), points.begin() + 3 * i, points.begin() + 3 * i + 3 );
+    }
+
+  const uint64_t topologyHash = itk::NativeMeshFile::TopologyHash(surface.GetNumberOfPoints(),
+                                                                  &surface.Triangles[0],
+                                                                  surface.GetNumberOfTriangles());
+  const uint64_t coordinateHash = itk::NativeMeshFile::CoordinateHash(&points[0], points.size());
+
+  unsigned int errors = 0;
+  try
+    {
+    itk::FlatPointLocator::Pointer built = itk::FlatPointLocator::New();
+    built->Build(&points[0], numberOfPoints);
+    built->SetTopologyHash(topologyHash);
+    if ( built->GetCoordinateHash() != coordinateHash )
+      {
+      std::cerr << "The coordinate hash of the index is not that of its points" << std::endl;
+      ++errors;
+      }
+    errors += CheckQueries(built, points, queries, "Built");
+
+    built->Write(fileName);
+    itk::FlatPointLocator::Pointer mapped = itk::FlatPointLocator::New();
+    mapped->ReadMapped(fileName, topologyHash, coordinateHash);
+    if ( mapped->GetNumberOfPoints() != numberOfPoints
+         || std::memcmp( mapped->GetPointArray(), built->GetPointArray(), 3 * numberOfPoints * sizeof( double ) ) != 0
+         || std::memcmp( mapped->GetIndexArray(), built->GetIndexArray(), numberOfPoints * sizeof( uint32_t ) ) != 0
+         || std::memcmp( mapped->GetSplitAxisArray(), built->GetSplitAxisArray(), numberOfPoints ) != 0 )
+      {
+      std::cerr << "The mapped arrays differ from the built ones" << std::endl;
+      ++errors;
+      }
+    errors += CheckQueries(mapped, points, queries, "Mapped");
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  errors += ExpectRejected(fileName, topologyHash, coordinateHash + 1, "another coordinate hash");
+  errors += ExpectRejected(fileName, topologyHash + 1, coordinateHash, "another topology hash");
+
+  std::ifstream     input( fileName.c_str(), std::ios::in | std::ios::binary );
+  std::vector< char > bytes( ( std::istreambuf_iterator< char >(input) ), std::istreambuf_iterator< char >() );
+  input.close();
+  if ( bytes.size() < 64 )
+    {
+    std::cerr << "Unable to read back " << fileName << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  const std::string truncatedName = directory + "/itkFlatPointLocatorTestTruncated.tsdk";
+  WriteBytes(truncatedName, bytes, bytes.size() - 1);
+  errors += ExpectRejected(truncatedName, 0, 0, "a truncated body");
+  WriteBytes(truncatedName, bytes, 16);
+  errors += ExpectRejected(truncatedName, 0, 0, "a truncated header");
+
+  const std::string magicName = directory + "/itkFlatPointLocatorTestMagic.tsdk";
+  bytes[0] ^= 0x20;
+  WriteBytes(magicName, bytes, bytes.size());
+  errors += ExpectRejected(magicName, 0, 0, "a wrong magic");
+
+  try
+    {
+    errors += CheckMetricRejectsForeignLocator(surface);
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,194 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "itkHardwareCounters.h"
+#include "itkMeshDisplacementTransform.h"
+#include "itkMultiThreader.h"
+#include "itkRegistrationProfiler.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+#include "itkWorkerPool.h"
+#include "itksys/SystemTools.hxx"
+
+// Profiles metric evaluations with hardware counters attached, first with
+// the counters disabled through ITK_DISABLE_HARDWARE_COUNTERS, as in a
+// container where perf_event_open is denied, then as the host allows.
+// Without counters the profiler must still time every phase, report the
+// counters as unavailable and not throw; with counters, only phases on the
+// thread that opened them are counted, and the workers of the global pool
+// are counted along with that thread.
+//
+//   itkHardwareCountersTest [points]
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >                      MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType >             GeneratorType;
+typedef itk::ThinShellDemonsMetric< MeshType, MeshType >    MetricType;
+typedef itk::MeshDisplacementTransform< double, Dimension > TransformType;
+typedef itk::RegistrationProfiler                           ProfilerType;
+
+// a phase recorded on another thread than the one that opened the counters
+ITK_THREAD_RETURN_TYPE
+OtherThreadCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = static_cast< itk::MultiThreader::ThreadInfoStruct * >( arg );
+  ProfilerType *                        profiler = static_cast< ProfilerType * >( info->UserData );
+  ProfilerType::Scope                   scope(profiler, ProfilerType::NeighborhoodPhase);
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+unsigned int
+CheckProfile(MeshType *fixedMesh, MeshType *movingMesh, bool disabled)
+{
+  itk::HardwareCounters::Pointer counters = itk::HardwareCounters::New();
+  const bool                     opened = counters->Open();
+  std::cout << ( disabled ? "Disabled: " : "Host: " )
+            << ( opened ? std::string("counters available") : "counters unavailable, " + counters->GetUnavailableReason() )
+            << std::endl;
+
+  unsigned int errors = 0;
+  if ( opened != counters->IsAvailable() || ( disabled && opened ) || ( !opened && counters->GetUnavailableReason().empty() ) )
+    {
+    std::cerr << "Inconsistent availability" << std::endl;
+    ++errors;
+    }
+
+  itk::HardwareCounters::CountersType values;
+  if ( counters->Read(values) != opened || counters->IsOwningThread() != opened )
+    {
+    std::cerr << "Read() or IsOwningThread() disagree with Open()" << std::endl;
+    ++errors;
+    }
+  for ( unsigned int c = 0; !opened && c < itk::HardwareCounters::NumberOfCounters; ++c )
+    {
+    errors += values.Available[c] || values.Values[c] != 0;
+    }
+
+  // the metric runs its parallel parts on the workers of the global pool,
+  // which is free here, so each of them must be counted too
+  const itk::SizeValueType workers = opened ? itk::WorkerPool::GetGlobalPool()->GetNumberOfThreads() - 1 : 0;
+  if ( counters->GetNumberOfWorkerThreads() != workers )
+    {
+    std::cerr << counters->GetNumberOfWorkerThreads() << " pool workers counted, expected " << workers << std::endl;
+    ++errors;
+    }
+
+  ProfilerType::Pointer profiler = ProfilerType::New();
+  profiler->SetHardwareCounters(counters);
+
+  TransformType::Pointer transform = TransformType::New();
+  transform->SetMeshTemplate(movingMesh);
+  transform->Initialize();
+  transform->SetIdentity();
+
+  MetricType::Pointer metric = MetricType::New();
+  metric->SetProfiler(profiler);
+  metric->SetFixedMesh(fixedMesh);
+  metric->SetMovingMesh(movingMesh);
+  metric->SetTransform(transform);
+  metric->Initialize();
+  MetricType::DerivativeType derivative;
+  for ( unsigned int i = 0; i < 3; ++i )
+    {
+    metric->GetValue( transform->GetParameters() );
+    metric->GetDerivative(transform->GetParameters(), derivative);
+    }
+
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SpawnThread( OtherThreadCallback, profiler.GetPointer() );
+  threader->TerminateThread(0);
+
+  const ProfilerType::PhaseType phases[] = { ProfilerType::MetricInitializePhase, ProfilerType::GetValuePhase,
+                                             ProfilerType::GetDerivativePhase };
+  for ( unsigned int p = 0; p < 3; ++p )
+    {
+    const ProfilerType::PhaseStatistics statistics = profiler->GetPhaseStatistics(phases[p]);
+    if ( statistics.NumberOfCalls == 0 || statistics.TotalTime <= 0.0 )
+      {
+      std::cerr << ProfilerType::GetPhaseName(phases[p]) << " was not timed" << std::endl;
+      ++errors;
+      }
+    if ( ( statistics.NumberOfCountedCalls > 0 ) != opened )
+      {
+      std::cerr << ProfilerType::GetPhaseName(phases[p]) << ": " << statistics.NumberOfCountedCalls
+                << " counted calls" << std::endl;
+      ++errors;
+      }
+    for ( unsigned int c = 0; !opened && c < itk::HardwareCounters::NumberOfCounters; ++c )
+      {
+      errors += statistics.Counters[c] != 0;
+      }
+    }
+  const ProfilerType::PhaseStatistics other = profiler->GetPhaseStatistics(ProfilerType::NeighborhoodPhase);
+  if ( other.NumberOfCalls != 1 || other.NumberOfCountedCalls != 0 )
+    {
+    std::cerr << "A phase on another thread was not timed, or was counted" << std::endl;
+    ++errors;
+    }
+
+  std::ostringstream report;
+  profiler->Report(report);
+  std::cout << report.str();
+  const bool reportsUnavailable = report.str().find("Hardware counters unavailable") != std::string::npos;
+  const bool reportsCounters = report.str().find("Cycles") != std::string::npos;
+  if ( report.str().find( ProfilerType::GetPhaseName(ProfilerType::GetValuePhase) ) == std::string::npos
+       || reportsUnavailable == opened || reportsCounters != opened )
+    {
+    std::cerr << "The report does not match the availability of the counters" << std::endl;
+    ++errors;
+    }
+
+  counters->Close();
+  errors += counters->IsAvailable();
+  return errors;
+}
+} // end anonymous namespace
+
+int itkHardwareCountersTest( int argc, char * argv[] )
+{
+  const itk::SizeValueType size = argc > 1 ? std::atol(argv[1]) : 2000;
+
+  GeneratorType::SurfaceType fixedSurface = GeneratorType::Generate("icosphere", size);
+  GeneratorType::SurfaceType movingSurface = fixedSurface;
+  GeneratorType::Deform(movingSurface, 0.02, 0.5);
+  MeshType::Pointer fixedMesh = GeneratorType::MakeMesh(fixedSurface);
+  MeshType::Pointer movingMesh = GeneratorType::MakeMesh(movingSurface);
+
+  unsigned int errors = 0;
+  try
+    {
+    itksys::SystemTools::PutEnv("ITK_DISABLE_HARDWARE_COUNTERS=1");
+    errors += CheckProfile(fixedMesh, movingMesh, true);
+    itksys::SystemTools::UnPutEnv("ITK_DISABLE_HARDWARE_COUNTERS");
+    errors += CheckProfile(fixedMesh, movingMesh, false);
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
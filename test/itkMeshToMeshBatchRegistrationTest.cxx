@@ -0,0 +1,394 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "itkBoundedQueue.h"
+#include "itkFastVTKPolyDataWriter.h"
+#include "itkMeshToMeshBatchRegistration.h"
+#include "itkMultiThreader.h"
+#include "itkNativeMeshFileReader.h"
+#include "itkNativeMeshFileWriter.h"
+#include "itkSimpleFastMutexLock.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkVTKPolyDataReader.h"
+#include "itksys/SystemTools.hxx"
+
+// Checks BoundedQueue on its own and between two threads, the default
+// thread split of MeshToMeshBatchRegistration, and batches of four
+// synthetic cases of different sizes with broken cases among them: a
+// missing input, a registration that throws and an output that cannot be
+// written. Every other case must be written, each output must belong to
+// its own case, and Update() must return with the failures reported.
+//
+//   itkMeshToMeshBatchRegistrationTest outputDirectory [points]
+//
+// The test has a timeout, so a pipeline that does not shut down on an
+// error fails instead of hanging.
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >                         MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType >                GeneratorType;
+typedef itk::MeshToMeshBatchRegistration< MeshType, MeshType > BatchType;
+typedef itk::BoundedQueue< int >                               QueueType;
+
+/** Batch registration whose registration stage fails for one case and takes
+ * longer for earlier cases, so that cases finish out of order. */
+class FaultyBatchRegistration:public BatchType
+{
+public:
+  typedef FaultyBatchRegistration         Self;
+  typedef BatchType                       Superclass;
+  typedef itk::SmartPointer< Self >       Pointer;
+  typedef itk::SmartPointer< const Self > ConstPointer;
+
+  itkNewMacro(Self);
+  itkTypeMacro(FaultyBatchRegistration, MeshToMeshBatchRegistration);
+
+  itkSetMacro(FailingCase, itk::SizeValueType);
+
+  /** Cases in the order their registration finished. */
+  const std::vector< itk::SizeValueType > & GetCompletionOrder() const { return m_CompletionOrder; }
+
+protected:
+  FaultyBatchRegistration() :
+    m_FailingCase( itk::NumericTraits< itk::SizeValueType >::max() )
+  {}
+
+  virtual void RegisterCase(CaseType & c) const ITK_OVERRIDE
+  {
+    const itk::SizeValueType index = static_cast< itk::SizeValueType >( &c - &this->GetCase(0) );
+    itksys::SystemTools::Delay( static_cast< unsigned int >( 50 * ( this->GetNumberOfCases() - index ) ) );
+    if ( index == m_FailingCase )
+      {
+      itkExceptionMacro(<< "Deliberate failure of case " << index);
+      }
+    Superclass::RegisterCase(c);
+
+    m_Mutex.Lock();
+    m_CompletionOrder.push_back(index);
+    m_Mutex.Unlock();
+  }
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(FaultyBatchRegistration);
+
+  itk::SizeValueType                        m_FailingCase;
+  mutable std::vector< itk::SizeValueType > m_CompletionOrder;
+  mutable itk::SimpleFastMutexLock          m_Mutex;
+};
+
+const itk::SizeValueType NumberOfItems = 1000;
+
+// thread 0 pushes 0 .. NumberOfItems - 1 and closes, thread 1 pops them
+struct QueueThreadStruct
+  {
+  QueueType *        Queue;
+  std::vector< int > Popped;
+  };
+
+ITK_THREAD_RETURN_TYPE
+QueueThreaderCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = static_cast< itk::MultiThreader::ThreadInfoStruct * >( arg );
+  QueueThreadStruct *                   str = static_cast< QueueThreadStruct * >( info->UserData );
+  if ( info->ThreadID == 0 )
+    {
+    for ( itk::SizeValueType i = 0; i < NumberOfItems; ++i )
+      {
+      str->Queue->Push( static_cast< int >( i ) );
+      }
+    str->Queue->Close();
+    }
+  else
+    {
+    int item;
+    while ( str->Queue->Pop(item) )
+      {
+      str->Popped.push_back(item);
+      }
+    }
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+unsigned int
+CheckQueue()
+{
+  unsigned int errors = 0;
+
+  QueueType zero(0);
+  errors += zero.GetCapacity() != 1;
+
+  QueueType queue(3);
+  errors += !queue.Push(1) || !queue.Push(2);
+  errors += queue.GetSize() != 2;
+  int item = 0;
+  errors += !queue.Pop(item) || item != 1;
+  queue.Close();
+  errors += !queue.IsClosed();
+  errors += queue.Push(3);
+  errors += !queue.Pop(item) || item != 2;
+  errors += queue.Pop(item);
+
+  // a capacity of one makes the producer wait for the consumer on each item
+  QueueType         shared(1);
+  QueueThreadStruct str;
+  str.Queue = &shared;
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads(2);
+  if ( threader->GetNumberOfThreads() == 2 )
+    {
+    threader->SetSingleMethod(QueueThreaderCallback, &str);
+    threader->SingleMethodExecute();
+    errors += str.Popped.size() != NumberOfItems;
+    for ( itk::SizeValueType i = 0; i < str.Popped.size(); ++i )
+      {
+      errors += str.Popped[i] != static_cast< int >( i );
+      }
+    }
+
+  std::cout << "BoundedQueue: " << errors << " errors" << std::endl;
+  return errors;
+}
+
+unsigned int
+CheckThreadSplit()
+{
+  const itk::ThreadIdType cores = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  BatchType::Pointer      batch = BatchType::New();
+
+  const itk::ThreadIdType total =
+    batch->GetNumberOfReaderThreads() + batch->GetNumberOfWorkerThreads() + batch->GetNumberOfWriterThreads();
+  std::cout << cores << " cores: " << batch->GetNumberOfReaderThreads() << " readers, "
+            << batch->GetNumberOfWorkerThreads() << " workers, " << batch->GetNumberOfWriterThreads()
+            << " writers" << std::endl;
+
+  // one reader, one writer, the other cores work; at least one of each
+  if ( batch->GetNumberOfReaderThreads() != 1 || batch->GetNumberOfWriterThreads() != 1
+       || batch->GetNumberOfWorkerThreads() < 1 || total > std::max< itk::ThreadIdType >(cores, 3) )
+    {
+    std::cerr << "Unexpected default thread split" << std::endl;
+    return 1;
+    }
+  return 0;
+}
+
+struct InputType
+  {
+  std::string        Fixed;
+  std::string        Moving;
+  itk::SizeValueType NumberOfPoints;
+  itk::SizeValueType NumberOfTriangles;
+  };
+
+template< typename TWriter >
+void
+WriteMesh(const GeneratorType::SurfaceType & surface, const std::string & fileName)
+{
+  MeshType::Pointer         mesh = GeneratorType::MakeMesh(surface);
+  typename TWriter::Pointer writer = TWriter::New();
+  writer->SetInput(mesh);
+  writer->SetFileName(fileName);
+  writer->Write();
+}
+
+// a moving mesh and a deformed copy as the fixed mesh, in VTK or native format
+InputType
+MakeInput(const std::string & directory, const std::string & shape, itk::SizeValueType size, const char *extension)
+{
+  GeneratorType::SurfaceType moving = GeneratorType::Generate(shape, size);
+  GeneratorType::SurfaceType fixed = moving;
+  GeneratorType::Deform(fixed, 0.02, 1.0);
+
+  InputType input;
+  input.Fixed = directory + "/itkMeshToMeshBatchRegistrationTest-" + shape + "-fixed" + extension;
+  input.Moving = directory + "/itkMeshToMeshBatchRegistrationTest-" + shape + "-moving" + extension;
+  input.NumberOfPoints = moving.GetNumberOfPoints();
+  input.NumberOfTriangles = moving.GetNumberOfTriangles();
+  if ( std::string(extension) == ".tsdm" )
+    {
+    WriteMesh< itk::NativeMeshFileWriter< MeshType > >(fixed, input.Fixed);
+    WriteMesh< itk::NativeMeshFileWriter< MeshType > >(moving, input.Moving);
+    }
+  else
+    {
+    WriteMesh< itk::FastVTKPolyDataWriter< MeshType > >(fixed, input.Fixed);
+    WriteMesh< itk::FastVTKPolyDataWriter< MeshType > >(moving, input.Moving);
+    }
+  return input;
+}
+
+MeshType::Pointer
+ReadMesh(const std::string & fileName)
+{
+  if ( itksys::SystemTools::GetFilenameLastExtension(fileName) == ".tsdm" )
+    {
+    itk::NativeMeshFileReader< MeshType >::Pointer reader = itk::NativeMeshFileReader< MeshType >::New();
+    reader->SetFileName(fileName);
+    reader->Update();
+    return reader->GetOutput();
+    }
+  itk::VTKPolyDataReader< MeshType >::Pointer reader = itk::VTKPolyDataReader< MeshType >::New();
+  reader->SetFileName(fileName);
+  reader->Update();
+  return reader->GetOutput();
+}
+
+// Runs the batch and checks the outcome of each case against the expected
+// failures. Every input has its own size, so an output written for the
+// wrong case shows.
+unsigned int
+CheckBatch(BatchType *batch, const std::vector< InputType > & inputs, const std::vector< std::string > & outputs,
+           const std::vector< bool > & failing, const char *what)
+{
+  batch->ClearCases();
+  for ( itk::SizeValueType i = 0; i < inputs.size(); ++i )
+    {
+    itksys::SystemTools::RemoveFile( outputs[i].c_str() );
+    batch->AddCase(inputs[i].Fixed, inputs[i].Moving, outputs[i]);
+    }
+  batch->Update();
+
+  unsigned int       errors = 0;
+  itk::SizeValueType expectedFailures = 0;
+  for ( itk::SizeValueType i = 0; i < inputs.size(); ++i )
+    {
+    const BatchType::CaseType & c = batch->GetCase(i);
+    expectedFailures += failing[i];
+    if ( c.Succeeded == failing[i] )
+      {
+      std::cerr << what << ": case " << i << ( failing[i] ? " succeeded" : " failed: " ) << c.ErrorMessage
+                << std::endl;
+      ++errors;
+      continue;
+      }
+    if ( failing[i] )
+      {
+      std::cout << what << ": case " << i << " failed as expected: " << c.ErrorMessage << std::endl;
+      errors += c.ErrorMessage.empty();
+      errors += itksys::SystemTools::FileExists( outputs[i].c_str() );
+      continue;
+      }
+    MeshType::Pointer output = ReadMesh(outputs[i]);
+    if ( output->GetNumberOfPoints() != inputs[i].NumberOfPoints
+         || output->GetNumberOfCells() != inputs[i].NumberOfTriangles )
+      {
+      std::cerr << what << ": output of case " << i << " has " << output->GetNumberOfPoints() << " points and "
+                << output->GetNumberOfCells() << " cells, expected " << inputs[i].NumberOfPoints << " and "
+                << inputs[i].NumberOfTriangles << std::endl;
+      ++errors;
+      }
+    }
+  if ( batch->GetNumberOfFailedCases() != expectedFailures )
+    {
+    std::cerr << what << ": " << batch->GetNumberOfFailedCases() << " failed cases reported, expected "
+              << expectedFailures << std::endl;
+    ++errors;
+    }
+
+  std::cout << what << ": " << errors << " errors in " << batch->GetElapsedTime() << " s" << std::endl;
+  return errors;
+}
+} // end anonymous namespace
+
+int itkMeshToMeshBatchRegistrationTest( int argc, char * argv[] )
+{
+  if ( argc < 2 )
+    {
+    std::cerr << "Usage: " << argv[0] << " outputDirectory [points]" << std::endl;
+    return EXIT_FAILURE;
+    }
+  const std::string        directory = argv[1];
+  const itk::SizeValueType size = argc > 2 ? std::atol(argv[2]) : 200;
+
+  unsigned int errors = 0;
+  try
+    {
+    errors += CheckQueue();
+    errors += CheckThreadSplit();
+
+    // four cases of different sizes, the third without a moving mesh
+    std::vector< InputType > inputs;
+    inputs.push_back( MakeInput(directory, "icosphere", size, ".vtk") );
+    inputs.push_back( MakeInput(directory, "torus", 2 * size, ".tsdm") );
+    inputs.push_back( MakeInput(directory, "bumps", 3 * size, ".vtk") );
+    inputs.push_back( MakeInput(directory, "torus", 4 * size, ".vtk") );
+    inputs[2].Moving = directory + "/itkMeshToMeshBatchRegistrationTest-missing.vtk";
+
+    std::vector< std::string > outputs;
+    std::vector< bool >        failing( inputs.size(), false );
+    for ( itk::SizeValueType i = 0; i < inputs.size(); ++i )
+      {
+      std::ostringstream name;
+      name << directory << "/itkMeshToMeshBatchRegistrationTest-output" << i << ( i == 1 ? ".tsdm" : ".vtk" );
+      outputs.push_back( name.str() );
+      }
+    failing[2] = true;
+
+    // pipelined, with queues that hold a single case
+    BatchType::Pointer batch = BatchType::New();
+    batch->SetNumberOfReaderThreads(2);
+    batch->SetNumberOfWorkerThreads(2);
+    batch->SetNumberOfWriterThreads(2);
+    batch->SetQueueCapacity(1);
+    errors += CheckBatch(batch, inputs, outputs, failing, "Pipelined");
+
+    // every stage fails once: the first case in registration, the third in
+    // reading and the fourth in writing
+    FaultyBatchRegistration::Pointer faulty = FaultyBatchRegistration::New();
+    faulty->SetNumberOfReaderThreads(1);
+    faulty->SetNumberOfWorkerThreads(3);
+    faulty->SetNumberOfWriterThreads(1);
+    faulty->SetQueueCapacity(1);
+    faulty->SetFailingCase(0);
+    std::vector< std::string > faultyOutputs = outputs;
+    faultyOutputs[3] = directory + "/missing/itkMeshToMeshBatchRegistrationTest-output3.vtk";
+    std::vector< bool > faultyFailing = failing;
+    faultyFailing[0] = true;
+    faultyFailing[3] = true;
+    errors += CheckBatch(faulty, inputs, faultyOutputs, faultyFailing, "Failing stages");
+
+    std::cout << "Registrations finished in the order";
+    for ( itk::SizeValueType i = 0; i < faulty->GetCompletionOrder().size(); ++i )
+      {
+      std::cout << " " << faulty->GetCompletionOrder()[i];
+      }
+    std::cout << std::endl;
+
+    // a single case runs without the pipeline
+    std::vector< InputType >   single( 1, inputs[0] );
+    std::vector< std::string > singleOutput( 1, outputs[0] );
+    errors += CheckBatch( batch, single, singleOutput, std::vector< bool >(1, false), "Sequential" );
+    single[0] = inputs[2];
+    errors += CheckBatch( batch, single, singleOutput, std::vector< bool >(1, true), "Sequential failing" );
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,290 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "itkNativeMeshFileReader.h"
+#include "itkNativeMeshFileWriter.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkTriangleVertexNeighborhood.h"
+
+// Round trip of the native mesh format: writes a mesh with a per-vertex
+// attribute, reads it into a mesh and memory mapped, and compares the
+// points, triangles, attributes and the vertex neighborhoods built from
+// them. Then checks that a truncated file, a wrong magic, a wrong version
+// and, with VerifyHashes on, altered coordinates are rejected with an
+// exception.
+//
+//   itkNativeMeshFileTest outputDirectory [points]
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >          MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType > GeneratorType;
+typedef itk::NativeMeshFileWriter< MeshType >   WriterType;
+typedef itk::NativeMeshFileReader< MeshType >   ReaderType;
+
+typedef std::vector< char > BytesType;
+
+void
+ReadBytes(const std::string & fileName, BytesType & bytes)
+{
+  std::ifstream input( fileName.c_str(), std::ios::in | std::ios::binary );
+  bytes.assign( std::istreambuf_iterator< char >(input), std::istreambuf_iterator< char >() );
+}
+
+void
+WriteBytes(const std::string & fileName, const BytesType & bytes, std::size_t size)
+{
+  std::ofstream output( fileName.c_str(), std::ios::out | std::ios::binary );
+  output.write( &bytes[0], size );
+}
+
+// 1 when the mapped arrays differ from the surface
+unsigned int
+CompareNeighborhoods(const GeneratorType::SurfaceType & surface, const uint32_t *triangles)
+{
+  const itk::SizeValueType numberOfPoints = surface.GetNumberOfPoints();
+  const itk::SizeValueType numberOfTriangles = surface.GetNumberOfTriangles();
+  const itk::SizeValueType numberOfNeighbors = itk::TriangleVertexNeighborhood::GetNumberOfNeighbors(numberOfTriangles);
+
+  std::vector< itk::SizeValueType > expectedOffsets( numberOfPoints + 1 );
+  std::vector< uint32_t >           expectedNeighbors( numberOfNeighbors );
+  std::vector< itk::SizeValueType > offsets( numberOfPoints + 1 );
+  std::vector< uint32_t >           neighbors( numberOfNeighbors );
+  if ( !itk::TriangleVertexNeighborhood::Build(&surface.Triangles[0], numberOfTriangles, numberOfPoints,
+                                               &expectedOffsets[0], &expectedNeighbors[0])
+       || !itk::TriangleVertexNeighborhood::Build(triangles, numberOfTriangles, numberOfPoints,
+                                                  &offsets[0], &neighbors[0]) )
+    {
+    std::cerr << "A triangle refers to a vertex out of range" << std::endl;
+    return 1;
+    }
+  if ( offsets != expectedOffsets || neighbors != expectedNeighbors )
+    {
+    std::cerr << "The neighborhoods of the mapped triangles differ" << std::endl;
+    return 1;
+    }
+  return 0;
+}
+
+// number of mismatches of a reader that builds the output mesh
+unsigned int
+CheckMeshRead(const std::string & fileName, const GeneratorType::SurfaceType & surface)
+{
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(fileName);
+  reader->SetVerifyHashes(true);
+  reader->Update();
+  const MeshType *mesh = reader->GetOutput();
+
+  if ( mesh->GetNumberOfPoints() != surface.GetNumberOfPoints()
+       || mesh->GetNumberOfCells() != surface.GetNumberOfTriangles() )
+    {
+    std::cerr << "Read " << mesh->GetNumberOfPoints() << " points and " << mesh->GetNumberOfCells()
+              << " cells, expected " << surface.GetNumberOfPoints() << " and " << surface.GetNumberOfTriangles()
+              << std::endl;
+    return 1;
+    }
+
+  unsigned int errors = 0;
+  for ( itk::SizeValueType i = 0; i < surface.GetNumberOfPoints(); ++i )
+    {
+    const MeshType::PointType p = mesh->GetPoint(i);
+    for ( unsigned int d = 0; d < Dimension; ++d )
+      {
+      errors += p[d] != surface.Points[3 * i + d];
+      }
+    }
+  for ( itk::SizeValueType c = 0; c < surface.GetNumberOfTriangles(); ++c )
+    {
+    MeshType::CellAutoPointer cell;
+    if ( !mesh->GetCell(c, cell) || cell->GetNumberOfPoints() != 3 )
+      {
+      ++errors;
+      continue;
+      }
+    for ( unsigned int k = 0; k < 3; ++k )
+      {
+      errors += cell->GetPointIds()[k] != surface.Triangles[3 * c + k];
+      }
+    }
+  std::cout << "Mesh read: " << errors << " mismatches" << std::endl;
+  return errors;
+}
+
+// number of mismatches of a reader that only maps the file
+unsigned int
+CheckMappedRead(const std::string & fileName, const GeneratorType::SurfaceType & surface,
+                const std::vector< float > & attributes)
+{
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(fileName);
+  reader->GenerateOutputMeshOff();
+  reader->Update();
+
+  const double *   points = reader->GetPointBuffer();
+  const uint32_t * triangles = reader->GetTriangleBuffer();
+  const float *    mappedAttributes = reader->GetAttributeBuffer();
+  if ( !points || !triangles || !mappedAttributes || reader->GetNumberOfAttributeComponents() != 1
+       || reader->GetNumberOfPoints() != surface.GetNumberOfPoints()
+       || reader->GetNumberOfTriangles() != surface.GetNumberOfTriangles() )
+    {
+    std::cerr << "The mapped file does not have the arrays written" << std::endl;
+    return 1;
+    }
+
+  unsigned int errors = 0;
+  const std::size_t alignment = static_cast< std::size_t >( itk::NativeMeshFile::GetAlignment() );
+  if ( reinterpret_cast< std::size_t >( points ) % alignment != 0
+       || reinterpret_cast< std::size_t >( triangles ) % alignment != 0
+       || reinterpret_cast< std::size_t >( mappedAttributes ) % alignment != 0 )
+    {
+    std::cerr << "A mapped array is not aligned to " << alignment << " bytes" << std::endl;
+    ++errors;
+    }
+  if ( std::memcmp( points, &surface.Points[0], surface.Points.size() * sizeof( double ) ) != 0
+       || std::memcmp( triangles, &surface.Triangles[0], surface.Triangles.size() * sizeof( uint32_t ) ) != 0
+       || std::memcmp( mappedAttributes, &attributes[0], attributes.size() * sizeof( float ) ) != 0 )
+    {
+    std::cerr << "The mapped arrays differ from the arrays written" << std::endl;
+    ++errors;
+    }
+  if ( reader->GetTopologyHash() != itk::NativeMeshFile::TopologyHash(surface.GetNumberOfPoints(),
+                                                                       &surface.Triangles[0],
+                                                                       surface.GetNumberOfTriangles())
+       || reader->GetCoordinateHash() != itk::NativeMeshFile::CoordinateHash(&surface.Points[0],
+                                                                             surface.Points.size()) )
+    {
+    std::cerr << "The hashes in the header differ from those of the arrays" << std::endl;
+    ++errors;
+    }
+  if ( reader->GetOutput()->GetNumberOfPoints() != 0 )
+    {
+    std::cerr << "The output mesh was filled with GenerateOutputMesh off" << std::endl;
+    ++errors;
+    }
+  errors += CompareNeighborhoods(surface, triangles);
+
+  std::cout << "Mapped read: " << errors << " mismatches" << std::endl;
+  return errors;
+}
+
+// 1 when reading the file does not throw
+unsigned int
+ExpectRejected(const std::string & fileName, const char *what, bool verifyHashes)
+{
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(fileName);
+  reader->SetVerifyHashes(verifyHashes);
+  try
+    {
+    reader->Update();
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cout << what << " rejected: " << e.GetDescription() << std::endl;
+    return 0;
+    }
+  std::cerr << "A file with " << what << " was read" << std::endl;
+  return 1;
+}
+} // end anonymous namespace
+
+int itkNativeMeshFileTest( int argc, char * argv[] )
+{
+  if ( argc < 2 )
+    {
+    std::cerr << "Usage: " << argv[0] << " outputDirectory [points]" << std::endl;
+    return EXIT_FAILURE;
+    }
+  const std::string        directory = argv[1];
+  const itk::SizeValueType size = argc > 2 ? std::atol(argv[2]) : 2000;
+  const std::string        fileName = directory + "/itkNativeMeshFileTest.tsdm";
+
+  const GeneratorType::SurfaceType surface = GeneratorType::Generate("icosphere", size);
+  MeshType::Pointer                mesh = GeneratorType::MakeMesh(surface);
+  std::vector< float >             attributes( surface.GetNumberOfPoints() );
+  for ( itk::SizeValueType i = 0; i < attributes.size(); ++i )
+    {
+    attributes[i] = static_cast< float >( surface.Points[3 * i + 2] );
+    }
+
+  unsigned int errors = 0;
+  try
+    {
+    WriterType::Pointer writer = WriterType::New();
+    writer->SetInput(mesh);
+    writer->SetFileName(fileName);
+    writer->SetPointAttributes(&attributes[0], 1);
+    writer->Update();
+
+    errors += CheckMeshRead(fileName, surface);
+    errors += CheckMappedRead(fileName, surface, attributes);
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  BytesType bytes;
+  ReadBytes(fileName, bytes);
+  if ( bytes.size() < sizeof( itk::NativeMeshFileHeader ) )
+    {
+    std::cerr << "Unable to read back " << fileName << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  const std::string truncatedName = directory + "/itkNativeMeshFileTestTruncated.tsdm";
+  WriteBytes(truncatedName, bytes, bytes.size() / 2);
+  errors += ExpectRejected(truncatedName, "a truncated body", false);
+  WriteBytes(truncatedName, bytes, sizeof( itk::NativeMeshFileHeader ) / 2);
+  errors += ExpectRejected(truncatedName, "a truncated header", false);
+
+  const std::string magicName = directory + "/itkNativeMeshFileTestMagic.tsdm";
+  BytesType         altered = bytes;
+  altered[offsetof( itk::NativeMeshFileHeader, Magic )] ^= 0x20;
+  WriteBytes(magicName, altered, altered.size());
+  errors += ExpectRejected(magicName, "a wrong magic", false);
+
+  const std::string versionName = directory + "/itkNativeMeshFileTestVersion.tsdm";
+  altered = bytes;
+  const uint32_t version = itk::NativeMeshFile::GetVersion() + 1;
+  std::memcpy( &altered[offsetof( itk::NativeMeshFileHeader, Version )], &version, sizeof( version ) );
+  WriteBytes(versionName, altered, altered.size());
+  errors += ExpectRejected(versionName, "a wrong version", false);
+
+  const std::string coordinatesName = directory + "/itkNativeMeshFileTestCoordinates.tsdm";
+  altered = bytes;
+  itk::NativeMeshFileHeader header;
+  std::memcpy( &header, &bytes[0], sizeof( header ) );
+  altered[header.PointsOffset] ^= 0x01;
+  WriteBytes(coordinatesName, altered, altered.size());
+  errors += ExpectRejected(coordinatesName, "altered coordinates", true);
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
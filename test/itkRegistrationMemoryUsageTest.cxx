@@ -0,0 +1,153 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "itkConjugateGradientOptimizer.h"
+#include "itkMeshDisplacementTransform.h"
+#include "itkMeshToMeshRegistrationMethod.h"
+#include "itkRegistrationMemoryUsage.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+
+// Compares RegistrationMemoryUsage::Estimate() with the table
+// GetMemoryUsage() of the registration method holds after Update(), on a
+// synthetic icosphere pair, for a metric storing doubles and one storing
+// floats. The estimate is given the precision and the number of evaluation
+// workspaces of the metric, and must then be within the tolerance of every
+// entry and of the total. The peak of both tables must not be below their
+// total.
+//
+//   itkRegistrationMemoryUsageTest [points] [tolerance]
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >                          MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType >                 GeneratorType;
+typedef itk::Image< unsigned short, Dimension >                 DistanceMapType;
+typedef itk::MeshDisplacementTransform< double, Dimension >     TransformType;
+typedef itk::ConjugateGradientOptimizer                         OptimizerType;
+typedef itk::MeshToMeshRegistrationMethod< MeshType, MeshType > RegistrationType;
+typedef itk::RegistrationMemoryUsage                            UsageType;
+
+bool
+WithinTolerance(uint64_t estimated, uint64_t actual, double tolerance)
+{
+  return std::fabs( static_cast< double >( estimated ) - static_cast< double >( actual ) )
+         <= tolerance * static_cast< double >( actual );
+}
+
+template< typename TPrecision >
+unsigned int
+CheckEstimate(const GeneratorType::SurfaceType & fixedSurface, const GeneratorType::SurfaceType & movingSurface,
+              double tolerance)
+{
+  typedef itk::ThinShellDemonsMetric< MeshType, MeshType, DistanceMapType, TPrecision > MetricType;
+
+  MeshType::Pointer fixedMesh = GeneratorType::MakeMesh(fixedSurface);
+  MeshType::Pointer movingMesh = GeneratorType::MakeMesh(movingSurface);
+
+  typename MetricType::Pointer metric = MetricType::New();
+  metric->SetStretchWeight(4);
+  metric->SetBendWeight(1);
+
+  TransformType::Pointer transform = TransformType::New();
+  transform->SetMeshTemplate(movingMesh);
+  transform->Initialize();
+  transform->SetIdentity();
+
+  OptimizerType::Pointer    optimizer = OptimizerType::New();
+  RegistrationType::Pointer registration = RegistrationType::New();
+  registration->SetMetric(metric);
+  registration->SetOptimizer(optimizer);
+  registration->SetTransform(transform);
+  registration->SetInitialTransformParameters( transform->GetParameters() );
+  registration->SetFixedMesh(fixedMesh);
+  registration->SetMovingMesh(movingMesh);
+  registration->Update();
+
+  const UsageType *actual = registration->GetMemoryUsage();
+  UsageType::Pointer estimate = UsageType::New();
+  UsageType::Estimate( fixedSurface.GetNumberOfPoints(), fixedSurface.GetNumberOfTriangles(),
+                       movingSurface.GetNumberOfPoints(), movingSurface.GetNumberOfTriangles(), estimate,
+                       sizeof( TPrecision ), metric->GetNumberOfEvaluationWorkspaces() );
+
+  std::cout << sizeof( TPrecision ) << " byte coordinates, " << metric->GetNumberOfEvaluationWorkspaces()
+            << " workspace(s)" << std::endl;
+  std::cout << "After Update():" << std::endl;
+  actual->Report(std::cout);
+  std::cout << "Estimate():" << std::endl;
+  estimate->Report(std::cout);
+
+  unsigned int errors = 0;
+  for ( unsigned int c = 0; c < UsageType::NumberOfComponents; ++c )
+    {
+    const UsageType::ComponentType component = static_cast< UsageType::ComponentType >( c );
+    if ( !WithinTolerance(estimate->GetBytes(component), actual->GetBytes(component), tolerance) )
+      {
+      std::cerr << UsageType::GetComponentName(component) << ": estimated " << estimate->GetBytes(component)
+                << " bytes, actual " << actual->GetBytes(component) << std::endl;
+      ++errors;
+      }
+    }
+  if ( !WithinTolerance(estimate->GetTotalBytes(), actual->GetTotalBytes(), tolerance) )
+    {
+    std::cerr << "Total: estimated " << estimate->GetTotalBytes() << " bytes, actual "
+              << actual->GetTotalBytes() << std::endl;
+    ++errors;
+    }
+  if ( actual->GetPeakBytes() < actual->GetTotalBytes() || estimate->GetPeakBytes() < estimate->GetTotalBytes() )
+    {
+    std::cerr << "A peak is below its total" << std::endl;
+    ++errors;
+    }
+  return errors;
+}
+} // end anonymous namespace
+
+int itkRegistrationMemoryUsageTest( int argc, char * argv[] )
+{
+  const itk::SizeValueType size = argc > 1 ? std::atol(argv[1]) : 2000;
+  const double             tolerance = argc > 2 ? std::atof(argv[2]) : 0.01;
+
+  GeneratorType::SurfaceType fixedSurface = GeneratorType::Generate("icosphere", size);
+  GeneratorType::SurfaceType movingSurface = fixedSurface;
+  GeneratorType::Deform(movingSurface, 0.02, 0.5);
+
+  unsigned int errors = 0;
+  try
+    {
+    errors += CheckEstimate< double >(fixedSurface, movingSurface, tolerance);
+    errors += CheckEstimate< float >(fixedSurface, movingSurface, tolerance);
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  if ( errors > 0 )
+    {
+    std::cerr << errors << " estimate(s) off by more than " << 100.0 * tolerance << "%" << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "itkMultiThreader.h"
+#include "itkRegistrationTracer.h"
+
+// Records events from many short-lived threads and into a buffer too small
+// for them, parses the output of WriteChromeTrace() as JSON and checks that
+// every event is either in the trace, with its phase, timestamp and
+// duration, or counted as dropped.
+//
+//   itkRegistrationTracerTest [calls]
+//
+// Each of the calls runs a fresh set of threader threads; more calls than
+// RegistrationTracer::MaximumNumberOfThreads need the buffer slots of
+// exited threads to be reused.
+
+namespace
+{
+typedef std::map< std::string, std::string > MembersType;
+
+/** Minimal JSON parser. Collects the scalar members of every object, with
+ * strings unescaped and numbers as written. */
+class JSONParser
+{
+public:
+  std::vector< MembersType > Objects;
+
+  bool Parse(const std::string & text)
+  {
+    m_Text = text;
+    m_Position = 0;
+    Objects.clear();
+    std::string scalar;
+    if ( !this->ParseValue(scalar) )
+      {
+      return false;
+      }
+    this->SkipSpace();
+    return m_Position == m_Text.size();
+  }
+
+  std::string::size_type GetPosition() const { return m_Position; }
+
+private:
+  std::string            m_Text;
+  std::string::size_type m_Position;
+
+  void SkipSpace()
+  {
+    while ( m_Position < m_Text.size() && std::string(" \t\r\n").find(m_Text[m_Position]) != std::string::npos )
+      {
+      ++m_Position;
+      }
+  }
+
+  bool Accept(char c)
+  {
+    this->SkipSpace();
+    if ( m_Position < m_Text.size() && m_Text[m_Position] == c )
+      {
+      ++m_Position;
+      return true;
+      }
+    return false;
+  }
+
+  bool ParseValue(std::string & scalar)
+  {
+    this->SkipSpace();
+    if ( m_Position >= m_Text.size() )
+      {
+      return false;
+      }
+    const char c = m_Text[m_Position];
+    if ( c == '{' )
+      {
+      return this->ParseObject();
+      }
+    if ( c == '[' )
+      {
+      return this->ParseArray();
+      }
+    if ( c == '"' )
+      {
+      return this->ParseString(scalar);
+      }
+    const char *literals[] = { "true", "false", "null" };
+    for ( unsigned int i = 0; i < 3; ++i )
+      {
+      if ( m_Text.compare(m_Position, std::strlen(literals[i]), literals[i]) == 0 )
+        {
+        scalar = literals[i];
+        m_Position += scalar.size();
+        return true;
+        }
+      }
+    return this->ParseNumber(scalar);
+  }
+
+  bool ParseObject()
+  {
+    MembersType members;
+    ++m_Position;
+    if ( this->Accept('}') )
+      {
+      Objects.push_back(members);
+      return true;
+      }
+    do
+      {
+      std::string key;
+      std::string scalar;
+      this->SkipSpace();
+      if ( !this->ParseString(key) || !this->Accept(':') || !this->ParseValue(scalar) )
+        {
+        return false;
+        }
+      members[key] = scalar;
+      }
+    while ( this->Accept(',') );
+    Objects.push_back(members);
+    return this->Accept('}');
+  }
+
+  bool ParseArray()
+  {
+    ++m_Position;
+    if ( this->Accept(']') )
+      {
+      return true;
+      }
+    do
+      {
+      std::string scalar;
+      if ( !this->ParseValue(scalar) )
+        {
+        return false;
+        }
+      }
+    while ( this->Accept(',') );
+    return this->Accept(']');
+  }
+
+  bool ParseString(std::string & value)
+  {
+    if ( m_Position >= m_Text.size() || m_Text[m_Position] != '"' )
+      {
+      return false;
+      }
+    value.clear();
+    for ( ++m_Position; m_Position < m_Text.size(); ++m_Position )
+      {
+      char c = m_Text[m_Position];
+      if ( c == '"' )
+        {
+        ++m_Position;
+        return true;
+        }
+      if ( static_cast< unsigned char >( c ) < 0x20 )
+        {
+        return false;
+        }
+      if ( c == '\\' )
+        {
+        if ( ++m_Position >= m_Text.size() || std::string("\"\\/bfnrt").find(m_Text[m_Position]) == std::string::npos )
+          {
+          return false; // \u escapes are not written by the tracer
+          }
+        c = m_Text[m_Position];
+        }
+      value += c;
+      }
+    return false;
+  }
+
+  bool ParseNumber(std::string & value)
+  {
+    const std::string::size_type start = m_Position;
+    if ( m_Position < m_Text.size() && m_Text[m_Position] == '-' )
+      {
+      ++m_Position;
+      }
+    while ( m_Position < m_Text.size() && std::string("0123456789.eE+-").find(m_Text[m_Position]) != std::string::npos )
+      {
+      ++m_Position;
+      }
+    value = m_Text.substr(start, m_Position - start);
+    char *end;
+    std::strtod(value.c_str(), &end);
+    return !value.empty() && *end == '\0';
+  }
+};
+
+const char *const QuotedName = "a \"quoted\\name\"";
+
+struct RecordStruct
+  {
+  itk::RegistrationTracer *Tracer;
+  };
+
+ITK_THREAD_RETURN_TYPE
+RecordThreaderCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = static_cast< itk::MultiThreader::ThreadInfoStruct * >( arg );
+  RecordStruct *                        str = static_cast< RecordStruct * >( info->UserData );
+  itk::RegistrationTracer::Scope        scope(str->Tracer, "task", "test", info->ThreadID);
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+bool
+IsNumber(const MembersType & event, const char *key)
+{
+  MembersType::const_iterator it = event.find(key);
+  if ( it == event.end() )
+    {
+    return false;
+    }
+  char *end;
+  const double value = std::strtod(it->second.c_str(), &end);
+  return !it->second.empty() && *end == '\0' && value >= 0.0;
+}
+
+// number of malformed events; counts the complete and instant events
+unsigned int
+CheckTrace(const itk::RegistrationTracer *tracer, itk::SizeValueType & complete, itk::SizeValueType & instant,
+           itk::SizeValueType & quoted)
+{
+  std::ostringstream os;
+  tracer->WriteChromeTrace(os);
+
+  JSONParser parser;
+  if ( !parser.Parse( os.str() ) )
+    {
+    std::cerr << "Invalid JSON at offset " << parser.GetPosition() << ":" << std::endl
+              << os.str().substr(parser.GetPosition() > 80 ? parser.GetPosition() - 80 : 0, 160) << std::endl;
+    return 1;
+    }
+
+  unsigned int errors = 0;
+  complete = instant = quoted = 0;
+  for ( std::vector< MembersType >::const_iterator it = parser.Objects.begin(); it != parser.Objects.end(); ++it )
+    {
+    MembersType::const_iterator ph = it->find("ph");
+    if ( ph == it->end() )
+      {
+      continue; // the top level, and the args of events
+      }
+    if ( !IsNumber(*it, "pid") || !IsNumber(*it, "tid") || it->find("name") == it->end() )
+      {
+      ++errors;
+      }
+    if ( ph->second == "X" )
+      {
+      ++complete;
+      errors += !IsNumber(*it, "ts") || !IsNumber(*it, "dur") || it->find("cat") == it->end();
+      quoted += it->find("name")->second == QuotedName;
+      }
+    else if ( ph->second == "i" )
+      {
+      ++instant;
+      errors += !IsNumber(*it, "ts") || it->find("dur") != it->end();
+      }
+    else if ( ph->second != "M" )
+      {
+      ++errors;
+      }
+    }
+  return errors;
+}
+} // end anonymous namespace
+
+int itkRegistrationTracerTest( int argc, char * argv[] )
+{
+  const unsigned int calls = argc > 1 ? std::atoi(argv[1]) : 300;
+
+  unsigned int errors = 0;
+  try
+    {
+    // fresh threads on every call, more than there are buffer slots
+    itk::RegistrationTracer::Pointer tracer = itk::RegistrationTracer::New();
+    tracer->SetEventsPerThread(4 * calls);
+
+    RecordStruct str;
+    str.Tracer = tracer;
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads(2);
+    threader->SetSingleMethod(RecordThreaderCallback, &str);
+    itk::SizeValueType recorded = 0;
+    for ( unsigned int i = 0; i < calls; ++i )
+      {
+      threader->SingleMethodExecute();
+      recorded += threader->GetNumberOfThreads();
+      }
+    tracer->AddCompleteEvent(QuotedName, "test", tracer->GetTime(), 0.0, 7);
+    tracer->AddInstantEvent("mark", "test");
+    ++recorded;
+
+    itk::SizeValueType complete, instant, quoted;
+    errors += CheckTrace(tracer, complete, instant, quoted);
+    std::cout << recorded << " complete events: " << tracer->GetNumberOfEvents() << " recorded, "
+              << tracer->GetNumberOfDroppedEvents() << " dropped, " << complete << " in the trace" << std::endl;
+    if ( tracer->GetNumberOfEvents() + tracer->GetNumberOfDroppedEvents() != recorded + 1
+         || complete + instant != tracer->GetNumberOfEvents() || instant != 1 || quoted != 1 )
+      {
+      std::cerr << "Events lost without being counted" << std::endl;
+      ++errors;
+      }
+#if !defined( _WIN32 )
+    // exited threads hand their slots on, so nothing is dropped
+    errors += tracer->GetNumberOfDroppedEvents() != 0;
+#endif
+
+    // a full buffer counts what it drops
+    itk::RegistrationTracer::Pointer small = itk::RegistrationTracer::New();
+    small->SetEventsPerThread(4);
+    for ( unsigned int i = 0; i < 9; ++i )
+      {
+      itk::RegistrationTracer::Scope scope(small, "step", "test", i);
+      }
+    errors += CheckTrace(small, complete, instant, quoted);
+    std::cout << "9 events into 4 places: " << small->GetNumberOfEvents() << " recorded, "
+              << small->GetNumberOfDroppedEvents() << " dropped, " << complete << " in the trace" << std::endl;
+    if ( small->GetNumberOfEvents() != 4 || small->GetNumberOfDroppedEvents() != 5 || complete != 4 )
+      {
+      ++errors;
+      }
+
+    small->Clear();
+    errors += small->GetNumberOfEvents() != 0 || small->GetNumberOfDroppedEvents() != 0;
+    errors += CheckTrace(small, complete, instant, quoted);
+    errors += complete != 0;
+
+    // a null tracer records nothing
+    itk::RegistrationTracer::Scope none(ITK_NULLPTR, "none", "test");
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
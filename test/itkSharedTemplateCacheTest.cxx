@@ -0,0 +1,239 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "itkMesh.h"
+#include "itkNativeMeshFileFormat.h"
+#include "itkSharedTemplateCache.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkTriangleVertexNeighborhood.h"
+
+#if !defined( _WIN32 )
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Publishes a template with one SharedTemplateCache and attaches to it with
+// another, in the same process, and compares the shared arrays with the
+// template. Then checks that the segment of a publisher that died before
+// completing it is removed and published again, that a segment still being
+// published is left alone, and that UnlinkOnDetach removes the segment while
+// attached caches keep their arrays.
+//
+//   itkSharedTemplateCacheTest [points]
+//
+// The hashes include the process id, so that concurrent runs do not share
+// segments. Without POSIX shared memory only the private copy is checked.
+
+namespace
+{
+typedef itk::Mesh< double, 3 >                  MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType > GeneratorType;
+
+itk::SharedTemplateCache::Pointer
+MakeCache(uint64_t topologyHash, uint64_t coordinateHash)
+{
+  itk::SharedTemplateCache::Pointer cache = itk::SharedTemplateCache::New();
+  cache->SetTopologyHash(topologyHash);
+  cache->SetCoordinateHash(coordinateHash);
+  cache->SetAttachTimeout(0.2);
+  return cache;
+}
+
+// number of arrays of the cache that differ from the template
+unsigned int
+CompareArrays(const itk::SharedTemplateCache *cache, const GeneratorType::SurfaceType & surface, const char *what)
+{
+  const itk::SizeValueType numberOfPoints = surface.GetNumberOfPoints();
+  const itk::SizeValueType numberOfTriangles = surface.GetNumberOfTriangles();
+  if ( cache->GetNumberOfPoints() != numberOfPoints || cache->GetNumberOfTriangles() != numberOfTriangles
+       || !cache->GetPointBuffer() || !cache->GetTriangleBuffer() )
+    {
+    std::cerr << what << ": " << cache->GetNumberOfPoints() << " points and " << cache->GetNumberOfTriangles()
+              << " triangles, expected " << numberOfPoints << " and " << numberOfTriangles << std::endl;
+    return 1;
+    }
+
+  std::vector< itk::SizeValueType > offsets( numberOfPoints + 1 );
+  std::vector< uint32_t >           neighbors( itk::TriangleVertexNeighborhood::GetNumberOfNeighbors(numberOfTriangles) );
+  itk::TriangleVertexNeighborhood::Build(&surface.Triangles[0], numberOfTriangles, numberOfPoints,
+                                         &offsets[0], &neighbors[0]);
+
+  unsigned int errors = 0;
+  errors += std::memcmp( cache->GetPointBuffer(), &surface.Points[0], surface.Points.size() * sizeof( double ) ) != 0;
+  errors += std::memcmp( cache->GetTriangleBuffer(), &surface.Triangles[0],
+                         surface.Triangles.size() * sizeof( uint32_t ) ) != 0;
+  errors += std::memcmp( cache->GetNeighborOffsetBuffer(), &offsets[0],
+                         offsets.size() * sizeof( itk::SizeValueType ) ) != 0;
+  errors += std::memcmp( cache->GetNeighborBuffer(), &neighbors[0], neighbors.size() * sizeof( uint32_t ) ) != 0;
+
+  // the index answers like a linear scan for the points themselves
+  const itk::FlatPointLocator *locator = cache->GetPointLocator();
+  for ( itk::SizeValueType i = 0; i < numberOfPoints; i += 97 )
+    {
+    double distance;
+    if ( locator->FindClosestPoint(&surface.Points[3 * i], &distance) != i || distance != 0.0 )
+      {
+      ++errors;
+      break;
+      }
+    }
+
+  std::cout << what << ": " << errors << " arrays differ" << std::endl;
+  return errors;
+}
+
+#if !defined( _WIN32 )
+bool
+SegmentExists(const itk::SharedTemplateCache *cache)
+{
+  const int fd = shm_open(cache->GetSegmentName().c_str(), O_RDONLY, 0);
+  if ( fd < 0 )
+    {
+    return false;
+    }
+  close(fd);
+  return true;
+}
+
+// an incomplete segment, as left by a publisher; with holdLock the returned
+// descriptor keeps the publisher lock, as a live publisher would
+int
+CreateIncompleteSegment(const itk::SharedTemplateCache *cache, bool holdLock)
+{
+  const int fd = shm_open(cache->GetSegmentName().c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if ( fd < 0 )
+    {
+    return -1;
+    }
+  if ( ( holdLock && flock(fd, LOCK_EX) != 0 ) || ftruncate(fd, 4096) != 0 )
+    {
+    close(fd);
+    return -1;
+    }
+  if ( !holdLock )
+    {
+    close(fd);
+    return 0;
+    }
+  return fd;
+}
+#endif
+} // end anonymous namespace
+
+int itkSharedTemplateCacheTest( int argc, char * argv[] )
+{
+  const itk::SizeValueType size = argc > 1 ? std::atol(argv[1]) : 5000;
+
+  const GeneratorType::SurfaceType surface = GeneratorType::Generate("icosphere", size);
+#if !defined( _WIN32 )
+  const uint64_t salt = static_cast< uint64_t >( getpid() ) << 32;
+#else
+  const uint64_t salt = 0;
+#endif
+  const uint64_t                   topologyHash =
+    itk::NativeMeshFile::TopologyHash(surface.GetNumberOfPoints(), &surface.Triangles[0],
+                                      surface.GetNumberOfTriangles()) ^ salt;
+  const uint64_t coordinateHash = itk::NativeMeshFile::CoordinateHash(&surface.Points[0], surface.Points.size()) ^ salt;
+
+  unsigned int errors = 0;
+  try
+    {
+    itk::SharedTemplateCache::Pointer publisher = MakeCache(topologyHash, coordinateHash);
+    publisher->UnlinkOnDetachOn();
+    if ( publisher->Attach() )
+      {
+      std::cerr << "Attached to a template nobody published" << std::endl;
+      ++errors;
+      }
+    publisher->Publish(&surface.Points[0], surface.GetNumberOfPoints(),
+                       &surface.Triangles[0], surface.GetNumberOfTriangles());
+    errors += !publisher->GetIsPublisher();
+    errors += CompareArrays(publisher, surface, "Publisher");
+
+#if !defined( _WIN32 )
+    itk::SharedTemplateCache::Pointer attached = MakeCache(topologyHash, coordinateHash);
+    if ( !attached->Attach() )
+      {
+      std::cerr << "Unable to attach to the published template" << std::endl;
+      return EXIT_FAILURE;
+      }
+    errors += attached->GetIsPublisher();
+    errors += CompareArrays(attached, surface, "Attached");
+
+    // released by the publisher: gone from the system, still mapped here
+    publisher->Detach();
+    if ( SegmentExists(attached) )
+      {
+      std::cerr << "The segment outlived its publisher with UnlinkOnDetach" << std::endl;
+      ++errors;
+      }
+    errors += CompareArrays(attached, surface, "Attached after unlink");
+    attached->Detach();
+
+    // a publisher that died before the segment was ready
+    itk::SharedTemplateCache::Pointer recovering = MakeCache(topologyHash, coordinateHash);
+    if ( CreateIncompleteSegment(recovering, false) < 0 )
+      {
+      std::cerr << "Unable to create an incomplete segment" << std::endl;
+      return EXIT_FAILURE;
+      }
+    if ( recovering->Attach() || SegmentExists(recovering) )
+      {
+      std::cerr << "An abandoned segment was not removed by Attach()" << std::endl;
+      ++errors;
+      }
+    CreateIncompleteSegment(recovering, false);
+    recovering->Publish(&surface.Points[0], surface.GetNumberOfPoints(),
+                        &surface.Triangles[0], surface.GetNumberOfTriangles());
+    errors += !recovering->GetIsPublisher();
+    errors += CompareArrays(recovering, surface, "Published over an abandoned segment");
+    recovering->Detach();
+    recovering->Unlink();
+
+    // a publisher that is still filling its segment keeps it
+    itk::SharedTemplateCache::Pointer waiting = MakeCache(topologyHash, coordinateHash);
+    const int                         lockedFd = CreateIncompleteSegment(waiting, true);
+    if ( lockedFd < 0 )
+      {
+      std::cerr << "Unable to create a locked segment" << std::endl;
+      return EXIT_FAILURE;
+      }
+    if ( waiting->Attach() || !SegmentExists(waiting) )
+      {
+      std::cerr << "A segment being published was used or removed" << std::endl;
+      ++errors;
+      }
+    close(lockedFd);
+    waiting->Unlink();
+#endif
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,149 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "itkMeshDisplacementTransform.h"
+#include "itkSpeculativeLineSearchOptimizer.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+#include "itkTimeProbe.h"
+#include "itkWorkerPool.h"
+
+// Registers a synthetic pair with SpeculativeLineSearchOptimizer, once with
+// the candidate step lengths of each round evaluated concurrently and once
+// one after the other, and prints the wall time, evaluations and line
+// search rounds of both.
+//
+//   itkSpeculativeLineSearchOptimizerTest [points] [threads] [iterations]
+//
+// Fails unless both decrease the energy and end at bit-identical positions.
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >                      MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType >             GeneratorType;
+typedef itk::ThinShellDemonsMetric< MeshType, MeshType >    MetricType;
+typedef itk::MeshDisplacementTransform< double, Dimension > TransformType;
+typedef itk::SpeculativeLineSearchOptimizer                 OptimizerType;
+
+struct OptimizationResult
+{
+  OptimizerType::ParametersType Position;
+  double                        Value;
+  itk::SizeValueType            Iterations;
+  double                        Time;
+};
+
+OptimizationResult
+Optimize(MetricType *metric, itk::WorkerPool *pool, const OptimizerType::ParametersType & initial,
+         itk::SizeValueType iterations, bool concurrent)
+{
+  OptimizerType::Pointer optimizer = OptimizerType::New();
+  optimizer->SetCostFunction(metric);
+  optimizer->SetWorkerPool(pool);
+  optimizer->SetUseConcurrentEvaluations(concurrent);
+  optimizer->SetNumberOfIterations(iterations);
+  optimizer->SetInitialStepLength(0.01);
+  optimizer->SetInitialPosition(initial);
+
+  itk::TimeProbe clock;
+  clock.Start();
+  optimizer->StartOptimization();
+  clock.Stop();
+
+  OptimizationResult result;
+  result.Position = optimizer->GetCurrentPosition();
+  result.Value = optimizer->GetValue();
+  result.Iterations = optimizer->GetCurrentIteration();
+  result.Time = clock.GetTotal();
+
+  std::cout << ( concurrent ? "concurrent" : "sequential" ) << ": value " << result.Value << " after "
+            << result.Iterations << " iterations, " << optimizer->GetNumberOfEvaluations() << " evaluations in "
+            << optimizer->GetNumberOfLineSearchRounds() << " rounds, " << result.Time << " s ("
+            << optimizer->GetStopConditionDescription() << ")" << std::endl;
+  return result;
+}
+} // end anonymous namespace
+
+int itkSpeculativeLineSearchOptimizerTest( int argc, char * argv[] )
+{
+  const itk::SizeValueType size = argc > 1 ? std::atol(argv[1]) : 5000;
+  const itk::ThreadIdType  threads = argc > 2 ? std::atoi(argv[2]) : 4;
+  const itk::SizeValueType iterations = argc > 3 ? std::atol(argv[3]) : 30;
+
+  GeneratorType::SurfaceType fixedSurface = GeneratorType::Generate("icosphere", size);
+  GeneratorType::SurfaceType movingSurface = fixedSurface;
+  GeneratorType::Deform(movingSurface, 0.02, 0.5);
+  MeshType::Pointer fixedMesh = GeneratorType::MakeMesh(fixedSurface);
+  MeshType::Pointer movingMesh = GeneratorType::MakeMesh(movingSurface);
+
+  try
+    {
+    TransformType::Pointer transform = TransformType::New();
+    transform->SetMeshTemplate(movingMesh);
+    transform->Initialize();
+    transform->SetIdentity();
+
+    // the candidates and the metric share the pool: while the candidates
+    // run, each evaluation stays on the thread of its candidate
+    itk::WorkerPool::Pointer pool = itk::WorkerPool::New();
+    pool->SetNumberOfThreads(threads);
+
+    MetricType::Pointer metric = MetricType::New();
+    metric->SetStretchWeight(4);
+    metric->SetBendWeight(1);
+    metric->SetNumberOfThreads(threads);
+    metric->SetWorkerPool(pool);
+    metric->SetFixedMesh(fixedMesh);
+    metric->SetMovingMesh(movingMesh);
+    metric->SetTransform(transform);
+    metric->Initialize();
+
+    const OptimizerType::ParametersType initial = transform->GetParameters();
+    const double                        initialValue = metric->GetValue(initial);
+    std::cout << movingSurface.GetNumberOfPoints() << " points, initial value " << initialValue << std::endl;
+
+    const OptimizationResult concurrent = Optimize(metric, pool, initial, iterations, true);
+    const OptimizationResult sequential = Optimize(metric, pool, initial, iterations, false);
+    std::cout << "speedup of the concurrent line search " << sequential.Time / concurrent.Time << std::endl;
+
+    if ( !( concurrent.Value < initialValue ) || !( sequential.Value < initialValue ) )
+      {
+      std::cerr << "The optimization did not decrease the energy" << std::endl;
+      return EXIT_FAILURE;
+      }
+    if ( concurrent.Iterations != sequential.Iterations
+         || concurrent.Position.Size() != sequential.Position.Size()
+         || std::memcmp( concurrent.Position.data_block(), sequential.Position.data_block(),
+                         concurrent.Position.Size() * sizeof( double ) ) != 0 )
+      {
+      std::cerr << "Concurrent and sequential line searches took different paths" << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
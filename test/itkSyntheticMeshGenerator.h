@@ -0,0 +1,321 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkSyntheticMeshGenerator_h
+#define itkSyntheticMeshGenerator_h
+
+#include "itkMesh.h"
+#include "itkTriangleCell.h"
+#include "itkMath.h"
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace itk
+{
+/** \class SyntheticMeshGenerator
+ * \brief Closed-form test surfaces of any size for benchmarks and tests.
+ *
+ * Surfaces are generated as packed xyz doubles and vertex index triples,
+ * the layout ThinShellDemonsMetric evaluates on, and converted to a mesh
+ * with MakeMesh(). Sizes are chosen as close to the requested number of
+ * vertices as the construction allows; GetNumberOfPoints() tells the
+ * actual count. Everything is deterministic, noise included.
+ *
+ */
+template< typename TMesh >
+class SyntheticMeshGenerator
+{
+public:
+  typedef TMesh                                 MeshType;
+  typedef typename MeshType::Pointer            MeshPointer;
+  typedef typename MeshType::PointType          PointType;
+  typedef typename MeshType::CellType           CellType;
+  typedef typename MeshType::CellAutoPointer    CellAutoPointer;
+  typedef TriangleCell< CellType >              TriangleCellType;
+
+  struct SurfaceType
+    {
+    std::vector< double >   Points;
+    std::vector< uint32_t > Triangles;
+
+    SizeValueType GetNumberOfPoints() const { return Points.size() / 3; }
+    SizeValueType GetNumberOfTriangles() const { return Triangles.size() / 3; }
+    };
+
+  /** Unit sphere: icosahedron subdivided k times, 10 * 4^k + 2 vertices.
+   *  k is chosen to come closest to numberOfPoints. */
+  static SurfaceType Icosphere(SizeValueType numberOfPoints)
+  {
+    unsigned int levels = 0;
+    while ( Distance(IcospherePoints(levels + 1), numberOfPoints) < Distance(IcospherePoints(levels), numberOfPoints) )
+      {
+      ++levels;
+      }
+
+    const double t = ( 1.0 + std::sqrt(5.0) ) / 2.0;
+    const double corners[12][3] = {
+      { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+      { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+      { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 } };
+    const uint32_t faces[20][3] = {
+      { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+      { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+      { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+      { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 } };
+
+    SurfaceType s;
+    s.Points.assign(&corners[0][0], &corners[0][0] + 36);
+    s.Triangles.assign(&faces[0][0], &faces[0][0] + 60);
+    for ( SizeValueType i = 0; i < 12; ++i )
+      {
+      Normalize(&s.Points[3 * i]);
+      }
+
+    for ( unsigned int level = 0; level < levels; ++level )
+      {
+      // one midpoint per edge: sort the edge keys, the rank is the id
+      std::vector< uint64_t > edges;
+      edges.reserve( s.Triangles.size() );
+      for ( SizeValueType i = 0; i < s.Triangles.size(); i += 3 )
+        {
+        for ( unsigned int e = 0; e < 3; ++e )
+          {
+          edges.push_back( EdgeKey(s.Triangles[i + e], s.Triangles[i + ( e + 1 ) % 3]) );
+          }
+        }
+      std::sort( edges.begin(), edges.end() );
+      edges.erase( std::unique( edges.begin(), edges.end() ), edges.end() );
+
+      const SizeValueType firstMidpoint = s.GetNumberOfPoints();
+      s.Points.resize( 3 * ( firstMidpoint + edges.size() ) );
+      for ( SizeValueType e = 0; e < edges.size(); ++e )
+        {
+        const uint32_t a = static_cast< uint32_t >( edges[e] >> 32 );
+        const uint32_t b = static_cast< uint32_t >( edges[e] & 0xffffffffu );
+        double *       m = &s.Points[3 * ( firstMidpoint + e )];
+        for ( unsigned int d = 0; d < 3; ++d )
+          {
+          m[d] = 0.5 * ( s.Points[3 * a + d] + s.Points[3 * b + d] );
+          }
+        Normalize(m);
+        }
+
+      std::vector< uint32_t > triangles;
+      triangles.reserve( 4 * s.Triangles.size() );
+      for ( SizeValueType i = 0; i < s.Triangles.size(); i += 3 )
+        {
+        const uint32_t v0 = s.Triangles[i], v1 = s.Triangles[i + 1], v2 = s.Triangles[i + 2];
+        const uint32_t m01 = Midpoint(edges, firstMidpoint, v0, v1);
+        const uint32_t m12 = Midpoint(edges, firstMidpoint, v1, v2);
+        const uint32_t m20 = Midpoint(edges, firstMidpoint, v2, v0);
+        const uint32_t sub[12] = { v0, m01, m20, v1, m12, m01, v2, m20, m12, m01, m12, m20 };
+        triangles.insert(triangles.end(), sub, sub + 12);
+        }
+      s.Triangles.swap(triangles);
+      }
+    return s;
+  }
+
+  /** Torus around the z axis with radii 1 and 1/3, on a periodic grid of
+   *  about numberOfPoints vertices. */
+  static SurfaceType Torus(SizeValueType numberOfPoints)
+  {
+    const SizeValueType nu = std::max< SizeValueType >( 3, static_cast< SizeValueType >( std::sqrt(3.0 * numberOfPoints) + 0.5 ) );
+    const SizeValueType nv = std::max< SizeValueType >( 3, ( numberOfPoints + nu / 2 ) / nu );
+    const double        R = 1.0;
+    const double        r = 1.0 / 3.0;
+
+    SurfaceType s;
+    s.Points.reserve(3 * nu * nv);
+    for ( SizeValueType i = 0; i < nu; ++i )
+      {
+      const double u = 2.0 * Math::pi * i / nu;
+      for ( SizeValueType j = 0; j < nv; ++j )
+        {
+        const double v = 2.0 * Math::pi * j / nv;
+        s.Points.push_back( ( R + r * std::cos(v) ) * std::cos(u) );
+        s.Points.push_back( ( R + r * std::cos(v) ) * std::sin(u) );
+        s.Points.push_back( r * std::sin(v) );
+        }
+      }
+    GridTriangles(nu, nv, true, true, s.Triangles);
+    return s;
+  }
+
+  /** Unit square height field with a few Gaussian bumps plus uniform noise
+   *  of the given amplitude, on a grid of about numberOfPoints vertices. */
+  static SurfaceType NoisyBumps(SizeValueType numberOfPoints, double noise, unsigned int seed = 1)
+  {
+    const SizeValueType n = std::max< SizeValueType >( 2, static_cast< SizeValueType >( std::sqrt( static_cast< double >( numberOfPoints ) ) + 0.5 ) );
+    const double        bumps[4][4] = { // x, y, height, width
+      { 0.3, 0.3, 0.15, 0.10 }, { 0.7, 0.4, -0.10, 0.08 }, { 0.4, 0.75, 0.20, 0.12 }, { 0.8, 0.8, 0.05, 0.05 } };
+
+    uint32_t    state = seed;
+    SurfaceType s;
+    s.Points.reserve(3 * n * n);
+    for ( SizeValueType i = 0; i < n; ++i )
+      {
+      const double x = static_cast< double >( i ) / ( n - 1 );
+      for ( SizeValueType j = 0; j < n; ++j )
+        {
+        const double y = static_cast< double >( j ) / ( n - 1 );
+        double       z = noise * ( 2.0 * Random(state) - 1.0 );
+        for ( unsigned int b = 0; b < 4; ++b )
+          {
+          const double dx = x - bumps[b][0];
+          const double dy = y - bumps[b][1];
+          z += bumps[b][2] * std::exp( -( dx * dx + dy * dy ) / ( 2.0 * bumps[b][3] * bumps[b][3] ) );
+          }
+        s.Points.push_back(x);
+        s.Points.push_back(y);
+        s.Points.push_back(z);
+        }
+      }
+    GridTriangles(n, n, false, false, s.Triangles);
+    return s;
+  }
+
+  /** Generate by name: "icosphere", "torus" or "bumps". */
+  static SurfaceType Generate(const std::string & shape, SizeValueType numberOfPoints)
+  {
+    if ( shape == "icosphere" )
+      {
+      return Icosphere(numberOfPoints);
+      }
+    if ( shape == "torus" )
+      {
+      return Torus(numberOfPoints);
+      }
+    return NoisyBumps(numberOfPoints, 0.002);
+  }
+
+  /** Displace every vertex by the smooth analytic field
+   *    u(x) = amplitude * ( sin(w y), sin(w z), sin(w x) ),  w = 2 pi / wavelength.
+   *  The field is known in closed form, so tests can compare a recovered
+   *  displacement with it. */
+  static void Deform(SurfaceType & s, double amplitude, double wavelength)
+  {
+    std::vector< double > u;
+    Displacement(s, amplitude, wavelength, u);
+    for ( SizeValueType i = 0; i < s.Points.size(); ++i )
+      {
+      s.Points[i] += u[i];
+      }
+  }
+
+  static void Displacement(const SurfaceType & s, double amplitude, double wavelength, std::vector< double > & u)
+  {
+    const double w = 2.0 * Math::pi / wavelength;
+    u.resize( s.Points.size() );
+    for ( SizeValueType i = 0; i < s.Points.size(); i += 3 )
+      {
+      u[i] = amplitude * std::sin(w * s.Points[i + 1]);
+      u[i + 1] = amplitude * std::sin(w * s.Points[i + 2]);
+      u[i + 2] = amplitude * std::sin(w * s.Points[i]);
+      }
+  }
+
+  /** Build a mesh with triangle cells from a surface. */
+  static MeshPointer MakeMesh(const SurfaceType & s)
+  {
+    MeshPointer         mesh = MeshType::New();
+    const SizeValueType numberOfPoints = s.GetNumberOfPoints();
+    mesh->GetPoints()->Reserve(numberOfPoints);
+    for ( SizeValueType i = 0; i < numberOfPoints; ++i )
+      {
+      PointType p;
+      for ( unsigned int d = 0; d < 3; ++d )
+        {
+        p[d] = s.Points[3 * i + d];
+        }
+      mesh->SetPoint(i, p);
+      }
+    for ( SizeValueType i = 0; i < s.GetNumberOfTriangles(); ++i )
+      {
+      CellAutoPointer cell;
+      cell.TakeOwnership(new TriangleCellType);
+      for ( unsigned int k = 0; k < 3; ++k )
+        {
+        cell->SetPointId(k, s.Triangles[3 * i + k]);
+        }
+      mesh->SetCell(i, cell);
+      }
+    return mesh;
+  }
+
+private:
+  static SizeValueType IcospherePoints(unsigned int levels)
+  {
+    return 10 * ( static_cast< SizeValueType >( 1 ) << ( 2 * levels ) ) + 2;
+  }
+
+  static SizeValueType Distance(SizeValueType a, SizeValueType b)
+  {
+    return a > b ? a - b : b - a;
+  }
+
+  static void Normalize(double *p)
+  {
+    const double norm = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+    p[0] /= norm;
+    p[1] /= norm;
+    p[2] /= norm;
+  }
+
+  static uint64_t EdgeKey(uint32_t a, uint32_t b)
+  {
+    return a < b ? ( static_cast< uint64_t >( a ) << 32 ) | b : ( static_cast< uint64_t >( b ) << 32 ) | a;
+  }
+
+  static uint32_t Midpoint(const std::vector< uint64_t > & edges, SizeValueType firstMidpoint, uint32_t a, uint32_t b)
+  {
+    const SizeValueType rank = std::lower_bound( edges.begin(), edges.end(), EdgeKey(a, b) ) - edges.begin();
+    return static_cast< uint32_t >( firstMidpoint + rank );
+  }
+
+  /** Two triangles per cell of a nu x nv vertex grid, optionally periodic. */
+  static void GridTriangles(SizeValueType nu, SizeValueType nv, bool wrapU, bool wrapV, std::vector< uint32_t > & triangles)
+  {
+    const SizeValueType cu = wrapU ? nu : nu - 1;
+    const SizeValueType cv = wrapV ? nv : nv - 1;
+    triangles.reserve(6 * cu * cv);
+    for ( SizeValueType i = 0; i < cu; ++i )
+      {
+      for ( SizeValueType j = 0; j < cv; ++j )
+        {
+        const uint32_t a = static_cast< uint32_t >( i * nv + j );
+        const uint32_t b = static_cast< uint32_t >( ( ( i + 1 ) % nu ) * nv + j );
+        const uint32_t c = static_cast< uint32_t >( ( ( i + 1 ) % nu ) * nv + ( j + 1 ) % nv );
+        const uint32_t d = static_cast< uint32_t >( i * nv + ( j + 1 ) % nv );
+        const uint32_t quad[6] = { a, b, c, a, c, d };
+        triangles.insert(triangles.end(), quad, quad + 6);
+        }
+      }
+  }
+
+  /** Portable linear congruential generator in [0, 1). */
+  static double Random(uint32_t & state)
+  {
+    state = state * 1664525u + 1013904223u;
+    return ( state >> 8 ) / 16777216.0;
+  }
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,181 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include "itkAtomicInt.h"
+#include "itkMeshDisplacementTransform.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+#include "itkWorkerPool.h"
+
+// Checks that ThinShellDemonsMetric::GetValue() and GetDerivative() do not
+// allocate once the metric is initialized and the derivative has its size,
+// single threaded and on a worker pool, in the fast and the deterministic
+// mode.
+//
+//   itkThinShellDemonsAllocationTest [points] [threads] [iterations]
+//
+// Allocations are counted by replacing the global operator new, which
+// affects the whole test driver but counts only between
+// StartCountingAllocations() and StopCountingAllocations().
+
+namespace
+{
+itk::AtomicInt< int > countingAllocations;
+itk::AtomicInt< int > numberOfAllocations;
+
+void
+StartCountingAllocations()
+{
+  numberOfAllocations = 0;
+  countingAllocations = 1;
+}
+
+int
+StopCountingAllocations()
+{
+  countingAllocations = 0;
+  return numberOfAllocations;
+}
+} // end anonymous namespace
+
+#if __cplusplus >= 201103L
+void * operator new(std::size_t size)
+#else
+void * operator new(std::size_t size) throw( std::bad_alloc )
+#endif
+{
+  if ( countingAllocations.load() )
+    {
+    ++numberOfAllocations;
+    }
+  void *data = std::malloc( size > 0 ? size : 1 );
+  if ( !data )
+    {
+    throw std::bad_alloc();
+    }
+  return data;
+}
+
+#if __cplusplus >= 201103L
+void operator delete(void *data) noexcept
+#else
+void operator delete(void *data) throw()
+#endif
+{
+  std::free(data);
+}
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >                      MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType >             GeneratorType;
+typedef itk::ThinShellDemonsMetric< MeshType, MeshType >    MetricType;
+typedef itk::MeshDisplacementTransform< double, Dimension > TransformType;
+
+// allocations of the given number of GetValue() and GetDerivative() calls
+int
+CountAllocations(MeshType *fixedMesh, MeshType *movingMesh, const MetricType::TransformParametersType & position,
+                 itk::ThreadIdType threads, bool deterministic, unsigned int iterations)
+{
+  TransformType::Pointer transform = TransformType::New();
+  transform->SetMeshTemplate(movingMesh);
+  transform->Initialize();
+  transform->SetIdentity();
+
+  itk::WorkerPool::Pointer pool = itk::WorkerPool::New();
+  pool->SetNumberOfThreads(threads);
+
+  MetricType::Pointer metric = MetricType::New();
+  metric->SetStretchWeight(4);
+  metric->SetBendWeight(1);
+  metric->SetNumberOfThreads(threads);
+  metric->SetWorkerPool(pool);
+  metric->SetMinimumVerticesPerThread(1);
+  metric->SetDeterministic(deterministic);
+  metric->SetFixedMesh(fixedMesh);
+  metric->SetMovingMesh(movingMesh);
+  metric->SetTransform(transform);
+  metric->Initialize();
+
+  // the derivative is sized by the first call, as by an optimizer
+  MetricType::DerivativeType derivative;
+  metric->GetDerivative(position, derivative);
+
+  StartCountingAllocations();
+  double value = 0.0;
+  for ( unsigned int i = 0; i < iterations; ++i )
+    {
+    value += metric->GetValue(position);
+    metric->GetDerivative(position, derivative);
+    }
+  const int allocations = StopCountingAllocations();
+
+  std::cout << threads << " threads, " << ( deterministic ? "deterministic" : "fast" ) << ": " << allocations
+            << " allocations in " << iterations << " iterations, " << metric->GetNumberOfEvaluationWorkspaces()
+            << " workspaces (value " << value / iterations << ")" << std::endl;
+  return allocations;
+}
+} // end anonymous namespace
+
+int itkThinShellDemonsAllocationTest( int argc, char * argv[] )
+{
+  const itk::SizeValueType size = argc > 1 ? std::atol(argv[1]) : 10000;
+  const itk::ThreadIdType  threads = argc > 2 ? std::atoi(argv[2]) : 4;
+  const unsigned int       iterations = argc > 3 ? std::atoi(argv[3]) : 20;
+
+  GeneratorType::SurfaceType fixedSurface = GeneratorType::Generate("icosphere", size);
+  GeneratorType::SurfaceType movingSurface = fixedSurface;
+  GeneratorType::Deform(movingSurface, 0.02, 0.5);
+  MeshType::Pointer fixedMesh = GeneratorType::MakeMesh(fixedSurface);
+  MeshType::Pointer movingMesh = GeneratorType::MakeMesh(movingSurface);
+
+  std::vector< double > u;
+  GeneratorType::Displacement(movingSurface, 0.01, 0.3, u);
+  MetricType::TransformParametersType position( u.size() );
+  for ( unsigned int i = 0; i < position.Size(); ++i )
+    {
+    position[i] = u[i];
+    }
+
+  int allocations = 0;
+  try
+    {
+    for ( int deterministic = 0; deterministic < 2; ++deterministic )
+      {
+      allocations += CountAllocations(fixedMesh, movingMesh, position, 1, deterministic != 0, iterations);
+      allocations += CountAllocations(fixedMesh, movingMesh, position, threads, deterministic != 0, iterations);
+      }
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  if ( allocations != 0 )
+    {
+    std::cerr << allocations << " allocations in the evaluations, expected none" << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "itkMeshDisplacementTransform.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+#include "itkTimeProbe.h"
+#include "itkWorkerPool.h"
+
+// Checks ThinShellDemonsMetric::GetValues() against GetValue() at each of
+// count parameter vectors, single threaded and on a worker pool, in the
+// fast and the deterministic mode, and measures the batch against as many
+// GetValue() calls.
+//
+//   itkThinShellDemonsBatchTest [points] [threads] [count]
+//
+// A count above ThinShellDemonsKernels::MaximumBatchSize spans several
+// batches.
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >                      MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType >             GeneratorType;
+typedef itk::ThinShellDemonsMetric< MeshType, MeshType >    MetricType;
+typedef itk::MeshDisplacementTransform< double, Dimension > TransformType;
+
+const double Tolerance = 1e-12;
+
+// largest relative difference between the batch and the single values
+double
+CheckBatch(MeshType *fixedMesh, MeshType *movingMesh, const MetricType::ParametersListType & positions,
+           itk::ThreadIdType threads, bool deterministic)
+{
+  TransformType::Pointer transform = TransformType::New();
+  transform->SetMeshTemplate(movingMesh);
+  transform->Initialize();
+  transform->SetIdentity();
+
+  itk::WorkerPool::Pointer pool = itk::WorkerPool::New();
+  pool->SetNumberOfThreads(threads);
+
+  MetricType::Pointer metric = MetricType::New();
+  metric->SetStretchWeight(4);
+  metric->SetBendWeight(1);
+  metric->SetNumberOfThreads(threads);
+  metric->SetWorkerPool(pool);
+  metric->SetMinimumVerticesPerThread(1);
+  metric->SetDeterministic(deterministic);
+  metric->SetFixedMesh(fixedMesh);
+  metric->SetMovingMesh(movingMesh);
+  metric->SetTransform(transform);
+  metric->Initialize();
+
+  MetricType::MeasureListType values;
+  MetricType::MeasureListType singles( positions.size() );
+  metric->GetValues(positions, values);
+  for ( size_t k = 0; k < positions.size(); ++k )
+    {
+    singles[k] = metric->GetValue(positions[k]);
+    }
+
+  double error = 0.0;
+  for ( size_t k = 0; k < positions.size(); ++k )
+    {
+    const double difference = std::fabs(values[k] - singles[k]);
+    error = std::max( error, singles[k] != 0.0 ? difference / std::fabs(singles[k]) : difference );
+    }
+
+  // the same evaluations, timed
+  const unsigned int repetitions = 5;
+  itk::TimeProbe     batchProbe;
+  itk::TimeProbe     singleProbe;
+  for ( unsigned int r = 0; r < repetitions; ++r )
+    {
+    batchProbe.Start();
+    metric->GetValues(positions, values);
+    batchProbe.Stop();
+    singleProbe.Start();
+    for ( size_t k = 0; k < positions.size(); ++k )
+      {
+      singles[k] = metric->GetValue(positions[k]);
+      }
+    singleProbe.Stop();
+    }
+
+  std::cout << threads << " threads, " << ( deterministic ? "deterministic" : "fast" ) << ": "
+            << positions.size() << " values in " << batchProbe.GetMean() * 1e3 << " ms, "
+            << singleProbe.GetMean() * 1e3 << " ms by GetValue(), speedup "
+            << singleProbe.GetMean() / batchProbe.GetMean() << ", relative error " << error << std::endl;
+  return error;
+}
+} // end anonymous namespace
+
+int itkThinShellDemonsBatchTest( int argc, char * argv[] )
+{
+  const itk::SizeValueType size = argc > 1 ? std::atol(argv[1]) : 20000;
+  const itk::ThreadIdType  threads = argc > 2 ? std::atoi(argv[2]) : 4;
+  const unsigned int       count = argc > 3 ? std::atoi(argv[3]) : 11;
+
+  GeneratorType::SurfaceType fixedSurface = GeneratorType::Generate("icosphere", size);
+  GeneratorType::SurfaceType movingSurface = fixedSurface;
+  GeneratorType::Deform(movingSurface, 0.02, 0.5);
+  MeshType::Pointer fixedMesh = GeneratorType::MakeMesh(fixedSurface);
+  MeshType::Pointer movingMesh = GeneratorType::MakeMesh(movingSurface);
+
+  // the displacement at count scales, as the trial steps of a line search
+  std::vector< double > u;
+  GeneratorType::Displacement(movingSurface, 0.01, 0.3, u);
+  MetricType::ParametersListType positions( count );
+  for ( unsigned int k = 0; k < count; ++k )
+    {
+    positions[k].SetSize( u.size() );
+    for ( unsigned int i = 0; i < u.size(); ++i )
+      {
+      positions[k][i] = u[i] * ( k + 1 ) / count;
+      }
+    }
+
+  double error = 0.0;
+  try
+    {
+    for ( int deterministic = 0; deterministic < 2; ++deterministic )
+      {
+      error = std::max( error, CheckBatch(fixedMesh, movingMesh, positions, 1, deterministic != 0) );
+      error = std::max( error, CheckBatch(fixedMesh, movingMesh, positions, threads, deterministic != 0) );
+      }
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  if ( !( error <= Tolerance ) )
+    {
+    std::cerr << "GetValues() differs from GetValue() by a relative " << error << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include "itkThinShellDemonsBenchmarkCase.h"
+
+// Times the stages of a Thin Shell Demons registration on synthetic
+// fixed/moving pairs of increasing size and writes the results as JSON.
+//
+//   itkThinShellDemonsBenchmark output.json [maxPoints] [repetitions] [functionEvaluations]
+//                               [threads]
+//
+// Each pair is a generated surface (icosphere, torus, noisy bumps) and a
+// copy of it displaced by a smooth analytic field. Sizes run from 1k to
+// 5M vertices and stop at maxPoints. The output, which includes the host
+// calibration, can serve as the baseline of itkThinShellDemonsPerformanceTest.
+// The metric runs on threads threads, 1 by default, as the calibration does.
+
+int itkThinShellDemonsBenchmark( int argc, char * argv[] )
+{
+  if ( argc < 2 )
+    {
+    std::cerr << "Usage: " << argv[0] << " output.json [maxPoints] [repetitions] [functionEvaluations] [threads]"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  const itk::SizeValueType maxPoints = argc > 2 ? std::atol(argv[2]) : 100000;
+  const unsigned int       repetitions = argc > 3 ? std::atoi(argv[3]) : 5;
+  const unsigned int       evaluations = argc > 4 ? std::atoi(argv[4]) : 20;
+  const itk::ThreadIdType  threads = argc > 5 ? std::atoi(argv[5]) : 1;
+
+  const itk::SizeValueType sizes[] = { 1000, 10000, 100000, 1000000, 5000000 };
+  const char *             shapes[] = { "icosphere", "torus", "bumps" };
+
+  std::vector< itk::ThinShellDemonsBenchmarkCase::ResultType > results;
+  try
+    {
+    for ( unsigned int s = 0; s < sizeof( sizes ) / sizeof( sizes[0] ) && sizes[s] <= maxPoints; ++s )
+      {
+      for ( unsigned int k = 0; k < 3; ++k )
+        {
+        results.push_back( itk::ThinShellDemonsBenchmarkCase::Run(shapes[k], sizes[s], repetitions, evaluations,
+                                                                  threads) );
+        const itk::ThinShellDemonsBenchmarkCase::ResultType & r = results.back();
+        std::cout << r.Shape << " " << r.NumberOfPoints << " points: initialize " << r.Initialize
+                  << " s, GetValue " << r.GetValue << " s, GetDerivative " << r.GetDerivative
+                  << " s, optimizer " << r.Optimizer << " s" << std::endl;
+        }
+      }
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  std::ofstream output( argv[1] );
+  if ( !output )
+    {
+    std::cerr << "Unable to open " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+    }
+  itk::ThinShellDemonsBenchmarkCase::WriteJSON( output, results, repetitions,
+                                               itk::ThinShellDemonsBenchmarkCase::MeasureCalibration() );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,381 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkThinShellDemonsBenchmarkCase_h
+#define itkThinShellDemonsBenchmarkCase_h
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "itkConjugateGradientOptimizer.h"
+#include "itkFlatPointLocator.h"
+#include "itkMeshDisplacementTransform.h"
+#include "itkMeshToMeshRegistrationMethod.h"
+#include "itkRegistrationProfiler.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+#include "itkTimeProbe.h"
+#include "itkWorkerPool.h"
+
+namespace itk
+{
+/** \class ThinShellDemonsBenchmarkCase
+ * \brief One timed Thin Shell Demons registration on a synthetic pair.
+ *
+ * Shared by the benchmark, which writes the results as JSON, and the
+ * performance test, which reads such a file back as its baseline. The
+ * pair is a generated surface (icosphere, torus, noisy bumps) and a copy
+ * of it displaced by a smooth analytic field.
+ *
+ * MeasureCalibration() times a fixed workload of arithmetic, sorting and
+ * streaming memory access. Timings taken on two hosts are compared after
+ * scaling by the ratio of their calibration times. The calibration runs on
+ * one thread, so the metric runs on an explicit number of threads, recorded
+ * with each case, rather than on the global default of the host.
+ *
+ */
+class ThinShellDemonsBenchmarkCase
+{
+public:
+  typedef Mesh< double, 3 >                                    MeshType;
+  typedef SyntheticMeshGenerator< MeshType >                   GeneratorType;
+  typedef ThinShellDemonsMetric< MeshType, MeshType >          MetricType;
+  typedef MeshDisplacementTransform< double, 3 >               TransformType;
+  typedef ConjugateGradientOptimizer                           OptimizerType;
+  typedef MeshToMeshRegistrationMethod< MeshType, MeshType >   RegistrationType;
+
+  struct ResultType
+    {
+    std::string   Shape;
+    SizeValueType Size;
+    ThreadIdType  NumberOfThreads;
+    SizeValueType NumberOfPoints;
+    SizeValueType NumberOfTriangles;
+    double        Generate;
+    double        LocatorBuild;
+    double        Correspondence;
+    double        Initialize;
+    double        InitializeCorrespondence;
+    double        InitializeNeighborhood;
+    double        GetValue;
+    double        GetDerivative;
+    double        Optimizer;
+    unsigned int  OptimizerEvaluations;
+    double        UpdateMovingMesh;
+    double        FinalValue;
+
+    ResultType() :
+      Size(0), NumberOfThreads(0), NumberOfPoints(0), NumberOfTriangles(0), Generate(0.0), LocatorBuild(0.0), Correspondence(0.0),
+      Initialize(0.0), InitializeCorrespondence(0.0), InitializeNeighborhood(0.0), GetValue(0.0),
+      GetDerivative(0.0), Optimizer(0.0), OptimizerEvaluations(0), UpdateMovingMesh(0.0), FinalValue(0.0) {}
+    };
+
+  /** Timed phases, by JSON key. */
+  typedef double ResultType::*PhaseMemberType;
+  static unsigned int GetNumberOfPhases() { return 10; }
+  static const char * GetPhaseName(unsigned int phase)
+  {
+    static const char *names[] = {
+      "generate", "locator_build", "correspondence", "initialize", "initialize_correspondence",
+      "initialize_neighborhood", "get_value", "get_derivative", "optimizer", "update_moving_mesh"
+    };
+    return names[phase];
+  }
+  static PhaseMemberType GetPhaseMember(unsigned int phase)
+  {
+    static const PhaseMemberType members[] = {
+      &ResultType::Generate, &ResultType::LocatorBuild, &ResultType::Correspondence, &ResultType::Initialize,
+      &ResultType::InitializeCorrespondence, &ResultType::InitializeNeighborhood, &ResultType::GetValue,
+      &ResultType::GetDerivative, &ResultType::Optimizer, &ResultType::UpdateMovingMesh
+    };
+    return members[phase];
+  }
+
+  /** Register a pair of the given shape and requested size, with the
+   *  metric on the given number of threads. GetValue() and GetDerivative()
+   *  are averaged over repetitions; the optimizer stops after the given
+   *  number of function evaluations. */
+  static ResultType Run(const std::string & shape, SizeValueType size, unsigned int repetitions,
+                        unsigned int evaluations, ThreadIdType threads)
+  {
+    ResultType result;
+    result.Shape = shape;
+    result.Size = size;
+    result.NumberOfThreads = threads;
+
+    TimeProbe generateClock;
+    generateClock.Start();
+    GeneratorType::SurfaceType fixedSurface = GeneratorType::Generate(shape, size);
+    GeneratorType::SurfaceType movingSurface = fixedSurface;
+    GeneratorType::Deform(movingSurface, 0.02, 0.5);
+    MeshType::Pointer fixedMesh = GeneratorType::MakeMesh(fixedSurface);
+    MeshType::Pointer movingMesh = GeneratorType::MakeMesh(movingSurface);
+    generateClock.Stop();
+    result.Generate = generateClock.GetTotal();
+    result.NumberOfPoints = movingSurface.GetNumberOfPoints();
+    result.NumberOfTriangles = movingSurface.GetNumberOfTriangles();
+
+    // The closest point search of Initialize(), on its own: build the index
+    // over the fixed points and query every moving point.
+    FlatPointLocator::Pointer locator = FlatPointLocator::New();
+    TimeProbe                 locatorClock;
+    locatorClock.Start();
+    locator->Build( &fixedSurface.Points[0], fixedSurface.GetNumberOfPoints() );
+    locatorClock.Stop();
+    result.LocatorBuild = locatorClock.GetTotal();
+
+    TimeProbe correspondenceClock;
+    correspondenceClock.Start();
+    SizeValueType checksum = 0;
+    for ( SizeValueType i = 0; i < movingSurface.GetNumberOfPoints(); ++i )
+      {
+      checksum += locator->FindClosestPoint( &movingSurface.Points[3 * i] );
+      }
+    correspondenceClock.Stop();
+    result.Correspondence = correspondenceClock.GetTotal();
+    if ( checksum == 0 && movingSurface.GetNumberOfPoints() > 1 )
+      {
+      std::cerr << "Suspicious correspondence result" << std::endl;
+      }
+
+    // a pool of its own, so that the global default neither caps nor sets
+    // the threads
+    WorkerPool::Pointer pool = WorkerPool::New();
+    pool->SetNumberOfThreads(threads);
+
+    MetricType::Pointer metric = MetricType::New();
+    metric->SetStretchWeight(4);
+    metric->SetBendWeight(1);
+    metric->SetNumberOfThreads(threads);
+    metric->SetWorkerPool(pool);
+
+    TransformType::Pointer transform = TransformType::New();
+    transform->SetMeshTemplate(movingMesh);
+    transform->Initialize();
+    transform->SetIdentity();
+
+    OptimizerType::Pointer    optimizer = OptimizerType::New();
+    RegistrationType::Pointer registration = RegistrationType::New();
+    registration->SetMetric(metric);
+    registration->SetOptimizer(optimizer);
+    registration->SetTransform(transform);
+    registration->SetInitialTransformParameters( transform->GetParameters() );
+    registration->SetFixedMesh(fixedMesh);
+    registration->SetMovingMesh(movingMesh);
+
+    RegistrationProfiler::Pointer profiler = RegistrationProfiler::New();
+    registration->SetProfiler(profiler);
+
+    TimeProbe initializeClock;
+    initializeClock.Start();
+    registration->Initialize();
+    initializeClock.Stop();
+    result.Initialize = initializeClock.GetTotal();
+    result.InitializeCorrespondence = profiler->GetTotalTime(RegistrationProfiler::CorrespondencePhase);
+    result.InitializeNeighborhood = profiler->GetTotalTime(RegistrationProfiler::NeighborhoodPhase);
+
+    MetricType::TransformParametersType parameters = transform->GetParameters();
+    for ( unsigned int i = 0; i < parameters.Size(); ++i )
+      {
+      parameters[i] = 1e-3 * ( ( i % 7 ) - 3.0 );
+      }
+
+    TimeProbe valueClock;
+    for ( unsigned int r = 0; r < repetitions; ++r )
+      {
+      valueClock.Start();
+      metric->GetValue(parameters);
+      valueClock.Stop();
+      }
+    result.GetValue = valueClock.GetMean();
+
+    MetricType::DerivativeType derivative;
+    TimeProbe                  derivativeClock;
+    for ( unsigned int r = 0; r < repetitions; ++r )
+      {
+      derivativeClock.Start();
+      metric->GetDerivative(parameters, derivative);
+      derivativeClock.Stop();
+      }
+    result.GetDerivative = derivativeClock.GetMean();
+
+    // A fixed number of function evaluations, so sizes are comparable.
+    optimizer->GetOptimizer()->set_max_function_evals(evaluations);
+    TimeProbe optimizerClock;
+    optimizerClock.Start();
+    optimizer->StartOptimization();
+    optimizerClock.Stop();
+    result.Optimizer = optimizerClock.GetTotal();
+    result.OptimizerEvaluations = optimizer->GetOptimizer()->get_num_evaluations();
+    result.FinalValue = optimizer->GetValue();
+    transform->SetParameters( optimizer->GetCurrentPosition() );
+
+    TimeProbe updateClock;
+    updateClock.Start();
+    registration->UpdateMovingMesh();
+    updateClock.Stop();
+    result.UpdateMovingMesh = updateClock.GetTotal();
+
+    return result;
+  }
+
+  /** Seconds taken by a fixed workload on this host, the best of five. */
+  static double MeasureCalibration()
+  {
+    const SizeValueType   size = 1 << 20;
+    std::vector< double > values(size);
+    double                best = 0.0;
+
+    for ( unsigned int trial = 0; trial < 5; ++trial )
+      {
+      TimeProbe clock;
+      clock.Start();
+      uint64_t state = 12345;
+      for ( SizeValueType i = 0; i < size; ++i )
+        {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        values[i] = static_cast< double >( state >> 11 ) * ( 1.0 / 9007199254740992.0 );
+        }
+      std::sort( values.begin(), values.end() );
+      double sum = 0.0;
+      for ( SizeValueType stride = 1; stride <= 64; stride *= 4 )
+        {
+        for ( SizeValueType i = 0; i < size; i += stride )
+          {
+          sum += values[i] * values[size - 1 - i];
+          }
+        }
+      clock.Stop();
+      if ( sum < 0.0 )
+        {
+        std::cerr << "Calibration failed" << std::endl;
+        }
+      if ( trial == 0 || clock.GetTotal() < best )
+        {
+        best = clock.GetTotal();
+        }
+      }
+    return best;
+  }
+
+  static void WriteJSON(std::ostream & os, const std::vector< ResultType > & results, unsigned int repetitions,
+                        double calibration)
+  {
+    os.precision(9);
+    os << "{\n";
+    os << "  \"benchmark\": \"ThinShellDemons\",\n";
+    os << "  \"version\": 3,\n";
+    os << "  \"units\": \"seconds\",\n";
+    os << "  \"repetitions\": " << repetitions << ",\n";
+    os << "  \"calibration\": " << calibration << ",\n";
+    os << "  \"cases\": [\n";
+    for ( size_t i = 0; i < results.size(); ++i )
+      {
+      const ResultType & r = results[i];
+      os << "    {\n";
+      os << "      \"shape\": \"" << r.Shape << "\",\n";
+      os << "      \"size\": " << r.Size << ",\n";
+      os << "      \"threads\": " << r.NumberOfThreads << ",\n";
+      os << "      \"points\": " << r.NumberOfPoints << ",\n";
+      os << "      \"triangles\": " << r.NumberOfTriangles << ",\n";
+      for ( unsigned int p = 0; p < GetNumberOfPhases(); ++p )
+        {
+        os << "      \"" << GetPhaseName(p) << "\": " << r.*GetPhaseMember(p) << ",\n";
+        }
+      os << "      \"optimizer_evaluations\": " << r.OptimizerEvaluations << ",\n";
+      os << "      \"final_value\": " << r.FinalValue << "\n";
+      os << "    }" << ( i + 1 < results.size() ? "," : "" ) << "\n";
+      }
+    os << "  ]\n";
+    os << "}\n";
+  }
+
+  /** Read a file written by WriteJSON(). Only the layout written there is
+   *  understood: one "key": value pair per line. Cases of files written
+   *  before the thread count was recorded have NumberOfThreads 0. Returns
+   *  false if the file cannot be opened or has no calibration. */
+  static bool ReadJSON(const std::string & fileName, std::vector< ResultType > & results, double & calibration)
+  {
+    std::ifstream input( fileName.c_str() );
+    if ( !input )
+      {
+      return false;
+      }
+
+    results.clear();
+    calibration = 0.0;
+    std::string line;
+    while ( std::getline(input, line) )
+      {
+      const std::string::size_type keyBegin = line.find('"');
+      const std::string::size_type keyEnd = keyBegin == std::string::npos ? keyBegin : line.find('"', keyBegin + 1);
+      const std::string::size_type colon = keyEnd == std::string::npos ? keyEnd : line.find(':', keyEnd);
+      if ( colon == std::string::npos )
+        {
+        continue;
+        }
+      const std::string key = line.substr(keyBegin + 1, keyEnd - keyBegin - 1);
+      std::string       value = line.substr(colon + 1);
+      value.erase( 0, value.find_first_not_of(" \"") );
+      value.erase( value.find_last_not_of(" \",") + 1 );
+
+      if ( key == "calibration" )
+        {
+        calibration = std::atof( value.c_str() );
+        }
+      else if ( key == "shape" )
+        {
+        results.push_back( ResultType() );
+        results.back().Shape = value;
+        }
+      else if ( results.empty() )
+        {
+        continue;
+        }
+      else if ( key == "size" )
+        {
+        results.back().Size = std::atol( value.c_str() );
+        }
+      else if ( key == "threads" )
+        {
+        results.back().NumberOfThreads = std::atoi( value.c_str() );
+        }
+      else if ( key == "points" )
+        {
+        results.back().NumberOfPoints = std::atol( value.c_str() );
+        }
+      else
+        {
+        for ( unsigned int p = 0; p < GetNumberOfPhases(); ++p )
+          {
+          if ( key == GetPhaseName(p) )
+            {
+            results.back().*GetPhaseMember(p) = std::atof( value.c_str() );
+            }
+          }
+        }
+      }
+    return calibration > 0.0;
+  }
+};
+} // end namespace itk
+
+#endif
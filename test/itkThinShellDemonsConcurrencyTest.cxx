@@ -0,0 +1,175 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "itkAtomicInt.h"
+#include "itkMeshDisplacementTransform.h"
+#include "itkMultiThreader.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+#include "itkWorkerPool.h"
+
+// Checks that one ThinShellDemonsMetric can be evaluated by several threads
+// at once: every caller thread evaluates GetValue() and GetDerivative() at
+// a parameter vector of its own, repeatedly, and the results must be
+// bit-identical to those of the same calls made one at a time.
+//
+//   itkThinShellDemonsConcurrencyTest [points] [callers] [poolThreads] [repetitions]
+//
+// The metric runs on a pool of poolThreads workers, so that some calls get
+// the pool and the others run their parallel sections on the caller.
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >                      MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType >             GeneratorType;
+typedef itk::ThinShellDemonsMetric< MeshType, MeshType >    MetricType;
+typedef itk::MeshDisplacementTransform< double, Dimension > TransformType;
+
+struct ConcurrencyStruct
+{
+  const MetricType *                                  Metric;
+  std::vector< MetricType::TransformParametersType > Positions;
+  std::vector< double >                              Values;
+  std::vector< MetricType::DerivativeType >          Derivatives;
+  unsigned int                                       Repetitions;
+  itk::AtomicInt< int >                              Mismatches;
+  itk::AtomicInt< int >                              Failures;
+};
+
+bool
+BitIdentical(const double *a, const double *b, itk::SizeValueType n)
+{
+  return n == 0 || std::memcmp( a, b, n * sizeof( double ) ) == 0;
+}
+
+ITK_THREAD_RETURN_TYPE
+EvaluateThreaderCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = static_cast< itk::MultiThreader::ThreadInfoStruct * >( arg );
+  ConcurrencyStruct *                   str = static_cast< ConcurrencyStruct * >( info->UserData );
+  const itk::ThreadIdType               caller = info->ThreadID;
+
+  try
+    {
+    MetricType::DerivativeType derivative;
+    for ( unsigned int r = 0; r < str->Repetitions; ++r )
+      {
+      const double value = str->Metric->GetValue(str->Positions[caller]);
+      str->Metric->GetDerivative(str->Positions[caller], derivative);
+      if ( !BitIdentical(&value, &str->Values[caller], 1)
+           || !BitIdentical( derivative.data_block(), str->Derivatives[caller].data_block(), derivative.Size() ) )
+        {
+        ++str->Mismatches;
+        }
+      }
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    ++str->Failures;
+    }
+  return ITK_THREAD_RETURN_VALUE;
+}
+} // end anonymous namespace
+
+int itkThinShellDemonsConcurrencyTest( int argc, char * argv[] )
+{
+  const itk::SizeValueType size = argc > 1 ? std::atol(argv[1]) : 10000;
+  const itk::ThreadIdType  callers = argc > 2 ? std::atoi(argv[2]) : 4;
+  const itk::ThreadIdType  poolThreads = argc > 3 ? std::atoi(argv[3]) : 2;
+  const unsigned int       repetitions = argc > 4 ? std::atoi(argv[4]) : 10;
+
+  GeneratorType::SurfaceType fixedSurface = GeneratorType::Generate("icosphere", size);
+  GeneratorType::SurfaceType movingSurface = fixedSurface;
+  GeneratorType::Deform(movingSurface, 0.02, 0.5);
+  MeshType::Pointer fixedMesh = GeneratorType::MakeMesh(fixedSurface);
+  MeshType::Pointer movingMesh = GeneratorType::MakeMesh(movingSurface);
+
+  std::vector< double > u;
+  GeneratorType::Displacement(movingSurface, 0.01, 0.3, u);
+
+  ConcurrencyStruct str;
+  str.Repetitions = repetitions;
+  str.Mismatches = 0;
+  str.Failures = 0;
+
+  try
+    {
+    TransformType::Pointer transform = TransformType::New();
+    transform->SetMeshTemplate(movingMesh);
+    transform->Initialize();
+    transform->SetIdentity();
+
+    itk::WorkerPool::Pointer pool = itk::WorkerPool::New();
+    pool->SetNumberOfThreads(poolThreads);
+
+    MetricType::Pointer metric = MetricType::New();
+    metric->SetStretchWeight(4);
+    metric->SetBendWeight(1);
+    metric->SetNumberOfThreads(poolThreads);
+    metric->SetWorkerPool(pool);
+    metric->SetMinimumVerticesPerThread(1);
+    metric->SetFixedMesh(fixedMesh);
+    metric->SetMovingMesh(movingMesh);
+    metric->SetTransform(transform);
+    metric->Initialize();
+    str.Metric = metric;
+
+    // the displacement scaled differently for every caller, evaluated one
+    // call at a time for reference
+    str.Positions.resize(callers);
+    str.Values.resize(callers);
+    str.Derivatives.resize(callers);
+    for ( itk::ThreadIdType c = 0; c < callers; ++c )
+      {
+      str.Positions[c].SetSize( u.size() );
+      for ( unsigned int i = 0; i < u.size(); ++i )
+        {
+        str.Positions[c][i] = u[i] * ( c + 1 ) / callers;
+        }
+      str.Values[c] = metric->GetValue(str.Positions[c]);
+      metric->GetDerivative(str.Positions[c], str.Derivatives[c]);
+      }
+
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads(callers);
+    threader->SetSingleMethod(EvaluateThreaderCallback, &str);
+    threader->SingleMethodExecute();
+
+    std::cout << callers << " callers on a pool of " << poolThreads << " threads: " << str.Mismatches
+              << " mismatches in " << callers * repetitions << " evaluations, "
+              << metric->GetNumberOfEvaluationWorkspaces() << " workspaces" << std::endl;
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  if ( str.Failures != 0 || str.Mismatches != 0 )
+    {
+    std::cerr << "Concurrent evaluations differ from serial ones" << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "itkMeshDisplacementTransform.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+#include "itkTimeProbe.h"
+#include "itkWorkerPool.h"
+
+// Checks that ThinShellDemonsMetric::GetValue() in the deterministic mode
+// returns bit-identical values and energy terms, and GetDerivative()
+// bit-identical derivatives, for 1 ... maxThreads threads and on repeated
+// calls, and measures the cost of the deterministic mode relative to the
+// fast mode.
+//
+//   itkThinShellDemonsDeterminismTest [points] [maxThreads] [evaluations]
+//
+// Fails if any result differs from the one of a single thread.
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >                      MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType >             GeneratorType;
+typedef itk::ThinShellDemonsMetric< MeshType, MeshType >    MetricType;
+typedef itk::MeshDisplacementTransform< double, Dimension > TransformType;
+
+struct EvaluationResult
+{
+  double                       Value;
+  double                       Terms[MetricType::NumberOfEnergyTerms];
+  MetricType::DerivativeType   Derivative;
+  bool                         Repeatable; // every timed GetValue() returned Value
+  double                       ValueTime;  // seconds per GetValue()
+};
+
+bool
+BitIdentical(const double *a, const double *b, itk::SizeValueType n)
+{
+  return n == 0 || std::memcmp( a, b, n * sizeof( double ) ) == 0;
+}
+
+EvaluationResult
+Evaluate(MeshType *fixedMesh, MeshType *movingMesh, const MetricType::TransformParametersType & position,
+         itk::ThreadIdType threads, bool deterministic, unsigned int evaluations)
+{
+  TransformType::Pointer transform = TransformType::New();
+  transform->SetMeshTemplate(movingMesh);
+  transform->Initialize();
+  transform->SetIdentity();
+
+  itk::WorkerPool::Pointer pool = itk::WorkerPool::New();
+  pool->SetNumberOfThreads(threads);
+
+  MetricType::Pointer metric = MetricType::New();
+  metric->SetStretchWeight(4);
+  metric->SetBendWeight(1);
+  metric->SetNumberOfThreads(threads);
+  metric->SetWorkerPool(pool);
+  // split even small meshes, so that every thread count gives other parts
+  metric->SetMinimumVerticesPerThread(1);
+  metric->SetDeterministic(deterministic);
+  metric->SetFixedMesh(fixedMesh);
+  metric->SetMovingMesh(movingMesh);
+  metric->SetTransform(transform);
+  metric->Initialize();
+
+  EvaluationResult result;
+  result.Value = metric->GetValue(position);
+  for ( unsigned int k = 0; k < MetricType::NumberOfEnergyTerms; ++k )
+    {
+    result.Terms[k] = metric->GetEnergyTerm(k);
+    }
+  metric->GetDerivative(position, result.Derivative);
+
+  result.Repeatable = true;
+  itk::TimeProbe probe;
+  probe.Start();
+  for ( unsigned int e = 0; e < evaluations; ++e )
+    {
+    const double value = metric->GetValue(position);
+    result.Repeatable = result.Repeatable && BitIdentical(&value, &result.Value, 1);
+    }
+  probe.Stop();
+  result.ValueTime = evaluations > 0 ? probe.GetTotal() / evaluations : 0.0;
+  return result;
+}
+} // end anonymous namespace
+
+int itkThinShellDemonsDeterminismTest( int argc, char * argv[] )
+{
+  const itk::SizeValueType size = argc > 1 ? std::atol(argv[1]) : 50000;
+  const itk::ThreadIdType  maxThreads = argc > 2 ? std::atoi(argv[2]) :
+                                        itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  const unsigned int       evaluations = argc > 3 ? std::atoi(argv[3]) : 20;
+
+  GeneratorType::SurfaceType fixedSurface = GeneratorType::Generate("icosphere", size);
+  GeneratorType::SurfaceType movingSurface = fixedSurface;
+  GeneratorType::Deform(movingSurface, 0.02, 0.5);
+  MeshType::Pointer fixedMesh = GeneratorType::MakeMesh(fixedSurface);
+  MeshType::Pointer movingMesh = GeneratorType::MakeMesh(movingSurface);
+
+  // a smooth displacement, so that every term is non zero
+  std::vector< double > u;
+  GeneratorType::Displacement(movingSurface, 0.01, 0.3, u);
+  MetricType::TransformParametersType position( u.size() );
+  for ( unsigned int i = 0; i < position.Size(); ++i )
+    {
+    position[i] = u[i];
+    }
+
+  std::cout << movingSurface.GetNumberOfPoints() << " points" << std::endl;
+  std::cout.precision(17);
+
+  int status = EXIT_SUCCESS;
+  try
+    {
+    EvaluationResult reference;
+    for ( itk::ThreadIdType threads = 1; threads <= std::max< itk::ThreadIdType >( maxThreads, 1 ); ++threads )
+      {
+      const EvaluationResult fast = Evaluate(fixedMesh, movingMesh, position, threads, false, evaluations);
+      const EvaluationResult exact = Evaluate(fixedMesh, movingMesh, position, threads, true, evaluations);
+      if ( threads == 1 )
+        {
+        reference = exact;
+        }
+
+      const bool sameValue = exact.Repeatable && BitIdentical(&exact.Value, &reference.Value, 1)
+                             && BitIdentical(exact.Terms, reference.Terms, MetricType::NumberOfEnergyTerms);
+      const bool sameDerivative = exact.Derivative.Size() == reference.Derivative.Size()
+                                  && BitIdentical( exact.Derivative.data_block(), reference.Derivative.data_block(),
+                                                   exact.Derivative.Size() );
+
+      std::cout << threads << " threads: deterministic " << exact.Value
+                << ( sameValue ? "" : " (differs)" ) << ( sameDerivative ? "" : ", derivative differs" )
+                << ", fast " << fast.Value << " (" << fast.Value - exact.Value << ")"
+                << "; GetValue() " << fast.ValueTime * 1e3 << " ms fast, " << exact.ValueTime * 1e3
+                << " ms deterministic, ratio " << ( fast.ValueTime > 0.0 ? exact.ValueTime / fast.ValueTime : 0.0 )
+                << std::endl;
+
+      if ( !sameValue || !sameDerivative )
+        {
+        std::cerr << "The deterministic result at " << threads << " threads differs from a single thread"
+                  << std::endl;
+        status = EXIT_FAILURE;
+        }
+      }
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+  return status;
+}
@@ -0,0 +1,150 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cstdlib>
+#include <iostream>
+
+#include "itkFiniteDifferenceGradientChecker.h"
+#include "itkMeshDisplacementTransform.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+
+// Checks ThinShellDemonsMetric::GetDerivative() against central differences
+// of GetValue() on a deformed icosphere pair, at a non zero displacement so
+// that every term of the energy depends on the parameters.
+//
+//   itkThinShellDemonsGradientTest [points] [samples] [tolerance] [threads]
+//
+// samples = 0 checks every parameter. Fails if the largest relative error
+// exceeds the tolerance, or if a parameter vector of the wrong size is not
+// rejected.
+
+int itkThinShellDemonsGradientTest( int argc, char * argv[] )
+{
+  const unsigned int Dimension = 3;
+  typedef itk::Mesh< double, Dimension >                      MeshType;
+  typedef itk::SyntheticMeshGenerator< MeshType >             GeneratorType;
+  typedef itk::ThinShellDemonsMetric< MeshType, MeshType >    MetricType;
+  typedef itk::MeshDisplacementTransform< double, Dimension > TransformType;
+  typedef itk::FiniteDifferenceGradientChecker                CheckerType;
+
+  const itk::SizeValueType size = argc > 1 ? std::atoi(argv[1]) : 2000;
+  const itk::SizeValueType samples = argc > 2 ? std::atoi(argv[2]) : 0;
+  const double             tolerance = argc > 3 ? std::atof(argv[3]) : 1e-4;
+  const itk::ThreadIdType  threads = argc > 4 ? std::atoi(argv[4]) :
+                                     itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+
+  GeneratorType::SurfaceType fixedSurface = GeneratorType::Generate("icosphere", size);
+  GeneratorType::SurfaceType movingSurface = fixedSurface;
+  GeneratorType::Deform(movingSurface, 0.02, 0.5);
+  MeshType::Pointer fixedMesh = GeneratorType::MakeMesh(fixedSurface);
+  MeshType::Pointer movingMesh = GeneratorType::MakeMesh(movingSurface);
+
+  TransformType::Pointer transform = TransformType::New();
+  transform->SetMeshTemplate(movingMesh);
+  transform->Initialize();
+  transform->SetIdentity();
+
+  MetricType::Pointer metric = MetricType::New();
+  metric->SetStretchWeight(4);
+  metric->SetBendWeight(1);
+  // the checker runs the evaluations in parallel instead
+  metric->SetNumberOfThreads(1);
+  metric->SetFixedMesh(fixedMesh);
+  metric->SetMovingMesh(movingMesh);
+  metric->SetTransform(transform);
+
+  // a smooth displacement, as the optimizer would produce
+  std::vector< double > u;
+  GeneratorType::Displacement(movingSurface, 0.01, 0.3, u);
+  MetricType::TransformParametersType position = transform->GetParameters();
+  for ( unsigned int i = 0; i < position.Size(); ++i )
+    {
+    position[i] = u[i];
+    }
+
+  CheckerType::Pointer checker = CheckerType::New();
+  checker->SetCostFunction(metric);
+  checker->SetNumberOfSamples(samples);
+  checker->SetNumberOfThreads(threads);
+  // the components are of the order of 1e-2; smaller ones are compared on
+  // their absolute error, which rounding in GetValue() dominates
+  checker->SetErrorFloor(1e-3);
+  try
+    {
+    metric->Initialize();
+    checker->Check(position);
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // one value short and one too many: every evaluation must throw instead
+  // of reading past the end
+  for ( int extra = -1; extra <= 1; extra += 2 )
+    {
+    MetricType::TransformParametersType wrong( position.Size() + extra );
+    wrong.Fill(0.0);
+    MetricType::DerivativeType derivative;
+    MetricType::MeasureType    value;
+    unsigned int               rejected = 0;
+    try
+      {
+      metric->GetValue(wrong);
+      }
+    catch ( itk::ExceptionObject & )
+      {
+      ++rejected;
+      }
+    try
+      {
+      metric->GetDerivative(wrong, derivative);
+      }
+    catch ( itk::ExceptionObject & )
+      {
+      ++rejected;
+      }
+    try
+      {
+      metric->GetValueAndDerivative(wrong, value, derivative);
+      }
+    catch ( itk::ExceptionObject & )
+      {
+      ++rejected;
+      }
+    if ( rejected != 3 )
+      {
+      std::cerr << "Only " << rejected << " of 3 evaluations rejected " << wrong.Size()
+                << " parameters, expected " << position.Size() << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  std::cout << movingSurface.GetNumberOfPoints() << " points, " << threads << " threads" << std::endl;
+  checker->Report(std::cout);
+
+  if ( checker->GetMaximumRelativeError() > tolerance )
+    {
+    std::cerr << "Relative error " << checker->GetMaximumRelativeError() << " at parameter "
+              << checker->GetWorstParameter() << " exceeds " << tolerance << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,621 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "itkArray.h"
+#include "itkFlatPointLocator.h"
+#include "itkMapContainer.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsKernels.h"
+#include "itkTimeProbe.h"
+#include "itkTriangleVertexNeighborhood.h"
+
+// Microbenchmarks of the hot kernels of ThinShellDemonsMetric, each against
+// a naive reference written the way the metric originally evaluated it: on
+// the itk::Mesh containers, with neighbors found through the cell links
+// and the closest point by a linear scan. The batched energy is measured
+// against the single kernels instead.
+//
+//   itkThinShellDemonsKernelBenchmark [numberOfPoints] [minimumTime] [output.json]
+//
+// Each kernel and its reference run repeatedly until minimumTime seconds
+// have passed; the time per run, the throughput and the speedup over the
+// reference are printed. The test fails if a kernel's result differs from
+// its reference by more than a relative 1e-10.
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >          MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType > GeneratorType;
+typedef MeshType::PointType                     PointType;
+typedef MeshType::PointsContainer               PointsContainer;
+typedef MeshType::CellType                      CellType;
+typedef itk::Array< double >                    ParametersType;
+typedef itk::MapContainer< int, PointType >     TargetMapType;
+
+const double Tolerance = 1e-10;
+
+/** Inputs shared by all kernels: a deformed icosphere against the original,
+ *  in the packed layout of the kernels and as meshes for the references. */
+struct Fixture
+{
+  GeneratorType::SurfaceType     Fixed;
+  GeneratorType::SurfaceType     Moving;
+  MeshType::Pointer              FixedMesh;
+  MeshType::Pointer              MovingMesh;
+  itk::FlatPointLocator::Pointer Locator;
+  itk::SizeValueType             NumberOfPoints;
+
+  std::vector< itk::SizeValueType > Offsets;
+  std::vector< uint32_t >           Neighbors;
+  std::vector< itk::SizeValueType > ReverseOffsets;
+  std::vector< uint32_t >           ReverseNeighbors;
+
+  std::vector< double >  Targets;
+  TargetMapType::Pointer TargetMap;
+  std::vector< double >  U;
+  ParametersType         Parameters;
+
+  explicit Fixture(itk::SizeValueType size)
+  {
+    Fixed = GeneratorType::Generate("icosphere", size);
+    Moving = Fixed;
+    GeneratorType::Deform(Moving, 0.02, 0.5);
+    FixedMesh = GeneratorType::MakeMesh(Fixed);
+    MovingMesh = GeneratorType::MakeMesh(Moving);
+    MovingMesh->BuildCellLinks();
+    NumberOfPoints = Moving.GetNumberOfPoints();
+
+    Locator = itk::FlatPointLocator::New();
+    Locator->Build( &Fixed.Points[0], Fixed.GetNumberOfPoints() );
+
+    Offsets.resize(NumberOfPoints + 1);
+    Neighbors.resize( itk::TriangleVertexNeighborhood::GetNumberOfNeighbors( Moving.GetNumberOfTriangles() ) );
+    itk::TriangleVertexNeighborhood::Build( &Moving.Triangles[0], Moving.GetNumberOfTriangles(), NumberOfPoints,
+                                            &Offsets[0], &Neighbors[0] );
+    ReverseOffsets.resize(NumberOfPoints + 1);
+    ReverseNeighbors.resize( Neighbors.size() );
+    itk::TriangleVertexNeighborhood::Transpose( &Offsets[0], &Neighbors[0], NumberOfPoints,
+                                                &ReverseOffsets[0], &ReverseNeighbors[0] );
+
+    Targets.resize(3 * NumberOfPoints);
+    TargetMap = TargetMapType::New();
+    for ( itk::SizeValueType i = 0; i < NumberOfPoints; ++i )
+      {
+      const double *target = &Fixed.Points[3 * Locator->FindClosestPoint( &Moving.Points[3 * i] )];
+      PointType     p;
+      for ( unsigned int d = 0; d < 3; ++d )
+        {
+        Targets[3 * i + d] = target[d];
+        p[d] = target[d];
+        }
+      TargetMap->InsertElement(static_cast< int >( i ), p);
+      }
+
+    GeneratorType::Displacement(Moving, 0.01, 0.3, U);
+    Parameters.SetSize( U.size() );
+    for ( itk::SizeValueType i = 0; i < U.size(); ++i )
+      {
+      Parameters[i] = U[i];
+      }
+  }
+
+  // the neighbor of a vertex in a triangle, as the original metric chose it
+  itk::SizeValueType ReferenceNeighbor(itk::SizeValueType identifier, MeshType::CellIdentifier cellId) const
+  {
+    MeshType::CellAutoPointer cell;
+    MovingMesh->GetCell(cellId, cell);
+    CellType::PointIdConstIterator pointIds = cell->PointIdsBegin();
+    return pointIds[0] != identifier ? pointIds[0] : pointIds[1];
+  }
+};
+
+/** A kernel and its reference. Run() executes one of them; GetError()
+ *  compares the outputs of the last runs of both. */
+class KernelCase
+{
+public:
+  virtual ~KernelCase() {}
+  virtual const char * GetName() const = 0;
+  virtual itk::SizeValueType GetNumberOfItems() const = 0;
+  virtual void Run(bool reference) = 0;
+  virtual double GetError() const = 0;
+};
+
+double
+RelativeError(const std::vector< double > & result, const std::vector< double > & reference)
+{
+  double maximum = 0.0;
+  double difference = 0.0;
+  for ( size_t i = 0; i < reference.size(); ++i )
+    {
+    maximum = std::max( maximum, std::fabs(reference[i]) );
+    difference = std::max( difference, std::fabs(result[i] - reference[i]) );
+    }
+  return maximum > 0.0 ? difference / maximum : difference;
+}
+
+double
+RelativeError(double result, double reference)
+{
+  return reference != 0.0 ? std::fabs(result - reference) / std::fabs(reference) : std::fabs(result);
+}
+
+class ClosestPointCase:public KernelCase
+{
+public:
+  // the reference is a linear scan, so only a subset of the points is queried
+  explicit ClosestPointCase(const Fixture & f) :
+    m_Fixture(f), m_NumberOfQueries( std::min< itk::SizeValueType >( f.NumberOfPoints, 1000 ) ),
+    m_Result(m_NumberOfQueries), m_Reference(m_NumberOfQueries) {}
+  const char * GetName() const { return "closest_point"; }
+  itk::SizeValueType GetNumberOfItems() const { return m_NumberOfQueries; }
+  void Run(bool reference)
+  {
+    const itk::SizeValueType stride = m_Fixture.NumberOfPoints / m_NumberOfQueries;
+    for ( itk::SizeValueType q = 0; q < m_NumberOfQueries; ++q )
+      {
+      const double *query = &m_Fixture.Moving.Points[3 * q * stride];
+      if ( !reference )
+        {
+        m_Fixture.Locator->FindClosestPoint( query, &m_Result[q] );
+        continue;
+        }
+      PointType p;
+      p[0] = query[0];
+      p[1] = query[1];
+      p[2] = query[2];
+      double minimumDistance = itk::NumericTraits< double >::max();
+      for ( PointsContainer::ConstIterator it = m_Fixture.FixedMesh->GetPoints()->Begin();
+            it != m_Fixture.FixedMesh->GetPoints()->End(); ++it )
+        {
+        minimumDistance = std::min( minimumDistance, it.Value().SquaredEuclideanDistanceTo(p) );
+        }
+      m_Reference[q] = minimumDistance;
+      }
+  }
+  double GetError() const { return RelativeError(m_Result, m_Reference); }
+
+private:
+  const Fixture &       m_Fixture;
+  itk::SizeValueType    m_NumberOfQueries;
+  std::vector< double > m_Result;
+  std::vector< double > m_Reference;
+};
+
+class DataTermCase:public KernelCase
+{
+public:
+  explicit DataTermCase(const Fixture & f) : m_Fixture(f), m_Result(0.0), m_Reference(0.0) {}
+  const char * GetName() const { return "data_term"; }
+  itk::SizeValueType GetNumberOfItems() const { return m_Fixture.NumberOfPoints; }
+  void Run(bool reference)
+  {
+    if ( !reference )
+      {
+      m_Result = itk::ThinShellDemonsKernels::DataEnergy( &m_Fixture.Targets[0], &m_Fixture.Moving.Points[0],
+                                                          &m_Fixture.U[0], 0, m_Fixture.NumberOfPoints );
+      return;
+      }
+    double value = 0.0;
+    int    identifier = 0;
+    for ( PointsContainer::ConstIterator it = m_Fixture.MovingMesh->GetPoints()->Begin();
+          it != m_Fixture.MovingMesh->GetPoints()->End(); ++it, ++identifier )
+      {
+      MeshType::VectorType vec;
+      vec[0] = m_Fixture.Parameters[identifier * 3];
+      vec[1] = m_Fixture.Parameters[identifier * 3 + 1];
+      vec[2] = m_Fixture.Parameters[identifier * 3 + 2];
+      const PointType transformedPoint = it.Value() + vec;
+      value += m_Fixture.TargetMap->ElementAt(identifier).SquaredEuclideanDistanceTo(transformedPoint);
+      }
+    m_Reference = value;
+  }
+  double GetError() const { return RelativeError(m_Result, m_Reference); }
+
+private:
+  const Fixture & m_Fixture;
+  double          m_Result;
+  double          m_Reference;
+};
+
+/** Stretch, bend and the laplacian product share the reference walk over
+ *  the cell links of each vertex. */
+class RegularizerCase:public KernelCase
+{
+public:
+  typedef enum { Stretch, Bend, LaplacianProduct } TermType;
+
+  RegularizerCase(const Fixture & f, TermType term) :
+    m_Fixture(f), m_Term(term), m_Result(0.0), m_Reference(0.0),
+    m_Laplacians(3 * f.NumberOfPoints), m_ReferenceLaplacians(3 * f.NumberOfPoints) {}
+  const char * GetName() const
+  {
+    return m_Term == Stretch ? "stretch_term" : m_Term == Bend ? "bend_term" : "spmv";
+  }
+  itk::SizeValueType GetNumberOfItems() const { return m_Fixture.NumberOfPoints; }
+  void Run(bool reference)
+  {
+    const Fixture & f = m_Fixture;
+    if ( !reference )
+      {
+      switch ( m_Term )
+        {
+        case Stretch:
+          m_Result = itk::ThinShellDemonsKernels::StretchEnergy( &f.Offsets[0], &f.Neighbors[0], &f.U[0], 0,
+                                                                 f.NumberOfPoints );
+          break;
+        case Bend:
+          m_Result = itk::ThinShellDemonsKernels::BendEnergy( &f.Offsets[0], &f.Neighbors[0], &f.U[0], 0,
+                                                              f.NumberOfPoints );
+          break;
+        case LaplacianProduct:
+          itk::ThinShellDemonsKernels::LaplacianProduct( &f.Offsets[0], &f.Neighbors[0], &f.U[0], 0,
+                                                         f.NumberOfPoints, &m_Laplacians[0] );
+          break;
+        }
+      return;
+      }
+
+    double value = 0.0;
+    for ( itk::SizeValueType identifier = 0; identifier < f.NumberOfPoints; ++identifier )
+      {
+      const MeshType::PointCellLinksContainer & cells = f.MovingMesh->GetCellLinks()->ElementAt(identifier);
+      double lx = 0;
+      double ly = 0;
+      double lz = 0;
+      for ( MeshType::PointCellLinksContainer::const_iterator c = cells.begin(); c != cells.end(); ++c )
+        {
+        const itk::SizeValueType neighborIdx = f.ReferenceNeighbor(identifier, *c);
+        const double dx = f.Parameters[identifier * 3] - f.Parameters[neighborIdx * 3];
+        const double dy = f.Parameters[identifier * 3 + 1] - f.Parameters[neighborIdx * 3 + 1];
+        const double dz = f.Parameters[identifier * 3 + 2] - f.Parameters[neighborIdx * 3 + 2];
+        if ( m_Term == Stretch )
+          {
+          value += dx * dx + dy * dy + dz * dz;
+          }
+        lx += dx;
+        ly += dy;
+        lz += dz;
+        }
+      if ( m_Term == Bend )
+        {
+        value += lx * lx + ly * ly + lz * lz;
+        }
+      m_ReferenceLaplacians[identifier * 3] = lx;
+      m_ReferenceLaplacians[identifier * 3 + 1] = ly;
+      m_ReferenceLaplacians[identifier * 3 + 2] = lz;
+      }
+    m_Reference = value;
+  }
+  double GetError() const
+  {
+    return m_Term == LaplacianProduct ? RelativeError(m_Laplacians, m_ReferenceLaplacians)
+                                      : RelativeError(m_Result, m_Reference);
+  }
+
+private:
+  const Fixture &       m_Fixture;
+  TermType              m_Term;
+  double                m_Result;
+  double                m_Reference;
+  std::vector< double > m_Laplacians;
+  std::vector< double > m_ReferenceLaplacians;
+};
+
+/** Derivative of the stretch and bend energies (plus the data term):
+ *  gathered per vertex against the original scatter to the neighbors. */
+class DerivativeCase:public KernelCase
+{
+public:
+  explicit DerivativeCase(const Fixture & f) :
+    m_Fixture(f), m_Laplacians(3 * f.NumberOfPoints), m_Result(3 * f.NumberOfPoints),
+    m_Reference(3 * f.NumberOfPoints) {}
+  const char * GetName() const { return "derivative"; }
+  itk::SizeValueType GetNumberOfItems() const { return m_Fixture.NumberOfPoints; }
+  void Run(bool reference)
+  {
+    const Fixture & f = m_Fixture;
+    const double    stretchWeight = 4.0;
+    const double    bendWeight = 1.0;
+    if ( !reference )
+      {
+      itk::ThinShellDemonsKernels::LaplacianProduct( &f.Offsets[0], &f.Neighbors[0], &f.U[0], 0,
+                                                     f.NumberOfPoints, &m_Laplacians[0] );
+      itk::ThinShellDemonsKernels::GatherDerivative( &f.Targets[0], &f.Moving.Points[0], &f.U[0], &f.Offsets[0],
+                                                     &f.ReverseOffsets[0], &f.ReverseNeighbors[0], &m_Laplacians[0],
+                                                     stretchWeight, bendWeight, 0, f.NumberOfPoints, &m_Result[0] );
+      return;
+      }
+
+    for ( itk::SizeValueType identifier = 0; identifier < f.NumberOfPoints; ++identifier )
+      {
+      const PointType & target = f.TargetMap->ElementAt(identifier);
+      const PointType & point = f.MovingMesh->GetPoints()->ElementAt(identifier);
+      for ( unsigned int d = 0; d < 3; ++d )
+        {
+        m_Reference[identifier * 3 + d] = -2 * ( target[d] - point[d] - f.Parameters[identifier * 3 + d] );
+        }
+      }
+    for ( itk::SizeValueType identifier = 0; identifier < f.NumberOfPoints; ++identifier )
+      {
+      const MeshType::PointCellLinksContainer & cells = f.MovingMesh->GetCellLinks()->ElementAt(identifier);
+      double l[3] = { 0, 0, 0 };
+      for ( MeshType::PointCellLinksContainer::const_iterator c = cells.begin(); c != cells.end(); ++c )
+        {
+        const itk::SizeValueType neighborIdx = f.ReferenceNeighbor(identifier, *c);
+        for ( unsigned int d = 0; d < 3; ++d )
+          {
+          const double delta = f.Parameters[identifier * 3 + d] - f.Parameters[neighborIdx * 3 + d];
+          m_Reference[identifier * 3 + d] += 2 * delta * stretchWeight;
+          m_Reference[neighborIdx * 3 + d] -= 2 * delta * stretchWeight;
+          l[d] += delta;
+          }
+        }
+      for ( MeshType::PointCellLinksContainer::const_iterator c = cells.begin(); c != cells.end(); ++c )
+        {
+        const itk::SizeValueType neighborIdx = f.ReferenceNeighbor(identifier, *c);
+        for ( unsigned int d = 0; d < 3; ++d )
+          {
+          m_Reference[identifier * 3 + d] += 2 * l[d] * bendWeight;
+          m_Reference[neighborIdx * 3 + d] -= 2 * l[d] * bendWeight;
+          }
+        }
+      }
+  }
+  double GetError() const { return RelativeError(m_Result, m_Reference); }
+
+private:
+  const Fixture &       m_Fixture;
+  std::vector< double > m_Laplacians;
+  std::vector< double > m_Result;
+  std::vector< double > m_Reference;
+};
+
+/** The energy of MaximumBatchSize displacements in one pass, against the
+ *  single kernels called once per displacement: the speedup is the gain of
+ *  ThinShellDemonsMetric::GetValues() over as many GetValue() calls. */
+class BatchEnergyCase:public KernelCase
+{
+public:
+  enum { BatchSize = itk::ThinShellDemonsKernels::MaximumBatchSize };
+
+  explicit BatchEnergyCase(const Fixture & f) :
+    m_Fixture(f), m_Result(3 * BatchSize), m_Reference(3 * BatchSize)
+  {
+    // the displacement at as many scales, as in a line search
+    for ( unsigned int k = 0; k < BatchSize; ++k )
+      {
+      m_U[k].resize( f.U.size() );
+      for ( size_t i = 0; i < f.U.size(); ++i )
+        {
+        m_U[k][i] = f.U[i] * ( k + 1 ) / BatchSize;
+        }
+      m_Pointers[k] = &m_U[k][0];
+      }
+  }
+  const char * GetName() const { return "batch_energy"; }
+  itk::SizeValueType GetNumberOfItems() const { return BatchSize * m_Fixture.NumberOfPoints; }
+  void Run(bool reference)
+  {
+    const Fixture & f = m_Fixture;
+    if ( !reference )
+      {
+      itk::ThinShellDemonsKernels::BatchEnergy( &f.Targets[0], &f.Moving.Points[0], &f.Offsets[0], &f.Neighbors[0],
+                                                m_Pointers, BatchSize, 0, f.NumberOfPoints, &m_Result[0],
+                                                &m_Result[BatchSize], &m_Result[2 * BatchSize] );
+      return;
+      }
+    for ( unsigned int k = 0; k < BatchSize; ++k )
+      {
+      m_Reference[k] = itk::ThinShellDemonsKernels::DataEnergy( &f.Targets[0], &f.Moving.Points[0], m_Pointers[k],
+                                                                0, f.NumberOfPoints );
+      itk::ThinShellDemonsKernels::RegularizerEnergy( &f.Offsets[0], &f.Neighbors[0], m_Pointers[k], 0,
+                                                      f.NumberOfPoints, m_Reference[BatchSize + k],
+                                                      m_Reference[2 * BatchSize + k] );
+      }
+  }
+  double GetError() const { return RelativeError(m_Result, m_Reference); }
+
+private:
+  const Fixture &       m_Fixture;
+  std::vector< double > m_U[BatchSize];
+  const double *        m_Pointers[BatchSize];
+  std::vector< double > m_Result;
+  std::vector< double > m_Reference;
+};
+
+class TransformCase:public KernelCase
+{
+public:
+  explicit TransformCase(const Fixture & f) :
+    m_Fixture(f), m_Result(3 * f.NumberOfPoints), m_Reference(3 * f.NumberOfPoints)
+  {
+    m_Output = PointsContainer::New();
+    m_Output->Reserve(f.NumberOfPoints);
+  }
+  const char * GetName() const { return "transform"; }
+  itk::SizeValueType GetNumberOfItems() const { return m_Fixture.NumberOfPoints; }
+  void Run(bool reference)
+  {
+    if ( !reference )
+      {
+      itk::ThinShellDemonsKernels::Displace( &m_Fixture.Moving.Points[0], &m_Fixture.U[0], 0,
+                                             m_Fixture.NumberOfPoints, &m_Result[0] );
+      return;
+      }
+
+    // as UpdateMovingMesh() did: a copy of the parameters, then the containers
+    const ParametersType            vectorField = m_Fixture.Parameters;
+    PointsContainer::ConstIterator  inputPoint = m_Fixture.MovingMesh->GetPoints()->Begin();
+    PointsContainer::Iterator       outputPoint = m_Output->Begin();
+    int                             idx = 0;
+    for ( ; inputPoint != m_Fixture.MovingMesh->GetPoints()->End(); ++inputPoint, ++outputPoint, ++idx )
+      {
+      PointType displacedPoint;
+      for ( unsigned int i = 0; i < 3; i++ )
+        {
+        displacedPoint[i] = inputPoint.Value()[i] + vectorField[idx * 3 + i];
+        }
+      outputPoint.Value() = displacedPoint;
+      }
+    idx = 0;
+    for ( PointsContainer::ConstIterator it = m_Output->Begin(); it != m_Output->End(); ++it, ++idx )
+      {
+      for ( unsigned int i = 0; i < 3; i++ )
+        {
+        m_Reference[idx * 3 + i] = it.Value()[i];
+        }
+      }
+  }
+  double GetError() const { return RelativeError(m_Result, m_Reference); }
+
+private:
+  const Fixture &          m_Fixture;
+  PointsContainer::Pointer m_Output;
+  std::vector< double >    m_Result;
+  std::vector< double >    m_Reference;
+};
+
+/** Seconds per run: runs in batches of doubling size until the total time
+ *  reaches minimumTime. */
+double
+TimeKernel(KernelCase & kernel, bool reference, double minimumTime, itk::SizeValueType & iterations)
+{
+  kernel.Run(reference);  // warm up
+  iterations = 0;
+  double             total = 0.0;
+  itk::SizeValueType batch = 1;
+  while ( total < minimumTime )
+    {
+    itk::TimeProbe clock;
+    clock.Start();
+    for ( itk::SizeValueType i = 0; i < batch; ++i )
+      {
+      kernel.Run(reference);
+      }
+    clock.Stop();
+    total += clock.GetTotal();
+    iterations += batch;
+    batch *= 2;
+    }
+  return total / iterations;
+}
+
+struct KernelResult
+{
+  std::string        Name;
+  itk::SizeValueType Items;
+  double             KernelTime;
+  double             ReferenceTime;
+  itk::SizeValueType KernelIterations;
+  itk::SizeValueType ReferenceIterations;
+  double             Error;
+};
+} // end anonymous namespace
+
+int itkThinShellDemonsKernelBenchmark( int argc, char * argv[] )
+{
+  const itk::SizeValueType size = argc > 1 ? std::atol(argv[1]) : 100000;
+  const double             minimumTime = argc > 2 ? std::atof(argv[2]) : 0.5;
+
+  std::vector< KernelResult > results;
+  try
+    {
+    Fixture fixture(size);
+    std::cout << "Moving mesh: " << fixture.NumberOfPoints << " points, "
+              << fixture.Moving.GetNumberOfTriangles() << " triangles" << std::endl;
+
+    ClosestPointCase closestPoint(fixture);
+    DataTermCase     dataTerm(fixture);
+    RegularizerCase  stretchTerm(fixture, RegularizerCase::Stretch);
+    RegularizerCase  bendTerm(fixture, RegularizerCase::Bend);
+    RegularizerCase  spmv(fixture, RegularizerCase::LaplacianProduct);
+    DerivativeCase   derivative(fixture);
+    BatchEnergyCase  batchEnergy(fixture);
+    TransformCase    transform(fixture);
+    KernelCase *     kernels[] = { &closestPoint, &dataTerm, &stretchTerm, &bendTerm, &spmv, &derivative,
+                                   &batchEnergy, &transform };
+
+    for ( unsigned int k = 0; k < sizeof( kernels ) / sizeof( kernels[0] ); ++k )
+      {
+      KernelResult r;
+      r.Name = kernels[k]->GetName();
+      r.Items = kernels[k]->GetNumberOfItems();
+      r.ReferenceTime = TimeKernel(*kernels[k], true, minimumTime, r.ReferenceIterations);
+      r.KernelTime = TimeKernel(*kernels[k], false, minimumTime, r.KernelIterations);
+      r.Error = kernels[k]->GetError();
+      results.push_back(r);
+      }
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  int status = EXIT_SUCCESS;
+  std::printf("%-24s %14s %12s %16s %9s %10s\n", "Benchmark", "Time", "Iterations", "Items/s", "Speedup", "RelError");
+  for ( size_t i = 0; i < results.size(); ++i )
+    {
+    const KernelResult & r = results[i];
+    std::printf("%-24s %11.3f us %12lu %16.4g %9s %10s\n", ( r.Name + "/reference" ).c_str(),
+                1e6 * r.ReferenceTime, static_cast< unsigned long >( r.ReferenceIterations ),
+                r.Items / r.ReferenceTime, "", "");
+    std::printf("%-24s %11.3f us %12lu %16.4g %8.2fx %10.2e%s\n", ( r.Name + "/kernel" ).c_str(),
+                1e6 * r.KernelTime, static_cast< unsigned long >( r.KernelIterations ),
+                r.Items / r.KernelTime, r.ReferenceTime / r.KernelTime, r.Error,
+                r.Error > Tolerance ? "  MISMATCH" : "");
+    if ( !( r.Error <= Tolerance ) )
+      {
+      status = EXIT_FAILURE;
+      }
+    }
+
+  if ( argc > 3 )
+    {
+    std::ofstream output( argv[3] );
+    if ( !output )
+      {
+      std::cerr << "Unable to open " << argv[3] << std::endl;
+      return EXIT_FAILURE;
+      }
+    output.precision(9);
+    output << "{\n  \"benchmark\": \"ThinShellDemonsKernels\",\n  \"version\": 1,\n  \"units\": \"seconds\",\n";
+    output << "  \"kernels\": [\n";
+    for ( size_t i = 0; i < results.size(); ++i )
+      {
+      const KernelResult & r = results[i];
+      output << "    { \"name\": \"" << r.Name << "\", \"items\": " << r.Items
+             << ", \"kernel\": " << r.KernelTime << ", \"reference\": " << r.ReferenceTime
+             << ", \"speedup\": " << r.ReferenceTime / r.KernelTime << ", \"relative_error\": " << r.Error << " }"
+             << ( i + 1 < results.size() ? "," : "" ) << "\n";
+      }
+    output << "  ]\n}\n";
+    }
+
+  return status;
+}
@@ -0,0 +1,199 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "itkThinShellDemonsBenchmarkCase.h"
+
+// Fails when a phase of the benchmark cases runs slower than its baseline.
+//
+//   itkThinShellDemonsPerformanceTest baseline.json output.json [tolerance] [trials]
+//                                     [repetitions] [functionEvaluations] [threads]
+//
+// The baseline is an output of itkThinShellDemonsBenchmark (or of this test)
+// and includes the calibration time of the host it was recorded on. Every
+// case of the baseline is run again, trials times, keeping the fastest time
+// of each phase. A phase fails if it takes longer than its baseline time,
+// scaled by the ratio of the calibration times of this host and the baseline
+// host, times (1 + tolerance). Phases below MinimumGatedTime in the baseline
+// are too noisy to gate and only reported, as is the mesh generation, which
+// is part of the test rather than of the registration.
+//
+// The metric runs on threads threads, 1 by default, like the single
+// threaded calibration. A baseline case recorded with another thread
+// count, or before the count was recorded, fails: its times are not
+// comparable.
+//
+// Without a baseline file the default cases are run and written to
+// output.json, and the test returns SkipReturnCode, which CTest reports as
+// skipped rather than passed; copy that file to the baseline location to
+// start gating. A baseline file without cases or calibration time fails.
+
+namespace
+{
+typedef itk::ThinShellDemonsBenchmarkCase Case;
+typedef Case::ResultType                  ResultType;
+
+const double MinimumGatedTime = 1e-3;
+
+// the SKIP_RETURN_CODE of the test in CMakeLists.txt
+const int SkipReturnCode = 77;
+
+// fastest time of each phase over several runs of a case
+ResultType
+RunTrials(const std::string & shape, itk::SizeValueType size, unsigned int trials, unsigned int repetitions,
+          unsigned int evaluations, itk::ThreadIdType threads)
+{
+  ResultType best = Case::Run(shape, size, repetitions, evaluations, threads);
+  for ( unsigned int t = 1; t < trials; ++t )
+    {
+    const ResultType result = Case::Run(shape, size, repetitions, evaluations, threads);
+    for ( unsigned int p = 0; p < Case::GetNumberOfPhases(); ++p )
+      {
+      const Case::PhaseMemberType member = Case::GetPhaseMember(p);
+      best.*member = std::min(best.*member, result.*member);
+      }
+    }
+  return best;
+}
+} // end anonymous namespace
+
+int itkThinShellDemonsPerformanceTest( int argc, char * argv[] )
+{
+  if ( argc < 3 )
+    {
+    std::cerr << "Usage: " << argv[0]
+              << " baseline.json output.json [tolerance] [trials] [repetitions] [functionEvaluations] [threads]"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  const double            tolerance = argc > 3 ? std::atof(argv[3]) : 0.25;
+  const unsigned int      trials = argc > 4 ? std::atoi(argv[4]) : 3;
+  const unsigned int      repetitions = argc > 5 ? std::atoi(argv[5]) : 3;
+  const unsigned int      evaluations = argc > 6 ? std::atoi(argv[6]) : 10;
+  const itk::ThreadIdType threads = argc > 7 ? std::atoi(argv[7]) : 1;
+
+  const double calibration = Case::MeasureCalibration();
+  std::cout << "Host calibration: " << calibration << " s, metric on " << threads << " threads" << std::endl;
+
+  std::vector< ResultType > baseline;
+  double                    baselineCalibration = 0.0;
+  const bool                haveBaseline = Case::ReadJSON(argv[1], baseline, baselineCalibration);
+  if ( haveBaseline && ( baseline.empty() || !( baselineCalibration > 0.0 ) ) )
+    {
+    std::cerr << "The baseline " << argv[1] << " has no cases or no calibration time" << std::endl;
+    return EXIT_FAILURE;
+    }
+  for ( size_t i = 0; haveBaseline && i < baseline.size(); ++i )
+    {
+    if ( baseline[i].NumberOfThreads != threads )
+      {
+      std::cerr << "The baseline case " << baseline[i].Shape << " " << baseline[i].Size << " was recorded with "
+                << baseline[i].NumberOfThreads << " threads, this run uses " << threads
+                << "; record the baseline again with the same arguments" << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  if ( !haveBaseline )
+    {
+    std::cout << "No baseline in " << argv[1] << ", recording the default cases" << std::endl;
+    const char *shapes[] = { "icosphere", "torus", "bumps" };
+    for ( unsigned int k = 0; k < 3; ++k )
+      {
+      ResultType r;
+      r.Shape = shapes[k];
+      r.Size = 10000;
+      baseline.push_back(r);
+      }
+    }
+
+  std::vector< ResultType > results;
+  try
+    {
+    for ( size_t i = 0; i < baseline.size(); ++i )
+      {
+      results.push_back( RunTrials(baseline[i].Shape, baseline[i].Size, trials, repetitions, evaluations,
+                                   threads) );
+      }
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  std::ofstream output( argv[2] );
+  if ( !output )
+    {
+    std::cerr << "Unable to open " << argv[2] << std::endl;
+    return EXIT_FAILURE;
+    }
+  Case::WriteJSON(output, results, repetitions, calibration);
+
+  if ( !haveBaseline )
+    {
+    std::cout << "Wrote " << argv[2] << "; use it as the baseline to enable the gates" << std::endl;
+    return SkipReturnCode;
+    }
+
+  // a host twice as slow on the calibration workload is allowed twice the time
+  const double scale = calibration / baselineCalibration;
+  std::cout << "Baseline calibration: " << baselineCalibration << " s, scale " << scale
+            << ", tolerance " << tolerance << std::endl;
+
+  unsigned int numberOfRegressions = 0;
+  for ( size_t i = 0; i < results.size(); ++i )
+    {
+    std::cout << baseline[i].Shape << " " << results[i].NumberOfPoints << " points" << std::endl;
+    for ( unsigned int p = 0; p < Case::GetNumberOfPhases(); ++p )
+      {
+      const Case::PhaseMemberType member = Case::GetPhaseMember(p);
+      const double                reference = baseline[i].*member * scale;
+      const double                measured = results[i].*member;
+      const bool                  gated = baseline[i].*member >= MinimumGatedTime
+                                          && std::string( Case::GetPhaseName(p) ) != "generate";
+      const bool                  failed = gated && measured > reference * ( 1.0 + tolerance );
+
+      std::cout << "  " << std::left << std::setw(28) << Case::GetPhaseName(p) << std::right
+                << std::setw(12) << measured << " s  expected " << std::setw(12) << reference << " s";
+      if ( reference > 0.0 )
+        {
+        std::cout << "  " << std::setw(7) << std::fixed << std::setprecision(1)
+                  << 100.0 * ( measured / reference - 1.0 ) << "%";
+        std::cout.unsetf(std::ios_base::floatfield);
+        std::cout << std::setprecision(6);
+        }
+      std::cout << ( !gated ? "  (not gated)" : failed ? "  REGRESSION" : "" ) << std::endl;
+      if ( failed )
+        {
+        ++numberOfRegressions;
+        }
+      }
+    }
+
+  if ( numberOfRegressions > 0 )
+    {
+    std::cerr << numberOfRegressions << " phase(s) regressed by more than " << 100.0 * tolerance << "%" << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
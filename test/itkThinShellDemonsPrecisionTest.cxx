@@ -0,0 +1,186 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "itkMeshDisplacementTransform.h"
+#include "itkRegistrationMemoryUsage.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+#include "itkTimeProbe.h"
+
+// Accuracy report of ThinShellDemonsMetric with float point and target
+// storage against the all double metric: the relative error of the value,
+// of each energy term and of the derivative, the time of GetValue() and
+// GetDerivative(), and the bytes of the points and targets.
+//
+//   itkThinShellDemonsPrecisionTest [points] [repetitions] [tolerance]
+//
+// Fails when a relative error exceeds the tolerance.
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >                      MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType >             GeneratorType;
+typedef itk::Image< unsigned short, Dimension >             DistanceMapType;
+typedef itk::ThinShellDemonsMetric< MeshType, MeshType, DistanceMapType, double > DoubleMetricType;
+typedef itk::ThinShellDemonsMetric< MeshType, MeshType, DistanceMapType, float >  FloatMetricType;
+typedef itk::MeshDisplacementTransform< double, Dimension > TransformType;
+typedef DoubleMetricType::TransformParametersType           ParametersType;
+typedef DoubleMetricType::DerivativeType                    DerivativeType;
+
+struct ResultType
+  {
+  double         Value;
+  double         Terms[DoubleMetricType::NumberOfEnergyTerms];
+  DerivativeType Derivative;
+  double         ValueTime;
+  double         DerivativeTime;
+  uint64_t       Bytes;
+  };
+
+template< typename TMetric >
+void
+Evaluate(MeshType *fixedMesh, MeshType *movingMesh, const ParametersType & position, unsigned int repetitions,
+         ResultType & result)
+{
+  TransformType::Pointer transform = TransformType::New();
+  transform->SetMeshTemplate(movingMesh);
+  transform->Initialize();
+  transform->SetIdentity();
+
+  typename TMetric::Pointer metric = TMetric::New();
+  metric->SetStretchWeight(4);
+  metric->SetBendWeight(1);
+  metric->SetNumberOfThreads(1);
+  metric->SetDeterministic(true);
+  metric->SetFixedMesh(fixedMesh);
+  metric->SetMovingMesh(movingMesh);
+  metric->SetTransform(transform);
+  metric->Initialize();
+
+  result.Value = metric->GetValue(position);
+  for ( unsigned int t = 0; t < TMetric::NumberOfEnergyTerms; ++t )
+    {
+    result.Terms[t] = metric->GetEnergyTerm(t);
+    }
+  metric->GetDerivative(position, result.Derivative);
+
+  itk::TimeProbe valueProbe;
+  itk::TimeProbe derivativeProbe;
+  for ( unsigned int r = 0; r < repetitions; ++r )
+    {
+    valueProbe.Start();
+    metric->GetValue(position);
+    valueProbe.Stop();
+    derivativeProbe.Start();
+    metric->GetDerivative(position, result.Derivative);
+    derivativeProbe.Stop();
+    }
+  result.ValueTime = valueProbe.GetMean();
+  result.DerivativeTime = derivativeProbe.GetMean();
+
+  itk::RegistrationMemoryUsage::Pointer usage = itk::RegistrationMemoryUsage::New();
+  metric->UpdateMemoryUsage(usage);
+  result.Bytes = usage->GetBytes(itk::RegistrationMemoryUsage::MovingPointsComponent)
+                 + usage->GetBytes(itk::RegistrationMemoryUsage::TargetPositionsComponent);
+}
+
+double
+RelativeError(double value, double reference)
+{
+  const double difference = std::fabs(value - reference);
+  return reference != 0.0 ? difference / std::fabs(reference) : difference;
+}
+} // end anonymous namespace
+
+int itkThinShellDemonsPrecisionTest( int argc, char * argv[] )
+{
+  const itk::SizeValueType size = argc > 1 ? std::atol(argv[1]) : 50000;
+  const unsigned int       repetitions = argc > 2 ? std::atoi(argv[2]) : 10;
+  const double             tolerance = argc > 3 ? std::atof(argv[3]) : 1e-3;
+
+  GeneratorType::SurfaceType fixedSurface = GeneratorType::Generate("icosphere", size);
+  GeneratorType::SurfaceType movingSurface = fixedSurface;
+  GeneratorType::Deform(movingSurface, 0.02, 0.5);
+  MeshType::Pointer fixedMesh = GeneratorType::MakeMesh(fixedSurface);
+  MeshType::Pointer movingMesh = GeneratorType::MakeMesh(movingSurface);
+
+  std::vector< double > u;
+  GeneratorType::Displacement(movingSurface, 0.01, 0.3, u);
+  ParametersType position( u.size() );
+  for ( unsigned int i = 0; i < position.Size(); ++i )
+    {
+    position[i] = u[i];
+    }
+
+  ResultType reference;
+  ResultType single;
+  try
+    {
+    Evaluate< DoubleMetricType >(fixedMesh, movingMesh, position, repetitions, reference);
+    Evaluate< FloatMetricType >(fixedMesh, movingMesh, position, repetitions, single);
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  double error = RelativeError(single.Value, reference.Value);
+  std::cout << "value " << reference.Value << ", relative error " << error << std::endl;
+  const char * const names[] = { "data", "stretch", "bend" };
+  for ( unsigned int t = 0; t < DoubleMetricType::NumberOfEnergyTerms; ++t )
+    {
+    const double termError = RelativeError(single.Terms[t], reference.Terms[t]);
+    std::cout << names[t] << " term " << reference.Terms[t] << ", relative error " << termError << std::endl;
+    error = std::max( error, termError );
+    }
+
+  // the derivative relative to its largest component, as many are near 0
+  double largest = 0.0;
+  double difference = 0.0;
+  for ( unsigned int i = 0; i < reference.Derivative.Size(); ++i )
+    {
+    largest = std::max( largest, std::fabs(reference.Derivative[i]) );
+    difference = std::max( difference, std::fabs(single.Derivative[i] - reference.Derivative[i]) );
+    }
+  const double derivativeError = largest > 0.0 ? difference / largest : difference;
+  std::cout << "derivative, relative error " << derivativeError << std::endl;
+  error = std::max( error, derivativeError );
+
+  std::cout << "GetValue() " << reference.ValueTime * 1e3 << " ms double, " << single.ValueTime * 1e3
+            << " ms float, speedup " << reference.ValueTime / single.ValueTime << std::endl;
+  std::cout << "GetDerivative() " << reference.DerivativeTime * 1e3 << " ms double, "
+            << single.DerivativeTime * 1e3 << " ms float, speedup "
+            << reference.DerivativeTime / single.DerivativeTime << std::endl;
+  std::cout << "points and targets " << reference.Bytes << " bytes double, " << single.Bytes << " bytes float"
+            << std::endl;
+
+  if ( !( error <= tolerance ) )
+    {
+    std::cerr << "Float storage differs from double by a relative " << error << ", tolerance " << tolerance
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,360 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "itkConjugateGradientOptimizer.h"
+#include "itkFlatPointLocator.h"
+#include "itkMeshDisplacementTransform.h"
+#include "itkMeshToMeshRegistrationMethod.h"
+#include "itkMultiThreader.h"
+#include "itkRegistrationProfiler.h"
+#include "itkSyntheticMeshGenerator.h"
+#include "itkThinShellDemonsMetric.h"
+#include "itkTimeProbe.h"
+#include "itkWorkerPool.h"
+
+// Measures how the parallel parts of a Thin Shell Demons registration scale
+// with the number of threads and writes the results as JSON.
+//
+//   itkThinShellDemonsScalingBenchmark output.json [points] [maxThreads] [repetitions]
+//                                      [functionEvaluations] [minEfficiency] [offset]
+//
+// Strong scaling: a fixed icosphere pair of the given size at 1, 2, 4 ...
+// maxThreads threads. Weak scaling: the same at points * threads vertices.
+// For the closest point search, GetValue(), GetDerivative() and a full
+// registration each run reports the time, the speedup and the efficiency
+// relative to one thread, and the load imbalance (slowest thread over the
+// mean thread busy time). With minEfficiency > 0 the test fails if a strong
+// scaling efficiency of the metric falls below it, and returns
+// SkipReturnCode without measuring when the machine has fewer than
+// maxThreads cores, as the efficiency of oversubscribed threads means
+// nothing. offset shifts the moving sphere by that many radii
+// along x, so that the closest point queries of the far side cost more than
+// those of the overlapping side.
+
+namespace
+{
+const unsigned int Dimension = 3;
+typedef itk::Mesh< double, Dimension >                          MeshType;
+typedef itk::SyntheticMeshGenerator< MeshType >                 GeneratorType;
+typedef itk::ThinShellDemonsMetric< MeshType, MeshType >        MetricType;
+typedef itk::MeshDisplacementTransform< double, Dimension >     TransformType;
+typedef itk::ConjugateGradientOptimizer                         OptimizerType;
+typedef itk::MeshToMeshRegistrationMethod< MeshType, MeshType > RegistrationType;
+
+// the SKIP_RETURN_CODE of the tests in CMakeLists.txt
+const int SkipReturnCode = 77;
+
+enum { Correspondence = 0, GetValue, GetDerivative, Registration, NumberOfKernels };
+
+const char *kernelNames[NumberOfKernels] = { "correspondence", "get_value", "get_derivative", "registration" };
+
+struct ScalingResult
+{
+  itk::ThreadIdType  NumberOfThreads;
+  itk::SizeValueType NumberOfPoints;
+  double             Time[NumberOfKernels];
+  double             Imbalance[NumberOfKernels];
+  double             Speedup[NumberOfKernels];
+  double             Efficiency[NumberOfKernels];
+};
+
+// slowest thread over the mean busy time, 1 when perfectly balanced
+double
+ComputeImbalance(const std::vector< double > & threadTimes)
+{
+  double sum = 0.0;
+  double maximum = 0.0;
+  for ( size_t t = 0; t < threadTimes.size(); ++t )
+    {
+    sum += threadTimes[t];
+    maximum = std::max(maximum, threadTimes[t]);
+    }
+  return sum > 0.0 ? maximum * threadTimes.size() / sum : 1.0;
+}
+
+ScalingResult
+RunScaling(itk::SizeValueType size, itk::ThreadIdType threads, unsigned int repetitions, unsigned int evaluations,
+           double offset)
+{
+  GeneratorType::SurfaceType fixedSurface = GeneratorType::Generate("icosphere", size);
+  GeneratorType::SurfaceType movingSurface = fixedSurface;
+  GeneratorType::Deform(movingSurface, 0.02, 0.5);
+  for ( itk::SizeValueType i = 0; i < movingSurface.GetNumberOfPoints(); ++i )
+    {
+    movingSurface.Points[3 * i] += offset;
+    }
+  MeshType::Pointer fixedMesh = GeneratorType::MakeMesh(fixedSurface);
+  MeshType::Pointer movingMesh = GeneratorType::MakeMesh(movingSurface);
+
+  ScalingResult result;
+  result.NumberOfThreads = threads;
+  result.NumberOfPoints = movingSurface.GetNumberOfPoints();
+
+  // A prebuilt spatial index, so that the correspondence phase is the
+  // parallel search alone.
+  itk::FlatPointLocator::Pointer locator = itk::FlatPointLocator::New();
+  locator->Build( &fixedSurface.Points[0], fixedSurface.GetNumberOfPoints() );
+
+  // a pool of its own, so that the global default does not cap the threads
+  itk::WorkerPool::Pointer pool = itk::WorkerPool::New();
+  pool->SetNumberOfThreads(threads);
+
+  MetricType::Pointer metric = MetricType::New();
+  metric->SetStretchWeight(4);
+  metric->SetBendWeight(1);
+  metric->SetNumberOfThreads(threads);
+  metric->SetWorkerPool(pool);
+  metric->SetFixedPointLocator(locator);
+
+  TransformType::Pointer transform = TransformType::New();
+  transform->SetMeshTemplate(movingMesh);
+  transform->Initialize();
+  transform->SetIdentity();
+
+  OptimizerType::Pointer optimizer = OptimizerType::New();
+  optimizer->GetOptimizer()->set_max_function_evals(evaluations);
+
+  RegistrationType::Pointer registration = RegistrationType::New();
+  registration->SetMetric(metric);
+  registration->SetOptimizer(optimizer);
+  registration->SetTransform(transform);
+  registration->SetInitialTransformParameters( transform->GetParameters() );
+  registration->SetFixedMesh(fixedMesh);
+  registration->SetMovingMesh(movingMesh);
+
+  itk::RegistrationProfiler::Pointer profiler = itk::RegistrationProfiler::New();
+  registration->SetProfiler(profiler);
+  registration->Initialize();
+  result.Time[Correspondence] = profiler->GetTotalTime(itk::RegistrationProfiler::CorrespondencePhase);
+  result.Imbalance[Correspondence] = ComputeImbalance( metric->GetThreadTimes() );
+
+  MetricType::TransformParametersType parameters = transform->GetParameters();
+  for ( unsigned int i = 0; i < parameters.Size(); ++i )
+    {
+    parameters[i] = 1e-3 * ( ( i % 7 ) - 3.0 );
+    }
+
+  itk::TimeProbe valueClock;
+  double         valueImbalance = 0.0;
+  for ( unsigned int r = 0; r < repetitions; ++r )
+    {
+    valueClock.Start();
+    metric->GetValue(parameters);
+    valueClock.Stop();
+    valueImbalance += ComputeImbalance( metric->GetThreadTimes() );
+    }
+  result.Time[GetValue] = valueClock.GetMean();
+  result.Imbalance[GetValue] = valueImbalance / repetitions;
+
+  MetricType::DerivativeType derivative;
+  itk::TimeProbe             derivativeClock;
+  double                     derivativeImbalance = 0.0;
+  for ( unsigned int r = 0; r < repetitions; ++r )
+    {
+    derivativeClock.Start();
+    metric->GetDerivative(parameters, derivative);
+    derivativeClock.Stop();
+    derivativeImbalance += ComputeImbalance( metric->GetThreadTimes() );
+    }
+  result.Time[GetDerivative] = derivativeClock.GetMean();
+  result.Imbalance[GetDerivative] = derivativeImbalance / repetitions;
+
+  // the whole registration, including Initialize() and the serial optimizer
+  itk::TimeProbe registrationClock;
+  registrationClock.Start();
+  registration->Update();
+  registrationClock.Stop();
+  result.Time[Registration] = registrationClock.GetTotal();
+  result.Imbalance[Registration] = result.Imbalance[GetDerivative];
+
+  return result;
+}
+
+// speedup and efficiency of each run relative to the single thread run;
+// weak scaling compares times directly since the work per thread is fixed
+void
+ComputeScaling(std::vector< ScalingResult > & results, bool weak)
+{
+  for ( size_t i = 0; i < results.size(); ++i )
+    {
+    for ( unsigned int k = 0; k < NumberOfKernels; ++k )
+      {
+      const double reference = results[0].Time[k];
+      const double time = results[i].Time[k];
+      const double threads = static_cast< double >( results[i].NumberOfThreads );
+      if ( time <= 0.0 )
+        {
+        results[i].Speedup[k] = 0.0;
+        results[i].Efficiency[k] = 0.0;
+        }
+      else if ( weak )
+        {
+        results[i].Efficiency[k] = reference / time;
+        results[i].Speedup[k] = results[i].Efficiency[k] * threads;
+        }
+      else
+        {
+        results[i].Speedup[k] = reference / time;
+        results[i].Efficiency[k] = results[i].Speedup[k] / threads;
+        }
+      }
+    }
+}
+
+void
+WriteResults(std::ostream & os, const char *name, const std::vector< ScalingResult > & results, bool last)
+{
+  os << "  \"" << name << "\": [\n";
+  for ( size_t i = 0; i < results.size(); ++i )
+    {
+    const ScalingResult & r = results[i];
+    os << "    {\n";
+    os << "      \"threads\": " << r.NumberOfThreads << ",\n";
+    os << "      \"points\": " << r.NumberOfPoints << ",\n";
+    for ( unsigned int k = 0; k < NumberOfKernels; ++k )
+      {
+      os << "      \"" << kernelNames[k] << "\": { \"time\": " << r.Time[k]
+         << ", \"speedup\": " << r.Speedup[k]
+         << ", \"efficiency\": " << r.Efficiency[k]
+         << ", \"imbalance\": " << r.Imbalance[k] << " }"
+         << ( k + 1 < NumberOfKernels ? "," : "" ) << "\n";
+      }
+    os << "    }" << ( i + 1 < results.size() ? "," : "" ) << "\n";
+    }
+  os << "  ]" << ( last ? "" : "," ) << "\n";
+}
+
+void
+PrintResults(const char *name, const std::vector< ScalingResult > & results)
+{
+  for ( size_t i = 0; i < results.size(); ++i )
+    {
+    const ScalingResult & r = results[i];
+    std::cout << name << " " << r.NumberOfThreads << " threads, " << r.NumberOfPoints << " points:";
+    for ( unsigned int k = 0; k < NumberOfKernels; ++k )
+      {
+      std::cout << " " << kernelNames[k] << " " << r.Time[k] << " s (x" << r.Speedup[k]
+                << ", imbalance " << r.Imbalance[k] << ")";
+      }
+    std::cout << std::endl;
+    }
+}
+} // end anonymous namespace
+
+int itkThinShellDemonsScalingBenchmark( int argc, char * argv[] )
+{
+  if ( argc < 2 )
+    {
+    std::cerr << "Usage: " << argv[0]
+              << " output.json [points] [maxThreads] [repetitions] [functionEvaluations] [minEfficiency] [offset]"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  const itk::ThreadIdType  cores = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  const itk::SizeValueType points = argc > 2 ? std::atol(argv[2]) : 100000;
+  const itk::ThreadIdType  maxThreads = argc > 3 ? std::atoi(argv[3]) : cores;
+  const unsigned int       repetitions = argc > 4 ? std::atoi(argv[4]) : 5;
+  const unsigned int       evaluations = argc > 5 ? std::atoi(argv[5]) : 10;
+  const double             minEfficiency = argc > 6 ? std::atof(argv[6]) : 0.0;
+  const double             offset = argc > 7 ? std::atof(argv[7]) : 0.0;
+
+  if ( minEfficiency > 0.0 && cores < maxThreads )
+    {
+    std::cout << "Only " << cores << " cores for " << maxThreads << " threads, the scaling is not gated" << std::endl;
+    return SkipReturnCode;
+    }
+
+  // 1, 2, 4 ... and maxThreads itself when it is not a power of two
+  std::vector< itk::ThreadIdType > threadCounts;
+  for ( itk::ThreadIdType t = 1; t <= maxThreads; t *= 2 )
+    {
+    threadCounts.push_back(t);
+    }
+  if ( threadCounts.empty() || threadCounts.back() != maxThreads )
+    {
+    threadCounts.push_back( std::max< itk::ThreadIdType >( maxThreads, 1 ) );
+    }
+
+  std::vector< ScalingResult > strong;
+  std::vector< ScalingResult > weak;
+  try
+    {
+    for ( size_t i = 0; i < threadCounts.size(); ++i )
+      {
+      strong.push_back( RunScaling(points, threadCounts[i], repetitions, evaluations, offset) );
+      }
+    for ( size_t i = 0; i < threadCounts.size(); ++i )
+      {
+      weak.push_back( RunScaling(points * threadCounts[i], threadCounts[i], repetitions, evaluations, offset) );
+      }
+    }
+  catch ( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+  ComputeScaling(strong, false);
+  ComputeScaling(weak, true);
+  PrintResults("strong", strong);
+  PrintResults("weak", weak);
+
+  std::ofstream output( argv[1] );
+  if ( !output )
+    {
+    std::cerr << "Unable to open " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+    }
+  output.precision(9);
+  output << "{\n";
+  output << "  \"benchmark\": \"ThinShellDemonsScaling\",\n";
+  output << "  \"version\": 1,\n";
+  output << "  \"units\": \"seconds\",\n";
+  output << "  \"cores\": " << cores << ",\n";
+  output << "  \"repetitions\": " << repetitions << ",\n";
+  output << "  \"offset\": " << offset << ",\n";
+  WriteResults(output, "strong", strong, false);
+  WriteResults(output, "weak", weak, true);
+  output << "}\n";
+
+  // the registration includes the serial optimizer, so only the metric is gated
+  int status = EXIT_SUCCESS;
+  if ( minEfficiency > 0.0 )
+    {
+    for ( size_t i = 1; i < strong.size(); ++i )
+      {
+      for ( unsigned int k = 0; k < Registration; ++k )
+        {
+        if ( strong[i].Efficiency[k] < minEfficiency )
+          {
+          std::cerr << kernelNames[k] << " at " << strong[i].NumberOfThreads << " threads: efficiency "
+                    << strong[i].Efficiency[k] << " is below " << minEfficiency << std::endl;
+          status = EXIT_FAILURE;
+          }
+        }
+      }
+    }
+
+  return status;
+}